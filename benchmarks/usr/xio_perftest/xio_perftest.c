@@ -42,6 +42,7 @@
 #include <string.h>
 #include <inttypes.h>
 #include <sched.h>
+#include <pthread.h>
 #include "libxio.h"
 #include "xio_perftest_parameters.h"
 #include "xio_perftest.h"
@@ -60,6 +61,54 @@ static void set_cpu_affinity(int cpu)
 		fprintf(stderr, "Unable to set affinity. %m\n");
 }
 
+#ifdef FAKE_VERBS
+/*---------------------------------------------------------------------------*/
+/* fake_server_cb							     */
+/*---------------------------------------------------------------------------*/
+static void *fake_server_cb(void *data)
+{
+	run_server_test(data);
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* run_fake_test							     */
+/*---------------------------------------------------------------------------*/
+static int run_fake_test(struct perf_parameters *user_param)
+{
+	struct perf_parameters	client_param;
+	pthread_t		server_thread;
+
+	/* the library carries both ends over in-process fake verbs, the
+	 * server runs on the portals given on the command line
+	 */
+	client_param			= *user_param;
+	client_param.machine_type	= CLIENT;
+	client_param.portals_arr	= NULL;
+	client_param.portals_arr_len	= 0;
+	client_param.server_addr	= strdup("127.0.0.1");
+	user_param->output_file		= NULL;
+	/* keep the server's portal threads off the client's cores */
+	user_param->cpu			+= user_param->threads_num;
+
+	if (pthread_create(&server_thread, NULL, fake_server_cb, user_param)) {
+		fprintf(stderr, "failed to start the server. %m\n");
+		free(client_param.server_addr);
+		return -1;
+	}
+	/* let the server bind its listeners before connecting */
+	sleep(1);
+
+	run_client_test(&client_param);
+
+	pthread_join(server_thread, NULL);
+	destroy_perf_params(&client_param);
+
+	return 0;
+}
+#endif
+
 /*---------------------------------------------------------------------------*/
 /* main									     */
 /*---------------------------------------------------------------------------*/
@@ -76,6 +125,28 @@ int main(int argc, char *argv[])
 
 	set_cpu_affinity(user_param.cpu);
 
+	if (user_param.enable_srq) {
+		optval = 1;
+		xio_set_opt(NULL,
+			    XIO_OPTLEVEL_RDMA,
+			    XIO_OPTNAME_ENABLE_SRQ,
+			    &optval, sizeof(optval));
+	}
+	if (user_param.enable_write_imm) {
+		optval = 1;
+		xio_set_opt(NULL,
+			    XIO_OPTLEVEL_RDMA,
+			    XIO_OPTNAME_ENABLE_WRITE_IMM,
+			    &optval, sizeof(optval));
+	}
+	if (user_param.enable_adaptive_rq) {
+		optval = 1;
+		xio_set_opt(NULL,
+			    XIO_OPTLEVEL_RDMA,
+			    XIO_OPTNAME_ENABLE_ADAPTIVE_RQ,
+			    &optval, sizeof(optval));
+	}
+
 	/* run as root */
 	if (user_param.test_type == LAT) {
 		optval = 1;
@@ -86,11 +157,19 @@ int main(int argc, char *argv[])
 	}
 
 
+#ifdef FAKE_VERBS
+	if (user_param.machine_type == SERVER)
+		run_fake_test(&user_param);
+	else
+		fprintf(stderr, "server and client share this process, " \
+			"give the portals and no host\n");
+#else
 	if (user_param.machine_type == CLIENT)
 		run_client_test(&user_param);
 
 	if (user_param.machine_type == SERVER)
 		run_server_test(&user_param);
+#endif
 
 	/* run as root */
 	if (user_param.test_type == LAT) {
@@ -43,6 +43,7 @@
 #include <getopt.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <errno.h>
 #include <sched.h>
 #include <pthread.h>
@@ -58,6 +59,7 @@
 #define USECS_IN_SEC		1000000
 #define NSECS_IN_USEC		1000
 #define ONE_MB			(1 << 20)
+#define MAX_CLASS_SAMPLES	(1 << 16)
 
 struct thread_stat_data {
 	volatile uint64_t	scnt;
@@ -65,6 +67,8 @@ struct thread_stat_data {
 	volatile uint64_t	tot_rtt;
 	volatile uint64_t	max_rtt;
 	volatile uint64_t	min_rtt;
+	volatile uint64_t	class_nr[XIO_MAX_MSG_CLASSES];
+	uint64_t		*class_rtt[XIO_MAX_MSG_CLASSES];
 };
 
 struct thread_data {
@@ -74,6 +78,7 @@ struct thread_data {
 	struct xio_buf		*xbuf;
 	struct xio_session	*session;
 	struct xio_connection	*conn;
+	struct xio_connection	*hedge_conn;
 	struct xio_context	*ctx;
 	struct perf_parameters	*user_param;
 	uint64_t		data_len;
@@ -92,13 +97,33 @@ struct session_data {
 	double			avg_lat_us;
 	double			min_lat_us;
 	double			max_lat_us;
+	double			cpu_per_msg_us;
 	double			avg_bw;
+	uint64_t		class_nr[XIO_MAX_MSG_CLASSES];
+	double			class_p50_us[XIO_MAX_MSG_CLASSES];
+	double			class_p99_us[XIO_MAX_MSG_CLASSES];
+	double			class_p999_us[XIO_MAX_MSG_CLASSES];
 	int			abort;
 	int			pad;
 	struct xio_session	*session;
 	struct thread_data	*tdata;
 };
 
+/* connections without traffic, each one on a context of its own so that
+ * every one of them is a separate queue pair on the server
+ */
+struct idle_data {
+	struct perf_parameters	*user_param;
+	struct xio_context	**ctx;
+	struct xio_session	**session;
+	struct xio_connection	**conn;
+	int			nr;
+	int			closed_nr;
+	volatile int		stop;
+	volatile int		ready;
+	pthread_t		thread_id;
+};
+
 struct  test_vec {
 	uint32_t		hdr_len;
 	uint32_t		data_len;
@@ -113,6 +138,100 @@ static uint64_t	data_len;
 static FILE	*fd = NULL;
 static double	g_mhz;
 
+/*---------------------------------------------------------------------------*/
+/* cmp_rtt								     */
+/*---------------------------------------------------------------------------*/
+static int cmp_rtt(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*---------------------------------------------------------------------------*/
+/* sample_classes							     */
+/*---------------------------------------------------------------------------*/
+static int sample_classes(const struct perf_parameters *user_param)
+{
+	/* hedged runs report the percentiles of all requests */
+	if (user_param->classes_num == 0 && user_param->hedge_permille)
+		return 1;
+
+	return user_param->classes_num;
+}
+
+/*---------------------------------------------------------------------------*/
+/* send_request								     */
+/*---------------------------------------------------------------------------*/
+static int send_request(struct thread_data *tdata, struct xio_msg *msg)
+{
+	/* let the session pick the connection and hedge slow requests */
+	if (tdata->user_param->hedge_permille &&
+	    xio_session_send_request(tdata->session, tdata->ctx, msg, 0))
+		return 0;
+
+	return xio_send_request(tdata->conn, msg);
+}
+
+/*---------------------------------------------------------------------------*/
+/* set_response_buf							     */
+/*---------------------------------------------------------------------------*/
+static inline void set_response_buf(struct thread_data *tdata,
+				    struct xio_msg *msg)
+{
+	/* the response data lands in registered memory */
+	msg->in.data_iovlen		= 1;
+	msg->in.data_iov[0].iov_base	= tdata->xbuf->addr;
+	msg->in.data_iov[0].iov_len	= tdata->xbuf->length;
+	msg->in.data_iov[0].mr		= tdata->xbuf->mr;
+}
+
+/*---------------------------------------------------------------------------*/
+/* class_percentiles							     */
+/*---------------------------------------------------------------------------*/
+static void class_percentiles(struct session_data *sess_data, int cls)
+{
+	uint64_t	*rtt;
+	uint64_t	n = 0, nr;
+	int		i;
+
+	for (i = 0; i < threads_iter; i++)
+		n += sess_data->tdata[i].stat.class_nr[cls];
+	sess_data->class_nr[cls] = n;
+	if (n == 0)
+		return;
+
+	rtt = malloc(n * sizeof(*rtt));
+	if (rtt == NULL)
+		return;
+
+	n = 0;
+	for (i = 0; i < threads_iter; i++) {
+		nr = sess_data->tdata[i].stat.class_nr[cls];
+		memcpy(&rtt[n], sess_data->tdata[i].stat.class_rtt[cls],
+		       nr * sizeof(*rtt));
+		n += nr;
+	}
+	qsort(rtt, n, sizeof(*rtt), cmp_rtt);
+
+	sess_data->class_p50_us[cls]  = rtt[(n - 1) * 500 / 1000]/g_mhz;
+	sess_data->class_p99_us[cls]  = rtt[(n - 1) * 990 / 1000]/g_mhz;
+	sess_data->class_p999_us[cls] = rtt[(n - 1) * 999 / 1000]/g_mhz;
+
+	free(rtt);
+}
+
+/*---------------------------------------------------------------------------*/
+/* rusage_usecs								     */
+/*---------------------------------------------------------------------------*/
+static double rusage_usecs(const struct rusage *ru)
+{
+	/* user and system time of all the threads of the process */
+	return (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1.0 *
+		USECS_IN_SEC + ru->ru_utime.tv_usec + ru->ru_stime.tv_usec;
+}
+
 /*---------------------------------------------------------------------------*/
 /* statistics_thread_cb							     */
 /*---------------------------------------------------------------------------*/
@@ -128,8 +247,10 @@ static void *statistics_thread_cb(void *data)
 	uint64_t		min_rtt = -1;
 	uint64_t		max_rtt = 0;
 	struct session_data	*sess_data = data;
+	struct rusage		ru_start, ru_end;
+	double			cpu_us;
 	cpu_set_t		cpuset;
-	int			i;
+	int			i, cls;
 
 	/* set affinity to thread */
 
@@ -146,10 +267,13 @@ static void *statistics_thread_cb(void *data)
 		rtt_start += sess_data->tdata[i].stat.tot_rtt;
 		sess_data->tdata[i].stat.min_rtt  = -1;
 		sess_data->tdata[i].stat.max_rtt  = 0;
+		for (cls = 0; cls < XIO_MAX_MSG_CLASSES; cls++)
+			sess_data->tdata[i].stat.class_nr[cls] = 0;
 	}
 
 	/* test period */
 	/* start collecting statistics data */
+	getrusage(RUSAGE_SELF, &ru_start);
 	start_time = get_cycles();
 	for (i = 0; i < threads_iter; i++)
 		sess_data->tdata[i].do_stat = 1;
@@ -160,6 +284,8 @@ static void *statistics_thread_cb(void *data)
 		sess_data->tdata[i].do_stat = 0;
 
 	delta = (get_cycles() - start_time)/g_mhz;
+	getrusage(RUSAGE_SELF, &ru_end);
+	cpu_us = rusage_usecs(&ru_end) - rusage_usecs(&ru_start);
 
 	for (i = 0; i < threads_iter; i++) {
 		scnt_end += sess_data->tdata[i].stat.scnt;
@@ -178,8 +304,13 @@ static void *statistics_thread_cb(void *data)
 
 		sess_data->tps    = ((scnt_end - scnt_start)*USECS_IN_SEC)/delta;
 		sess_data->avg_bw = (1.0*sess_data->tps*tx_len/ONE_MB);
+		sess_data->cpu_per_msg_us = cpu_us/(scnt_end - scnt_start);
 	}
 
+	for (cls = 0; cls < sample_classes(sess_data->tdata[0].user_param);
+	     cls++)
+		class_percentiles(sess_data, cls);
+
 	for (i = 0; i < threads_iter; i++)
 		sess_data->tdata[i].disconnect = 1;
 
@@ -194,7 +325,9 @@ static void *worker_thread(void *data)
 	struct thread_data	*tdata = data;
 	cpu_set_t		cpuset;
 	struct xio_msg		*msg;
-	int			i;
+	int			i, cls;
+	int			classes = tdata->user_param->classes_num;
+	int			hedge = tdata->user_param->hedge_permille != 0;
 
 	/* set affinity to thread */
 
@@ -203,6 +336,10 @@ static void *worker_thread(void *data)
 
 	pthread_setaffinity_np(tdata->thread_id, sizeof(cpu_set_t), &cpuset);
 
+	for (cls = 0; cls < sample_classes(tdata->user_param); cls++)
+		tdata->stat.class_rtt[cls] =
+			calloc(MAX_CLASS_SAMPLES, sizeof(uint64_t));
+
 	/* prepare data for the cuurent thread */
 	tdata->pool = msg_pool_alloc(tdata->user_param->queue_depth);
 
@@ -212,8 +349,17 @@ static void *worker_thread(void *data)
 
 
 	/* connect the session  */
-	tdata->conn = xio_connect(tdata->session, tdata->ctx,
-				  tdata->cid, NULL, tdata);
+	if (hedge) {
+		/* adjacent indexes are accepted on different portals */
+		tdata->conn = xio_connect(tdata->session, tdata->ctx,
+					  2 * tdata->cid, NULL, tdata);
+		tdata->hedge_conn = xio_connect(tdata->session, tdata->ctx,
+						2 * tdata->cid + 1, NULL,
+						tdata);
+	} else {
+		tdata->conn = xio_connect(tdata->session, tdata->ctx,
+					  tdata->cid, NULL, tdata);
+	}
 
 	if (tdata->data_len)
 		tdata->xbuf = xio_alloc(tdata->data_len);
@@ -228,16 +374,31 @@ static void *worker_thread(void *data)
 		msg->in.header.iov_len = 0;
 		msg->in.data_iovlen = 0;
 		msg->out.header.iov_len = 0;
-		if (tdata->data_len) {
-			msg->out.data_iovlen		= 1;
-			msg->out.data_iov[0].iov_base	= tdata->xbuf->addr;
-			msg->out.data_iov[0].iov_len	= tdata->xbuf->length;
-			msg->out.data_iov[0].mr		= tdata->xbuf->mr;
-		} else {
-			msg->out.data_iovlen = 0;
+		/* class 0 carries the small, latency sensitive requests */
+		cls = classes ? (i % classes) : 0;
+		msg->flags = XIO_MSG_FLAG_CLASS(cls);
+		if (hedge)
+			msg->flags |= XIO_MSG_FLAG_HEDGE;
+		msg->out.data_iovlen = 0;
+		if (tdata->data_len && (classes == 0 || cls != 0)) {
+			if (tdata->user_param->verb == READ) {
+				msg->out.data_iovlen		= 1;
+				msg->out.data_iov[0].iov_base	=
+							tdata->xbuf->addr;
+				msg->out.data_iov[0].iov_len	=
+							tdata->xbuf->length;
+				msg->out.data_iov[0].mr		=
+							tdata->xbuf->mr;
+			} else {
+				/* ask for the data in the response */
+				msg->out.header.iov_base = &tdata->data_len;
+				msg->out.header.iov_len	 =
+						sizeof(tdata->data_len);
+				set_response_buf(tdata, msg);
+			}
 		}
 		msg->user_context = (void *)get_cycles();
-		/* send first message */
+		/* send first message, connections are not online yet */
 		if (xio_send_request(tdata->conn, msg) == -1) {
 			if (xio_errno() != EAGAIN)
 				printf("**** [%p] Error - xio_send_request " \
@@ -263,6 +424,9 @@ static void *worker_thread(void *data)
 	if (tdata->xbuf)
 		xio_free(&tdata->xbuf);
 
+	for (cls = 0; cls < sample_classes(tdata->user_param); cls++)
+		free(tdata->stat.class_rtt[cls]);
+
 
 	/* free the context */
 	xio_context_destroy(tdata->ctx);
@@ -318,6 +482,7 @@ static int on_response(struct xio_session *session,
 {
 	struct thread_data  *tdata = cb_user_context;
 	cycles_t rtt = (get_cycles()-(cycles_t)msg->user_context);
+	int cls = XIO_MSG_CLASS(msg->flags);
 
 	if (tdata->do_stat) {
 		if (rtt > tdata->stat.max_rtt)
@@ -326,6 +491,10 @@ static int on_response(struct xio_session *session,
 			tdata->stat.min_rtt = rtt;
 		tdata->stat.tot_rtt += rtt;
 		tdata->stat.ccnt++;
+		if (tdata->stat.class_rtt[cls] &&
+		    tdata->stat.class_nr[cls] < MAX_CLASS_SAMPLES)
+			tdata->stat.class_rtt[cls][
+				tdata->stat.class_nr[cls]++] = rtt;
 	}
 
 	tdata->rx_nr++;
@@ -334,9 +503,11 @@ static int on_response(struct xio_session *session,
 	xio_release_response(msg);
 
 	if (tdata->disconnect) {
-		if (tdata->rx_nr == tdata->tx_nr)
+		if (tdata->rx_nr == tdata->tx_nr) {
 			xio_disconnect(tdata->conn);
-		else
+			if (tdata->hedge_conn)
+				xio_disconnect(tdata->hedge_conn);
+		} else
 			msg_pool_put(tdata->pool, msg);
 		return 0;
 	}
@@ -344,9 +515,11 @@ static int on_response(struct xio_session *session,
 	/* reset message */
 	msg->in.header.iov_len = 0;
 	msg->in.data_iovlen = 0;
+	if (msg->out.header.iov_len)
+		set_response_buf(tdata, msg);
 
 	msg->user_context = (void *)get_cycles();
-	if (xio_send_request(tdata->conn, msg) == -1) {
+	if (send_request(tdata, msg) == -1) {
 		if (xio_errno() != EAGAIN)
 			printf("**** [%p] Error - xio_send_request " \
 					"failed %s\n",
@@ -388,12 +561,152 @@ static struct xio_session_ops ses_ops = {
 	.on_msg_error			=  on_msg_error
 };
 
+/*---------------------------------------------------------------------------*/
+/* on_idle_session_event						     */
+/*---------------------------------------------------------------------------*/
+static int on_idle_session_event(struct xio_session *session,
+		struct xio_session_event_data *event_data,
+		void *cb_user_context)
+{
+	struct idle_data *idata = cb_user_context;
+
+	switch (event_data->event) {
+	case XIO_SESSION_CONNECTION_TEARDOWN_EVENT:
+		xio_connection_destroy(event_data->conn);
+		break;
+	case XIO_SESSION_TEARDOWN_EVENT:
+		xio_session_destroy(session);
+		idata->closed_nr++;
+		break;
+	default:
+		break;
+	};
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* idle callbacks							     */
+/*---------------------------------------------------------------------------*/
+static struct xio_session_ops idle_ses_ops = {
+	.on_session_event		=  on_idle_session_event,
+	.on_session_established		=  NULL,
+	.on_msg_delivered		=  NULL,
+	.on_msg				=  NULL,
+	.on_msg_error			=  NULL
+};
+
+/*---------------------------------------------------------------------------*/
+/* idle_thread								     */
+/*---------------------------------------------------------------------------*/
+static void *idle_thread(void *data)
+{
+	struct idle_data	*idata = data;
+	char			url[256];
+	int			i;
+	struct xio_session_attr attr = {
+		&idle_ses_ops,
+		NULL,
+		0
+	};
+
+	sprintf(url, "rdma://%s:%d", idata->user_param->server_addr,
+		idata->user_param->server_port);
+
+	for (i = 0; i < idata->nr && !idata->stop; i++) {
+		idata->ctx[i] = xio_context_create(NULL, 0, -1);
+		if (idata->ctx[i] == NULL)
+			break;
+		idata->session[i] = xio_session_create(XIO_SESSION_CLIENT,
+						       &attr, url, 0, 0,
+						       idata);
+		if (idata->session[i] == NULL) {
+			xio_context_destroy(idata->ctx[i]);
+			break;
+		}
+		idata->conn[i] = xio_connect(idata->session[i], idata->ctx[i],
+					     0, NULL, idata);
+		/* let the handshake progress while the rest are opened */
+		xio_context_run_loop(idata->ctx[i], 0);
+	}
+	if (i < idata->nr)
+		fprintf(stderr, "opened %d of %d idle connections\n",
+			i, idata->nr);
+	idata->nr = i;
+	idata->ready = 1;
+
+	/* nothing is sent, the contexts only answer credit updates */
+	while (!idata->stop) {
+		for (i = 0; i < idata->nr; i++)
+			xio_context_run_loop(idata->ctx[i], 0);
+		usleep(1000);
+	}
+
+	for (i = 0; i < idata->nr; i++)
+		xio_disconnect(idata->conn[i]);
+	while (idata->closed_nr < idata->nr) {
+		for (i = 0; i < idata->nr; i++)
+			xio_context_run_loop(idata->ctx[i], 0);
+	}
+	for (i = 0; i < idata->nr; i++)
+		xio_context_destroy(idata->ctx[i]);
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* idle_conns_start							     */
+/*---------------------------------------------------------------------------*/
+static struct idle_data *idle_conns_start(struct perf_parameters *user_param)
+{
+	struct idle_data *idata;
+
+	idata = calloc(1, sizeof(*idata));
+	if (idata == NULL)
+		return NULL;
+
+	idata->user_param	= user_param;
+	idata->nr		= user_param->idle_conns;
+	idata->ctx		= calloc(idata->nr, sizeof(*idata->ctx));
+	idata->session		= calloc(idata->nr, sizeof(*idata->session));
+	idata->conn		= calloc(idata->nr, sizeof(*idata->conn));
+	if (!idata->ctx || !idata->session || !idata->conn) {
+		free(idata->ctx);
+		free(idata->session);
+		free(idata->conn);
+		free(idata);
+		return NULL;
+	}
+	pthread_create(&idata->thread_id, NULL, idle_thread, idata);
+
+	/* measure with all of them in place */
+	while (!idata->ready)
+		usleep(1000);
+
+	return idata;
+}
+
+/*---------------------------------------------------------------------------*/
+/* idle_conns_stop							     */
+/*---------------------------------------------------------------------------*/
+static void idle_conns_stop(struct idle_data *idata)
+{
+	idata->stop = 1;
+	pthread_join(idata->thread_id, NULL);
+
+	free(idata->ctx);
+	free(idata->session);
+	free(idata->conn);
+	free(idata);
+}
+
 /*---------------------------------------------------------------------------*/
 /* run_client_test							     */
 /*---------------------------------------------------------------------------*/
 int run_client_test(struct perf_parameters *user_param)
 {
 	struct session_data	sess_data;
+	struct idle_data	*idata = NULL;
 	struct perf_comm	*comm;
 	struct thread_data	*tdata;
 	char			url[256];
@@ -445,6 +758,15 @@ int run_client_test(struct perf_parameters *user_param)
 		fflush(fd);
 	}
 
+	/* the idle connections stay up through all the iterations */
+	if (user_param->idle_conns) {
+		idata = idle_conns_start(user_param);
+		if (idata == NULL) {
+			fprintf(stderr, "failed to open idle connections\n");
+			goto cleanup;
+		}
+	}
+
 
 	printf("%s", RESULT_FMT);
 	printf("%s", RESULT_LINE);
@@ -476,6 +798,9 @@ int run_client_test(struct perf_parameters *user_param)
 				error, xio_strerror(error));
 			goto cleanup;
 		}
+		if (user_param->hedge_permille)
+			xio_session_set_hedge(sess_data.session,
+					      user_param->hedge_permille);
 
 		pthread_create(&statistics_thread_id, NULL,
 			       statistics_thread_cb, &sess_data);
@@ -517,6 +842,7 @@ int run_client_test(struct perf_parameters *user_param)
 		command.results.avg_lat		= sess_data.avg_lat_us;
 		command.results.min_lat		= sess_data.min_lat_us;
 		command.results.max_lat		= sess_data.max_lat_us;
+		command.results.cpu_per_msg	= sess_data.cpu_per_msg_us;
 		command.command			= GetTestResults;
 
 		/* sync point */
@@ -529,7 +855,15 @@ int run_client_test(struct perf_parameters *user_param)
 		       sess_data.avg_bw,
 		       sess_data.avg_lat_us,
 		       sess_data.min_lat_us,
-		       sess_data.max_lat_us);
+		       sess_data.max_lat_us,
+		       sess_data.cpu_per_msg_us);
+		for (i = 0; i < sample_classes(user_param); i++)
+			printf(CLASS_REPORT_FMT,
+			       i,
+			       sess_data.class_nr[i],
+			       sess_data.class_p50_us[i],
+			       sess_data.class_p99_us[i],
+			       sess_data.class_p999_us[i]);
 		if (fd)
 			fprintf(fd, "%lu, %d, %lu, %.2lf, %.2lf\n",
 				data_len,
@@ -552,6 +886,9 @@ int run_client_test(struct perf_parameters *user_param)
 	printf("%s", RESULT_LINE);
 
 cleanup:
+	if (idata)
+		idle_conns_stop(idata);
+
 	if (fd)
 		fclose(fd);
 
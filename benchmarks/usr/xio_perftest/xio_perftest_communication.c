@@ -45,6 +45,7 @@
 
 
 #define CONFIG_PORT	20610
+#define MAX_PENDING	4
 
 /* configuration session data */
 struct control_context {
@@ -54,11 +55,53 @@ struct control_context {
 	struct xio_connection	*conn;
 	struct xio_msg		msg;
 	struct xio_msg		*reply;
+	/* messages that arrived while reply was still unread */
+	struct xio_msg		*pending[MAX_PENDING];
+	int			npending;
 	int			disconnect;
 	int			failed;
 };
 
 
+/*---------------------------------------------------------------------------*/
+/* next_reply								     */
+/*---------------------------------------------------------------------------*/
+static void next_reply(struct control_context *control_ctx)
+{
+	int i;
+
+	control_ctx->reply = NULL;
+	if (control_ctx->npending == 0)
+		return;
+
+	control_ctx->reply = control_ctx->pending[0];
+	for (i = 1; i < control_ctx->npending; i++)
+		control_ctx->pending[i - 1] = control_ctx->pending[i];
+	control_ctx->npending--;
+}
+
+/*---------------------------------------------------------------------------*/
+/* wait_reply								     */
+/*---------------------------------------------------------------------------*/
+static void wait_reply(struct control_context *control_ctx)
+{
+	/* the message may have come with the previous one */
+	if (control_ctx->reply == NULL)
+		xio_context_run_loop(control_ctx->ctx, XIO_INFINITE);
+}
+
+/*---------------------------------------------------------------------------*/
+/* release_replies							     */
+/*---------------------------------------------------------------------------*/
+static void release_replies(struct control_context *control_ctx)
+{
+	while (control_ctx->reply) {
+		xio_release_msg(control_ctx->reply);
+		next_reply(control_ctx);
+	}
+}
+
+
 /*---------------------------------------------------------------------------*/
 /* on_session_event							     */
 /*---------------------------------------------------------------------------*/
@@ -98,8 +141,19 @@ static int on_message(struct xio_session *session,
 {
 	struct perf_comm *comm = cb_user_context;
 
-	if (comm->control_ctx->reply)
-		fprintf(stderr, "message overrun\n");
+	if (comm->control_ctx->reply) {
+		/* the peer sent again before the last message was read.
+		 * keep it, dropping it would never return its task
+		 */
+		if (comm->control_ctx->npending == MAX_PENDING) {
+			fprintf(stderr, "message overrun\n");
+			xio_release_msg(msg);
+			return 0;
+		}
+		comm->control_ctx->pending[comm->control_ctx->npending++] =
+			msg;
+		return 0;
+	}
 
 	comm->control_ctx->reply = msg;
 
@@ -149,7 +203,6 @@ static int on_msg_send_complete(struct xio_session *session,
 {
 	struct perf_comm *comm = conn_user_context;
 
-	comm->control_ctx->reply  = NULL;
 	if (comm->control_ctx->disconnect) {
 		struct xio_connection *conn = xio_get_connection(
 				session,
@@ -269,7 +322,7 @@ int ctx_xchg_data(struct perf_comm *comm,
 
 		xio_send_request(comm->control_ctx->conn,
 				 &comm->control_ctx->msg);
-		xio_context_run_loop(comm->control_ctx->ctx, XIO_INFINITE);
+		wait_reply(comm->control_ctx);
 
 		if (comm->control_ctx->reply) {
 			if (comm->control_ctx->reply->in.header.iov_len)
@@ -279,10 +332,10 @@ int ctx_xchg_data(struct perf_comm *comm,
 				comm->control_ctx->reply->in.header.iov_len);
 
 			xio_release_response(comm->control_ctx->reply);
-			comm->control_ctx->reply = NULL;
+			next_reply(comm->control_ctx);
 		}
 	} else {
-		xio_context_run_loop(comm->control_ctx->ctx, XIO_INFINITE);
+		wait_reply(comm->control_ctx);
 
 		if (comm->control_ctx->failed)
 			goto cleanup;
@@ -301,16 +354,17 @@ int ctx_xchg_data(struct perf_comm *comm,
 
 		comm->control_ctx->msg.request = comm->control_ctx->reply;
 
+		/* the request goes back with the response. the peer's next
+		 * message may arrive before the send completion
+		 */
+		next_reply(comm->control_ctx);
 		xio_send_response(&comm->control_ctx->msg);
 	}
 
 	return 0;
 
 cleanup:
-	if (comm->control_ctx->reply) {
-		xio_release_msg(comm->control_ctx->reply);
-		comm->control_ctx->reply = NULL;
-	}
+	release_replies(comm->control_ctx);
 	return -1;
 }
 
@@ -341,7 +395,7 @@ int ctx_read_data(struct perf_comm *comm, void *data, int size, int *osize)
 	if (comm->control_ctx->failed)
 		goto cleanup;
 
-	xio_context_run_loop(comm->control_ctx->ctx, XIO_INFINITE);
+	wait_reply(comm->control_ctx);
 
 	if (comm->control_ctx->failed)
 		goto cleanup;
@@ -357,15 +411,12 @@ int ctx_read_data(struct perf_comm *comm, void *data, int size, int *osize)
 		       comm->control_ctx->reply->in.header.iov_len);
 
 	xio_release_msg(comm->control_ctx->reply);
-	comm->control_ctx->reply = NULL;
+	next_reply(comm->control_ctx);
 
 	return 0;
 
 cleanup:
-	if (comm->control_ctx->reply) {
-		xio_release_msg(comm->control_ctx->reply);
-		comm->control_ctx->reply = NULL;
-	}
+	release_replies(comm->control_ctx);
 	return -1;
 }
 
@@ -405,6 +456,7 @@ int ctx_close_connection(struct perf_comm *comm)
 			goto cleanup;
 
 		if (!comm->control_ctx->failed) {
+			release_replies(comm->control_ctx);
 			if (comm->user_param->machine_type == CLIENT)
 				xio_disconnect(comm->control_ctx->conn);
 
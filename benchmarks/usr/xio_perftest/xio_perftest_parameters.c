@@ -44,6 +44,7 @@
 #include <string.h>
 #include <inttypes.h>
 #include <getopt.h>
+#include "libxio.h"
 #include "xio_perftest_parameters.h"
 
 
@@ -173,6 +174,40 @@ void usage(const char *argv0, int status)
 	printf("\t\t\tSet the number of messages to send " \
 	       "(default %d)\n", XIO_DEF_QUEUE_DEPTH);
 
+	printf("\t-m, --classes=<number> ");
+	printf("\t\t\tSpread the queue over <number> transmit classes. " \
+	       "class 0 sends\n\t\t\t\t\t\theader only requests, " \
+	       "latency percentiles are\n\t\t\t\t\t\treported per class " \
+	       "(default %d - off)\n", XIO_DEF_CLASSES_NUM);
+
+	printf("\t-e, --hedge=<permille> ");
+	printf("\t\t\tOpen two connections per thread and hedge requests " \
+	       "not\n\t\t\t\t\t\tanswered within the given latency " \
+	       "percentile,\n\t\t\t\t\t\te.g. 990 for p99 " \
+	       "(default %d - off)\n", XIO_DEF_HEDGE_PERMILLE);
+
+	printf("\t-s, --slow_usecs=<number> ");
+	printf("\t\t\tServer: the first portal thread stalls every " \
+	       "%dth\n\t\t\t\t\t\trequest for <number> microseconds " \
+	       "(default %d - off)\n", SLOW_PORTAL_PERIOD, XIO_DEF_SLOW_USECS);
+
+	printf("\t-r, --srq ");
+	printf("\t\t\t\t\tPost receive buffers on one queue shared by " \
+	       "all\n\t\t\t\t\t\tconnections of a thread\n");
+
+	printf("\t-i, --write_imm ");
+	printf("\t\t\t\tPlace response data with rdma write with " \
+	       "immediate,\n\t\t\t\t\t\twithout a header send\n");
+
+	printf("\t-a, --adaptive_rq ");
+	printf("\t\t\t\tSize the receive window and the tasks pool " \
+	       "from\n\t\t\t\t\t\tthe traffic (both sides)\n");
+
+	printf("\t-I, --idle_conns=<number> ");
+	printf("\t\t\tClient: keep <number> connections open next to " \
+	       "the\n\t\t\t\t\t\tmeasured ones, without traffic " \
+	       "(default %d)\n", XIO_DEF_IDLE_CONNS);
+
 	printf("\t-v, --version ");
 	printf("\t\t\t\t\tPrint the version and exit\n");
 
@@ -214,6 +249,14 @@ static int force_dependencies(struct perf_parameters *user_param)
 			return -1;
 		}
 	}
+	if (user_param->classes_num > XIO_MAX_MSG_CLASSES) {
+		printf("at most %d transmit classes\n", XIO_MAX_MSG_CLASSES);
+		return -1;
+	}
+	if (user_param->hedge_permille >= 1000) {
+		printf("hedge percentile is given in permille (0-999)\n");
+		return -1;
+	}
 	if (user_param->threads_num  < 1) {
 		printf("threads number is mandatory - recommended cores " \
 		       "per numa\n");
@@ -241,6 +284,13 @@ static void init_perf_params(struct perf_parameters *user_param)
 	user_param->output_file		= NULL;
 	user_param->portals_arr		= NULL;
 	user_param->portals_arr_len     = 0;
+	user_param->classes_num		= XIO_DEF_CLASSES_NUM;
+	user_param->hedge_permille	= XIO_DEF_HEDGE_PERMILLE;
+	user_param->slow_usecs		= XIO_DEF_SLOW_USECS;
+	user_param->enable_srq		= 0;
+	user_param->enable_write_imm	= 0;
+	user_param->enable_adaptive_rq	= 0;
+	user_param->idle_conns		= XIO_DEF_IDLE_CONNS;
 	user_param->server_addr		= NULL;
 }
 
@@ -283,12 +333,19 @@ int parse_cmdline(struct perf_parameters *user_param,
 			{ .name = "poll_time",   .has_arg = 1, .val = 't'},
 			{ .name = "queue_depth", .has_arg = 1, .val = 'q'},
 			{ .name = "output file", .has_arg = 1, .val = 'o'},
+			{ .name = "classes",	 .has_arg = 1, .val = 'm'},
+			{ .name = "hedge",	 .has_arg = 1, .val = 'e'},
+			{ .name = "slow_usecs",	 .has_arg = 1, .val = 's'},
+			{ .name = "srq",	 .has_arg = 0, .val = 'r'},
+			{ .name = "write_imm",	 .has_arg = 0, .val = 'i'},
+			{ .name = "adaptive_rq", .has_arg = 0, .val = 'a'},
+			{ .name = "idle_conns",	 .has_arg = 1, .val = 'I'},
 			{ .name = "version",	 .has_arg = 0, .val = 'v'},
 			{ .name = "help",	 .has_arg = 0, .val = 'h'},
 			{0, 0, 0, 0},
 		};
 
-		static char *short_options = "c:p:n:w:t:q:o:vh";
+		static char *short_options = "c:p:n:w:t:q:o:m:e:s:riaI:vh";
 
 		c = getopt_long(argc, argv, short_options,
 				long_options, NULL);
@@ -339,6 +396,31 @@ int parse_cmdline(struct perf_parameters *user_param,
 			if (optarg)
 				user_param->output_file = strdup(optarg);
 		break;
+		case 'm':
+			user_param->classes_num =
+				(uint32_t)strtol(optarg, NULL, 0);
+			break;
+		case 'e':
+			user_param->hedge_permille =
+				(uint32_t)strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			user_param->slow_usecs =
+				(uint32_t)strtol(optarg, NULL, 0);
+			break;
+		case 'r':
+			user_param->enable_srq = 1;
+			break;
+		case 'i':
+			user_param->enable_write_imm = 1;
+			break;
+		case 'a':
+			user_param->enable_adaptive_rq = 1;
+			break;
+		case 'I':
+			user_param->idle_conns =
+				(uint32_t)strtol(optarg, NULL, 0);
+			break;
 		case 'v':
 			printf("version: %s\n", XIO_PERF_VERSION);
 			exit(0);
@@ -393,6 +475,24 @@ void print_test_info(const struct perf_parameters *user_param)
 	       user_param->threads_num);
 	printf(" Poll timeout		: %d\n",
 	       user_param->poll_timeout);
+	if (user_param->classes_num)
+		printf(" Transmit classes	: %d\n",
+		       user_param->classes_num);
+	if (user_param->hedge_permille)
+		printf(" Hedge percentile	: %d/1000\n",
+		       user_param->hedge_permille);
+	if (user_param->slow_usecs)
+		printf(" Slow portal stall	: %d usecs\n",
+		       user_param->slow_usecs);
+	if (user_param->enable_srq)
+		printf(" Shared receive queue	: on\n");
+	if (user_param->enable_write_imm)
+		printf(" Write with immediate	: on\n");
+	if (user_param->enable_adaptive_rq)
+		printf(" Adaptive receive queue	: on\n");
+	if (user_param->idle_conns)
+		printf(" Idle connections	: %d\n",
+		       user_param->idle_conns);
 	if (user_param->output_file)
 		printf(" Output file		: %s\n",
 		       user_param->output_file);
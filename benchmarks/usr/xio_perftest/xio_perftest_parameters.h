@@ -78,14 +78,22 @@ typedef enum { READ, WRITE} Verb;
 #endif
 
 #define XIO_DEF_THREADS_NUM		0
+#define XIO_DEF_CLASSES_NUM		0
+#define XIO_DEF_HEDGE_PERMILLE		0
+#define XIO_DEF_SLOW_USECS		0
+#define XIO_DEF_IDLE_CONNS		0
+#define SLOW_PORTAL_PERIOD		100
 #define XIO_PERF_VERSION		"1.0.0"
 
-#define RESULT_LINE "----------------------------------------------------------------------------------------------------------------------\n"
+#define RESULT_LINE "--------------------------------------------------------------------------------------------------------------------------------------\n"
 
 /* The format of the results */
-#define RESULT_FMT		" #bytes     #threads   #TPS       BW average[MBps]   Latency average[usecs]   Latency low[usecs]   Latency peak[usecs]\n"
+#define RESULT_FMT		" #bytes     #threads   #TPS       BW average[MBps]   Latency average[usecs]   Latency low[usecs]   Latency peak[usecs]   CPU/msg[usecs]\n"
 /* Result print format */
-#define REPORT_FMT		" %-7lu     %d         %-7.2lu	  %-7.2lf            %-7.2lf		      %-7.2lf		    %-7.2lf\n"
+#define REPORT_FMT		" %-7lu     %d         %-7.2lu	  %-7.2lf            %-7.2lf		      %-7.2lf		    %-7.2lf		  %-7.2lf\n"
+
+/* Per class latency format */
+#define CLASS_REPORT_FMT	"   class %d   #samples %-9lu  p50[usecs] %-9.2lf  p99[usecs] %-9.2lf  p99.9[usecs] %-9.2lf\n"
 
 
 struct perf_parameters {
@@ -95,6 +103,14 @@ struct perf_parameters {
 	uint32_t		poll_timeout;
 	uint32_t		threads_num;
 	uint32_t		portals_arr_len;
+	uint32_t		classes_num;
+	uint32_t		hedge_permille;
+	uint32_t		slow_usecs;
+	uint32_t		enable_srq;
+	uint32_t		enable_write_imm;
+	uint32_t		enable_adaptive_rq;
+	uint32_t		pad;
+	uint32_t		idle_conns;
 	TestType		test_type;
 	MachineType		machine_type;
 	Verb			verb;
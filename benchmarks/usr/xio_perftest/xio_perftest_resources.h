@@ -58,6 +58,7 @@ struct test_results {
 	double			avg_lat;
 	double			min_lat;
 	double			max_lat;
+	double			cpu_per_msg;
 
 };
 
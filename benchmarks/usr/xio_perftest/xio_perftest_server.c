@@ -64,6 +64,7 @@ struct  thread_data {
 	struct xio_mr		*mr;
 	int			affinity;
 	int			portal_index;
+	uint64_t		nr_reqs;
 	pthread_t		thread_id;
 };
 
@@ -74,6 +75,7 @@ struct server_data {
 	struct test_parameters  rem_test_param;
 	struct test_parameters	my_test_param;
 	struct xio_context	*ctx;
+	struct xio_portals_balancer *balancer;
 	int			tdata_nr;
 	int			running;
 	struct thread_data	*tdata;
@@ -84,6 +86,35 @@ struct server_data {
 /* globals								     */
 /*---------------------------------------------------------------------------*/
 
+/*---------------------------------------------------------------------------*/
+/* set_response_data							     */
+/*---------------------------------------------------------------------------*/
+static void set_response_data(struct thread_data *tdata, struct xio_msg *req,
+			      struct xio_msg *rsp)
+{
+	uint64_t len = 0;
+
+	/* the client asks for the data length in the request header */
+	if (req->in.header.iov_len == sizeof(len))
+		memcpy(&len, req->in.header.iov_base, sizeof(len));
+	if (len == 0) {
+		rsp->out.data_iovlen = 0;
+		return;
+	}
+
+	if (!tdata->out_xbuf) {
+		tdata->out_xbuf = xio_alloc(len);
+	} else if (tdata->out_xbuf->length < len) {
+		xio_free(&tdata->out_xbuf);
+		tdata->out_xbuf = xio_alloc(len);
+	}
+
+	rsp->out.data_iovlen		= 1;
+	rsp->out.data_iov[0].iov_base	= tdata->out_xbuf->addr;
+	rsp->out.data_iov[0].iov_len	= len;
+	rsp->out.data_iov[0].mr		= tdata->out_xbuf->mr;
+}
+
 /*---------------------------------------------------------------------------*/
 /* on_request								     */
 /*---------------------------------------------------------------------------*/
@@ -95,6 +126,11 @@ static int on_request(struct xio_session *session,
 	struct xio_msg		*rsp;
 	struct thread_data	*tdata = cb_prv_data;
 
+	/* a portal thread that stalls now and then, e.g. on page faults */
+	if (tdata->user_param->slow_usecs && tdata->portal_index == 0 &&
+	    ++tdata->nr_reqs % SLOW_PORTAL_PERIOD == 0)
+		usleep(tdata->user_param->slow_usecs);
+
 	/* alloc transaction */
 	rsp	= msg_pool_get(tdata->pool);
 
@@ -107,6 +143,8 @@ static int on_request(struct xio_session *session,
 
 	if (tdata->user_param->verb == READ)
 		rsp->out.data_iovlen = 0;
+	else
+		set_response_data(tdata, req, rsp);
 
 	if (xio_send_response(rsp) == -1) {
 		printf("**** [%p] Error - xio_send_msg failed. %s\n",
@@ -198,8 +236,12 @@ static void *portal_server_cb(void *data)
 
 	pthread_setaffinity_np(tdata->thread_id, sizeof(cpu_set_t), &cpuset);
 
-	/* prepare data for the cuurent thread */
-	tdata->pool = msg_pool_alloc(tdata->user_param->queue_depth + 32);
+	/* prepare data for the cuurent thread. both copies of a hedged
+	 * request may land on the same portal
+	 */
+	tdata->pool = msg_pool_alloc(
+			(tdata->user_param->hedge_permille ? 2 : 1) *
+			tdata->user_param->queue_depth + 32);
 
 	/* create thread context for the client */
 	tdata->ctx = xio_context_create(NULL, tdata->user_param->poll_timeout,
@@ -269,12 +311,31 @@ static int on_new_session(struct xio_session *session,
 			void *cb_user_context)
 {
 	struct server_data  *server_data = cb_user_context;
+	struct perf_parameters *user_param = server_data->user_param;
+	int		    i;
+
+	/* the portal threads are up by the time clients connect */
+	if (server_data->balancer == NULL) {
+		server_data->balancer = xio_portals_balancer_create();
+		for (i = 0; server_data->balancer &&
+			    i < user_param->threads_num &&
+			    i < user_param->portals_arr_len; i++)
+			xio_portals_balancer_add(
+				server_data->balancer,
+				server_data->tdata[i].ctx,
+				user_param->portals_arr[
+					server_data->tdata[i].portal_index]);
+	}
 
-	/* automatic accept the request */
-	xio_accept(session,
-		   (const char **)server_data->user_param->portals_arr,
-		   server_data->user_param->portals_arr_len,
-		   NULL, 0);
+	/* automatic accept the request, least loaded portals first */
+	if (server_data->balancer)
+		xio_portals_balancer_accept(server_data->balancer, session,
+					    NULL, 0);
+	else
+		xio_accept(session,
+			   (const char **)user_param->portals_arr,
+			   user_param->portals_arr_len,
+			   NULL, 0);
 
 	return 0;
 }
@@ -319,6 +380,8 @@ static void *balancer_server_cb(void *data)
 
 	/* free the server */
 	xio_unbind(server);
+	xio_portals_balancer_destroy(server_data->balancer);
+	server_data->balancer = NULL;
 cleanup:
 	/* free the context */
 	xio_context_destroy(server_data->ctx);
@@ -332,6 +395,10 @@ cleanup:
 /*---------------------------------------------------------------------------*/
 static void on_test_results(struct test_results *results)
 {
+#ifdef FAKE_VERBS
+	/* the client in this process already printed them */
+	return;
+#endif
 	printf(REPORT_FMT,
 	       (uint64_t)results->bytes,
 	       results->threads,
@@ -339,7 +406,8 @@ static void on_test_results(struct test_results *results)
 	       results->avg_bw,
 	       results->avg_lat,
 	       results->min_lat,
-	       results->max_lat);
+	       results->max_lat,
+	       results->cpu_per_msg);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -364,6 +432,7 @@ int run_server_test(struct perf_parameters *user_param)
 	server_data.my_test_param.data_len	= 0;
 
 
+	server_data.balancer = NULL;
 	server_data.tdata = calloc(user_param->threads_num,
 				   sizeof(*server_data.tdata));
 
@@ -386,9 +455,10 @@ int run_server_test(struct perf_parameters *user_param)
 	server_data.comm = create_comm_struct(user_param);
 	establish_connection(server_data.comm);
 
-
+#ifndef FAKE_VERBS
 	printf("%s", RESULT_FMT);
 	printf("%s", RESULT_LINE);
+#endif
 
 	while (1) {
 		/* sync test parameters */
@@ -416,8 +486,10 @@ int run_server_test(struct perf_parameters *user_param)
 			break;
 		};
 	}
+#ifndef FAKE_VERBS
 	if (retval == 0)
 		printf("%s", RESULT_LINE);
+#endif
 
 	/* normal exit phase */
 	ctx_close_connection(server_data.comm);
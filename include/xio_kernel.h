@@ -99,7 +99,18 @@ enum xio_optname {
 	XIO_OPTNAME_ENABLE_DMA_LATENCY,   /**< enables the dma latency        */
 
 	XIO_OPTNAME_RDMA_BUF_THRESHOLD,   /**< set/get rdma buffer threshold  */
-	XIO_OPTNAME_MEM_ALLOCATOR         /**< set customed allocators hooks  */
+	XIO_OPTNAME_MEM_ALLOCATOR,        /**< set customed allocators hooks  */
+	XIO_OPTNAME_RDMA_CHUNK_SIZE,      /**< set/get rdma read chunk size   */
+					  /**< (0 - chunking disabled)	      */
+	XIO_OPTNAME_ENABLE_SRQ,           /**< share one receive queue among  */
+					  /**< the rdma connections of a      */
+					  /**< context			      */
+	XIO_OPTNAME_ENABLE_WRITE_IMM,     /**< place response data with rdma  */
+					  /**< write with immediate when both */
+					  /**< peers enable it		      */
+	XIO_OPTNAME_ENABLE_ADAPTIVE_RQ    /**< size the receive window and    */
+					  /**< the tasks pool from traffic,   */
+					  /**< set on both peers	      */
 };
 
 /*  A number random enough not to collide with different errno ranges.       */
@@ -145,9 +156,22 @@ enum xio_session_flags {
 
 enum xio_msg_flags {
 	XIO_MSG_FLAG_REQUEST_READ_RECEIPT = 0x1,  /**< request read receipt   */
-	XIO_MSG_FLAG_SMALL_ZERO_COPY	  = 0x2   /**< zero copy for transfers*/
+	XIO_MSG_FLAG_SMALL_ZERO_COPY	  = 0x2,  /**< zero copy for transfers*/
+	XIO_MSG_FLAG_HEDGE		  = 0x4,  /**< may be duplicated      */
+	XIO_MSG_FLAG_STRIPE		  = 0x8,  /**< striped sub request    */
+	XIO_MSG_FLAG_CLASS_MASK		  = 0x30, /**< transmit class bits    */
+	XIO_MSG_FLAG_FANOUT		  = 0x40, /**< fan out copy           */
+	XIO_MSG_FLAG_FORWARD		  = 0x80  /**< forwarded message      */
 };
 
+/* maximum number of stripes of xio_session_send_striped */
+#define XIO_MAX_STRIPES			64
+
+/* number of transmit classes per connection, class 0 is served first */
+#define XIO_MAX_MSG_CLASSES		4
+#define XIO_MSG_FLAG_CLASS(cls)		(((cls) << 4) & XIO_MSG_FLAG_CLASS_MASK)
+#define XIO_MSG_CLASS(flags)		(((flags) & XIO_MSG_FLAG_CLASS_MASK) >> 4)
+
 enum xio_session_event {
 	XIO_SESSION_REJECT_EVENT,		  /**< session reject event   */
 	XIO_SESSION_TEARDOWN_EVENT,		  /**< session teardown event */
@@ -178,13 +202,29 @@ enum xio_receipt_result {
 	XIO_READ_RECEIPT_REJECT,
 };
 
+enum xio_lb_policy {
+	XIO_LB_ROUND_ROBIN,		/**< next connection in turn	     */
+	XIO_LB_LEAST_OUTSTANDING,	/**< fewest queued and in flight     */
+					/**< requests			     */
+	XIO_LB_LATENCY_EWMA,		/**< lowest response time average    */
+					/**< weighted by outstanding requests*/
+	XIO_LB_HASH			/**< by key, same key same connection*/
+};
+
 enum xio_connection_attr_mask {
 	XIO_CONNECTION_ATTR_CTX                 = 1 << 0,
-	XIO_CONNECTION_ATTR_USER_CTX		= 1 << 1
+	XIO_CONNECTION_ATTR_USER_CTX		= 1 << 1,
+	XIO_CONNECTION_ATTR_WATERMARKS		= 1 << 2,
+	XIO_CONNECTION_ATTR_TX_QUEUE		= 1 << 3, /* query only */
+	XIO_CONNECTION_ATTR_QOS			= 1 << 4,
+	XIO_CONNECTION_ATTR_TX_SCHED		= 1 << 5,
+	XIO_CONNECTION_ATTR_TX_STATS		= 1 << 6  /* query only */
 };
 
 enum xio_context_attr_mask {
-	XIO_CONTEXT_ATTR_USER_CTX		= 1 << 0
+	XIO_CONTEXT_ATTR_USER_CTX		= 1 << 0,
+	XIO_CONTEXT_ATTR_COMP_VECTOR		= 1 << 1,
+	XIO_CONTEXT_ATTR_PREWARM_MAX		= 1 << 2
 };
 
 /*---------------------------------------------------------------------------*/
@@ -194,6 +234,7 @@ struct xio_context;		/* xio context			*/
 struct xio_server;		/* server handle		*/
 struct xio_session;		/* session handle		*/
 struct xio_connection;		/* connection handle		*/
+struct xio_portals_balancer;	/* server portals balancer	*/
 struct xio_mr;			/* registered memory handle	*/
 
 /*---------------------------------------------------------------------------*/
@@ -228,6 +269,33 @@ struct xio_connection_attr {
 						/**< pass to connection      */
 						/**< oriented callbacks      */
 	struct xio_context	*ctx;
+	uint32_t		tx_high_watermark; /**< queued requests that */
+						/**< make send return EAGAIN */
+						/**< 0 - unlimited	     */
+	uint32_t		tx_low_watermark; /**< queued requests below */
+						/**< which on_tx_ready fires */
+	uint32_t		tx_queued_msgs;	/**< requests waiting to be  */
+						/**< posted		     */
+	uint32_t		tx_in_flight_msgs; /**< requests posted and  */
+						/**< not yet completed	     */
+	uint32_t		tx_class_quantum[XIO_MAX_MSG_CLASSES];
+						/**< bytes a class may send  */
+						/**< per round, 0 - strict   */
+						/**< priority by class index */
+	uint32_t		tx_class_reserve[XIO_MAX_MSG_CLASSES];
+						/**< in flight requests kept */
+						/**< for the class only	     */
+	uint32_t		tx_quantum;	/**< bytes sent per turn of  */
+						/**< the context scheduler   */
+						/**< 0 - never yield, the    */
+						/**< default		     */
+	uint32_t		pad;
+	uint64_t		tx_service_bytes; /**< bytes transmitted     */
+	uint64_t		tx_service_msgs; /**< messages transmitted   */
+	uint64_t		tx_service_turns; /**< scheduler turns given */
+	uint64_t		tx_service_deferred; /**< times the quantum  */
+						/**< ran out with messages   */
+						/**< still queued	     */
 };
 
 /**
@@ -238,6 +306,15 @@ struct xio_context_attr {
 	void			*user_context;  /**< private user context to */
 						/**< pass to connection      */
 						/**< oriented callbacks      */
+	int			comp_vector;	/**< cq completion vector,   */
+						/**< -1 - the one whose irq  */
+						/**< is affine to the	     */
+						/**< context's cpu or node.  */
+						/**< query returns the one   */
+						/**< in use		     */
+	int			prewarm_max;	/**< bound of the context's  */
+						/**< prewarmed connections,  */
+						/**< see xio_connect_prewarm */
 };
 
 struct xio_buf {
@@ -266,6 +343,22 @@ struct xio_msg_pdata {
 	struct xio_msg		**prev;		/**< internal library usage   */
 };
 
+/**
+ * @struct xio_msg_timer
+ * @brief message deadline data used internaly by the library
+ *
+ * Note: embedding it in struct xio_msg changed the size and layout of
+ *	 struct xio_msg. modules built against older headers must be rebuilt
+ */
+struct xio_msg_timer {
+	struct xio_msg		*next;          /* internal use */
+	struct xio_msg		**prev;		/* internal use */
+	void			*parent;	/* internal use */
+	uint32_t		expires;	/* internal use */
+	uint16_t		armed;		/* internal use */
+	uint16_t		in_flight;	/* internal use */
+};
+
 struct xio_vmsg {
 	struct xio_iovec	header;		/* header's iovec */
 	size_t			data_iovlen;	/* number of items in vector  */
@@ -289,12 +382,30 @@ struct xio_msg {
 	int			flags;
 	enum xio_receipt_result	receipt_res;
 	uint64_t		timestamp;	/**< submission timestamp     */
-	int			reserved;
+	uint32_t		timeout_ms;	/* request deadline in msec,
+						 * 0 - none. a sent request
+						 * completes with XIO_E_TIMEOUT
+						 * once the peer cancels or
+						 * answers it
+						 */
 	void			*user_context;	/* for user usage - not sent */
 	struct xio_msg_pdata	pdata;		/**< accelio private data     */
+	struct xio_msg_timer	timer;		/* internal use */
 	struct xio_msg		*next;          /* internal use */
 };
 
+/**
+ * @struct xio_stripe_info
+ * @brief  position of a striped sub request in the whole transfer
+ */
+struct xio_stripe_info {
+	uint64_t		offset;		/**< stripe offset in bytes   */
+	uint64_t		stripe_len;	/**< stripe length in bytes   */
+	uint64_t		total_len;	/**< whole transfer length    */
+	uint32_t		index;		/**< stripe index	      */
+	uint32_t		count;		/**< number of stripes	      */
+};
+
 /**
  * @struct xio_session_event_data
  * @brief  session enent callback parmaters
@@ -410,6 +521,29 @@ struct xio_session_ops {
 	int (*on_ow_msg_send_complete)(struct xio_session *session,
 				       struct xio_msg *msg,
 				       void *conn_user_context);
+
+	/* incoming message data chunk arrived notification */
+	int (*on_msg_data_chunk)(struct xio_session *session,
+				 struct xio_msg *msg,
+				 size_t offset, size_t len,
+				 void *conn_user_context);
+
+	/* vectorized message arrived notification, replaces on_msg */
+	int (*on_msgs)(struct xio_session *session,
+		       struct xio_msg **msgs, int nr,
+		       void *conn_user_context);
+
+	/* vectorized send completion notification, replaces
+	 * on_msg_send_complete and on_ow_msg_send_complete
+	 */
+	int (*on_msgs_send_complete)(struct xio_session *session,
+				     struct xio_msg **msgs, int nr,
+				     void *conn_user_context);
+
+	/* transmit queue dropped to the low watermark after EAGAIN */
+	int (*on_tx_ready)(struct xio_session *session,
+			   struct xio_connection *connection,
+			   void *conn_user_context);
 };
 
 /**
@@ -684,6 +818,18 @@ struct xio_session *xio_session_create(
  */
 int xio_session_destroy(struct xio_session *session);
 
+/**
+ * xio_session_set_resume - keep unanswered requests of a dropped
+ * connection and the session itself for a grace period, so that another
+ * or a new connection of the session, on any context, resumes them.
+ *
+ * @session: The xio session handle
+ * @grace_ms: grace period in milliseconds, 0 to disable
+ *
+ * RETURNS: success (0), or a (negative) error value.
+ */
+int xio_session_set_resume(struct xio_session *session, uint32_t grace_ms);
+
 /**
  * xio_connect - create connection handle.
  *
@@ -693,6 +839,9 @@ int xio_session_destroy(struct xio_session *session);
  * @out_if: bounded outgoing interface address
  * @conn_user_context: Private data pointer to pass to each connection callback
  *
+ * A session may open several connections on one context, each gets a
+ * transport connection of its own.
+ *
  * RETURNS: xio session context, or NULL upon error.
  */
 struct xio_connection *xio_connect(
@@ -702,6 +851,31 @@ struct xio_connection *xio_connect(
 				const char *out_if,
 				void *conn_user_context);
 
+/**
+ * xio_connect_prewarm - open a transport connection to a portal ahead of
+ * any session, into the context's prewarm pool. sessions of the context
+ * take pooled connections and the pool refills, up to prewarm_max.
+ *
+ * @ctx: The xio context handle
+ * @uri: uri of the portal
+ * @out_if: bounded outgoing interface address and/or port, or NULL
+ *
+ * RETURNS: success (0), or a (negative) error value.
+ */
+int xio_connect_prewarm(struct xio_context *ctx, const char *uri,
+			const char *out_if);
+
+/**
+ * xio_connect_prewarm_release - close the prewarmed connections of a
+ * context.
+ *
+ * @ctx: The xio context handle
+ * @uri: uri of the portal, or NULL for all portals
+ *
+ * RETURNS: success (0), or a (negative) error value.
+ */
+int xio_connect_prewarm_release(struct xio_context *ctx, const char *uri);
+
 /**
  * xio_disconnect - teardown an opened connection.
  *
@@ -756,6 +930,86 @@ int xio_query_connection(struct xio_connection *conn,
 int xio_send_request(struct xio_connection *conn,
 		     struct xio_msg *req);
 
+/**
+ * xio_send_request_batch - send an array of requests with one doorbell.
+ *
+ * @conn: The xio connection handle.
+ * @reqs: array of requests to send
+ * @nr: number of requests in the array
+ *
+ * RETURNS: number of requests accepted (may be less than nr), or -1.
+ * An invalid entry fails the call with EINVAL before any request is queued.
+ */
+int xio_send_request_batch(struct xio_connection *conn,
+			   struct xio_msg **reqs, int nr);
+
+/**
+ * xio_session_set_lb_policy - set the connection selection policy of
+ * xio_session_send_request.
+ *
+ * @session: The xio session handle.
+ * @policy: one of enum xio_lb_policy
+ *
+ * RETURNS: success (0), or a (negative) error value.
+ */
+int xio_session_set_lb_policy(struct xio_session *session,
+			      enum xio_lb_policy policy);
+
+/**
+ * xio_session_send_request - send request on a session connection picked
+ * by the load balancing policy.
+ *
+ * @session: The xio session handle.
+ * @ctx: context of the caller, only its online connections are used
+ * @req: request message to send
+ * @key: affinity key for XIO_LB_HASH
+ *
+ * RETURNS: the connection used, or NULL on error.
+ */
+struct xio_connection *xio_session_send_request(struct xio_session *session,
+						struct xio_context *ctx,
+						struct xio_msg *req,
+						uint64_t key);
+
+/**
+ * xio_session_set_hedge - duplicate XIO_MSG_FLAG_HEDGE requests on a second
+ * connection when not answered within a response time percentile.
+ *
+ * @session: The xio session handle.
+ * @permille: percentile in 1/1000 units, 0 disables hedging
+ *
+ * RETURNS: success (0), or a (negative) error value.
+ */
+int xio_session_set_hedge(struct xio_session *session, uint32_t permille);
+
+/**
+ * xio_session_send_striped - send a large request as stripes spread over the
+ * session's connections. req completes on ctx once all stripes answered.
+ *
+ * @session: The xio session handle.
+ * @ctx: context of the caller, with at least one online connection. stripes
+ *	 on connections of other contexts are posted by their own threads
+ * @req: request, exactly one of its in and out data is non empty
+ * @stripe_size: stripe length in bytes
+ *
+ * RETURNS: success (0), or a (negative) error value.
+ */
+int xio_session_send_striped(struct xio_session *session,
+			     struct xio_context *ctx,
+			     struct xio_msg *req,
+			     size_t stripe_size);
+
+/**
+ * xio_msg_stripe_info - responder side position of a XIO_MSG_FLAG_STRIPE
+ * request, the descriptor is removed from req->in.header.
+ *
+ * @req: received request
+ * @info: stripe position
+ *
+ * RETURNS: success (0), or a (negative) error value.
+ */
+int xio_msg_stripe_info(struct xio_msg *req, struct xio_stripe_info *info);
+
 /**
  * xio_release_response - release message resources back to xio.
  *
@@ -768,6 +1022,19 @@ int xio_send_request(struct xio_connection *conn,
  */
 int xio_release_response(struct xio_msg *rsp);
 
+/**
+ * xio_release_response_batch - release an array of responses back to xio.
+ *
+ * Note: the transmit queue is kicked once per run of adjacent responses
+ *	 of the same connection. NULL entries fail the whole call.
+ *
+ * @rsps: array of responses to release
+ * @nr: number of responses in the array
+ *
+ * RETURNS: success (0), or a (negative) error value.
+ */
+int xio_release_response_batch(struct xio_msg **rsps, int nr);
+
 /**
  * xio_send_msg - send one way message to remote peer.
  *
@@ -779,6 +1046,37 @@ int xio_release_response(struct xio_msg *rsp);
 int xio_send_msg(struct xio_connection *conn,
 		 struct xio_msg *msg);
 
+/**
+ * xio_send_msg_fanout - send one one way message to several connections
+ * of the same context without copying its payload.
+ *
+ * @conns: array of connections
+ * @nr: number of connections in the array
+ * @msg: message to send
+ * @status: optional array of nr per target results
+ *
+ * msg completes once, after the last target.
+ *
+ * RETURNS: success (0), or a (negative) error value.
+ */
+int xio_send_msg_fanout(struct xio_connection **conns, int nr,
+			struct xio_msg *msg, int *status);
+
+/**
+ * xio_forward_msg - forward a received message to a connection of the same
+ * context straight from its receive buffers.
+ *
+ * @conn: The xio connection handle to forward on
+ * @imsg: received request or one way message
+ * @fwd: message to send
+ *
+ * The receive task is held until fwd completes.
+ *
+ * RETURNS: success (0), or a (negative) error value.
+ */
+int xio_forward_msg(struct xio_connection *conn,
+		    struct xio_msg *imsg, struct xio_msg *fwd);
+
 /**
  * xio_release_msg - release one way message resources back to xio.
  *
@@ -830,6 +1128,9 @@ int xio_unbind(struct xio_server *server);
  * @session: The xio session handle.
  * @ctx: the xio context handle.
  *
+ * A session may hold several connections on a context, the first one
+ * is returned.
+ *
  * RETURNS: xio session context, or NULL upon error.
  */
 struct xio_connection *xio_get_connection(struct xio_session  *session,
@@ -891,6 +1192,61 @@ int xio_reject(struct xio_session *session,
 				void *user_context,
 				size_t user_context_len);
 
+/**
+ * xio_portals_balancer_create - create a load aware portals balancer.
+ *
+ * RETURNS: balancer handle, or NULL upon error.
+ */
+struct xio_portals_balancer *xio_portals_balancer_create(void);
+
+/**
+ * xio_portals_balancer_destroy - destroy a portals balancer.
+ *
+ * @balancer: The balancer handle.
+ */
+void xio_portals_balancer_destroy(struct xio_portals_balancer *balancer);
+
+/**
+ * xio_portals_balancer_add - add a portal served by ctx.
+ *
+ * @balancer: The balancer handle.
+ * @ctx: context of the thread serving the portal
+ * @portal: the portal uri as passed to xio_bind
+ *
+ * RETURNS: success (0), or a (negative) error value.
+ */
+int xio_portals_balancer_add(struct xio_portals_balancer *balancer,
+			     struct xio_context *ctx,
+			     const char *portal);
+
+/**
+ * xio_portals_balancer_select - get the portals from the least loaded.
+ *
+ * @balancer: The balancer handle.
+ * @portals_array: filled with up to portals_array_len portals
+ * @portals_array_len: size of portals_array
+ *
+ * RETURNS: number of portals filled, or -1 upon error.
+ */
+int xio_portals_balancer_select(struct xio_portals_balancer *balancer,
+				const char **portals_array,
+				size_t portals_array_len);
+
+/**
+ * xio_portals_balancer_accept - accept with portals from the least loaded.
+ *
+ * @balancer: The balancer handle.
+ * @session: The xio session handle.
+ * @user_context: as in xio_accept
+ * @user_context_len: as in xio_accept
+ *
+ * RETURNS: success (0), or a (negative) error value.
+ */
+int xio_portals_balancer_accept(struct xio_portals_balancer *balancer,
+				struct xio_session *session,
+				void *user_context,
+				size_t user_context_len);
+
 /**
  * xio_send_response - send response.
  *
@@ -136,7 +136,18 @@ enum xio_optname {
 	XIO_OPTNAME_ENABLE_DMA_LATENCY,   /**< enables the dma latency        */
 
 	XIO_OPTNAME_RDMA_BUF_THRESHOLD,   /**< set/get rdma buffer threshold  */
-	XIO_OPTNAME_MEM_ALLOCATOR         /**< set customed allocators hooks  */
+	XIO_OPTNAME_MEM_ALLOCATOR,        /**< set customed allocators hooks  */
+	XIO_OPTNAME_RDMA_CHUNK_SIZE,      /**< set/get rdma read chunk size   */
+					  /**< (0 - chunking disabled)	      */
+	XIO_OPTNAME_ENABLE_SRQ,           /**< share one receive queue among  */
+					  /**< the rdma connections of a      */
+					  /**< context			      */
+	XIO_OPTNAME_ENABLE_WRITE_IMM,     /**< place response data with rdma  */
+					  /**< write with immediate when both */
+					  /**< peers enable it		      */
+	XIO_OPTNAME_ENABLE_ADAPTIVE_RQ    /**< size the receive window and    */
+					  /**< the tasks pool from traffic,   */
+					  /**< set on both peers	      */
 };
 
 /**
@@ -224,9 +235,30 @@ enum xio_session_event {
  */
 enum xio_msg_flags {
 	XIO_MSG_FLAG_REQUEST_READ_RECEIPT = 0x1,  /**< request read receipt   */
-	XIO_MSG_FLAG_SMALL_ZERO_COPY	  = 0x2   /**< zero copy for transfers*/
+	XIO_MSG_FLAG_SMALL_ZERO_COPY	  = 0x2,  /**< zero copy for transfers*/
+	XIO_MSG_FLAG_HEDGE		  = 0x4,  /**< idempotent, may be     */
+						  /**< duplicated on a second */
+						  /**< connection             */
+	XIO_MSG_FLAG_STRIPE		  = 0x8,  /**< sub request of a       */
+						  /**< striped transfer, set  */
+						  /**< by the library         */
+	XIO_MSG_FLAG_CLASS_MASK		  = 0x30, /**< transmit class bits    */
+	XIO_MSG_FLAG_FANOUT		  = 0x40, /**< copy of a fan out      */
+						  /**< message, set by the    */
+						  /**< library                */
+	XIO_MSG_FLAG_FORWARD		  = 0x80  /**< forward of a received  */
+						  /**< message, set by the    */
+						  /**< library                */
 };
 
+/* maximum number of stripes of xio_session_send_striped */
+#define XIO_MAX_STRIPES			64
+
+/* number of transmit classes per connection, class 0 is served first */
+#define XIO_MAX_MSG_CLASSES		4
+#define XIO_MSG_FLAG_CLASS(cls)		(((cls) << 4) & XIO_MSG_FLAG_CLASS_MASK)
+#define XIO_MSG_CLASS(flags)		(((flags) & XIO_MSG_FLAG_CLASS_MASK) >> 4)
+
 /**
  * @enum xio_receipt_result
  * @brief message receipt result as sent by the message recipient
@@ -256,13 +288,31 @@ enum xio_msg_type {
 	XIO_MSG_TYPE_ONE_WAY		= (XIO_ONE_WAY | XIO_REQUEST),
 };
 
+/**
+ * @enum xio_lb_policy
+ * @brief connection selection policy of xio_session_send_request
+ */
+enum xio_lb_policy {
+	XIO_LB_ROUND_ROBIN,		/**< next connection in turn	     */
+	XIO_LB_LEAST_OUTSTANDING,	/**< fewest queued and in flight     */
+					/**< requests			     */
+	XIO_LB_LATENCY_EWMA,		/**< lowest response time average    */
+					/**< weighted by outstanding requests*/
+	XIO_LB_HASH			/**< by key, same key same connection*/
+};
+
 /**
  * @enum xio_connection_attr_mask
  * @brief supported connection attributes to query/modify
  */
 enum xio_connection_attr_mask {
 	XIO_CONNECTION_ATTR_CTX                 = 1 << 0,
-	XIO_CONNECTION_ATTR_USER_CTX		= 1 << 1
+	XIO_CONNECTION_ATTR_USER_CTX		= 1 << 1,
+	XIO_CONNECTION_ATTR_WATERMARKS		= 1 << 2,
+	XIO_CONNECTION_ATTR_TX_QUEUE		= 1 << 3, /* query only */
+	XIO_CONNECTION_ATTR_QOS			= 1 << 4,
+	XIO_CONNECTION_ATTR_TX_SCHED		= 1 << 5,
+	XIO_CONNECTION_ATTR_TX_STATS		= 1 << 6  /* query only */
 };
 
 /**
@@ -270,7 +320,9 @@ enum xio_connection_attr_mask {
  * @brief supported context attributes to query/modify
  */
 enum xio_context_attr_mask {
-	XIO_CONTEXT_ATTR_USER_CTX		= 1 << 0
+	XIO_CONTEXT_ATTR_USER_CTX		= 1 << 0,
+	XIO_CONTEXT_ATTR_COMP_VECTOR		= 1 << 1,
+	XIO_CONTEXT_ATTR_PREWARM_MAX		= 1 << 2
 };
 
 /*---------------------------------------------------------------------------*/
@@ -282,6 +334,7 @@ struct xio_session;			     /* session handle		     */
 struct xio_connection;			     /* connection handle	     */
 struct xio_mr;				     /* registered memory handle     */
 struct xio_mempool;			     /* mempool object		     */
+struct xio_portals_balancer;		     /* server portals balancer      */
 
 /*---------------------------------------------------------------------------*/
 /* typedefs								     */
@@ -339,6 +392,33 @@ struct xio_connection_attr {
 						/**< pass to connection      */
 						/**< oriented callbacks      */
 	struct xio_context	*ctx;
+	uint32_t		tx_high_watermark; /**< queued requests that */
+						/**< make send return EAGAIN */
+						/**< 0 - unlimited	     */
+	uint32_t		tx_low_watermark; /**< queued requests below */
+						/**< which on_tx_ready fires */
+	uint32_t		tx_queued_msgs;	/**< requests waiting to be  */
+						/**< posted		     */
+	uint32_t		tx_in_flight_msgs; /**< requests posted and  */
+						/**< not yet completed	     */
+	uint32_t		tx_class_quantum[XIO_MAX_MSG_CLASSES];
+						/**< bytes a class may send  */
+						/**< per round, 0 - strict   */
+						/**< priority by class index */
+	uint32_t		tx_class_reserve[XIO_MAX_MSG_CLASSES];
+						/**< in flight requests kept */
+						/**< for the class only	     */
+	uint32_t		tx_quantum;	/**< bytes sent per turn of  */
+						/**< the context scheduler   */
+						/**< 0 - never yield, the    */
+						/**< default		     */
+	uint32_t		pad;
+	uint64_t		tx_service_bytes; /**< bytes transmitted     */
+	uint64_t		tx_service_msgs; /**< messages transmitted   */
+	uint64_t		tx_service_turns; /**< scheduler turns given */
+	uint64_t		tx_service_deferred; /**< times the quantum  */
+						/**< ran out with messages   */
+						/**< still queued	     */
 };
 
 /**
@@ -349,6 +429,15 @@ struct xio_context_attr {
 	void			*user_context;  /**< private user context to */
 						/**< pass to connection      */
 						/**< oriented callbacks      */
+	int			comp_vector;	/**< cq completion vector,   */
+						/**< -1 - the one whose irq  */
+						/**< is affine to the	     */
+						/**< context's cpu or node.  */
+						/**< query returns the one   */
+						/**< in use		     */
+	int			prewarm_max;	/**< bound of the context's  */
+						/**< prewarmed connections,  */
+						/**< see xio_connect_prewarm */
 };
 
 /**
@@ -392,6 +481,23 @@ struct xio_msg_pdata {
 	struct xio_msg		**prev;		/**< internal library usage   */
 };
 
+/**
+ * @struct xio_msg_timer
+ * @brief message deadline data used internally by the library
+ *
+ * @note embedding it, together with timeout_ms, in struct xio_msg changed
+ *	 the size and layout of struct xio_msg. applications built against
+ *	 older headers must be rebuilt
+ */
+struct xio_msg_timer {
+	struct xio_msg		*next;          /**< internal library usage   */
+	struct xio_msg		**prev;		/**< internal library usage   */
+	void			*parent;	/**< internal library usage   */
+	uint32_t		expires;	/**< internal library usage   */
+	uint16_t		armed;		/**< internal library usage   */
+	uint16_t		in_flight;	/**< internal library usage   */
+};
+
 
 /**
  * @struct xio_vmsg
@@ -429,14 +535,28 @@ struct xio_msg {
 	int			flags;		/**< message flags mask       */
 	enum xio_receipt_result	receipt_res;    /**< the receipt result if    */
 						/**< required                 */
-	int			reserved;	/**< reseved for padding      */
+	uint32_t		timeout_ms;	/**< request deadline in msec */
+						/**< from submission, 0 - none*/
 	uint64_t		timestamp;	/**< submission timestamp     */
 	void			*user_context;	/**< private user data        */
 						/**< not sent to the peer     */
 	struct xio_msg_pdata	pdata;		/**< accelio private data     */
+	struct xio_msg_timer	timer;		/**< accelio private data     */
 	struct xio_msg		*next;          /**< send list of messages    */
 };
 
+/**
+ * @struct xio_stripe_info
+ * @brief  position of a striped sub request in the whole transfer
+ */
+struct xio_stripe_info {
+	uint64_t		offset;		/**< stripe offset in bytes   */
+	uint64_t		stripe_len;	/**< stripe length in bytes   */
+	uint64_t		total_len;	/**< whole transfer length    */
+	uint32_t		index;		/**< stripe index	      */
+	uint32_t		count;		/**< number of stripes	      */
+};
+
 /**
  * @struct xio_session_event_data
  * @brief  session event callback parameters
@@ -665,6 +785,84 @@ struct xio_session_ops {
 				       struct xio_msg *msg,
 				       void *conn_user_context);
 
+	/**
+	 * incoming message data chunk arrived notification
+	 *
+	 *  @param[in] session			the session
+	 *  @param[in] msg			the incoming message
+	 *  @param[in] offset			offset of the chunk within the
+	 *					message's in data
+	 *  @param[in] len			length of the chunk in bytes
+	 *  @param[in] conn_user_context	user private data provided in
+	 *					connection open on which
+	 *					the message send
+	 *
+	 *  @returns 0
+	 *  @note  called in order, only for messages that are read in
+	 *	   chunks (see XIO_OPTNAME_RDMA_CHUNK_SIZE). only the msg's
+	 *	   in data vector and user_context are valid at this stage.
+	 *	   on_msg is called once the last chunk has landed
+	 */
+	int (*on_msg_data_chunk)(struct xio_session *session,
+				 struct xio_msg *msg,
+				 size_t offset, size_t len,
+				 void *conn_user_context);
+
+	/**
+	 * vectorized message arrived notification
+	 *
+	 *  @param[in] session			the session
+	 *  @param[in] msgs			array of incoming messages
+	 *  @param[in] nr			number of messages in msgs
+	 *  @param[in] conn_user_context	user private data provided in
+	 *					connection open on which
+	 *					the messages were received
+	 *
+	 *  @returns 0
+	 *  @note  when set, replaces on_msg. messages gathered from one
+	 *	   completion poll are handed over together, in order.
+	 *	   requests that asked for a read receipt are passed alone.
+	 */
+	int (*on_msgs)(struct xio_session *session,
+		       struct xio_msg **msgs, int nr,
+		       void *conn_user_context);
+
+	/**
+	 * vectorized send completion notification
+	 *
+	 *  @param[in] session			the session
+	 *  @param[in] msgs			array of sent messages
+	 *  @param[in] nr			number of messages in msgs
+	 *  @param[in] conn_user_context	user private data provided in
+	 *					connection open on which
+	 *					the messages were sent
+	 *
+	 *  @returns 0
+	 *  @note  when set, replaces on_msg_send_complete and
+	 *	   on_ow_msg_send_complete. use msg->type to tell responses
+	 *	   from one way messages
+	 */
+	int (*on_msgs_send_complete)(struct xio_session *session,
+				     struct xio_msg **msgs, int nr,
+				     void *conn_user_context);
+
+	/**
+	 * connection transmit queue drained notification
+	 *
+	 *  @param[in] session			the session
+	 *  @param[in] connection		the connection
+	 *  @param[in] conn_user_context	user private data provided in
+	 *					connection open
+	 *
+	 *  @returns 0
+	 *  @note  called once after xio_send_request or xio_send_msg
+	 *	   failed with EAGAIN on the high watermark, when the queued
+	 *	   requests drop to the low watermark
+	 *	   (see XIO_CONNECTION_ATTR_WATERMARKS)
+	 */
+	int (*on_tx_ready)(struct xio_session *session,
+			   struct xio_connection *connection,
+			   void *conn_user_context);
 };
 
 /**
@@ -987,7 +1185,34 @@ struct xio_session *xio_session_create(
 int xio_session_destroy(struct xio_session *session);
 
 /**
- * creates connection handle
+ * keep a session alive for a grace period after a connection drops
+ *
+ * when a connection of an online session is disconnected, its unanswered
+ * requests and unsent messages are kept instead of being flushed back
+ * with XIO_E_MSG_FLUSHED. they are sent again on another online
+ * connection of the session, one of the same context first, or on the
+ * next connection xio_connect opens. messages moved to a connection of
+ * another context complete on that context's thread. the dropped
+ * transport's task pool and registered buffers are kept for the next
+ * connection of its context. the session is not torn down when its last
+ * connection is destroyed, xio_connect may reattach to it until the
+ * grace period ends. the server admits a connection only with the token
+ * it handed out when accepting the session. the server side must enable
+ * resumption on its session too, typically in on_new_session
+ *
+ * @note	replayed requests may reach the peer twice, they should be
+ *		idempotent. the grace period counts from the first drop
+ *
+ * @param[in] session	The xio session handle
+ * @param[in] grace_ms	grace period in milliseconds, 0 to disable
+ *
+ * @returns success (0), or a (negative) error value
+ */
+int xio_session_set_resume(struct xio_session *session, uint32_t grace_ms);
+
+/**
+ * creates connection handle. a session may open several connections on
+ * one context, each gets a transport connection of its own
  *
  * @param[in] session	The xio session handle
  * @param[in] ctx	The xio context handle
@@ -1009,6 +1234,40 @@ struct xio_connection *xio_connect(
 		const char *out_addr,
 		void *conn_user_context);
 
+/**
+ * open a transport connection to a portal ahead of any session
+ *
+ * the connection, its task pools and its registered buffers are set up in
+ * the background and kept in the context's prewarm pool until released.
+ * a session of the context connecting to the same portal takes a pooled
+ * connection instead of connecting from scratch, and the pool opens a new
+ * one in its place. each call adds one connection, up to the context's
+ * prewarm_max (see xio_modify_context). calls for several portals connect
+ * concurrently
+ *
+ * @param[in] ctx	The xio context handle
+ * @param[in] uri	uri of the portal, e.g. "rdma://host:port"
+ * @param[in] out_addr	bounded outgoing interface address and/or port -
+ *			NULL if not specified
+ *
+ * @returns success (0), or a (negative) error value. XIO_E_NO_BUFS when
+ *	    the pool is full
+ */
+int xio_connect_prewarm(struct xio_context *ctx, const char *uri,
+			const char *out_addr);
+
+/**
+ * close the prewarmed connections of a context
+ *
+ * connections already taken by sessions are not affected
+ *
+ * @param[in] ctx	The xio context handle
+ * @param[in] uri	uri of the portal, NULL for all portals
+ *
+ * @returns success (0), or a (negative) error value
+ */
+int xio_connect_prewarm_release(struct xio_context *ctx, const char *uri);
+
 /**
  * teardown an opened connection
  *
@@ -1058,10 +1317,130 @@ int xio_query_connection(struct xio_connection *conn,
  * @param[in] req	request message to send
  *
  * @return success (0), or a (negative) error value
+ * @note fails with EAGAIN while the connection's queued requests are at
+ *	 the high watermark. on_tx_ready is called once they drain
+ * @note if req->timeout_ms is set and no response arrived in time, a
+ *	 queued request is dequeued and on_msg_error is called with
+ *	 XIO_E_TIMEOUT. a request already sent is canceled at the peer, and
+ *	 on_msg_error(XIO_E_TIMEOUT) follows once the peer can no longer
+ *	 touch its buffers: on the cancel answer, on the late response, whose
+ *	 data is dropped, or when the connection is flushed
+ * @note req->flags may carry XIO_MSG_FLAG_CLASS(cls) to queue the request
+ *	 on one of the connection's transmit classes
+ *	 (see XIO_CONNECTION_ATTR_QOS). order is kept within a class only
  */
 int xio_send_request(struct xio_connection *conn,
 		     struct xio_msg *req);
 
+/**
+ * send an array of requests to responder, posting them to the transport
+ * with a single doorbell
+ *
+ * the call may accept only a prefix of the array when the connection's
+ * in-flight budget, a class reservation or the task pool are exhausted, or
+ * when the connection is over its transmit high watermark. messages that
+ * were not accepted are left untouched and may be resubmitted later.
+ *
+ * @param[in] conn	The xio connection handle
+ * @param[in] reqs	array of request messages to send
+ * @param[in] nr	number of entries in reqs
+ *
+ * @return number of requests accepted (may be 0), or -1 on error. fails
+ *	   with EINVAL, before any request is queued, when an entry is NULL
+ *	   or invalid. the index is logged
+ */
+int xio_send_request_batch(struct xio_connection *conn,
+			   struct xio_msg **reqs, int nr);
+
+/**
+ * set the policy xio_session_send_request uses to pick a connection
+ *
+ * @param[in] session	The xio session handle
+ * @param[in] policy	one of enum xio_lb_policy
+ *
+ * @return success (0), or a (negative) error value
+ */
+int xio_session_set_lb_policy(struct xio_session *session,
+			      enum xio_lb_policy policy);
+
+/**
+ * send request on one of the session's connections, picked by the
+ * session's load balancing policy
+ *
+ * @param[in] session	The xio session handle
+ * @param[in] ctx	context of the calling thread. only online
+ *			connections opened on this context are considered
+ * @param[in] req	request message to send
+ * @param[in] key	affinity key, used by XIO_LB_HASH only
+ *
+ * @return the connection the request was queued on, or NULL on error.
+ *	   fails with EAGAIN when no connection is online on ctx
+ */
+struct xio_connection *xio_session_send_request(struct xio_session *session,
+						struct xio_context *ctx,
+						struct xio_msg *req,
+						uint64_t key);
+
+/**
+ * enable request hedging on the session. a request sent by
+ * xio_session_send_request with XIO_MSG_FLAG_HEDGE that was not answered
+ * within the given percentile of the session's observed response times is
+ * duplicated on a second connection of the same context. the first
+ * response is delivered on the original request and the other copy is
+ * cancelled.
+ *
+ * @param[in] session	The xio session handle
+ * @param[in] permille	response time percentile in 1/1000 units, e.g. 990
+ *			for p99. 0 disables hedging
+ *
+ * @return success (0), or a (negative) error value
+ *
+ * @note hedged requests must be idempotent. the duplicate receives its
+ *	 response in library buffers which are copied to req->in when it
+ *	 wins. read receipts and timeout_ms are not supported on hedged
+ *	 requests and xio_cancel_request must not be called on them
+ */
+int xio_session_set_hedge(struct xio_session *session, uint32_t permille);
+
+/**
+ * send a large request as stripes spread over the session's connections.
+ * either the in or the out data of req is cut into contiguous stripes of
+ * stripe_size bytes (at most XIO_MAX_STRIPES), each sent as a sub request
+ * carrying req's header and XIO_MSG_FLAG_STRIPE. response data is written
+ * in place into req's in data buffers, and req is completed through
+ * on_msg once the last stripe answered, or through on_msg_error once
+ * all stripes are done if any of them failed
+ *
+ * @param[in] session	  The xio session handle
+ * @param[in] ctx	  context of the calling thread, which needs an
+ *			  online connection of the session. stripes also go
+ *			  to the session's connections on other contexts,
+ *			  posted by the threads running them, while req is
+ *			  completed on this context
+ * @param[in] req	  request message. exactly one of its in and out
+ *			  data must be non empty, and in data must use
+ *			  application buffers
+ * @param[in] stripe_size stripe length in bytes
+ *
+ * @return success (0), or a (negative) error value
+ */
+int xio_session_send_striped(struct xio_session *session,
+			     struct xio_context *ctx,
+			     struct xio_msg *req,
+			     size_t stripe_size);
+
+/**
+ * responder side: get the position of a XIO_MSG_FLAG_STRIPE request in its
+ * transfer. the stripe descriptor is removed from req->in.header, the
+ * response should carry stripe_len bytes from offset (for reads)
+ *
+ * @param[in] req	received request
+ * @param[out] info	stripe position
+ *
+ * @return success (0), or a (negative) error value
+ */
+int xio_msg_stripe_info(struct xio_msg *req, struct xio_stripe_info *info);
+
 /**
  * cancel an outstanding asynchronous I/O request
  *
@@ -1095,6 +1474,22 @@ int xio_cancel(struct xio_msg *req, enum xio_status result);
  */
 int xio_release_response(struct xio_msg *rsp);
 
+/**
+ * release an array of responses back to xio
+ *
+ * all responses are validated before any of them is released. the
+ * connection transmit queue is kicked once per run of adjacent responses
+ * of the same connection instead of once per response, so responses
+ * grouped by connection cost one kick per connection. a NULL entry fails
+ * the call with EINVAL before anything is released
+ *
+ * @param[in] rsps	array of responses to release
+ * @param[in] nr	number of responses in rsps
+ *
+ * @returns success (0), or a (negative) error value
+ */
+int xio_release_response_batch(struct xio_msg **rsps, int nr);
+
 /**
  * send one way message to remote peer
  *
@@ -1106,6 +1501,56 @@ int xio_release_response(struct xio_msg *rsp);
 int xio_send_msg(struct xio_connection *conn,
 		 struct xio_msg *msg);
 
+/**
+ * send one one way message to several connections of the same context
+ *
+ * every target gets a library owned copy of msg that points at msg's out
+ * buffers, so the payload is posted nr times but never copied when its
+ * data is registered (mr). msg must stay untouched until it completes
+ *
+ * msg completes once, after the last target: through the send complete
+ * callback of the connection that finished last, or through on_msg_error
+ * with the first failure when any target failed
+ *
+ * @note	read receipts are not supported and are ignored
+ *
+ * @param[in] conns	array of connections, all opened on the same context
+ * @param[in] nr	number of connections in conns
+ * @param[in] msg	The message to send
+ * @param[out] status	optional array of nr entries. each entry is set to
+ *			XIO_E_IN_PORGRESS when posted and to the result of its
+ *			target when that target completes
+ *
+ * @returns success (0) if at least one target was posted, or a (negative)
+ *	    error value
+ */
+int xio_send_msg_fanout(struct xio_connection **conns, int nr,
+			struct xio_msg *msg, int *status);
+
+/**
+ * forward a received message to a connection of the same context
+ *
+ * fwd is sent with imsg's header and data as its out side, straight from
+ * the buffers of imsg's receive task. requests are forwarded as requests
+ * (the answer lands in fwd->in) and one way messages as one way messages.
+ * the receive task is held until fwd completes, so imsg may be released
+ * (xio_release_msg) right away. a forwarded request must not be answered
+ * before fwd completes, since the answer reuses the receive buffer
+ *
+ * @note	hedging, striping, fan out and read receipts are cleared on
+ *		fwd. the connection imsg arrived on must stay open until fwd
+ *		completes
+ *
+ * @param[in] conn	The xio connection handle to forward on
+ * @param[in] imsg	request or one way message received on any
+ *			connection of conn's context
+ * @param[in] fwd	application owned message to send
+ *
+ * @returns success (0), or a (negative) error value
+ */
+int xio_forward_msg(struct xio_connection *conn,
+		    struct xio_msg *imsg, struct xio_msg *fwd);
+
 /**
  * release one way message resources back to xio when message is no longer
  * needed
@@ -1173,7 +1618,8 @@ struct xio_server *xio_bind(struct xio_context *ctx,
 int xio_unbind(struct xio_server *server);
 
 /**
- * return connection handle on server
+ * return connection handle on server. a session may hold several
+ * connections on a context, the first one is returned
  *
  * @param[in]	session		The xio session handle
  * @param[in]	ctx		The xio context handle
@@ -1244,6 +1690,71 @@ int xio_reject(struct xio_session *session,
 				void *user_context,
 				size_t user_context_len);
 
+/**
+ * create a load aware portals balancer
+ *
+ * the balancer ranks the server's portals by the load of the context
+ * serving each: busy time of its event loop, open connections and
+ * requests received and not yet answered. it is not thread safe, use it
+ * from the thread that handles on_new_session
+ *
+ * @returns balancer handle, or NULL upon error
+ */
+struct xio_portals_balancer *xio_portals_balancer_create(void);
+
+/**
+ * destroy a portals balancer
+ *
+ * @param[in] balancer	The balancer handle
+ */
+void xio_portals_balancer_destroy(struct xio_portals_balancer *balancer);
+
+/**
+ * add a portal to the balancer
+ *
+ * @param[in] balancer	The balancer handle
+ * @param[in] ctx	context of the thread serving the portal
+ * @param[in] portal	the portal uri as passed to xio_bind
+ *
+ * @returns success (0), or a (negative) error value
+ */
+int xio_portals_balancer_add(struct xio_portals_balancer *balancer,
+			     struct xio_context *ctx,
+			     const char *portal);
+
+/**
+ * get the portals ordered from the least loaded
+ *
+ * the first portal is counted as taken by a new connection until its
+ * context reports it, so a burst of sessions is spread as well
+ *
+ * @param[in] balancer		The balancer handle
+ * @param[out] portals_array	filled with up to portals_array_len portals
+ * @param[in] portals_array_len	size of portals_array
+ *
+ * @returns number of portals filled, or -1 upon error
+ * @note pass the result to xio_accept, or to xio_redirect to move the
+ *	 session off the accepting portal
+ */
+int xio_portals_balancer_select(struct xio_portals_balancer *balancer,
+				const char **portals_array,
+				size_t portals_array_len);
+
+/**
+ * accept new session with its portals ordered from the least loaded
+ *
+ * @param[in] balancer		The balancer handle
+ * @param[in] session		The xio session handle
+ * @param[in] user_context	as in xio_accept
+ * @param[in] user_context_len	as in xio_accept
+ *
+ * @returns success (0), or a (negative) error value
+ */
+int xio_portals_balancer_accept(struct xio_portals_balancer *balancer,
+				struct xio_session *session,
+				void *user_context,
+				size_t user_context_len);
+
 /**
  * send response back to requester
  *
@@ -166,6 +166,15 @@ struct __attribute__((__packed__)) xio_session_cancel_hdr {
 	uint64_t		sn;
 };
 
+/* trails the header of a striped sub request */
+struct __attribute__((__packed__)) xio_stripe_hdr {
+	uint64_t		offset;
+	uint64_t		stripe_len;
+	uint64_t		total_len;
+	uint32_t		index;
+	uint32_t		count;
+};
+
 struct xio_msg;
 struct xio_iovec;
 struct xio_iovec_ex;
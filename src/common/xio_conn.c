@@ -69,6 +69,9 @@ static int xio_on_transport_event(void *observer, void *sender, int event,
 static void xio_on_conn_closed(struct xio_conn *conn,
 			       union xio_transport_event_data *event_data);
 static int xio_conn_flush_tx_queue(struct xio_conn *conn);
+static int xio_conn_primary_pool_free(struct xio_conn *conn);
+static void xio_conn_prewarm_unlink(struct xio_context *ctx,
+				    struct xio_conn *conn);
 
 
 /*---------------------------------------------------------------------------*/
@@ -150,8 +153,14 @@ struct xio_observer *xio_conn_observer_lookup(struct xio_conn *conn,
 	list_for_each_entry(node,
 			    &conn->observers_htbl,
 			    observers_htbl_node) {
-		if (node->id == id)
+		if (node->id == id) {
+			/* sessions sharing the conn may mostly be idle,
+			 * keep the busy ones in front
+			 */
+			list_move(&node->observers_htbl_node,
+				  &conn->observers_htbl);
 			return node->observer;
+		}
 	}
 
 	return NULL;
@@ -212,8 +221,136 @@ static inline void xio_conn_put_task(struct kref *kref)
 
 	xio_pre_put_task(task);
 
-	pool->nr++;
-	list_move(&task->tasks_list_entry, &pool->stack);
+	xio_tasks_pool_push(pool, task);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_pool_slab_items_uninit						     */
+/*---------------------------------------------------------------------------*/
+static void xio_pool_slab_items_uninit(struct xio_tasks_pool *tasks_pool,
+				       struct xio_tasks_slab *slab,
+				       struct xio_tasks_pool_ops *pool_ops)
+{
+	int i;
+
+	if (!pool_ops->pool_uninit_item)
+		return;
+
+	for (i = slab->start_idx; i < slab->start_idx + slab->nr; i++)
+		pool_ops->pool_uninit_item(slab->dd_data,
+					   tasks_pool->array[i]);
+}
+
+/*---------------------------------------------------------------------------*/
+/* 	xio_pool_items_uninit						     */
+/*---------------------------------------------------------------------------*/
+static void xio_pool_items_uninit(struct xio_tasks_pool *tasks_pool,
+				  struct xio_tasks_pool_ops *pool_ops)
+{
+	struct xio_tasks_slab *slab;
+
+	list_for_each_entry(slab, &tasks_pool->slabs_list, slabs_list_entry)
+		xio_pool_slab_items_uninit(tasks_pool, slab, pool_ops);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_pool_slabs_free							     */
+/*---------------------------------------------------------------------------*/
+static int xio_pool_slabs_free(struct xio_conn *conn,
+			       struct xio_tasks_pool *tasks_pool,
+			       struct xio_tasks_pool_ops *pool_ops)
+{
+	struct xio_tasks_slab *slab;
+	int retval = 0;
+
+	if (!pool_ops->pool_free)
+		return 0;
+
+	list_for_each_entry(slab, &tasks_pool->slabs_list, slabs_list_entry) {
+		if (pool_ops->pool_free(conn->transport_hndl,
+					slab->dd_data) != 0)
+			retval = -1;
+	}
+	return retval;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_conn_primary_pool_grow						     */
+/*---------------------------------------------------------------------------*/
+static int xio_conn_primary_pool_grow(struct xio_conn *conn)
+{
+	struct xio_tasks_pool	*q = conn->primary_tasks_pool;
+	struct xio_tasks_slab	*slab;
+	struct xio_task		*task;
+	int			i, retval;
+
+	slab = xio_tasks_pool_alloc_slab(q, conn->primary_slab_len);
+	if (slab == NULL) {
+		if (q->alloc_nr < q->max)
+			ERROR_LOG("xio_tasks_pool_alloc_slab failed\n");
+		return -1;
+	}
+
+	/* allocate the slab's transport resources */
+	retval = conn->primary_pool_ops->pool_alloc(conn->transport_hndl,
+						    slab->nr, slab->dd_data);
+	if (retval != 0) {
+		ERROR_LOG("primary_pool_alloc failed\n");
+		goto cleanup;
+	}
+
+	for (i = slab->start_idx; i < slab->start_idx + slab->nr; i++) {
+		task = q->array[i];
+		/* initialize each pool's item */
+		retval = conn->primary_pool_ops->pool_init_item(
+				conn->transport_hndl,
+				slab->dd_data,
+				task);
+		if (retval != 0) {
+			ERROR_LOG("primary_pool_init_item failed\n");
+			goto cleanup1;
+		}
+		task->release = xio_conn_put_task;
+		task->conn = conn;
+	}
+	xio_tasks_pool_add_slab(q, slab);
+
+	TRACE_LOG("conn %p: primary pool grew to %d/%d tasks\n",
+		  conn, q->alloc_nr, q->max);
+
+	return 0;
+
+cleanup1:
+	xio_pool_slab_items_uninit(q, slab, conn->primary_pool_ops);
+	conn->primary_pool_ops->pool_free(conn->transport_hndl,
+					  slab->dd_data);
+cleanup:
+	xio_tasks_pool_free_slab(q, slab);
+	return -1;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_conn_primary_pool_shrink						     */
+/*---------------------------------------------------------------------------*/
+static int xio_conn_primary_pool_shrink(void *pool_provider)
+{
+	struct xio_conn		*conn = pool_provider;
+	struct xio_tasks_pool	*q = conn->primary_tasks_pool;
+	struct xio_tasks_slab	*slab;
+
+	slab = xio_tasks_pool_idle_slab(q);
+	if (slab == NULL)
+		return -1;
+
+	xio_pool_slab_items_uninit(q, slab, conn->primary_pool_ops);
+	conn->primary_pool_ops->pool_free(conn->transport_hndl,
+					  slab->dd_data);
+	xio_tasks_pool_free_slab(q, slab);
+
+	TRACE_LOG("conn %p: primary pool shrank to %d/%d tasks\n",
+		  conn, q->alloc_nr, q->max);
+
+	return 0;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -239,8 +376,11 @@ inline struct xio_task *xio_conn_get_primary_task(struct xio_conn *conn)
 {
 	struct xio_task *task =  xio_tasks_pool_get(conn->primary_tasks_pool);
 
-	if (task == NULL)
-		return NULL;
+	if (unlikely(task == NULL)) {
+		if (xio_conn_primary_pool_grow(conn) != 0)
+			return NULL;
+		task = xio_tasks_pool_get(conn->primary_tasks_pool);
+	}
 
 	if (conn->primary_pool_ops->post_get)
 		conn->primary_pool_ops->post_get(conn->transport_hndl,
@@ -248,6 +388,30 @@ inline struct xio_task *xio_conn_get_primary_task(struct xio_conn *conn)
 	return task;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_conn_get_primary_tasks						     */
+/*---------------------------------------------------------------------------*/
+int xio_conn_get_primary_tasks(struct xio_conn *conn,
+			       struct list_head *list, int nr)
+{
+	struct xio_task *task;
+	int		n;
+
+	/* list is expected to be empty */
+	n = xio_tasks_pool_get_bulk(conn->primary_tasks_pool, list, nr);
+	while (unlikely(n < nr) && xio_conn_primary_pool_grow(conn) == 0)
+		n += xio_tasks_pool_get_bulk(conn->primary_tasks_pool, list,
+					     nr - n);
+
+	if (n && conn->primary_pool_ops->post_get) {
+		list_for_each_entry(task, list, tasks_list_entry)
+			conn->primary_pool_ops->post_get(conn->transport_hndl,
+							 task);
+	}
+
+	return n;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_conn_primary_task_alloc						     */
 /*---------------------------------------------------------------------------*/
@@ -662,26 +826,6 @@ static int xio_conn_on_send_msg_comp(struct xio_conn *conn,
 	return 0;
 }
 
-/*---------------------------------------------------------------------------*/
-/* 	xio_pool_items_uninit						     */
-/*---------------------------------------------------------------------------*/
-static void xio_pool_items_uninit(struct xio_tasks_pool *tasks_pool,
-				  struct xio_tasks_pool_ops *pool_ops)
-{
-	int i;
-
-	if (!pool_ops->pool_uninit_item)
-		return;
-
-	for (i = 0; i < tasks_pool->max; i++) {
-		if (tasks_pool->array[i]) {
-			pool_ops->pool_uninit_item(tasks_pool->dd_data,
-						   tasks_pool->array[i]);
-			tasks_pool->array[i] = NULL;
-		}
-	}
-}
-
 /*---------------------------------------------------------------------------*/
 /* xio_conn_initial_pool_setup						     */
 /*---------------------------------------------------------------------------*/
@@ -747,6 +891,7 @@ static int xio_conn_initial_pool_setup(struct xio_conn *conn)
 	pool_cls.task_alloc  = xio_conn_get_initial_task;
 	pool_cls.task_lookup = NULL;
 	pool_cls.task_free   = xio_tasks_pool_put;
+	pool_cls.pool_shrink = NULL;
 
 	if (conn->transport->set_pools_cls)
 		conn->transport->set_pools_cls(conn->transport_hndl,
@@ -796,12 +941,138 @@ static int xio_conn_initial_pool_free(struct xio_conn *conn)
 	return retval;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_conn_kept_free							     */
+/*---------------------------------------------------------------------------*/
+static void xio_conn_kept_free(struct xio_conn *conn, int unreg)
+{
+	TRACE_LOG("conn:%p - kept primary pool freed\n", conn);
+
+	xio_conn_primary_pool_free(conn);
+
+	if (unreg)
+		xio_context_unreg_observer(conn->kept_ctx,
+					   &conn->ctx_observer);
+	kfree(conn);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_conn_kept_expired						     */
+/*---------------------------------------------------------------------------*/
+static void xio_conn_kept_expired(void *data)
+{
+	struct xio_conn *conn = data;
+
+	/* no successor came for the pool */
+	xio_conns_store_unkeep(conn);
+	xio_conn_kept_free(conn, 1);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_conn_keep_primary_pool						     */
+/*---------------------------------------------------------------------------*/
+static int xio_conn_keep_primary_pool(struct xio_conn *conn)
+{
+	struct xio_tasks_pool	*q = conn->primary_tasks_pool;
+	int			retval;
+
+	if (q == NULL || conn->transport_hndl == NULL ||
+	    conn->primary_pool_ops->pool_reuse == NULL)
+		return -1;
+
+	/* a task still held may be put later, free the pool as usual */
+	if (q->nr != q->alloc_nr)
+		return -1;
+
+	conn->kept_ctx = conn->transport_hndl->ctx;
+	retval = xio_ctx_add_delayed_work(conn->kept_ctx,
+					  conn->keep_pool_ms, conn,
+					  xio_conn_kept_expired,
+					  &conn->close_time_hndl);
+	if (retval != 0) {
+		ERROR_LOG("xio_ctx_add_delayed_work failed.\n");
+		conn->kept_ctx = NULL;
+		return -1;
+	}
+
+	xio_conns_store_remove(conn->cid);
+	xio_conns_store_keep(conn);
+
+	/* the transport handle goes away with its qp */
+	conn->transport_hndl = NULL;
+
+	TRACE_LOG("conn:%p - primary pool kept for %u msec\n",
+		  conn, conn->keep_pool_ms);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_conn_adopt_primary_pool						     */
+/*---------------------------------------------------------------------------*/
+static struct xio_tasks_pool *xio_conn_adopt_primary_pool(
+		struct xio_conn *conn, int max)
+{
+	struct xio_conn		*kept;
+	struct xio_tasks_pool	*q;
+	struct xio_tasks_slab	*slab;
+	struct xio_task		*task;
+	int			i, retval;
+
+	if (conn->primary_pool_ops->pool_reuse == NULL)
+		return NULL;
+
+	kept = xio_conns_store_take_kept(conn->transport_hndl->ctx,
+					 conn->primary_pool_ops, max);
+	if (kept == NULL)
+		return NULL;
+
+	if (xio_is_delayed_work_pending(&kept->close_time_hndl))
+		xio_ctx_del_delayed_work(kept->kept_ctx,
+					 &kept->close_time_hndl);
+	q = kept->primary_tasks_pool;
+
+	/* the buffers must be registered for the new handle's device */
+	list_for_each_entry(slab, &q->slabs_list, slabs_list_entry) {
+		retval = conn->primary_pool_ops->pool_reuse(
+				conn->transport_hndl, slab->dd_data);
+		if (retval != 0)
+			goto cleanup;
+	}
+	list_for_each_entry(slab, &q->slabs_list, slabs_list_entry) {
+		for (i = slab->start_idx; i < slab->start_idx + slab->nr;
+		     i++) {
+			task = q->array[i];
+			retval = conn->primary_pool_ops->pool_init_item(
+					conn->transport_hndl,
+					slab->dd_data,
+					task);
+			if (retval != 0) {
+				ERROR_LOG("primary_pool_init_item failed\n");
+				goto cleanup;
+			}
+			task->conn = conn;
+		}
+	}
+	kept->primary_tasks_pool = NULL;
+	xio_conn_kept_free(kept, 1);
+
+	TRACE_LOG("conn %p: adopted primary pool of %d/%d tasks\n",
+		  conn, q->alloc_nr, q->max);
+
+	return q;
+
+cleanup:
+	xio_conn_kept_free(kept, 1);
+	return NULL;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_conn_primary_pool_setup					     */
 /*---------------------------------------------------------------------------*/
 static int xio_conn_primary_pool_setup(struct xio_conn *conn)
 {
-	int i, retval;
+	int retval;
 	int num_tasks;
 	int task_dd_sz;
 	int pool_dd_sz;
@@ -823,43 +1094,42 @@ static int xio_conn_primary_pool_setup(struct xio_conn *conn)
 						 &pool_dd_sz,
 						 &task_dd_sz);
 
+	/* the transport may let the pool grow with the traffic */
+	conn->primary_slab_len = num_tasks;
+	if (conn->primary_pool_ops->pool_get_slab_params)
+		conn->primary_pool_ops->pool_get_slab_params(
+				conn->transport_hndl,
+				&conn->primary_slab_len);
+
+	/* a dropped conn of the context may have left its pool */
+	conn->primary_tasks_pool = xio_conn_adopt_primary_pool(conn,
+							       num_tasks);
+	if (conn->primary_tasks_pool)
+		goto pool_ready;
+
 	/* initialize the tasks pool */
-	conn->primary_tasks_pool = xio_tasks_pool_init(
+	conn->primary_tasks_pool = xio_tasks_pool_create(
 			num_tasks, pool_dd_sz, task_dd_sz,
 			conn->primary_pool_ops);
 	if (conn->primary_tasks_pool == NULL) {
-		ERROR_LOG("xio_ tasks_pool_init failed\n");
+		ERROR_LOG("xio_ tasks_pool_create failed\n");
 		goto cleanup0;
 	}
 
-	/* allocate the pool */
-	retval = conn->primary_pool_ops->pool_alloc(
-				conn->transport_hndl,
-				conn->primary_tasks_pool->max,
-				conn->primary_tasks_pool->dd_data);
-
+	/* allocate the first slab */
+	retval = xio_conn_primary_pool_grow(conn);
 	if (retval != 0) {
-		ERROR_LOG("primary_pool_alloc failed\n");
+		ERROR_LOG("primary_pool_grow failed\n");
 		goto cleanup1;
 	}
 
-	for (i = 0; i < conn->primary_tasks_pool->max; i++) {
-		/* initialize each pool's item */
-		retval = conn->primary_pool_ops->pool_init_item(
-				conn->transport_hndl,
-				conn->primary_tasks_pool->dd_data,
-				conn->primary_tasks_pool->array[i]);
-		if (retval != 0) {
-			ERROR_LOG("primary_pool_init_item failed\n");
-			goto cleanup;
-		}
-		conn->primary_tasks_pool->array[i]->release = xio_conn_put_task;
-		conn->primary_tasks_pool->array[i]->conn = conn;
-	}
+pool_ready:
+
 	pool_cls.pool	     = conn;
 	pool_cls.task_alloc  = xio_conn_primary_task_alloc;
 	pool_cls.task_lookup = xio_conn_task_lookup;
 	pool_cls.task_free   = xio_tasks_pool_put;
+	pool_cls.pool_shrink = xio_conn_primary_pool_shrink;
 
 	if (conn->transport->set_pools_cls)
 		conn->transport->set_pools_cls(conn->transport_hndl,
@@ -876,12 +1146,11 @@ static int xio_conn_primary_pool_setup(struct xio_conn *conn)
 
 cleanup:
 	xio_pool_items_uninit(conn->primary_tasks_pool, conn->primary_pool_ops);
-	/* pool_free was checked above and it is not NULL */
-	conn->primary_pool_ops->pool_free(conn->transport_hndl,
-					  conn->primary_tasks_pool->dd_data);
-
+	xio_pool_slabs_free(conn, conn->primary_tasks_pool,
+			    conn->primary_pool_ops);
 cleanup1:
 	xio_tasks_pool_free(conn->primary_tasks_pool);
+	conn->primary_tasks_pool = NULL;
 
 cleanup0:
 	return -1;
@@ -899,13 +1168,14 @@ static int xio_conn_primary_pool_free(struct xio_conn *conn)
 
 	xio_pool_items_uninit(conn->primary_tasks_pool, conn->primary_pool_ops);
 
-	if (conn->primary_pool_ops->pool_free) {
-		retval = conn->primary_pool_ops->pool_free(conn->transport_hndl,
-					   conn->primary_tasks_pool->dd_data);
-		if (retval != 0)
-			ERROR_LOG("releasing initial pool failed\n");
-	}
+	/* every slab holds its own transport resources */
+	retval = xio_pool_slabs_free(conn, conn->primary_tasks_pool,
+				     conn->primary_pool_ops);
+	if (retval != 0)
+		ERROR_LOG("releasing primary pool failed\n");
+
 	xio_tasks_pool_free(conn->primary_tasks_pool);
+	conn->primary_tasks_pool = NULL;
 
 	return retval;
 }
@@ -959,6 +1229,19 @@ static void xio_on_context_close(struct xio_conn *conn,
 {
 	TRACE_LOG("xio_on_context_close. conn:%p, ctx:%p\n", conn, ctx);
 
+	/* a kept pool has no transport left to shut down */
+	if (conn->kept_ctx) {
+		if (xio_is_delayed_work_pending(&conn->close_time_hndl))
+			xio_ctx_del_delayed_work(ctx, &conn->close_time_hndl);
+		xio_conns_store_unkeep(conn);
+		xio_conn_kept_free(conn, 0);
+		return;
+	}
+
+	/* the prewarm pool goes with its context */
+	if (conn->is_prewarmed)
+		xio_conn_prewarm_unlink(ctx, conn);
+
 	/* remove the conn from table */
 	xio_conns_store_remove(conn->cid);
 
@@ -1143,6 +1426,10 @@ static void xio_on_conn_closed(struct xio_conn *conn,
 
 	xio_conn_initial_pool_free(conn);
 
+	/* a resumable session's next conn on the context takes it over */
+	if (conn->keep_pool_ms && xio_conn_keep_primary_pool(conn) == 0)
+		return;
+
 	xio_conn_primary_free_tasks(conn);
 	xio_conn_primary_pool_free(conn);
 
@@ -1152,6 +1439,7 @@ static void xio_on_conn_closed(struct xio_conn *conn,
 		xio_context_unreg_observer(conn->transport_hndl->ctx,
 					   &conn->ctx_observer);
 
+	kfree(conn->prewarm_out_if);
 	kfree(conn);
 }
 
@@ -1296,6 +1584,30 @@ static int xio_on_assign_in_buf(struct xio_conn *conn,
 	return retval;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_on_data_chunk							     */
+/*---------------------------------------------------------------------------*/
+static int xio_on_data_chunk(struct xio_conn *conn,
+			     union xio_transport_event_data
+			     *event_data)
+{
+	union xio_conn_event_data conn_event_data = {
+		.chunk.task	= event_data->chunk.task,
+		.chunk.offset	= event_data->chunk.offset,
+		.chunk.len	= event_data->chunk.len,
+	};
+
+	event_data->chunk.task->conn = conn;
+
+	/* route the chunk to any of the sessions */
+	xio_observable_notify_any_observer(
+			&conn->observable,
+			XIO_CONN_EVENT_DATA_CHUNK,
+			&conn_event_data);
+
+	return 0;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_on_cancel_request						     */
 /*---------------------------------------------------------------------------*/
@@ -1374,6 +1686,13 @@ static int xio_on_transport_event(void *observer, void *sender, int event,
 */
 		xio_on_assign_in_buf(conn, ev_data);
 		break;
+	case XIO_TRANSPORT_DATA_CHUNK:
+/*
+		TRACE_LOG("conn: [notification] - data chunk. " \
+			 "conn:%p, transport:%p\n", observer, sender);
+*/
+		xio_on_data_chunk(conn, ev_data);
+		break;
 	case XIO_TRANSPORT_MESSAGE_ERROR:
 		DEBUG_LOG("conn: [notification] - message error. " \
 			 "conn:%p, transport:%p\n", observer, sender);
@@ -1429,9 +1748,9 @@ static int xio_on_transport_event(void *observer, void *sender, int event,
 }
 
 /*---------------------------------------------------------------------------*/
-/* xio_conn_open		                                             */
+/* xio_conn_open_new							     */
 /*---------------------------------------------------------------------------*/
-struct xio_conn *xio_conn_open(
+static struct xio_conn *xio_conn_open_new(
 		struct xio_context *ctx,
 		const char *portal_uri,
 		struct xio_observer  *observer,
@@ -1441,29 +1760,6 @@ struct xio_conn *xio_conn_open(
 	struct xio_conn			*conn;
 	char				proto[8];
 
-
-	/* look for opened connection */
-	conn = xio_conns_store_find(ctx, portal_uri);
-	if (conn != NULL) {
-		if (observer) {
-			xio_observable_reg_observer(&conn->observable,
-						    observer);
-			xio_conn_hash_observer(conn, observer, oid);
-		}
-		if (xio_is_delayed_work_pending(&conn->close_time_hndl)) {
-			xio_ctx_del_delayed_work(ctx,
-						 &conn->close_time_hndl);
-			kref_init(&conn->kref);
-		} else {
-			xio_conn_addref(conn);
-		}
-
-		TRACE_LOG("conn: [addref] conn:%p, refcnt:%d\n", conn,
-			  atomic_read(&conn->kref.refcount));
-
-		return conn;
-	}
-
 	/* extract portal from uri */
 	if (xio_uri_get_proto(portal_uri, proto, sizeof(proto)) != 0) {
 		xio_set_error(XIO_E_ADDR_ERROR);
@@ -1540,6 +1836,219 @@ cleanup:
 	return NULL;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_conn_prewarm_put							     */
+/*---------------------------------------------------------------------------*/
+static void xio_conn_prewarm_put(struct kref *kref)
+{
+	struct xio_conn *conn = container_of(kref,
+					     struct xio_conn,
+					     kref);
+
+	/* nobody comes back for a pooled conn, close without lingering */
+	xio_conn_release(conn);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_conn_prewarm_unlink						     */
+/*---------------------------------------------------------------------------*/
+static void xio_conn_prewarm_unlink(struct xio_context *ctx,
+				    struct xio_conn *conn)
+{
+	list_del_init(&conn->prewarm_list_entry);
+	ctx->prewarm_nr--;
+	conn->is_prewarmed = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_conn_prewarm_drop						     */
+/*---------------------------------------------------------------------------*/
+static void xio_conn_prewarm_drop(struct xio_context *ctx,
+				  struct xio_conn *conn)
+{
+	TRACE_LOG("conn: [prewarm drop] conn:%p\n", conn);
+
+	xio_conn_prewarm_unlink(ctx, conn);
+
+	/* one in the middle of its handshake lingers like any conn nobody
+	 * uses, closing it there races the peer's setup response
+	 */
+	if (conn->state == XIO_CONN_STATE_CONNECTING)
+		xio_conn_close(conn, NULL);
+	else
+		kref_put(&conn->kref, xio_conn_prewarm_put);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_conn_prewarm_trim						     */
+/*---------------------------------------------------------------------------*/
+static void xio_conn_prewarm_trim(struct xio_context *ctx)
+{
+	struct xio_conn *conn;
+
+	/* a lowered bound closes the oldest first */
+	while (ctx->prewarm_nr > ctx->prewarm_max) {
+		conn = list_first_entry(&ctx->prewarm_list,
+					struct xio_conn,
+					prewarm_list_entry);
+		xio_conn_prewarm_drop(ctx, conn);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_conn_prewarm							     */
+/*---------------------------------------------------------------------------*/
+int xio_conn_prewarm(struct xio_context *ctx, const char *portal_uri,
+		     const char *out_if)
+{
+	struct xio_conn *conn;
+
+	xio_conn_prewarm_trim(ctx);
+	if (ctx->prewarm_nr >= ctx->prewarm_max) {
+		xio_set_error(XIO_E_NO_BUFS);
+		ERROR_LOG("prewarm pool is full. ctx:%p, prewarm_max:%d\n",
+			  ctx, ctx->prewarm_max);
+		return -1;
+	}
+	conn = xio_conn_open_new(ctx, portal_uri, NULL, 0);
+	if (conn == NULL) {
+		ERROR_LOG("failed to create connection\n");
+		return -1;
+	}
+	/* out of reach of xio_conns_store_find until taken */
+	conn->is_prewarmed = 1;
+	list_add_tail(&conn->prewarm_list_entry, &ctx->prewarm_list);
+	ctx->prewarm_nr++;
+
+	if (out_if) {
+		conn->prewarm_out_if = kstrdup(out_if, GFP_KERNEL);
+		if (conn->prewarm_out_if == NULL) {
+			xio_set_error(ENOMEM);
+			ERROR_LOG("kstrdup failed. %m\n");
+			goto cleanup;
+		}
+	}
+	if (xio_conn_connect(conn, portal_uri, NULL, out_if) != 0) {
+		ERROR_LOG("connection connect failed\n");
+		goto cleanup;
+	}
+
+	return 0;
+
+cleanup:
+	xio_conn_prewarm_drop(ctx, conn);
+	return -1;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_conn_prewarm_take						     */
+/*---------------------------------------------------------------------------*/
+static struct xio_conn *xio_conn_prewarm_take(struct xio_context *ctx,
+					      const char *portal_uri)
+{
+	struct xio_conn *conn, *tmp_conn;
+
+	xio_conn_prewarm_trim(ctx);
+
+	list_for_each_entry_safe(conn, tmp_conn, &ctx->prewarm_list,
+				 prewarm_list_entry) {
+		if (strcmp(conn->transport_hndl->portal_uri, portal_uri) != 0)
+			continue;
+		/* refused or dropped while it waited */
+		if (conn->state != XIO_CONN_STATE_CONNECTING &&
+		    conn->state != XIO_CONN_STATE_CONNECTED) {
+			xio_conn_prewarm_drop(ctx, conn);
+			continue;
+		}
+		xio_conn_prewarm_unlink(ctx, conn);
+
+		/* the pool's reference is the caller's now, open a conn in
+		 * its place for the next session
+		 */
+		if (xio_conn_prewarm(ctx, portal_uri,
+				     conn->prewarm_out_if) != 0)
+			ERROR_LOG("prewarm refill failed. portal:%s\n",
+				  portal_uri);
+		kfree(conn->prewarm_out_if);
+		conn->prewarm_out_if = NULL;
+
+		TRACE_LOG("conn: [prewarm take] conn:%p\n", conn);
+
+		return conn;
+	}
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_conn_prewarm_release						     */
+/*---------------------------------------------------------------------------*/
+void xio_conn_prewarm_release(struct xio_context *ctx,
+			      const char *portal_uri)
+{
+	struct xio_conn *conn, *tmp_conn;
+
+	list_for_each_entry_safe(conn, tmp_conn, &ctx->prewarm_list,
+				 prewarm_list_entry) {
+		if (portal_uri &&
+		    strcmp(conn->transport_hndl->portal_uri, portal_uri) != 0)
+			continue;
+		xio_conn_prewarm_drop(ctx, conn);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_conn_open		                                             */
+/*---------------------------------------------------------------------------*/
+struct xio_conn *xio_conn_open(
+		struct xio_context *ctx,
+		const char *portal_uri,
+		struct xio_observer  *observer,
+		uint32_t oid)
+{
+	struct xio_conn			*conn;
+
+	/* a session takes a conn of the prewarm pool first */
+	if (observer) {
+		conn = xio_conn_prewarm_take(ctx, portal_uri);
+		if (conn != NULL) {
+			xio_observable_reg_observer(&conn->observable,
+						    observer);
+			xio_conn_hash_observer(conn, observer, oid);
+			return conn;
+		}
+	}
+
+	/* look for opened connection. a session gets a conn of its own for
+	 * each of its connections on the context, since the conn delivers
+	 * to the session and the session tells its connections by conn
+	 */
+	conn = xio_conns_store_find(ctx, portal_uri);
+	if (conn != NULL && observer && xio_conn_observer_lookup(conn, oid))
+		conn = NULL;
+	if (conn != NULL) {
+		if (observer) {
+			xio_observable_reg_observer(&conn->observable,
+						    observer);
+			xio_conn_hash_observer(conn, observer, oid);
+		}
+		if (xio_is_delayed_work_pending(&conn->close_time_hndl)) {
+			xio_ctx_del_delayed_work(ctx,
+						 &conn->close_time_hndl);
+			kref_init(&conn->kref);
+		} else {
+			xio_conn_addref(conn);
+		}
+
+		TRACE_LOG("conn: [addref] conn:%p, refcnt:%d\n", conn,
+			  atomic_read(&conn->kref.refcount));
+
+		return conn;
+	}
+
+	return xio_conn_open_new(ctx, portal_uri, observer, oid);
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_conn_connect		                                             */
 /*---------------------------------------------------------------------------*/
@@ -68,7 +68,8 @@ enum xio_conn_event {
 	XIO_CONN_EVENT_CANCEL_REQUEST,
 	XIO_CONN_EVENT_CANCEL_RESPONSE,
 	XIO_CONN_EVENT_ERROR,
-	XIO_CONN_EVENT_MESSAGE_ERROR
+	XIO_CONN_EVENT_MESSAGE_ERROR,
+	XIO_CONN_EVENT_DATA_CHUNK
 };
 
 enum xio_conn_state {
@@ -115,6 +116,11 @@ union xio_conn_event_data {
 		void			*ulp_msg;
 		size_t			ulp_msg_sz;
 	} cancel;
+	struct {
+		struct xio_task		*task;
+		size_t			offset;
+		size_t			len;
+	} chunk;
 };
 
 
@@ -140,12 +146,24 @@ struct xio_conn {
 	enum xio_conn_state		state;
 	int				is_first_req;
 	int				is_listener;
-	int				pad;
+	int				primary_slab_len;
+	/* msec the primary pool outlives the conn, for a successor */
+	uint32_t			keep_pool_ms;
+	/* owned by the prewarm pool of its context */
+	int				is_prewarmed;
 	xio_delayed_work_handle_t	close_time_hndl;
 
 	struct list_head		observers_htbl;
 	struct list_head		tx_queue;
 
+	/* context of a closed conn whose primary pool is kept */
+	struct xio_context		*kept_ctx;
+	struct list_head		kept_list_entry;
+
+	/* on the context's prewarm_list, refilled with out_if when taken */
+	struct list_head		prewarm_list_entry;
+	char				*prewarm_out_if;
+
 	HT_ENTRY(xio_conn, xio_key_int32) conns_htbl;
 };
 
@@ -169,6 +187,18 @@ int xio_conn_connect(struct xio_conn *conn, const char *portal_uri,
 		     struct xio_observer *observer,
 		     const char *out_if);
 
+/*---------------------------------------------------------------------------*/
+/* xio_conn_prewarm							     */
+/*---------------------------------------------------------------------------*/
+int xio_conn_prewarm(struct xio_context *ctx, const char *portal_uri,
+		     const char *out_if);
+
+/*---------------------------------------------------------------------------*/
+/* xio_conn_prewarm_release						     */
+/*---------------------------------------------------------------------------*/
+void xio_conn_prewarm_release(struct xio_context *ctx,
+			      const char *portal_uri);
+
 /*---------------------------------------------------------------------------*/
 /* xio_conn_listen							     */
 /*---------------------------------------------------------------------------*/
@@ -226,6 +256,12 @@ int xio_conn_get_opt(struct xio_conn *conn, int optname,
 /*---------------------------------------------------------------------------*/
 struct xio_task *xio_conn_get_primary_task(struct xio_conn *conn);
 
+/*---------------------------------------------------------------------------*/
+/* xio_conn_get_primary_tasks						     */
+/*---------------------------------------------------------------------------*/
+int xio_conn_get_primary_tasks(struct xio_conn *conn,
+			       struct list_head *list, int nr);
+
 /*---------------------------------------------------------------------------*/
 /* xio_conn_primary_free_tasks						     */
 /*---------------------------------------------------------------------------*/
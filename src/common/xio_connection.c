@@ -38,6 +38,7 @@
 #include "xio_os.h"
 #include "libxio.h"
 #include "xio_common.h"
+#include "xio_protocol.h"
 #include "xio_task.h"
 #include "xio_msg_list.h"
 #include "xio_observer.h"
@@ -53,6 +54,19 @@
 #define		IS_APPLICATION_MSG(msg) \
 		  (IS_MESSAGE((msg)->type) || IS_ONE_WAY((msg)->type))
 
+#define XIO_DEADLINE_SLOTS_MASK		(XIO_DEADLINE_SLOTS - 1)
+
+/* a request that timed out while in flight. it is completed with
+ * XIO_E_TIMEOUT only once the peer can no longer touch its buffers
+ */
+struct xio_timed_out {
+	struct list_head		entry;
+	uint64_t			sn;
+	struct xio_msg			*msg;	/* kept after a flush */
+	int				done;
+	int				cancel_answered;
+};
+
 static struct xio_transition xio_transition_table[][2] = {
 /* INIT */	  {
 		   {.valid = 0, .next_state = XIO_CONNECTION_STATE_INVALID, .send_flags = 0 },
@@ -207,6 +221,552 @@ static int xio_free_ow_msg_pool(struct xio_connection *connection)
 	return 0;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_connection_reqs_queued						     */
+/*---------------------------------------------------------------------------*/
+static inline void xio_connection_reqs_queued(
+		struct xio_connection *connection,
+		struct xio_msg *msg)
+{
+	if (IS_APPLICATION_MSG(msg))
+		connection->reqs_queued_nr++;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_tx_ready_check					     */
+/*---------------------------------------------------------------------------*/
+static inline void xio_connection_tx_ready_check(
+		struct xio_connection *connection)
+{
+	if (connection->tx_throttled &&
+	    (!connection->tx_high_watermark ||
+	     connection->reqs_queued_nr <= connection->tx_low_watermark)) {
+		connection->tx_throttled = 0;
+		/* notify outside of the transmit path */
+		xio_ctx_add_event(connection->ctx,
+				  &connection->tx_ready_event);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_reqs_dequeued						     */
+/*---------------------------------------------------------------------------*/
+static inline void xio_connection_reqs_dequeued(
+		struct xio_connection *connection,
+		struct xio_msg *msg)
+{
+	if (!IS_APPLICATION_MSG(msg))
+		return;
+
+	connection->reqs_queued_nr--;
+	xio_connection_tx_ready_check(connection);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_tx_throttle						     */
+/*---------------------------------------------------------------------------*/
+static inline int xio_connection_tx_throttle(struct xio_connection *connection)
+{
+	if (!connection->tx_high_watermark ||
+	    connection->reqs_queued_nr < connection->tx_high_watermark)
+		return 0;
+
+	connection->tx_throttled = 1;
+	xio_set_error(EAGAIN);
+
+	return -1;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_reqs_q						     */
+/*---------------------------------------------------------------------------*/
+static inline struct xio_msg_list *xio_connection_reqs_q(
+		struct xio_connection *connection,
+		struct xio_msg *msg)
+{
+	/* control messages go ahead of everything */
+	if (!IS_APPLICATION_MSG(msg))
+		return &connection->reqs_msgq[0];
+
+	return &connection->reqs_msgq[XIO_MSG_CLASS(msg->flags)];
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_reqs_empty						     */
+/*---------------------------------------------------------------------------*/
+static inline int xio_connection_reqs_empty(struct xio_connection *connection)
+{
+	int i;
+
+	for (i = 0; i < XIO_MAX_MSG_CLASSES; i++)
+		if (!xio_msg_list_empty(&connection->reqs_msgq[i]))
+			return 0;
+
+	return 1;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_class_may_send					     */
+/*---------------------------------------------------------------------------*/
+static inline int xio_connection_class_may_send(
+		struct xio_connection *connection, int cls)
+{
+	int i, shared;
+
+	if (connection->in_flight_reqs_budget == 0)
+		return 0;
+	if (likely(!connection->class_reserved) ||
+	    connection->class_in_flight[cls] < connection->class_reserve[cls])
+		return 1;
+
+	/* beyond its reservation a class uses only what no other class
+	 * holds reserved
+	 */
+	shared = connection->in_flight_reqs_budget;
+	for (i = 0; i < XIO_MAX_MSG_CLASSES; i++)
+		if (connection->class_in_flight[i] <
+		    connection->class_reserve[i])
+			shared -= connection->class_reserve[i] -
+				  connection->class_in_flight[i];
+
+	return shared > 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_may_send						     */
+/*---------------------------------------------------------------------------*/
+static inline int xio_connection_may_send(struct xio_connection *connection,
+					  struct xio_msg *msg)
+{
+	if (!IS_APPLICATION_MSG(msg))
+		return 1;
+	if (msg->type == XIO_MSG_TYPE_REQ)
+		return xio_connection_class_may_send(
+				connection, XIO_MSG_CLASS(msg->flags));
+	if (msg->type == XIO_ONE_WAY_REQ)
+		return connection->in_flight_sends_budget > 0;
+
+	return 1;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_next_req						     */
+/*---------------------------------------------------------------------------*/
+static struct xio_msg *xio_connection_next_req(
+		struct xio_connection *connection,
+		struct xio_msg_list **msgq)
+{
+	struct xio_msg	*msg;
+	uint64_t	size;
+	int		i, cls, active = 0;
+
+	/* strict priority classes, lowest index first */
+	for (i = 0; i < XIO_MAX_MSG_CLASSES; i++) {
+		msg = xio_msg_list_first(&connection->reqs_msgq[i]);
+		if (msg == NULL || !xio_connection_may_send(connection, msg))
+			continue;
+		if (connection->class_quantum[i] == 0) {
+			*msgq = &connection->reqs_msgq[i];
+			return msg;
+		}
+		active = 1;
+	}
+	if (!active)
+		return NULL;
+
+	/* deficit round robin over the rest. some class is sendable so
+	 * its deficit grows each turn until the head message fits
+	 */
+	while (1) {
+		cls = connection->drr_cur;
+		msg = xio_msg_list_first(&connection->reqs_msgq[cls]);
+		if (connection->class_quantum[cls] == 0 || msg == NULL) {
+			connection->class_deficit[cls] = 0;
+			goto next;
+		}
+		if (!xio_connection_may_send(connection, msg))
+			goto next;
+		if (connection->drr_new_turn) {
+			connection->class_deficit[cls] +=
+				connection->class_quantum[cls];
+			connection->drr_new_turn = 0;
+		}
+		size = msg->out.header.iov_len +
+		       xio_iovex_length(msg->out.data_iov,
+					msg->out.data_iovlen);
+		if (connection->class_deficit[cls] >= (int64_t)size) {
+			*msgq = &connection->reqs_msgq[cls];
+			return msg;
+		}
+next:
+		connection->drr_cur = (cls + 1) % XIO_MAX_MSG_CLASSES;
+		connection->drr_new_turn = 1;
+	}
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_class_sent						     */
+/*---------------------------------------------------------------------------*/
+static inline void xio_connection_class_sent(struct xio_connection *connection,
+					     struct xio_msg *msg)
+{
+	int cls;
+
+	if (!IS_APPLICATION_MSG(msg))
+		return;
+
+	cls = XIO_MSG_CLASS(msg->flags);
+	if (connection->class_quantum[cls])
+		connection->class_deficit[cls] -=
+			msg->out.header.iov_len +
+			xio_iovex_length(msg->out.data_iov,
+					 msg->out.data_iovlen);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_send_cancel						     */
+/*---------------------------------------------------------------------------*/
+static void xio_connection_send_cancel(struct xio_connection *connection,
+				       struct xio_msg *req)
+{
+	struct xio_session_cancel_hdr hdr;
+	uint64_t	stag;
+
+	hdr.sn			 = htonll(req->sn);
+	hdr.requester_session_id =
+		htonl(connection->session->session_id);
+	hdr.responder_session_id =
+		htonl(connection->session->peer_session_id);
+	stag			 =
+		uint64_from_ptr(connection->session);
+
+	/* cancel request on tx */
+	xio_conn_cancel_req(connection->conn, req, stag, &hdr, sizeof(hdr));
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_disarm_deadline					     */
+/*---------------------------------------------------------------------------*/
+static inline void xio_connection_disarm_deadline(
+		struct xio_connection *connection,
+		struct xio_msg *msg)
+{
+	if (!msg->timer.armed)
+		return;
+
+	xio_msg_list_remove(
+		&connection->deadlines[msg->timer.expires &
+				       XIO_DEADLINE_SLOTS_MASK],
+		msg, timer);
+	msg->timer.armed = 0;
+	connection->deadlines_nr--;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_expire						     */
+/*---------------------------------------------------------------------------*/
+static void xio_connection_expire(struct xio_connection *connection,
+				  struct xio_msg *msg)
+{
+	struct xio_timed_out *tmo;
+
+	if (!msg->timer.in_flight) {
+		/* still queued - it never reached the wire */
+		xio_msg_list_remove(xio_connection_reqs_q(connection, msg),
+				    msg, pdata);
+		xio_connection_reqs_dequeued(connection, msg);
+	} else {
+		tmo = kcalloc(1, sizeof(*tmo), GFP_KERNEL);
+		if (tmo == NULL) {
+			/* the response is still expected, keep waiting */
+			ERROR_LOG("failed to expire request sn:%llu\n",
+				  msg->sn);
+			return;
+		}
+		tmo->sn = msg->sn;
+		tmo->msg = msg;
+		list_add_tail(&tmo->entry, &connection->timed_out_list);
+
+		/* the peer may still read or write the request buffers. it
+		 * stays in flight until the cancel is answered, the response
+		 * arrives or the connection is flushed
+		 */
+		xio_connection_send_cancel(connection, msg);
+		return;
+	}
+
+	xio_session_notify_msg_error(connection, msg, XIO_E_TIMEOUT);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_timed_out_complete					     */
+/*---------------------------------------------------------------------------*/
+static void xio_connection_timed_out_complete(
+		struct xio_connection *connection,
+		struct xio_msg *msg)
+{
+	xio_connection_remove_in_flight(connection, msg);
+	xio_session_notify_msg_error(connection, msg, XIO_E_TIMEOUT);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_deadline_handler					     */
+/*---------------------------------------------------------------------------*/
+static void xio_connection_deadline_handler(void *data)
+{
+	struct xio_connection	*connection = data;
+	struct xio_msg_list	expired, *slot;
+	struct xio_msg		*pmsg, *tmp_pmsg;
+	int			retval;
+
+	connection->deadline_tick++;
+	slot = &connection->deadlines[connection->deadline_tick &
+				      XIO_DEADLINE_SLOTS_MASK];
+
+	/* detach first, the error callbacks may send or cancel requests */
+	xio_msg_list_init(&expired);
+	xio_msg_list_foreach_safe(pmsg, slot, tmp_pmsg, timer) {
+		if ((int32_t)(connection->deadline_tick -
+			      pmsg->timer.expires) < 0)
+			continue;
+		xio_connection_disarm_deadline(connection, pmsg);
+		xio_msg_list_insert_tail(&expired, pmsg, timer);
+	}
+	while (!xio_msg_list_empty(&expired)) {
+		pmsg = xio_msg_list_first(&expired);
+		xio_msg_list_remove(&expired, pmsg, timer);
+		xio_connection_expire(connection, pmsg);
+	}
+
+	if (connection->deadlines_nr == 0 ||
+	    xio_is_delayed_work_pending(&connection->deadline_work))
+		return;
+
+	retval = xio_ctx_add_delayed_work(connection->ctx,
+					  XIO_DEADLINE_TICK_MS, connection,
+					  xio_connection_deadline_handler,
+					  &connection->deadline_work);
+	if (retval != 0)
+		ERROR_LOG("xio_ctx_add_delayed_work failed.\n");
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_arm_deadline						     */
+/*---------------------------------------------------------------------------*/
+static inline void xio_connection_arm_deadline(
+		struct xio_connection *connection,
+		struct xio_msg *msg)
+{
+	int retval;
+
+	msg->timer.armed	= 0;
+	msg->timer.in_flight	= 0;
+
+	if (likely(!msg->timeout_ms || msg->type != XIO_MSG_TYPE_REQ))
+		return;
+
+	/* O(1): hashed wheel, far deadlines are revisited every turn */
+	msg->timer.expires = connection->deadline_tick +
+		(msg->timeout_ms + XIO_DEADLINE_TICK_MS - 1) /
+		XIO_DEADLINE_TICK_MS;
+	xio_msg_list_insert_tail(
+		&connection->deadlines[msg->timer.expires &
+				       XIO_DEADLINE_SLOTS_MASK],
+		msg, timer);
+	msg->timer.armed = 1;
+
+	if (connection->deadlines_nr++ ||
+	    xio_is_delayed_work_pending(&connection->deadline_work))
+		return;
+
+	retval = xio_ctx_add_delayed_work(connection->ctx,
+					  XIO_DEADLINE_TICK_MS, connection,
+					  xio_connection_deadline_handler,
+					  &connection->deadline_work);
+	if (retval != 0)
+		ERROR_LOG("xio_ctx_add_delayed_work failed.\n");
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_timed_out						     */
+/*---------------------------------------------------------------------------*/
+int xio_connection_timed_out(struct xio_connection *connection,
+			     uint64_t sn, enum xio_timed_out_event event)
+{
+	struct xio_timed_out	*tmo;
+	struct xio_msg		*msg = NULL;
+
+	list_for_each_entry(tmo, &connection->timed_out_list, entry) {
+		if (tmo->sn == sn)
+			break;
+	}
+	if (&tmo->entry == &connection->timed_out_list)
+		return 0;
+
+	switch (event) {
+	case XIO_TIMED_OUT_RSP_PART:
+		return 1;
+	case XIO_TIMED_OUT_RSP:
+	case XIO_TIMED_OUT_CANCELED:
+		/* nothing more reaches the request buffers */
+		if (!tmo->done)
+			msg = tmo->msg;
+		tmo->done = 1;
+		tmo->msg  = NULL;
+		if (event == XIO_TIMED_OUT_CANCELED)
+			tmo->cancel_answered = 1;
+		break;
+	case XIO_TIMED_OUT_CANCEL_FAILED:
+		/* the response is still on its way */
+		tmo->cancel_answered = 1;
+		break;
+	}
+
+	/* the entry drops the cancel answer and the late response */
+	if (tmo->done && tmo->cancel_answered) {
+		list_del(&tmo->entry);
+		kfree(tmo);
+	}
+	if (msg)
+		xio_connection_timed_out_complete(connection, msg);
+
+	return 1;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_timed_out_msg						     */
+/*---------------------------------------------------------------------------*/
+int xio_connection_timed_out_msg(struct xio_connection *connection,
+				 struct xio_msg *msg)
+{
+	struct xio_timed_out	*tmo;
+
+	list_for_each_entry(tmo, &connection->timed_out_list, entry) {
+		if (tmo->msg != msg)
+			continue;
+		/* already completed by the flush */
+		if (tmo->done)
+			return 1;
+		/* the request never left, the peer cannot touch it */
+		tmo->done = 1;
+		tmo->msg  = NULL;
+		xio_connection_timed_out_complete(connection, msg);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_flush_timed_out					     */
+/*---------------------------------------------------------------------------*/
+static void xio_connection_flush_timed_out(struct xio_connection *connection)
+{
+	struct xio_timed_out	*tmo, *tmp_tmo;
+
+	/* the transport is gone. the msg pointer is kept, so that a task
+	 * that is still queued and fails later is recognized
+	 */
+	list_for_each_entry_safe(tmo, tmp_tmo, &connection->timed_out_list,
+				 entry) {
+		if (tmo->done)
+			continue;
+		tmo->done = 1;
+		xio_connection_timed_out_complete(connection, tmo->msg);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_flush_batch						     */
+/*---------------------------------------------------------------------------*/
+void xio_connection_flush_batch(struct xio_connection *connection)
+{
+	struct xio_msg		*msgs[XIO_CONNECTION_MSGS_BATCH];
+	struct xio_task		*tasks[XIO_CONNECTION_MSGS_BATCH];
+	int			i, nr;
+
+	xio_ctx_remove_event(connection->ctx, &connection->batch_event);
+
+	/* the callbacks may queue more, so work on a private copy */
+	nr = connection->rx_batch_nr;
+	if (nr) {
+		memcpy(msgs, connection->rx_batch, nr * sizeof(msgs[0]));
+		connection->rx_batch_nr = 0;
+		if (connection->ses_ops.on_msgs)
+			connection->ses_ops.on_msgs(
+					connection->session, msgs, nr,
+					connection->cb_user_context);
+	}
+
+	nr = connection->tx_comp_batch_nr;
+	if (nr) {
+		memcpy(tasks, connection->tx_comp_batch,
+		       nr * sizeof(tasks[0]));
+		connection->tx_comp_batch_nr = 0;
+		for (i = 0; i < nr; i++)
+			msgs[i] = tasks[i]->omsg;
+		if (connection->ses_ops.on_msgs_send_complete)
+			connection->ses_ops.on_msgs_send_complete(
+					connection->session, msgs, nr,
+					connection->cb_user_context);
+		/* recycle the tasks */
+		for (i = 0; i < nr; i++)
+			xio_tasks_pool_put(tasks[i]);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_batch_handler						     */
+/*---------------------------------------------------------------------------*/
+static void xio_connection_batch_handler(xio_ctx_event_t *tev, void *data)
+{
+	struct xio_connection *connection = data;
+
+	xio_connection_flush_batch(connection);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_tx_ready_handler					     */
+/*---------------------------------------------------------------------------*/
+static void xio_connection_tx_ready_handler(xio_ctx_event_t *tev, void *data)
+{
+	struct xio_connection *connection = data;
+
+	if (connection->ses_ops.on_tx_ready)
+		connection->ses_ops.on_tx_ready(connection->session,
+						connection,
+						connection->cb_user_context);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_queue_rx_msg						     */
+/*---------------------------------------------------------------------------*/
+void xio_connection_queue_rx_msg(struct xio_connection *connection,
+				 struct xio_msg *msg)
+{
+	connection->rx_batch[connection->rx_batch_nr++] = msg;
+	if (connection->rx_batch_nr == XIO_CONNECTION_MSGS_BATCH)
+		xio_connection_flush_batch(connection);
+	else
+		/* flushed once the current completions poll is over */
+		xio_ctx_add_event(connection->ctx, &connection->batch_event);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_queue_tx_comp						     */
+/*---------------------------------------------------------------------------*/
+void xio_connection_queue_tx_comp(struct xio_connection *connection,
+				  struct xio_task *task)
+{
+	connection->tx_comp_batch[connection->tx_comp_batch_nr++] = task;
+	if (connection->tx_comp_batch_nr == XIO_CONNECTION_MSGS_BATCH)
+		xio_connection_flush_batch(connection);
+	else
+		xio_ctx_add_event(connection->ctx, &connection->batch_event);
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_connection_init							     */
 /*---------------------------------------------------------------------------*/
@@ -216,6 +776,7 @@ struct xio_connection *xio_connection_init(struct xio_session *session,
 					       void *cb_user_context)
 {
 		struct xio_connection *connection;
+		int i;
 
 		if ((ctx == NULL) || (session == NULL)) {
 			xio_set_error(EINVAL);
@@ -243,20 +804,89 @@ struct xio_connection *xio_connection_init(struct xio_session *session,
 		INIT_LIST_HEAD(&connection->post_io_tasks_list);
 		INIT_LIST_HEAD(&connection->pre_send_list);
 
-		xio_msg_list_init(&connection->reqs_msgq);
+		for (i = 0; i < XIO_MAX_MSG_CLASSES; i++) {
+			xio_msg_list_init(&connection->reqs_msgq[i]);
+			/* class 0 is strict priority, the rest share */
+			connection->class_quantum[i] =
+				i ? XIO_CLASS_DEFAULT_QUANTUM : 0;
+		}
+		connection->drr_new_turn = 1;
+		INIT_LIST_HEAD(&connection->tx_sched_entry);
 		xio_msg_list_init(&connection->rsps_msgq);
 
 		xio_msg_list_init(&connection->in_flight_reqs_msgq);
 		xio_msg_list_init(&connection->in_flight_rsps_msgq);
 
 		xio_init_ow_msg_pool(connection);
+		xio_ctx_init_event(&connection->batch_event,
+				   xio_connection_batch_handler, connection);
+		xio_ctx_init_event(&connection->tx_ready_event,
+				   xio_connection_tx_ready_handler, connection);
+		xio_ctx_init_event(&connection->hedge_event,
+				   xio_session_hedge_event, connection);
+		INIT_LIST_HEAD(&connection->timed_out_list);
+		INIT_LIST_HEAD(&connection->hedge_list);
+		INIT_LIST_HEAD(&connection->stripe_list);
+		for (i = 0; i < XIO_DEADLINE_SLOTS; i++)
+			xio_msg_list_init(&connection->deadlines[i]);
 
 		kref_init(&connection->kref);
 		list_add_tail(&connection->ctx_list_entry, &ctx->ctx_list);
+		ctx->connections_nr++;
 
 		return connection;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_connection_send_task						     */
+/*---------------------------------------------------------------------------*/
+static int xio_connection_send_task(struct xio_connection *connection,
+				    struct xio_msg *msg,
+				    struct xio_task *task,
+				    struct xio_session_hdr *hdr)
+{
+	int			retval;
+
+	/* reset the task mbuf */
+	xio_mbuf_reset(&task->mbuf);
+
+	/* set the the mbuf to begining of tlv */
+	if (xio_mbuf_tlv_start(&task->mbuf) != 0)
+		return -EFAULT;
+
+	task->tlv_type		= msg->type;
+	task->session		= connection->session;
+	task->stag		= uint64_from_ptr(task->session);
+	task->conn		= connection->conn;
+	task->connection	= connection;
+	task->omsg		= msg;
+	task->omsg_flags	= msg->flags;
+
+	/* mark as a control message */
+	task->is_control = !IS_APPLICATION_MSG(msg);
+
+	/* write session header */
+	hdr->flags		= msg->flags;
+	hdr->dest_session_id	= connection->session->peer_session_id;
+	xio_session_write_header(task, hdr);
+
+	/* send it */
+	retval = xio_conn_send(connection->conn, task);
+	if (retval != 0)
+		return (retval == -EAGAIN) ? -EAGAIN : -xio_errno();
+
+	if (!task->is_control) {
+		if (msg->type == XIO_MSG_TYPE_REQ) {
+			connection->in_flight_reqs_budget--;
+			connection->class_in_flight[
+					XIO_MSG_CLASS(msg->flags)]++;
+		}
+		if (msg->type == XIO_ONE_WAY_REQ)
+			connection->in_flight_sends_budget--;
+	}
+	return 0;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_connection_send							     */
 /*---------------------------------------------------------------------------*/
@@ -268,11 +898,11 @@ int xio_connection_send(struct xio_connection *connection,
 	struct xio_task		*req_task = NULL;
 	struct xio_session_hdr	hdr = {0};
 	int			is_req = 0;
-	int 			rc = EFAULT;
 
 	/*  control of the number of messages sent */
 	if (msg->type == XIO_MSG_TYPE_REQ &&
-	    connection->in_flight_reqs_budget == 0)
+	    !xio_connection_class_may_send(connection,
+					   XIO_MSG_CLASS(msg->flags)))
 		return -EAGAIN;
 
 	if (msg->type == XIO_ONE_WAY_REQ &&
@@ -325,42 +955,10 @@ int xio_connection_send(struct xio_connection *connection,
 		}
 	}
 
-	/* reset the task mbuf */
-	xio_mbuf_reset(&task->mbuf);
-
-	/* set the the mbuf to begining of tlv */
-	if (xio_mbuf_tlv_start(&task->mbuf) != 0)
-		goto cleanup;
-
-
-	task->tlv_type		= msg->type;
-	task->session		= connection->session;
-	task->stag		= uint64_from_ptr(task->session);
-	task->conn		= connection->conn;
-	task->connection	= connection;
-	task->omsg		= msg;
-	task->omsg_flags	= msg->flags;
-
-	/* mark as a control message */
-	task->is_control = !IS_APPLICATION_MSG(msg);
-
-	/* write session header */
-	hdr.flags		= msg->flags;
-	hdr.dest_session_id	= connection->session->peer_session_id;
-	xio_session_write_header(task, &hdr);
-
-	/* send it */
-	retval = xio_conn_send(connection->conn, task);
-	if (retval != 0) {
-		rc = (retval == -EAGAIN) ? EAGAIN : xio_errno();
+	retval = xio_connection_send_task(connection, msg, task, &hdr);
+	if (retval != 0)
 		goto cleanup;
-	}
-	if (!task->is_control) {
-		if (msg->type == XIO_MSG_TYPE_REQ)
-			connection->in_flight_reqs_budget--;
-		if (msg->type == XIO_ONE_WAY_REQ)
-			connection->in_flight_sends_budget--;
-	}
+
 	return 0;
 
 cleanup:
@@ -370,7 +968,7 @@ cleanup:
 		list_move(&task->tasks_list_entry, &connection->io_tasks_list);
 
 
-	return -rc;
+	return retval;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -379,20 +977,35 @@ cleanup:
 int xio_connection_flush_msgs(struct xio_connection *connection)
 {
 	struct xio_msg		*pmsg, *tmp_pmsg, *omsg = NULL;
-
-	if (!xio_msg_list_empty(&connection->reqs_msgq))
-		omsg = xio_msg_list_first(&connection->reqs_msgq);
+	struct xio_msg		*first[XIO_MAX_MSG_CLASSES];
+	struct xio_msg_list	*msgq;
+	int			i, cls;
+
+	xio_connection_flush_timed_out(connection);
+	if (!list_empty(&connection->hedge_list))
+		xio_session_hedge_flush(connection);
+	if (!list_empty(&connection->stripe_list))
+		xio_session_stripe_flush(connection);
+
+	/* in flight messages go back ahead of their class queue */
+	for (i = 0; i < XIO_MAX_MSG_CLASSES; i++)
+		first[i] = xio_msg_list_first(&connection->reqs_msgq[i]);
 	xio_msg_list_foreach_safe(pmsg, &connection->in_flight_reqs_msgq,
 				  tmp_pmsg, pdata) {
 		xio_msg_list_remove(&connection->in_flight_reqs_msgq,
 				    pmsg, pdata);
-		if (omsg)
-			xio_msg_list_insert_before(omsg, pmsg, pdata);
+		cls = XIO_MSG_CLASS(pmsg->flags);
+		msgq = &connection->reqs_msgq[cls];
+		if (first[cls])
+			xio_msg_list_insert_before(first[cls], pmsg, pdata);
 		else
-			xio_msg_list_insert_tail(&connection->reqs_msgq,
-						 pmsg, pdata);
-		if (pmsg->type == XIO_MSG_TYPE_REQ)
+			xio_msg_list_insert_tail(msgq, pmsg, pdata);
+		xio_connection_reqs_queued(connection, pmsg);
+		pmsg->timer.in_flight = 0;
+		if (pmsg->type == XIO_MSG_TYPE_REQ) {
 			connection->in_flight_reqs_budget++;
+			connection->class_in_flight[cls]--;
+		}
 		if (pmsg->type == XIO_ONE_WAY_REQ)
 			connection->in_flight_sends_budget++;
 	}
@@ -422,14 +1035,21 @@ int xio_connection_flush_msgs(struct xio_connection *connection)
 int xio_connection_notify_msgs_flush(struct xio_connection *connection)
 {
 	struct xio_msg		*pmsg, *tmp_pmsg;
-
-	xio_msg_list_foreach_safe(pmsg, &connection->reqs_msgq,
-				  tmp_pmsg, pdata) {
-		xio_msg_list_remove(&connection->reqs_msgq, pmsg, pdata);
-		xio_session_notify_msg_error(connection, pmsg,
-					     XIO_E_MSG_FLUSHED);
-
+	struct xio_msg_list	*msgq;
+	int			i;
+
+	for (i = 0; i < XIO_MAX_MSG_CLASSES; i++) {
+		msgq = &connection->reqs_msgq[i];
+		xio_msg_list_foreach_safe(pmsg, msgq, tmp_pmsg, pdata) {
+			xio_msg_list_remove(msgq, pmsg, pdata);
+			xio_connection_disarm_deadline(connection, pmsg);
+			xio_session_notify_msg_error(connection, pmsg,
+						     XIO_E_MSG_FLUSHED);
+		}
 	}
+	/* nothing left to wait for */
+	connection->reqs_queued_nr = 0;
+	connection->tx_throttled = 0;
 
 	xio_msg_list_foreach_safe(pmsg, &connection->rsps_msgq,
 				  tmp_pmsg, pdata) {
@@ -449,6 +1069,64 @@ int xio_connection_notify_msgs_flush(struct xio_connection *connection)
 	return 0;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_connection_detach_msgs						     */
+/*---------------------------------------------------------------------------*/
+int xio_connection_detach_msgs(struct xio_connection *connection,
+			       struct xio_msg_list *msgq)
+{
+	struct xio_msg		*pmsg, *tmp_pmsg;
+	struct xio_msg_list	*reqs_msgq;
+	int			i, nr = 0;
+
+	for (i = 0; i < XIO_MAX_MSG_CLASSES; i++) {
+		reqs_msgq = &connection->reqs_msgq[i];
+		xio_msg_list_foreach_safe(pmsg, reqs_msgq, tmp_pmsg, pdata) {
+			if (pmsg->type != XIO_MSG_TYPE_REQ &&
+			    pmsg->type != XIO_ONE_WAY_REQ)
+				continue;
+			/* sub requests belong to the connection they used */
+			if ((pmsg->flags & (XIO_MSG_FLAG_HEDGE |
+					    XIO_MSG_FLAG_STRIPE |
+					    XIO_MSG_FLAG_FANOUT |
+					    XIO_MSG_FLAG_FORWARD)) &&
+			    pmsg->timer.parent)
+				continue;
+			xio_msg_list_remove(reqs_msgq, pmsg, pdata);
+			xio_connection_disarm_deadline(connection, pmsg);
+			connection->reqs_queued_nr--;
+			xio_msg_list_insert_tail(msgq, pmsg, pdata);
+			nr++;
+		}
+	}
+
+	return nr;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_attach_msgs						     */
+/*---------------------------------------------------------------------------*/
+int xio_connection_attach_msgs(struct xio_connection *connection,
+			       struct xio_msg_list *msgq)
+{
+	struct xio_msg		*pmsg;
+	int			nr = 0;
+
+	/* deadlines restart, the messages never left this side */
+	while (!xio_msg_list_empty(msgq)) {
+		pmsg = xio_msg_list_first(msgq);
+		xio_msg_list_remove(msgq, pmsg, pdata);
+		xio_msg_list_insert_tail(xio_connection_reqs_q(connection,
+							       pmsg),
+					 pmsg, pdata);
+		xio_connection_reqs_queued(connection, pmsg);
+		xio_connection_arm_deadline(connection, pmsg);
+		nr++;
+	}
+
+	return nr;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_connection_flush_tasks						     */
 /*---------------------------------------------------------------------------*/
@@ -506,32 +1184,56 @@ int xio_connection_flush_tasks(struct xio_connection *connection)
 }
 
 /*---------------------------------------------------------------------------*/
-/* xio_connection_xmit							     */
+/* xio_connection_tx_defer						     */
 /*---------------------------------------------------------------------------*/
-static int xio_connection_xmit(struct xio_connection *connection)
+static void xio_connection_tx_defer(struct xio_connection *connection)
+{
+	struct xio_context *ctx = connection->ctx;
+
+	if (connection->tx_scheduled)
+		return;
+
+	/* wait for the next round of the context's scheduler */
+	connection->tx_scheduled = 1;
+	list_add_tail(&connection->tx_sched_entry, &ctx->tx_sched_list);
+	xio_ctx_add_event(ctx, &ctx->tx_sched_event);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_tx_pending						     */
+/*---------------------------------------------------------------------------*/
+static inline int xio_connection_tx_pending(struct xio_connection *connection)
+{
+	return !xio_connection_reqs_empty(connection) ||
+	       !xio_msg_list_empty(&connection->rsps_msgq);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_do_xmit						     */
+/*---------------------------------------------------------------------------*/
+static int xio_connection_do_xmit(struct xio_connection *connection)
 {
 	struct xio_msg *msg;
+	uint64_t size;
 	int    retval = 0;
 	int    retry_cnt = 0;
+	int    is_req;
 
-	struct xio_msg_list *msg_lists[] = {
-		&connection->reqs_msgq,
-		&connection->rsps_msgq
-	};
-	struct xio_msg_list *in_flight_msg_lists[] = {
-		&connection->in_flight_reqs_msgq,
-		&connection->in_flight_rsps_msgq
-	};
-	struct xio_msg_list *msgq, *in_flight_msgq;
+	struct xio_msg_list *msgq = NULL, *in_flight_msgq;
 
 
 	while (retry_cnt < 2) {
-		msgq		= msg_lists[connection->send_req_toggle];
-		in_flight_msgq	=
-			in_flight_msg_lists[connection->send_req_toggle];
+		is_req = (connection->send_req_toggle == 0);
 		connection->send_req_toggle =
 			1 - connection->send_req_toggle;
-		msg = xio_msg_list_first(msgq);
+		if (is_req) {
+			msg = xio_connection_next_req(connection, &msgq);
+			in_flight_msgq = &connection->in_flight_reqs_msgq;
+		} else {
+			msgq = &connection->rsps_msgq;
+			msg = xio_msg_list_first(msgq);
+			in_flight_msgq = &connection->in_flight_rsps_msgq;
+		}
 		if (msg != NULL) {
 			retval = xio_connection_send(connection, msg);
 			if (retval) {
@@ -542,6 +1244,12 @@ static int xio_connection_xmit(struct xio_connection *connection)
 							connection->session)) {
 						xio_msg_list_remove(msgq, msg,
 								    pdata);
+						if (is_req) {
+							xio_connection_reqs_dequeued(
+								connection, msg);
+							xio_connection_disarm_deadline(
+								connection, msg);
+						}
 						break;
 					}
 					retval = 0;
@@ -557,16 +1265,50 @@ static int xio_connection_xmit(struct xio_connection *connection)
 					continue;
 				} else  {
 					xio_msg_list_remove(msgq, msg, pdata);
+					if (is_req) {
+						xio_connection_reqs_dequeued(
+							connection, msg);
+						xio_connection_disarm_deadline(
+							connection, msg);
+					}
 					break;
 				}
 			} else {
 				retry_cnt = 0;
 				xio_msg_list_remove(msgq, msg, pdata);
+				if (is_req) {
+					xio_connection_reqs_dequeued(connection,
+								     msg);
+					xio_connection_class_sent(connection,
+								  msg);
+				}
 				if (IS_APPLICATION_MSG(msg)) {
 					xio_msg_list_insert_tail(
 							in_flight_msgq, msg,
 							pdata);
-
+					msg->timer.in_flight = 1;
+
+					size = msg->out.header.iov_len +
+					       xio_iovex_length(
+							msg->out.data_iov,
+							msg->out.data_iovlen);
+					connection->tx_service_msgs++;
+					connection->tx_service_bytes += size;
+					if (!connection->tx_quantum)
+						continue;
+					connection->tx_deficit -= size;
+					if (connection->tx_deficit > 0)
+						continue;
+					/* quantum used up, let the other
+					 * connections of the context go
+					 */
+					if (xio_connection_tx_pending(
+							connection)) {
+						connection->tx_service_deferred++;
+						xio_connection_tx_defer(
+							connection);
+					}
+					break;
 				}
 			}
 		} else {
@@ -583,6 +1325,59 @@ static int xio_connection_xmit(struct xio_connection *connection)
 	return retval ? -1 : 0;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_connection_xmit							     */
+/*---------------------------------------------------------------------------*/
+static int xio_connection_xmit(struct xio_connection *connection)
+{
+	/* a deferred connection waits for its turn */
+	if (connection->tx_scheduled)
+		return 0;
+
+	/* the deficit is replenished by the scheduler rounds only, a
+	 * connection that spent it joins the next round
+	 */
+	if (connection->tx_quantum && connection->tx_deficit <= 0) {
+		if (xio_connection_tx_pending(connection)) {
+			connection->tx_service_deferred++;
+			xio_connection_tx_defer(connection);
+		}
+		return 0;
+	}
+
+	return xio_connection_do_xmit(connection);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_tx_sched_handler					     */
+/*---------------------------------------------------------------------------*/
+void xio_connection_tx_sched_handler(xio_ctx_event_t *tev, void *data)
+{
+	struct xio_context	*ctx = data;
+	struct xio_connection	*connection;
+	LIST_HEAD(round);
+
+	/* one deficit round robin round over the deferred connections.
+	 * connections that use up their quantum again join the next round
+	 */
+	list_splice_init(&ctx->tx_sched_list, &round);
+	while (!list_empty(&round)) {
+		connection = list_first_entry(&round, struct xio_connection,
+					      tx_sched_entry);
+		list_del_init(&connection->tx_sched_entry);
+		connection->tx_scheduled = 0;
+		connection->tx_service_turns++;
+
+		connection->tx_deficit += connection->tx_quantum;
+		if (connection->tx_quantum && connection->tx_deficit <= 0) {
+			/* still paying off a large message */
+			xio_connection_tx_defer(connection);
+			continue;
+		}
+		xio_connection_do_xmit(connection);
+	}
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_connection_remove_in_flight					     */
 /*---------------------------------------------------------------------------*/
@@ -593,10 +1388,14 @@ int xio_connection_remove_in_flight(struct xio_connection *connection,
 		return 0;
 
 	if (IS_REQUEST(msg->type)) {
+		xio_connection_disarm_deadline(connection, msg);
 		xio_msg_list_remove(
 				&connection->in_flight_reqs_msgq, msg, pdata);
-		if (msg->type == XIO_MSG_TYPE_REQ)
+		if (msg->type == XIO_MSG_TYPE_REQ) {
 			connection->in_flight_reqs_budget++;
+			connection->class_in_flight[
+					XIO_MSG_CLASS(msg->flags)]--;
+		}
 		if (msg->type == XIO_ONE_WAY_REQ)
 			connection->in_flight_sends_budget++;
 	} else {
@@ -616,10 +1415,12 @@ int xio_connection_remove_msg_from_queue(struct xio_connection *connection,
 	if (!IS_APPLICATION_MSG(msg))
 		return 0;
 
-	if (IS_REQUEST(msg->type))
-		xio_msg_list_remove(
-				&connection->reqs_msgq, msg, pdata);
-	else
+	if (IS_REQUEST(msg->type)) {
+		xio_msg_list_remove(xio_connection_reqs_q(connection, msg),
+				    msg, pdata);
+		xio_connection_reqs_dequeued(connection, msg);
+		xio_connection_disarm_deadline(connection, msg);
+	} else
 		xio_msg_list_remove(
 				&connection->rsps_msgq, msg, pdata);
 
@@ -649,9 +1450,16 @@ int xio_send_request(struct xio_connection *connection,
 		return -1;
 	}
 
+	if (xio_connection_tx_throttle(connection))
+		return -1;
+
 	pmsg = msg;
 	stats = &connection->ctx->stats;
 	while (pmsg) {
+		/* only library owned sub requests and forwards have a parent */
+		if (!(pmsg->flags & XIO_MSG_FLAG_FORWARD))
+			pmsg->timer.parent = NULL;
+
 		valid = xio_session_is_valid_in_req(connection->session, pmsg);
 		if (!valid) {
 			xio_set_error(EINVAL);
@@ -691,7 +1499,10 @@ int xio_send_request(struct xio_connection *connection,
 		pmsg->sn = xio_session_get_sn(connection->session);
 		pmsg->type = XIO_MSG_TYPE_REQ;
 
-		xio_msg_list_insert_tail(&connection->reqs_msgq, pmsg, pdata);
+		xio_msg_list_insert_tail(xio_connection_reqs_q(connection, pmsg),
+					 pmsg, pdata);
+		xio_connection_reqs_queued(connection, pmsg);
+		xio_connection_arm_deadline(connection, pmsg);
 
 		pmsg = pmsg->next;
 	}
@@ -703,6 +1514,147 @@ int xio_send_request(struct xio_connection *connection,
 	return 0;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_send_request_batch						     */
+/*---------------------------------------------------------------------------*/
+int xio_send_request_batch(struct xio_connection *connection,
+			   struct xio_msg **msgs, int nr)
+{
+	struct xio_statistics	*stats;
+	struct xio_session_hdr	hdr;
+	struct xio_task		*task, *next_task;
+	struct xio_vmsg		*vmsg;
+	struct xio_msg		*pmsg;
+	LIST_HEAD(tasks);
+	uint64_t		timestamp;
+	int			i, n, retval = 0;
+
+	if (connection == NULL || msgs == NULL || nr <= 0) {
+		xio_set_error(EINVAL);
+		return -1;
+	}
+
+	/* validate up front, so that a short count only means back pressure */
+	for (i = 0; i < nr; i++) {
+		if (msgs[i] == NULL ||
+		    !xio_session_is_valid_in_req(connection->session, msgs[i]) ||
+		    !xio_session_is_valid_out_msg(connection->session,
+						  msgs[i])) {
+			ERROR_LOG("invalid message in batch, index:%d\n", i);
+			xio_set_error(EINVAL);
+			return -1;
+		}
+	}
+
+	if (unlikely((connection->state != XIO_CONNECTION_STATE_ONLINE &&
+		      connection->state != XIO_CONNECTION_STATE_ESTABLISHED &&
+		      connection->state != XIO_CONNECTION_STATE_INIT) ||
+		     connection->in_close)) {
+		xio_set_error(ESHUTDOWN);
+		return -1;
+	}
+
+	if (unlikely(!xio_is_connection_online(connection))) {
+		xio_set_error(EAGAIN);
+		return -1;
+	}
+
+	/* keep ordering with requests queued by xio_send_request */
+	if (!xio_connection_reqs_empty(connection)) {
+		if (xio_connection_xmit(connection))
+			return -1;
+		if (!xio_connection_reqs_empty(connection))
+			return 0;
+	}
+
+	if (connection->app_io_budget < 0)
+		return 0;
+
+	if (xio_connection_tx_throttle(connection))
+		return 0;
+
+	/* find the prefix that may go out now, so that its last message
+	 * closes the batch. the class counters are charged as we go and
+	 * restored below
+	 */
+	for (n = 0; n < nr; n++) {
+		pmsg = msgs[n];
+		if (!xio_connection_class_may_send(
+				connection, XIO_MSG_CLASS(pmsg->flags)))
+			break;
+		connection->class_in_flight[XIO_MSG_CLASS(pmsg->flags)]++;
+		connection->in_flight_reqs_budget--;
+	}
+	for (i = 0; i < n; i++) {
+		connection->class_in_flight[XIO_MSG_CLASS(msgs[i]->flags)]--;
+		connection->in_flight_reqs_budget++;
+	}
+	if (n == 0)
+		return 0;
+
+	n = xio_conn_get_primary_tasks(connection->conn, &tasks, n);
+	if (n == 0) {
+		ERROR_LOG("tasks pool is empty\n");
+		xio_set_error(ENOMEM);
+		return -1;
+	}
+
+	stats = &connection->ctx->stats;
+	timestamp = get_cycles();
+
+	for (i = 0; i < n; i++) {
+		pmsg = msgs[i];
+
+		pmsg->timer.parent	= NULL;
+		pmsg->timestamp		= timestamp;
+		pmsg->sn		= xio_session_get_sn(connection->session);
+		pmsg->type		= XIO_MSG_TYPE_REQ;
+		/* let the transport post the whole batch at once */
+		pmsg->more_in_batch	= (i < n - 1);
+
+		task = list_first_entry(&tasks, struct xio_task,
+					tasks_list_entry);
+		list_move_tail(&task->tasks_list_entry,
+			       &connection->pre_send_list);
+
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.serial_num = pmsg->sn;
+		retval = xio_connection_send_task(connection, pmsg, task, &hdr);
+		if (retval != 0) {
+			/* the transport posts what it queued before a refused
+			 * message
+			 */
+			ERROR_LOG("failed to send message - %s\n",
+				  xio_strerror(-retval));
+			xio_tasks_pool_put(task);
+			break;
+		}
+
+		vmsg = &pmsg->out;
+		xio_stat_inc(stats, XIO_STAT_TX_MSG);
+		xio_stat_add(stats, XIO_STAT_TX_BYTES,
+			     vmsg->header.iov_len +
+			     xio_iovex_length(vmsg->data_iov,
+					      vmsg->data_iovlen));
+
+		xio_msg_list_insert_tail(&connection->in_flight_reqs_msgq,
+					 pmsg, pdata);
+		xio_connection_arm_deadline(connection, pmsg);
+		pmsg->timer.in_flight = 1;
+	}
+
+	/* return the tasks that were not used */
+	list_for_each_entry_safe(task, next_task, &tasks, tasks_list_entry)
+		xio_tasks_pool_put(task);
+
+	if (i == 0) {
+		xio_set_error(-retval);
+		return -1;
+	}
+
+	return i;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_send_response							     */
 /*---------------------------------------------------------------------------*/
@@ -855,6 +1807,9 @@ int xio_send_msg(struct xio_connection *connection,
 		return -1;
 	}
 
+	if (xio_connection_tx_throttle(connection))
+		return -1;
+
 	while (pmsg) {
 		valid = xio_session_is_valid_out_msg(connection->session, pmsg);
 		if (!valid) {
@@ -888,7 +1843,11 @@ int xio_send_msg(struct xio_connection *connection,
 		pmsg->sn = xio_session_get_sn(connection->session);
 		pmsg->type = XIO_ONE_WAY_REQ;
 
-		xio_msg_list_insert_tail(&connection->reqs_msgq, pmsg, pdata);
+		xio_msg_list_insert_tail(xio_connection_reqs_q(connection, pmsg),
+					 pmsg, pdata);
+		xio_connection_reqs_queued(connection, pmsg);
+		/* one way messages have no deadline, only reset the timer */
+		xio_connection_arm_deadline(connection, pmsg);
 
 		pmsg = pmsg->next;
 	}
@@ -900,6 +1859,17 @@ int xio_send_msg(struct xio_connection *connection,
 	return 0;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_connection_outstanding						     */
+/*---------------------------------------------------------------------------*/
+int xio_connection_outstanding(struct xio_connection *connection)
+{
+	/* queued plus posted and not yet answered */
+	return connection->reqs_queued_nr +
+	       (XIO_CONNECTION_INFLIGHT_BUDGET -
+		connection->in_flight_reqs_budget);
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_connection_xmit_msgs						     */
 /*---------------------------------------------------------------------------*/
@@ -924,11 +1894,16 @@ static void xio_connection_release(struct kref *kref)
 	struct xio_connection *connection = container_of(kref,
 							 struct xio_connection,
 							 kref);
+	struct xio_timed_out *tmo, *tmp_tmo;
 
 	if (xio_is_work_pending(&connection->hello_work))
 		xio_ctx_del_work(connection->ctx,
 				 &connection->hello_work);
 
+	if (xio_is_work_pending(&connection->resume_work))
+		xio_ctx_del_work(connection->ctx,
+				 &connection->resume_work);
+
 	if (xio_is_delayed_work_pending(&connection->fin_delayed_work))
 		xio_ctx_del_delayed_work(connection->ctx,
 					&connection->fin_delayed_work);
@@ -937,8 +1912,30 @@ static void xio_connection_release(struct kref *kref)
 		xio_ctx_del_work(connection->ctx,
 				 &connection->fin_work);
 
+	xio_ctx_remove_event(connection->ctx, &connection->batch_event);
+	xio_ctx_remove_event(connection->ctx, &connection->tx_ready_event);
+	if (connection->tx_scheduled)
+		list_del_init(&connection->tx_sched_entry);
+
+	if (xio_is_delayed_work_pending(&connection->deadline_work))
+		xio_ctx_del_delayed_work(connection->ctx,
+					 &connection->deadline_work);
+
+	if (xio_is_delayed_work_pending(&connection->hedge_work))
+		xio_ctx_del_delayed_work(connection->ctx,
+					 &connection->hedge_work);
+	xio_ctx_remove_event(connection->ctx, &connection->hedge_event);
+
+	list_for_each_entry_safe(tmo, tmp_tmo, &connection->timed_out_list,
+				 entry) {
+		list_del(&tmo->entry);
+		kfree(tmo);
+	}
+
 	xio_free_ow_msg_pool(connection);
+	xio_ctx_conn_cache_del(connection->ctx, connection);
 	list_del(&connection->ctx_list_entry);
+	connection->ctx->connections_nr--;
 
 	kfree(connection);
 }
@@ -1012,6 +2009,63 @@ int xio_release_response(struct xio_msg *msg)
 	return 0;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_release_response_batch						     */
+/*---------------------------------------------------------------------------*/
+int xio_release_response_batch(struct xio_msg **msgs, int nr)
+{
+	struct xio_task		*task;
+	struct xio_connection	*connection = NULL;
+	int			i, err, retval = 0;
+
+	if (msgs == NULL || nr < 0) {
+		xio_set_error(EINVAL);
+		return -1;
+	}
+
+	/* validate up front so that the batch is released all or nothing */
+	for (i = 0; i < nr; i++) {
+		if (msgs[i] == NULL || msgs[i]->request == NULL) {
+			xio_set_error(EINVAL);
+			return -1;
+		}
+		task = container_of(msgs[i]->request, struct xio_task, imsg);
+		if (task->sender_task == NULL) {
+			/* do not release response in responder */
+			xio_set_error(EINVAL);
+			return -1;
+		}
+	}
+
+	/* the transmit queue is kicked when the connection changes, so
+	 * responses grouped by connection cost one kick per connection.
+	 * the first kick error is returned, the rest are still released
+	 */
+	for (i = 0; i < nr; i++) {
+		task = container_of(msgs[i]->request, struct xio_task, imsg);
+		if (connection && connection != task->connection &&
+		    xio_is_connection_online(connection)) {
+			err = xio_connection_xmit(connection);
+			if (err && !retval)
+				retval = err;
+		}
+
+		connection = task->connection;
+		connection->app_io_budget++;
+		list_move_tail(&task->tasks_list_entry,
+			       &connection->post_io_tasks_list);
+
+		xio_release_response_task(task);
+	}
+	if (connection && xio_is_connection_online(connection)) {
+		err = xio_connection_xmit(connection);
+		if (err && !retval)
+			retval = err;
+	}
+
+	return retval;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_release_msg							     */
 /*---------------------------------------------------------------------------*/
@@ -1078,7 +2132,8 @@ static int xio_send_fin_req(struct xio_connection *connection)
 
 
 	/* insert to the tail of the queue */
-	xio_msg_list_insert_tail(&connection->reqs_msgq, msg, pdata);
+	xio_msg_list_insert_tail(xio_connection_reqs_q(connection, msg),
+				 msg, pdata);
 
 	TRACE_LOG("send fin request. session:%p, connection:%p\n",
 		  connection->session, connection);
@@ -1222,34 +2277,25 @@ int xio_disconnect(struct xio_connection *connection)
 int xio_cancel_request(struct xio_connection *connection,
 		       struct xio_msg *req)
 {
+	struct xio_msg_list *msgq = xio_connection_reqs_q(connection, req);
 	struct xio_msg *pmsg, *tmp_pmsg;
-	uint64_t	stag;
-	struct xio_session_cancel_hdr hdr;
-
 
 	/* search the tx */
-	xio_msg_list_foreach_safe(pmsg, &connection->reqs_msgq,
-				  tmp_pmsg, pdata) {
+	xio_msg_list_foreach_safe(pmsg, msgq, tmp_pmsg, pdata) {
 		if (pmsg->sn == req->sn) {
 			ERROR_LOG("[%llu] - message found on reqs_msgq\n",
 				  req->sn);
-			xio_msg_list_remove(&connection->reqs_msgq,
-					    pmsg, pdata);
+			xio_msg_list_remove(msgq, pmsg, pdata);
+			xio_connection_reqs_dequeued(connection, pmsg);
+			xio_connection_disarm_deadline(connection, pmsg);
 			xio_session_notify_cancel(
 				connection, pmsg, XIO_E_MSG_CANCELED);
 			return 0;
 		}
 	}
-	hdr.sn			 = htonll(req->sn);
-	hdr.requester_session_id =
-		htonl(connection->session->session_id);
-	hdr.responder_session_id =
-		htonl(connection->session->peer_session_id);
-	stag			 =
-		uint64_from_ptr(connection->session);
-
-	/* cancel request on tx */
-	xio_conn_cancel_req(connection->conn, req, stag, &hdr, sizeof(hdr));
+	/* the application took over, the deadline no longer applies */
+	xio_connection_disarm_deadline(connection, req);
+	xio_connection_send_cancel(connection, req);
 
 	return 0;
 }
@@ -1320,15 +2366,62 @@ int xio_modify_connection(struct xio_connection *connection,
 		       struct xio_connection_attr *attr,
 		       int attr_mask)
 {
+	uint64_t	reserved = 0;
+	int		i;
+
 	if (!connection || !attr) {
 		xio_set_error(EINVAL);
 		ERROR_LOG("invalid parameters\n");
 		return -1;
 	}
 
+	if (attr_mask & XIO_CONNECTION_ATTR_WATERMARKS) {
+		if (attr->tx_high_watermark &&
+		    attr->tx_low_watermark >= attr->tx_high_watermark) {
+			xio_set_error(EINVAL);
+			ERROR_LOG("low watermark must be below high watermark\n");
+			return -1;
+		}
+	}
+
+	if (attr_mask & XIO_CONNECTION_ATTR_QOS) {
+		for (i = 0; i < XIO_MAX_MSG_CLASSES; i++)
+			reserved += attr->tx_class_reserve[i];
+		if (reserved > XIO_CONNECTION_INFLIGHT_BUDGET) {
+			xio_set_error(EINVAL);
+			ERROR_LOG("class reservations exceed %d requests\n",
+				  XIO_CONNECTION_INFLIGHT_BUDGET);
+			return -1;
+		}
+	}
+
 	if (attr_mask & XIO_CONNECTION_ATTR_USER_CTX)
 		connection->cb_user_context = attr->user_context;
 
+	if (attr_mask & XIO_CONNECTION_ATTR_WATERMARKS) {
+		connection->tx_high_watermark = attr->tx_high_watermark;
+		connection->tx_low_watermark  = attr->tx_low_watermark;
+		/* new marks may already release a throttled producer */
+		xio_connection_tx_ready_check(connection);
+	}
+
+	if (attr_mask & XIO_CONNECTION_ATTR_QOS) {
+		for (i = 0; i < XIO_MAX_MSG_CLASSES; i++) {
+			connection->class_quantum[i] =
+				attr->tx_class_quantum[i];
+			connection->class_reserve[i] =
+				attr->tx_class_reserve[i];
+			connection->class_deficit[i] = 0;
+		}
+		connection->class_reserved = reserved;
+		connection->drr_new_turn = 1;
+	}
+
+	if (attr_mask & XIO_CONNECTION_ATTR_TX_SCHED) {
+		connection->tx_quantum = attr->tx_quantum;
+		connection->tx_deficit = attr->tx_quantum;
+	}
+
 	return 0;
 }
 
@@ -1339,6 +2432,8 @@ int xio_query_connection(struct xio_connection *connection,
 		       struct xio_connection_attr *attr,
 		       int attr_mask)
 {
+	int i;
+
 	if (!connection || !attr) {
 		xio_set_error(EINVAL);
 		ERROR_LOG("invalid parameters\n");
@@ -1350,6 +2445,39 @@ int xio_query_connection(struct xio_connection *connection,
 	if (attr_mask & XIO_CONNECTION_ATTR_CTX)
 		attr->ctx = connection->ctx;
 
+	if (attr_mask & XIO_CONNECTION_ATTR_WATERMARKS) {
+		attr->tx_high_watermark = connection->tx_high_watermark;
+		attr->tx_low_watermark  = connection->tx_low_watermark;
+	}
+
+	if (attr_mask & XIO_CONNECTION_ATTR_TX_QUEUE) {
+		attr->tx_queued_msgs	= connection->reqs_queued_nr;
+		attr->tx_in_flight_msgs	=
+			(XIO_CONNECTION_INFLIGHT_BUDGET -
+			 connection->in_flight_reqs_budget) +
+			(XIO_CONNECTION_INFLIGHT_BUDGET -
+			 connection->in_flight_sends_budget);
+	}
+
+	if (attr_mask & XIO_CONNECTION_ATTR_QOS) {
+		for (i = 0; i < XIO_MAX_MSG_CLASSES; i++) {
+			attr->tx_class_quantum[i] =
+				connection->class_quantum[i];
+			attr->tx_class_reserve[i] =
+				connection->class_reserve[i];
+		}
+	}
+
+	if (attr_mask & XIO_CONNECTION_ATTR_TX_SCHED)
+		attr->tx_quantum = connection->tx_quantum;
+
+	if (attr_mask & XIO_CONNECTION_ATTR_TX_STATS) {
+		attr->tx_service_bytes	  = connection->tx_service_bytes;
+		attr->tx_service_msgs	  = connection->tx_service_msgs;
+		attr->tx_service_turns	  = connection->tx_service_turns;
+		attr->tx_service_deferred = connection->tx_service_deferred;
+	}
+
 	return 0;
 }
 
@@ -1367,9 +2495,14 @@ int xio_connection_send_hello_req(struct xio_connection *connection)
 	msg = xio_msg_list_first(&connection->one_way_msg_pool);
 	xio_msg_list_remove(&connection->one_way_msg_pool, msg, pdata);
 
+	/* the server lets in only the client it accepted */
+	xio_write_uint64(connection->session->token, 0,
+			 (uint8_t *)&connection->hello_token);
+
 	msg->type		= XIO_CONNECTION_HELLO_REQ;
 	msg->in.header.iov_len	= 0;
-	msg->out.header.iov_len	= 0;
+	msg->out.header.iov_base = &connection->hello_token;
+	msg->out.header.iov_len	= sizeof(connection->hello_token);
 	msg->in.data_iovlen	= 0;
 	msg->out.data_iovlen	= 0;
 
@@ -1450,6 +2583,8 @@ int xio_connection_post_destroy(struct xio_connection *connection)
 		  session->connections_nr);
 
 
+	/* hand over whatever was gathered before tearing down */
+	xio_connection_flush_batch(connection);
 	xio_connection_flush_tasks(connection);
 
 	/* remove the connection from the session's connections list */
@@ -1469,7 +2604,11 @@ int xio_connection_post_destroy(struct xio_connection *connection)
 		TRACE_LOG("redirected connection is closed\n");
 	} else {
 		spin_lock(&session->connections_list_lock);
-		if (session->connections_nr == 1)  {
+		/* a resumable session outlives its connections for a
+		 * grace period
+		 */
+		if (session->connections_nr == 1 &&
+		    !xio_is_delayed_work_pending(&session->resume_work)) {
 			session->state = XIO_SESSION_STATE_CLOSING;
 			destroy_session = 1;
 		}
@@ -1566,6 +2705,9 @@ int xio_connection_disconnected(struct xio_connection *connection)
 	/* flush all messages from in flight message queue to in queue */
 	xio_connection_flush_msgs(connection);
 
+	/* a resumable session keeps the requests for a new connection */
+	xio_session_resume_park(connection);
+
 	/* flush all messages back to user */
 	xio_connection_notify_msgs_flush(connection);
 
@@ -60,6 +60,24 @@ enum xio_connection_state {
 #define		SEND_ACK	0x0001
 #define		SEND_FIN	0x0002
 
+/* what became of a request that timed out in flight */
+enum xio_timed_out_event {
+	XIO_TIMED_OUT_RSP_PART,		/* a response part, more follow */
+	XIO_TIMED_OUT_RSP,		/* the last response part */
+	XIO_TIMED_OUT_CANCELED,		/* the peer dropped the request */
+	XIO_TIMED_OUT_CANCEL_FAILED,	/* the peer answers it anyway */
+};
+
+/* max messages handed to the vectorized callbacks in one call */
+#define XIO_CONNECTION_MSGS_BATCH	64
+
+/* request deadlines wheel: slots of one tick each, must be power of 2 */
+#define XIO_DEADLINE_SLOTS		64
+#define XIO_DEADLINE_TICK_MS		1
+
+/* default DRR quantum of the non strict transmit classes */
+#define XIO_CLASS_DEFAULT_QUANTUM	65536
+
 
 struct xio_transition {
 	int				valid;
@@ -90,7 +108,7 @@ struct xio_connection {
 	int				is_flushed;
 	int				pad;
 	struct kref			kref;
-	struct xio_msg_list		reqs_msgq;
+	struct xio_msg_list		reqs_msgq[XIO_MAX_MSG_CLASSES];
 	struct xio_msg_list		rsps_msgq;
 	struct xio_msg_list		in_flight_reqs_msgq;
 	struct xio_msg_list		in_flight_rsps_msgq;
@@ -98,6 +116,7 @@ struct xio_connection {
 	struct xio_msg_list		one_way_msg_pool;
 	struct xio_msg			*msg_array;
 	xio_work_handle_t		hello_work;
+	xio_work_handle_t		resume_work;
 	xio_work_handle_t		fin_work;
 	xio_delayed_work_handle_t	fin_delayed_work;
 
@@ -106,6 +125,64 @@ struct xio_connection {
 	struct list_head		pre_send_list;
 	struct list_head		connections_list_entry;
 	struct list_head		ctx_list_entry;
+
+	/* messages gathered for on_msgs / on_msgs_send_complete */
+	int				rx_batch_nr;
+	int				tx_comp_batch_nr;
+	struct xio_msg			*rx_batch[XIO_CONNECTION_MSGS_BATCH];
+	struct xio_task			*tx_comp_batch[XIO_CONNECTION_MSGS_BATCH];
+	xio_ctx_event_t			batch_event;
+
+	/* backpressure on the requests queue */
+	int				reqs_queued_nr;
+	int				tx_throttled;
+	uint32_t			tx_high_watermark;
+	uint32_t			tx_low_watermark;
+	xio_ctx_event_t			tx_ready_event;
+
+	/* request deadlines */
+	uint32_t			deadline_tick;
+	int				deadlines_nr;
+	xio_delayed_work_handle_t	deadline_work;
+	struct list_head		timed_out_list;
+	struct xio_msg_list		deadlines[XIO_DEADLINE_SLOTS];
+
+	/* requests transmit classes */
+	int				drr_cur;
+	int				drr_new_turn;
+	int				class_reserved;
+	int				pad1;
+	uint32_t			class_quantum[XIO_MAX_MSG_CLASSES];
+	int64_t				class_deficit[XIO_MAX_MSG_CLASSES];
+	int				class_reserve[XIO_MAX_MSG_CLASSES];
+	int				class_in_flight[XIO_MAX_MSG_CLASSES];
+
+	/* context transmit scheduler */
+	int				tx_scheduled;
+	uint32_t			tx_quantum;
+	int64_t				tx_deficit;
+	struct list_head		tx_sched_entry;
+	uint64_t			tx_service_bytes;
+	uint64_t			tx_service_msgs;
+	uint64_t			tx_service_turns;
+	uint64_t			tx_service_deferred;
+
+	/* response time moving average, in cycles */
+	uint64_t			rtt_ewma;
+
+	/* hedged requests waiting for their duplicate or winners' answers
+	 * held until the losing copy is cancelled or answered
+	 */
+	struct list_head		hedge_list;
+	xio_delayed_work_handle_t	hedge_work;
+	uint64_t			hedge_due;	/* hedge_work expiry */
+	xio_ctx_event_t			hedge_event;
+
+	/* striped requests holding an answer received here */
+	struct list_head		stripe_list;
+
+	/* the session token as the hello request carries it */
+	uint64_t			hello_token;
 };
 
 struct xio_connection *xio_connection_init(
@@ -134,6 +211,19 @@ int xio_connection_send(struct xio_connection *conn,
 
 int xio_connection_xmit_msgs(struct xio_connection *conn);
 
+int xio_connection_outstanding(struct xio_connection *conn);
+
+static inline void xio_connection_rtt_sample(struct xio_connection *conn,
+					     uint64_t rtt)
+{
+	/* ewma with weight 1/8, the first sample seeds it */
+	if (conn->rtt_ewma == 0)
+		conn->rtt_ewma = rtt;
+	else
+		conn->rtt_ewma = conn->rtt_ewma - (conn->rtt_ewma >> 3) +
+				 (rtt >> 3);
+}
+
 void xio_connection_queue_io_task(struct xio_connection *connection,
 				    struct xio_task *task);
 
@@ -186,6 +276,18 @@ int xio_connection_flush_tasks(struct xio_connection *connection);
 
 int xio_connection_notify_msgs_flush(struct xio_connection *conn);
 
+/*---------------------------------------------------------------------------*/
+/* xio_connection_detach_msgs						     */
+/*---------------------------------------------------------------------------*/
+int xio_connection_detach_msgs(struct xio_connection *connection,
+			       struct xio_msg_list *msgq);
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_attach_msgs						     */
+/*---------------------------------------------------------------------------*/
+int xio_connection_attach_msgs(struct xio_connection *connection,
+			       struct xio_msg_list *msgq);
+
 int xio_connection_remove_in_flight(struct xio_connection *conn,
 				    struct xio_msg *msg);
 
@@ -208,6 +310,20 @@ int xio_connection_release_hello(struct xio_connection *conn,
 
 char *xio_connection_state_str(enum xio_connection_state state);
 
+void xio_connection_queue_rx_msg(struct xio_connection *connection,
+				 struct xio_msg *msg);
+
+void xio_connection_queue_tx_comp(struct xio_connection *connection,
+				  struct xio_task *task);
+
+void xio_connection_flush_batch(struct xio_connection *connection);
+
+int xio_connection_timed_out(struct xio_connection *connection,
+			     uint64_t sn, enum xio_timed_out_event event);
+
+int xio_connection_timed_out_msg(struct xio_connection *connection,
+				 struct xio_msg *msg);
+
 
 #endif /*XIO_CONNECTION_H */
 
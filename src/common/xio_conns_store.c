@@ -45,6 +45,8 @@
 
 static HT_HEAD(, xio_conn, HASHTABLE_PRIME_SMALL)  conns_store;
 static spinlock_t cs_lock;
+/* closed conns whose primary pool waits for a successor */
+static struct list_head kept_list;
 
 /*---------------------------------------------------------------------------*/
 /* xio_conns_store_add				                             */
@@ -133,6 +135,14 @@ struct xio_conn *xio_conns_store_find(
 
 	spin_lock(&cs_lock);
 	HT_FOREACH(conn, &conns_store, conns_htbl) {
+		/* pooled conns are taken from the pool, never shared */
+		if (conn->is_prewarmed)
+			continue;
+		/* dropped conns wait for release, never hand them out */
+		if (conn->state != XIO_CONN_STATE_OPEN &&
+		    conn->state != XIO_CONN_STATE_CONNECTING &&
+		    conn->state != XIO_CONN_STATE_CONNECTED)
+			continue;
 		if (conn->transport_hndl->portal_uri) {
 			if (
 		(strcmp(conn->transport_hndl->portal_uri, portal_uri) == 0) &&
@@ -146,6 +156,50 @@ struct xio_conn *xio_conns_store_find(
 	return  NULL;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_conns_store_keep				                             */
+/*---------------------------------------------------------------------------*/
+void xio_conns_store_keep(struct xio_conn *conn)
+{
+	spin_lock(&cs_lock);
+	list_add_tail(&conn->kept_list_entry, &kept_list);
+	spin_unlock(&cs_lock);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_conns_store_unkeep			                             */
+/*---------------------------------------------------------------------------*/
+void xio_conns_store_unkeep(struct xio_conn *conn)
+{
+	spin_lock(&cs_lock);
+	list_del_init(&conn->kept_list_entry);
+	spin_unlock(&cs_lock);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_conns_store_take_kept			                             */
+/*---------------------------------------------------------------------------*/
+struct xio_conn *xio_conns_store_take_kept(
+		struct xio_context *ctx,
+		struct xio_tasks_pool_ops *pool_ops,
+		int max)
+{
+	struct xio_conn *conn;
+
+	spin_lock(&cs_lock);
+	list_for_each_entry(conn, &kept_list, kept_list_entry) {
+		if (conn->kept_ctx == ctx &&
+		    conn->primary_pool_ops == pool_ops &&
+		    conn->primary_tasks_pool->max == max) {
+			list_del_init(&conn->kept_list_entry);
+			spin_unlock(&cs_lock);
+			return conn;
+		}
+	}
+	spin_unlock(&cs_lock);
+	return  NULL;
+}
+
 /*---------------------------------------------------------------------------*/
 /* conns_store_construct				                     */
 /*---------------------------------------------------------------------------*/
@@ -153,6 +207,7 @@ void conns_store_construct(void)
 {
 	HT_INIT(&conns_store, xio_int32_hash, xio_int32_cmp, xio_int32_cp);
 	spin_lock_init(&cs_lock);
+	INIT_LIST_HEAD(&kept_list);
 }
 
 /*
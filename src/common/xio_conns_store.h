@@ -44,6 +44,7 @@
 /*---------------------------------------------------------------------------*/
 struct xio_conn_mgr;
 struct xio_conn;
+struct xio_tasks_pool_ops;
 
 struct xio_session;
 
@@ -66,6 +67,17 @@ struct xio_conn *xio_conns_store_find(
 		struct xio_context *ctx,
 		const char *portal_uri);
 
+void xio_conns_store_keep(
+		struct xio_conn *conn);
+
+void xio_conns_store_unkeep(
+		struct xio_conn *conn);
+
+struct xio_conn *xio_conns_store_take_kept(
+		struct xio_context *ctx,
+		struct xio_tasks_pool_ops *pool_ops,
+		int max);
+
 
 #endif /*XIO_CONNECTIONS_STORE_H */
 
@@ -45,6 +45,12 @@
 #define xio_ctx_delayed_work_t  xio_delayed_work_handle_t
 #define xio_ctx_event_t xio_ev_data_t
 
+/* slots of the connection lookup cache, a power of 2 */
+#define XIO_CTX_CONN_CACHE_SIZE		64
+
+/* default bound of the prewarm pool, see xio_conn_prewarm */
+#define XIO_CTX_PREWARM_MAX		4
+
 /*---------------------------------------------------------------------------*/
 /* enum									     */
 /*---------------------------------------------------------------------------*/
@@ -73,6 +79,8 @@ struct xio_statistics {
 	char		*name[XIO_STAT_LAST];
 };
 
+struct xio_connection;
+
 struct xio_context {
 	void				*ev_loop;
 	int				cpuid;
@@ -84,6 +92,22 @@ struct xio_context {
 	void				*user_context;
 	struct xio_workqueue		*workqueue;
 	struct list_head		ctx_list;  /* per context storage */
+	/* ctx_list entries by session and conn, checked on every hit */
+	struct xio_connection		*conn_cache[XIO_CTX_CONN_CACHE_SIZE];
+	/* connections waiting for their transmit turn */
+	struct list_head		tx_sched_list;
+	xio_ctx_event_t			tx_sched_event;
+	/* load as seen by xio_portals_balancer, read by other threads */
+	volatile int			connections_nr;
+	/* completion vector for new cqs, -1 - by irq affinity */
+	int				comp_vector;
+	/* vector of the last cq created, -1 before */
+	int				cq_comp_vector;
+	/* conns opened ahead of sessions, and their bound */
+	int				prewarm_max;
+	int				prewarm_nr;
+	int				pad;
+	struct list_head		prewarm_list;
 
 	/* list of sessions using this connection */
 	struct xio_observable		observable;
@@ -103,6 +127,20 @@ int xio_context_reg_observer(struct xio_context *context,
 void xio_context_unreg_observer(struct xio_context *conn,
 				struct xio_observer *observer);
 
+/*---------------------------------------------------------------------------*/
+/* xio_ctx_conn_cache_del						     */
+/*---------------------------------------------------------------------------*/
+static inline void xio_ctx_conn_cache_del(struct xio_context *ctx,
+					  struct xio_connection *connection)
+{
+	int i;
+
+	for (i = 0; i < XIO_CTX_CONN_CACHE_SIZE; i++) {
+		if (ctx->conn_cache[i] == connection)
+			ctx->conn_cache[i] = NULL;
+	}
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_add_counter							     */
 /*---------------------------------------------------------------------------*/
@@ -196,6 +234,17 @@ void xio_ctx_remove_event(struct xio_context *ctx,
 			  xio_ctx_event_t *evt);
 
 
+/*---------------------------------------------------------------------------*/
+/* xio_context_busy_cycles						     */
+/*---------------------------------------------------------------------------*/
+uint64_t xio_context_busy_cycles(struct xio_context *ctx);
+
+/*---------------------------------------------------------------------------*/
+/* xio_connection_tx_sched_handler					     */
+/*---------------------------------------------------------------------------*/
+/* services the connections on tx_sched_list, lives in the connection layer */
+void xio_connection_tx_sched_handler(xio_ctx_event_t *tev, void *data);
+
 /*---------------------------------------------------------------------------*/
 /* xio_context_is_loop_stopping						     */
 /*---------------------------------------------------------------------------*/
@@ -93,7 +93,7 @@ static int xio_on_new_message(struct xio_server *server,
 	struct xio_session		*session;
 	struct xio_connection		*connection;
 	struct xio_task			*task = event_data->msg.task;
-
+	uint64_t			token;
 
 	struct xio_session_attr attr = {
 		&server->ops,
@@ -153,6 +153,17 @@ static int xio_on_new_message(struct xio_server *server,
 				  "session not found\n");
 			return -1;
 		}
+		/* only the client the session was accepted for may join */
+		token = 0;
+		if (task->imsg.in.header.iov_len == sizeof(token))
+			xio_read_uint64(&token, 0,
+					task->imsg.in.header.iov_base);
+		if (token != session->token) {
+			ERROR_LOG("server [new connection]: bad token. " \
+				  "session:%p, conn:%p\n", session, conn);
+			xio_tasks_pool_put(task);
+			return -1;
+		}
 		task->session = session;
 
 		DEBUG_LOG("server [new connection]: server:%p, " \
@@ -174,6 +185,8 @@ static int xio_on_new_message(struct xio_server *server,
 		session->state = XIO_SESSION_STATE_ONLINE;
 		xio_connection_set_state(connection,
 					 XIO_CONNECTION_STATE_ONLINE);
+		/* a resumed session sends what the dropped one left */
+		xio_session_resume_replay(connection);
 	} else {
 		ERROR_LOG("server unexpected message\n");
 		return -1;
@@ -193,6 +206,29 @@ cleanup:
 	return -1;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_on_data_chunk							     */
+/*---------------------------------------------------------------------------*/
+static int xio_on_data_chunk(struct xio_server *server,
+			     struct xio_conn *conn,
+			     int event,
+			     union xio_conn_event_data *event_data)
+{
+	struct xio_session	*session;
+
+	/* the session was already created on buffer assignment */
+	session = xio_find_session(event_data->chunk.task);
+	if (session == NULL) {
+		ERROR_LOG("server: session not found. dropping chunk\n");
+		return -1;
+	}
+
+	/* route the chunk to the session */
+	xio_conn_notify_observer(conn, &session->observer, event, event_data);
+
+	return 0;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_on_conn_event				                             */
 /*---------------------------------------------------------------------------*/
@@ -217,6 +253,9 @@ static int xio_on_conn_event(void *observer, void *notifier, int event,
 		xio_on_new_conn(server, conn, event_data);
 		break;
 
+	case XIO_CONN_EVENT_DATA_CHUNK:
+		xio_on_data_chunk(server, conn, event, event_data);
+		break;
 	case XIO_CONN_EVENT_DISCONNECTED:
 	case XIO_CONN_EVENT_CLOSED:
 	case XIO_CONN_EVENT_ESTABLISHED:
@@ -317,3 +356,196 @@ int xio_unbind(struct xio_server *server)
 }
 
 
+
+/*---------------------------------------------------------------------------*/
+/* portals balancer							     */
+/*---------------------------------------------------------------------------*/
+#define XIO_BALANCER_MAX_PORTALS	64
+/* load points per open connection, a fully busy loop counts 1000 */
+#define XIO_BALANCER_CONN_LOAD		50
+
+struct xio_portal_load {
+	struct xio_context		*ctx;
+	char				*uri;
+	uint64_t			last_busy;
+	cycles_t			last_stamp;
+	uint64_t			score;
+	uint32_t			busy_permille;
+	int				last_connections;
+	int				pending;
+	int				pad;
+};
+
+struct xio_portals_balancer {
+	int				portals_nr;
+	int				pad;
+	struct xio_portal_load		portals[XIO_BALANCER_MAX_PORTALS];
+};
+
+/*---------------------------------------------------------------------------*/
+/* xio_portals_balancer_create						     */
+/*---------------------------------------------------------------------------*/
+struct xio_portals_balancer *xio_portals_balancer_create(void)
+{
+	struct xio_portals_balancer *balancer;
+
+	balancer = kcalloc(1, sizeof(*balancer), GFP_KERNEL);
+	if (balancer == NULL) {
+		xio_set_error(ENOMEM);
+		ERROR_LOG("failed to allocate portals balancer\n");
+		return NULL;
+	}
+
+	return balancer;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_portals_balancer_destroy						     */
+/*---------------------------------------------------------------------------*/
+void xio_portals_balancer_destroy(struct xio_portals_balancer *balancer)
+{
+	int i;
+
+	if (balancer == NULL)
+		return;
+
+	for (i = 0; i < balancer->portals_nr; i++)
+		kfree(balancer->portals[i].uri);
+	kfree(balancer);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_portals_balancer_add						     */
+/*---------------------------------------------------------------------------*/
+int xio_portals_balancer_add(struct xio_portals_balancer *balancer,
+			     struct xio_context *ctx,
+			     const char *portal)
+{
+	struct xio_portal_load *load;
+
+	if (balancer == NULL || ctx == NULL || portal == NULL) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid parameters\n");
+		return -1;
+	}
+	if (balancer->portals_nr == XIO_BALANCER_MAX_PORTALS) {
+		xio_set_error(ENOSPC);
+		ERROR_LOG("balancer is limited to %d portals\n",
+			  XIO_BALANCER_MAX_PORTALS);
+		return -1;
+	}
+
+	load = &balancer->portals[balancer->portals_nr];
+	load->uri = kstrdup(portal, GFP_KERNEL);
+	if (load->uri == NULL) {
+		xio_set_error(ENOMEM);
+		ERROR_LOG("failed to allocate portal\n");
+		return -1;
+	}
+	load->ctx		= ctx;
+	load->last_busy		= xio_context_busy_cycles(ctx);
+	load->last_stamp	= get_cycles();
+	load->last_connections	= ctx->connections_nr;
+	balancer->portals_nr++;
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_portal_load_update						     */
+/*---------------------------------------------------------------------------*/
+static void xio_portal_load_update(struct xio_portal_load *load)
+{
+	struct xio_context	*ctx = load->ctx;
+	uint64_t		busy = xio_context_busy_cycles(ctx);
+	cycles_t		now = get_cycles();
+	int64_t			outstanding;
+	uint64_t		permille;
+	int			connections = ctx->connections_nr;
+
+	/* smoothed share of the interval the loop was not waiting */
+	if (now > load->last_stamp) {
+		permille = (busy - load->last_busy) * 1000 /
+			   (now - load->last_stamp);
+		if (permille > 1000)
+			permille = 1000;
+		load->busy_permille = (load->busy_permille + permille) / 2;
+		load->last_busy  = busy;
+		load->last_stamp = now;
+	}
+
+	/* a connection that showed up settles what was handed out */
+	if (connections != load->last_connections) {
+		load->pending = 0;
+		load->last_connections = connections;
+	}
+
+	/* requests received and not yet answered */
+	outstanding = ctx->stats.counter[XIO_STAT_RX_MSG] -
+		      ctx->stats.counter[XIO_STAT_TX_MSG];
+	if (outstanding < 0)
+		outstanding = 0;
+
+	load->score = load->busy_permille +
+		      XIO_BALANCER_CONN_LOAD * (connections + load->pending) +
+		      outstanding;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_portals_balancer_select						     */
+/*---------------------------------------------------------------------------*/
+int xio_portals_balancer_select(struct xio_portals_balancer *balancer,
+				const char **portals_array,
+				size_t portals_array_len)
+{
+	struct xio_portal_load	*order[XIO_BALANCER_MAX_PORTALS];
+	struct xio_portal_load	*load;
+	int			i, j, nr;
+
+	if (balancer == NULL || portals_array == NULL) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid parameters\n");
+		return -1;
+	}
+
+	/* insertion sort, there are few portals */
+	for (i = 0; i < balancer->portals_nr; i++) {
+		load = &balancer->portals[i];
+		xio_portal_load_update(load);
+		for (j = i; j > 0 && order[j - 1]->score > load->score; j--)
+			order[j] = order[j - 1];
+		order[j] = load;
+	}
+
+	nr = balancer->portals_nr;
+	if (nr > portals_array_len)
+		nr = portals_array_len;
+	for (i = 0; i < nr; i++)
+		portals_array[i] = order[i]->uri;
+
+	/* the lead connection goes to the first portal */
+	if (nr)
+		order[0]->pending++;
+
+	return nr;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_portals_balancer_accept						     */
+/*---------------------------------------------------------------------------*/
+int xio_portals_balancer_accept(struct xio_portals_balancer *balancer,
+				struct xio_session *session,
+				void *user_context,
+				size_t user_context_len)
+{
+	const char	*portals[XIO_BALANCER_MAX_PORTALS];
+	int		nr;
+
+	nr = xio_portals_balancer_select(balancer, portals,
+					 XIO_BALANCER_MAX_PORTALS);
+	if (nr < 0)
+		return -1;
+
+	return xio_accept(session, nr ? portals : NULL, nr,
+			  user_context, user_context_len);
+}
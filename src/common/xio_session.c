@@ -50,6 +50,73 @@
 #include "xio_connection.h"
 #include "xio_session_priv.h"
 
+/* a hedged request: the application request stays off the wire while up
+ * to two library owned copies race for it
+ */
+enum xio_hedge_state {
+	XIO_HEDGE_STATE_PENDING,	/* first copy out, duplicate not sent */
+	XIO_HEDGE_STATE_RACING,		/* no answer yet */
+	XIO_HEDGE_STATE_DONE,		/* answered, the loser is cancelled */
+};
+
+struct xio_hedge {
+	struct xio_msg			*req;
+	struct xio_connection		*conn[2];
+	struct list_head		entry;
+	enum xio_hedge_state		state;
+	int				outstanding;
+	/* the winner's answer, held until the loser is done with req */
+	struct xio_task			*rsp_task;
+	/* the loser's cancel went out, its answer is still to come */
+	struct xio_connection		*cancel_conn;
+	struct xio_session_hdr		rsp_hdr;
+	struct xio_msg			copy[2];
+};
+
+/* a stripe sent on a connection of another context. it is posted and
+ * answered on the thread owning that connection, and its outcome is
+ * handed back to the thread owning the request
+ */
+struct xio_stripe_part {
+	struct xio_stripe_set		*set;
+	struct xio_connection		*conn;		/* NULL for local */
+	struct xio_context		*ctx;		/* conn's context */
+	xio_ctx_work_t			work;
+	xio_ctx_event_t			event;
+	enum xio_status			result;
+	int				failed;
+};
+
+/* a striped transfer: sub requests over slices of the request's data */
+struct xio_stripe_set {
+	struct xio_msg			*req;
+	struct xio_session		*session;
+	struct xio_context		*ctx;		/* of the caller */
+	int				in;		/* in data is striped */
+	int				outstanding;
+	enum xio_status			status;		/* first bad answer */
+	enum xio_status			error;		/* first failure */
+	uint64_t			stripe_size;
+	uint64_t			total_len;
+	/* a local answer, held to carry req while remote stripes are out */
+	struct xio_task			*rsp_task;
+	struct list_head		entry;
+	struct xio_session_hdr		rsp_hdr;
+	struct xio_stripe_part		*part;
+	int				remote;		/* stripes sent away */
+	int				pad;
+	struct xio_msg			sub[0];
+};
+
+/* one way message posted to several connections of one context */
+struct xio_fanout {
+	struct xio_msg			*msg;
+	int				*status;	/* per target, optional */
+	int				outstanding;
+	enum xio_status			error;		/* first failure */
+	struct xio_msg			copy[0];
+};
+
 /*---------------------------------------------------------------------------*/
 /* forward declarations							     */
 /*---------------------------------------------------------------------------*/
@@ -61,6 +128,34 @@ static int xio_on_ow_req_send_comp(struct xio_connection *connection,
 				  struct xio_task *task);
 static int xio_on_rsp_send_comp(struct xio_connection *connection,
 				  struct xio_task *task);
+static void xio_session_hedge_sample(struct xio_session *session,
+				     uint64_t rtt);
+static void xio_session_hedge_handler(void *data);
+static void xio_session_hedge_rsp(struct xio_connection *connection,
+				  struct xio_task *task,
+				  const struct xio_session_hdr *hdr);
+static struct xio_msg *xio_session_stripe_rsp(
+		struct xio_connection *connection,
+		struct xio_task *task,
+		struct xio_msg *sub,
+		const struct xio_session_hdr *hdr);
+static void xio_session_stripe_submit(void *data);
+static void xio_session_stripe_post(xio_ctx_event_t *tev, void *data);
+static void xio_session_stripe_done(void *data);
+static int xio_session_stripe_error(struct xio_connection *connection,
+				    struct xio_msg *sub,
+				    enum xio_status result);
+static int xio_session_hedge_error(struct xio_connection *connection,
+				   struct xio_msg *copy,
+				   enum xio_status result);
+static int xio_session_hedge_cancel_rsp(struct xio_connection *connection,
+					uint64_t sn, enum xio_status result);
+static struct xio_msg *xio_session_fanout_comp(
+		struct xio_connection *connection,
+		struct xio_msg *copy,
+		enum xio_status result);
+static void xio_session_forward_done(struct xio_msg *fwd);
+static void xio_session_resume_flush(struct xio_session *session);
 /*---------------------------------------------------------------------------*/
 /* xio_session_alloc_connection						     */
 /*---------------------------------------------------------------------------*/
@@ -149,11 +244,26 @@ struct xio_connection *xio_session_find_connection(
 {
 	struct xio_connection		*connection;
 	struct xio_context		*ctx = conn->transport_hndl->ctx;
+	struct xio_connection		**slot;
+
+	/* every message looks up its connection. the list holds all the
+	 * connections of the context, idle ones included, so remember the
+	 * hot ones
+	 */
+	slot = &ctx->conn_cache[int64_hash((uint64_t)(uintptr_t)session ^
+					   (uint64_t)(uintptr_t)conn) &
+				(XIO_CTX_CONN_CACHE_SIZE - 1)];
+	connection = *slot;
+	if (connection && connection->conn == conn &&
+	    connection->session == session)
+		return connection;
 
 	list_for_each_entry(connection, &ctx->ctx_list, ctx_list_entry) {
 		if (connection->conn == conn &&
-		    connection->session == session)
+		    connection->session == session) {
+			*slot = connection;
 			return connection;
+		}
 	}
 
 	return NULL;
@@ -608,6 +718,9 @@ int xio_on_fin_rsp_send_comp(struct xio_connection *connection,
 
 	/* transition from online to close_wait - notify the application */
 	if (connection->state == XIO_CONNECTION_STATE_CLOSE_WAIT) {
+		/* deliver what was gathered before the close notification */
+		xio_connection_flush_batch(connection);
+
 		if (!connection->disable_notify)
 			xio_session_notify_connection_closed(
 					connection->session,
@@ -680,11 +793,24 @@ static int xio_on_req_recv(struct xio_connection *connection,
 		     xio_iovex_length(vmsg->data_iov, vmsg->data_iovlen));
 
 	/* notify the upper layer */
-	if (connection->ses_ops.on_msg)
+	if (connection->ses_ops.on_msgs) {
+		if (hdr.flags & XIO_MSG_FLAG_REQUEST_READ_RECEIPT) {
+			/* the receipt depends on this very call */
+			xio_connection_flush_batch(connection);
+			connection->ses_ops.on_msgs(
+					connection->session, &msg, 1,
+					connection->cb_user_context);
+		} else {
+			xio_connection_queue_rx_msg(connection, msg);
+			if (!msg->more_in_batch)
+				xio_connection_flush_batch(connection);
+		}
+	} else if (connection->ses_ops.on_msg) {
 		connection->ses_ops.on_msg(
 				connection->session, msg,
 				msg->more_in_batch,
 				connection->cb_user_context);
+	}
 
 	if (hdr.flags & XIO_MSG_FLAG_REQUEST_READ_RECEIPT) {
 		if (task->state == XIO_TASK_STATE_DELIVERED) {
@@ -702,42 +828,22 @@ static int xio_on_req_recv(struct xio_connection *connection,
 }
 
 /*---------------------------------------------------------------------------*/
-/* xio_on_rsp_recv				                             */
+/* xio_on_rsp_deliver							     */
 /*---------------------------------------------------------------------------*/
-static int xio_on_rsp_recv(struct xio_connection *connection,
-			   struct xio_task *task)
+static void xio_on_rsp_deliver(struct xio_connection *connection,
+			       struct xio_task *task,
+			       struct xio_msg *omsg,
+			       const struct xio_session_hdr *hdr)
 {
-	struct xio_session_hdr	hdr;
 	struct xio_msg		*msg = &task->imsg;
-	struct xio_msg		*omsg;
 	struct xio_task		*sender_task = task->sender_task;
-	struct xio_statistics *stats = &connection->ctx->stats;
-
-	if (connection->state != XIO_CONNECTION_STATE_ONLINE) {
-		xio_connection_remove_in_flight(connection, sender_task->omsg);
-		xio_session_notify_msg_error(connection, sender_task->omsg,
-					     XIO_E_MSG_FLUSHED);
-		xio_release_response_task(task);
-		goto xmit;
-	}
-
-	/* read session header */
-	xio_session_read_header(task, &hdr);
-
-	msg->sn = hdr.serial_num;
+	struct xio_statistics	*stats = &connection->ctx->stats;
 
-	/* one way messages do not have sender task */
-	omsg		= sender_task->omsg;
 	omsg->request	= msg;
 	omsg->next	= NULL;
 
-	xio_stat_add(stats, XIO_STAT_DELAY,
-		     get_cycles() - omsg->timestamp);
-	xio_stat_inc(stats, XIO_STAT_RX_MSG);
-
 	task->connection = connection;
 
-	xio_connection_remove_in_flight(connection, omsg);
 	omsg->type = task->tlv_type;
 
 	/* store the task in io queue */
@@ -747,12 +853,12 @@ static int xio_on_rsp_recv(struct xio_connection *connection,
 
 	if (task->tlv_type == XIO_ONE_WAY_RSP) {
 		/* on way message with "read receipt" */
-		if (!(hdr.flags & XIO_MSG_RSP_FLAG_FIRST))
+		if (!(hdr->flags & XIO_MSG_RSP_FLAG_FIRST))
 			ERROR_LOG("protocol requires first flag to be set. " \
-				  "flags:0x%x\n", hdr.flags);
+				  "flags:0x%x\n", hdr->flags);
 
 		omsg->sn	  = msg->sn; /* one way do have response */
-		omsg->receipt_res = hdr.receipt_result;
+		omsg->receipt_res = hdr->receipt_result;
 		if (connection->ses_ops.on_msg_delivered)
 			connection->ses_ops.on_msg_delivered(
 				    connection->session,
@@ -762,9 +868,9 @@ static int xio_on_rsp_recv(struct xio_connection *connection,
 		sender_task->omsg = NULL;
 		xio_release_response_task(task);
 	} else {
-		if (hdr.flags & XIO_MSG_RSP_FLAG_FIRST) {
+		if (hdr->flags & XIO_MSG_RSP_FLAG_FIRST) {
 			if (connection->ses_ops.on_msg_delivered) {
-				omsg->receipt_res = hdr.receipt_result;
+				omsg->receipt_res = hdr->receipt_result;
 				connection->ses_ops.on_msg_delivered(
 						connection->session,
 						omsg,
@@ -772,29 +878,112 @@ static int xio_on_rsp_recv(struct xio_connection *connection,
 						connection->cb_user_context);
 			}
 			/* standalone receipt */
-			if ((hdr.flags &
+			if ((hdr->flags &
 			    (XIO_MSG_RSP_FLAG_FIRST | XIO_MSG_RSP_FLAG_LAST)) ==
 					XIO_MSG_RSP_FLAG_FIRST) {
 				/* recycle the receipt */
 				xio_tasks_pool_put(task);
 			}
 		}
-		if (hdr.flags & XIO_MSG_RSP_FLAG_LAST) {
+		if (hdr->flags & XIO_MSG_RSP_FLAG_LAST) {
 			struct xio_vmsg *vmsg = &msg->in;
 			xio_stat_add(stats, XIO_STAT_RX_BYTES,
 				     vmsg->header.iov_len +
 				     xio_iovex_length(vmsg->data_iov,
 						      vmsg->data_iovlen));
 
-			if (connection->ses_ops.on_msg)
+			if (connection->ses_ops.on_msgs) {
+				xio_connection_queue_rx_msg(connection, omsg);
+				if (!task->imsg.more_in_batch)
+					xio_connection_flush_batch(connection);
+			} else if (connection->ses_ops.on_msg) {
 				connection->ses_ops.on_msg(
 					connection->session,
 					omsg,
 					task->imsg.more_in_batch,
 					connection->cb_user_context);
+			}
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_on_rsp_recv				                             */
+/*---------------------------------------------------------------------------*/
+static int xio_on_rsp_recv(struct xio_connection *connection,
+			   struct xio_task *task)
+{
+	struct xio_session_hdr	hdr;
+	struct xio_msg		*msg = &task->imsg;
+	struct xio_msg		*omsg;
+	struct xio_task		*sender_task = task->sender_task;
+	struct xio_statistics *stats = &connection->ctx->stats;
+	uint64_t		delay;
+
+	/* read session header */
+	xio_session_read_header(task, &hdr);
+
+	msg->sn = hdr.serial_num;
+
+	/* late answer to a request that timed out. the request is completed
+	 * with XIO_E_TIMEOUT once its last part has landed
+	 */
+	if (unlikely(!list_empty(&connection->timed_out_list)) &&
+	    task->tlv_type != XIO_ONE_WAY_RSP &&
+	    xio_connection_timed_out(connection, msg->sn,
+				     XIO_TIMED_OUT_RSP_PART)) {
+		if (hdr.flags & XIO_MSG_RSP_FLAG_LAST) {
+			xio_release_response_task(task);
+			xio_connection_timed_out(connection, msg->sn,
+						 XIO_TIMED_OUT_RSP);
+		} else {
+			xio_tasks_pool_put(task);
+		}
+		goto xmit;
+	}
+
+	if (connection->state != XIO_CONNECTION_STATE_ONLINE) {
+		xio_connection_remove_in_flight(connection, sender_task->omsg);
+		xio_session_notify_msg_error(connection, sender_task->omsg,
+					     XIO_E_MSG_FLUSHED);
+		xio_release_response_task(task);
+		goto xmit;
+	}
+
+	/* one way messages do not have sender task */
+	omsg		= sender_task->omsg;
+
+	delay = get_cycles() - omsg->timestamp;
+	xio_stat_add(stats, XIO_STAT_DELAY, delay);
+	xio_stat_inc(stats, XIO_STAT_RX_MSG);
+	if (task->tlv_type != XIO_ONE_WAY_RSP) {
+		xio_connection_rtt_sample(connection, delay);
+		if (unlikely(connection->session->hedge_permille))
+			xio_session_hedge_sample(connection->session, delay);
+	}
+
+	xio_connection_remove_in_flight(connection, omsg);
+
+	if (unlikely(omsg->flags & XIO_MSG_FLAG_FORWARD) && omsg->timer.parent)
+		xio_session_forward_done(omsg);
+
+	/* sub requests complete the application request they belong to */
+	if (unlikely(omsg->flags &
+		     (XIO_MSG_FLAG_HEDGE | XIO_MSG_FLAG_STRIPE)) &&
+	    omsg->timer.parent) {
+		if (omsg->flags & XIO_MSG_FLAG_HEDGE) {
+			/* the hedge owns the answer from here on */
+			xio_session_hedge_rsp(connection, task, &hdr);
+			goto xmit;
 		}
+		/* the set owns the answer unless it carries req */
+		omsg = xio_session_stripe_rsp(connection, task, omsg, &hdr);
+		if (omsg == NULL)
+			goto xmit;
 	}
 
+	xio_on_rsp_deliver(connection, task, omsg, &hdr);
+
 xmit:
 	/* now try to send */
 	xio_connection_xmit_msgs(connection);
@@ -830,6 +1019,11 @@ static int xio_on_rsp_send_comp(
 		/* send completion notification only to responder to
 		 * release responses
 		 */
+		if (connection->ses_ops.on_msgs_send_complete) {
+			/* the task is recycled once the batch is flushed */
+			xio_connection_queue_tx_comp(connection, task);
+			goto xmit;
+		}
 		if (connection->ses_ops.on_msg_send_complete) {
 			connection->ses_ops.on_msg_send_complete(
 					connection->session, task->omsg,
@@ -867,9 +1061,28 @@ static int xio_on_ow_req_send_comp(
 
 		xio_connection_remove_in_flight(connection, task->omsg);
 
+		if (unlikely(omsg->flags & XIO_MSG_FLAG_FORWARD) &&
+		    omsg->timer.parent)
+			xio_session_forward_done(omsg);
+
+		/* fan out copies complete the application message once */
+		if (unlikely(omsg->flags & XIO_MSG_FLAG_FANOUT) &&
+		    omsg->timer.parent) {
+			task->omsg = xio_session_fanout_comp(connection, omsg,
+							     XIO_E_SUCCESS);
+			if (task->omsg == NULL) {
+				xio_tasks_pool_put(task);
+				goto xmit;
+			}
+		}
+
 		/* send completion notification to
 		 * release request
 		 */
+		if (connection->ses_ops.on_msgs_send_complete) {
+			xio_connection_queue_tx_comp(connection, task);
+			goto xmit;
+		}
 		if (connection->ses_ops.on_ow_msg_send_complete) {
 			connection->ses_ops.on_ow_msg_send_complete(
 					connection->session, task->omsg,
@@ -935,6 +1148,14 @@ int xio_on_conn_message_error(struct xio_session *session,
 {
 	struct xio_task *task = event_data->msg_error.task;
 
+	/* a timed out request is completed once, with XIO_E_TIMEOUT */
+	if (IS_REQUEST(task->tlv_type) &&
+	    unlikely(!list_empty(&task->connection->timed_out_list)) &&
+	    xio_connection_timed_out_msg(task->connection, task->omsg)) {
+		xio_tasks_pool_put(task);
+		return 0;
+	}
+
 	xio_connection_remove_msg_from_queue(task->connection, task->omsg);
 
 	if (task->session->ses_ops.on_msg_error)
@@ -1166,6 +1387,40 @@ int xio_on_assign_in_buf(struct xio_session *session,
 	return 0;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_on_data_chunk							     */
+/*---------------------------------------------------------------------------*/
+int xio_on_data_chunk(struct xio_session *session,
+		      struct xio_conn *conn,
+		      union xio_conn_event_data *event_data)
+{
+	struct xio_task	*task  = event_data->chunk.task;
+	struct xio_connection	*connection;
+
+	if (session == NULL)
+		session = xio_find_session(task);
+	if (session == NULL) {
+		ERROR_LOG("failed to find session. dropping chunk\n");
+		return -1;
+	}
+
+	connection = xio_session_find_connection(session, conn);
+	if (connection == NULL) {
+		ERROR_LOG("failed to find connection :%p. " \
+			  "dropping chunk\n", conn);
+		return -1;
+	}
+
+	if (connection->ses_ops.on_msg_data_chunk)
+		connection->ses_ops.on_msg_data_chunk(
+				session, &task->imsg,
+				event_data->chunk.offset,
+				event_data->chunk.len,
+				connection->cb_user_context);
+
+	return 0;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_on_cancel_request						     */
 /*---------------------------------------------------------------------------*/
@@ -1244,9 +1499,10 @@ int xio_on_cancel_response(struct xio_session *sess,
 		return -1;
 	}
 
+	tmp_hdr			 = event_data->cancel.ulp_msg;
+	hdr.sn			 = ntohll(tmp_hdr->sn);
+
 	if (event_data->cancel.task == NULL) {
-		tmp_hdr			 = event_data->cancel.ulp_msg;
-		hdr.sn			 = ntohll(tmp_hdr->sn);
 		hdr.requester_session_id = ntohl(tmp_hdr->requester_session_id);
 
 		observer = xio_conn_observer_lookup(conn,
@@ -1263,7 +1519,6 @@ int xio_on_cancel_response(struct xio_session *sess,
 	} else {
 		session		= event_data->cancel.task->session;
 		pmsg		= event_data->cancel.task->omsg;
-		hdr.sn		= pmsg->sn;
 	}
 
 	connection = xio_session_find_connection(session, conn);
@@ -1272,6 +1527,28 @@ int xio_on_cancel_response(struct xio_session *sess,
 		return -1;
 	}
 
+	/* cancel issued on deadline expiry. a canceled request completes
+	 * with XIO_E_TIMEOUT, otherwise its response is awaited
+	 */
+	if (unlikely(!list_empty(&connection->timed_out_list)) &&
+	    xio_connection_timed_out(
+			connection, hdr.sn,
+			event_data->cancel.result == XIO_E_MSG_CANCELED ?
+			XIO_TIMED_OUT_CANCELED :
+			XIO_TIMED_OUT_CANCEL_FAILED)) {
+		if (event_data->cancel.result == XIO_E_MSG_CANCELED)
+			xio_tasks_pool_put(event_data->cancel.task);
+		return 0;
+	}
+
+	/* loser of a hedged request, the application never saw it */
+	if (xio_session_hedge_cancel_rsp(connection, hdr.sn,
+					 event_data->cancel.result)) {
+		if (event_data->cancel.result == XIO_E_MSG_CANCELED)
+			xio_tasks_pool_put(event_data->cancel.task);
+		return 0;
+	}
+
 	/* need to release the last reference since answer is not expected */
 	if (event_data->cancel.result == XIO_E_MSG_CANCELED)
 		xio_tasks_pool_put(event_data->cancel.task);
@@ -1320,6 +1597,8 @@ struct xio_session *xio_session_init(
 					xio_on_conn_event_client);
 
 	INIT_LIST_HEAD(&session->connections_list);
+	xio_msg_list_init(&session->resume_msgq);
+	spin_lock_init(&session->resume_lock);
 
 	session->user_context_len = attr->user_context_len;
 
@@ -1345,6 +1624,10 @@ struct xio_session *xio_session_init(
 	session->state			= XIO_SESSION_STATE_INIT;
 	session->session_flags		= flags;
 
+	/* connections joining later prove themselves with it */
+	if (type == XIO_SESSION_SERVER)
+		get_random_bytes(&session->token, sizeof(session->token));
+
 	memcpy(&session->ses_ops, attr->ses_ops,
 	       sizeof(*attr->ses_ops));
 
@@ -1387,6 +1670,10 @@ int xio_session_destroy(struct xio_session *session)
 	TRACE_LOG("session destroy:%p\n", session);
 	session->state = XIO_SESSION_STATE_CLOSING;
 	if (list_empty(&session->connections_list)) {
+		if (xio_is_delayed_work_pending(&session->resume_work))
+			xio_ctx_del_delayed_work(session->resume_ctx,
+						 &session->resume_work);
+		xio_session_resume_flush(session);
 		xio_session_pre_teardown(session);
 		if (!session->in_notify)
 			xio_session_post_teardown(session);
@@ -1480,27 +1767,1552 @@ struct xio_connection *xio_get_connection(
 }
 
 /*---------------------------------------------------------------------------*/
-/* xio_session_notify_cancel						     */
+/* xio_session_set_lb_policy						     */
 /*---------------------------------------------------------------------------*/
-int xio_session_notify_cancel(struct xio_connection *connection,
-			      struct xio_msg *req, enum xio_status result)
+int xio_session_set_lb_policy(struct xio_session *session,
+			      enum xio_lb_policy policy)
 {
-	/* notify the upper layer */
-	if (connection->ses_ops.on_cancel)
-		connection->ses_ops.on_cancel(
-				connection->session, req,
-				result,
-				connection->cb_user_context);
+	if (session == NULL || policy > XIO_LB_HASH) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid parameters\n");
+		return -1;
+	}
+	session->lb_policy = policy;
 
 	return 0;
 }
 
 /*---------------------------------------------------------------------------*/
-/* xio_session_notify_msg_error						     */
+/* xio_session_lb_cost							     */
 /*---------------------------------------------------------------------------*/
-int xio_session_notify_msg_error(struct xio_connection *connection,
-				 struct xio_msg *msg, enum xio_status result)
+static inline uint64_t xio_session_lb_cost(struct xio_session *session,
+					   struct xio_connection *connection)
+{
+	uint64_t outstanding = xio_connection_outstanding(connection);
+
+	if (session->lb_policy == XIO_LB_LEAST_OUTSTANDING)
+		return outstanding;
+
+	/* expected wait: average response time for each request ahead.
+	 * connections without samples yet cost nothing and get probed
+	 */
+	return connection->rtt_ewma * (outstanding + 1);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_online_connections					     */
+/*---------------------------------------------------------------------------*/
+static int xio_session_online_connections(struct xio_session *session,
+					  struct xio_context *ctx,
+					  struct xio_connection **online)
+{
+	struct xio_connection	*connection;
+	int			n = 0;
+
+	spin_lock(&session->connections_list_lock);
+	list_for_each_entry(connection, &session->connections_list,
+			    connections_list_entry) {
+		if (connection->ctx != ctx ||
+		    connection->state != XIO_CONNECTION_STATE_ONLINE ||
+		    connection->in_close)
+			continue;
+		if (n == XIO_LB_MAX_CONNECTIONS)
+			break;
+		online[n++] = connection;
+	}
+	spin_unlock(&session->connections_list_lock);
+
+	return n;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_set_hedge						     */
+/*---------------------------------------------------------------------------*/
+int xio_session_set_hedge(struct xio_session *session, uint32_t permille)
+{
+	if (session == NULL || permille >= 1000) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid parameters\n");
+		return -1;
+	}
+	session->hedge_permille = permille;
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_hedge_bucket							     */
+/*---------------------------------------------------------------------------*/
+static inline int xio_hedge_bucket(uint64_t cycles)
+{
+	int msb;
+
+	if (cycles < 4)
+		return (int)cycles;
+
+	/* four buckets per power of two */
+	msb = 63 - __builtin_clzll(cycles);
+
+	return (msb << 2) | (int)((cycles >> (msb - 2)) & 3);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_hedge_bucket_limit						     */
+/*---------------------------------------------------------------------------*/
+static inline uint64_t xio_hedge_bucket_limit(int bucket)
+{
+	if (bucket < 4)
+		return bucket + 1;
+	if (bucket == XIO_HEDGE_BUCKETS - 1)
+		return (uint64_t)-1;
+
+	return (uint64_t)(5 + (bucket & 3)) << ((bucket >> 2) - 2);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_hedge_sample						     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_hedge_sample(struct xio_session *session,
+				     uint64_t rtt)
+{
+	uint64_t	target, sum = 0;
+	uint32_t	samples = 0;
+	int		i;
+
+	session->hedge_hist[xio_hedge_bucket(rtt)]++;
+	if (++session->hedge_samples % XIO_HEDGE_UPDATE)
+		return;
+
+	/* age the history so that the delay follows the load */
+	if (session->hedge_samples >= XIO_HEDGE_WINDOW) {
+		for (i = 0; i < XIO_HEDGE_BUCKETS; i++) {
+			session->hedge_hist[i] >>= 1;
+			samples += session->hedge_hist[i];
+		}
+		session->hedge_samples = samples;
+	}
+
+	target = (uint64_t)session->hedge_samples *
+		 session->hedge_permille / 1000;
+	for (i = 0; i < XIO_HEDGE_BUCKETS - 1; i++) {
+		sum += session->hedge_hist[i];
+		if (sum > target)
+			break;
+	}
+	session->hedge_delay = xio_hedge_bucket_limit(i);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_hedge_copy_init							     */
+/*---------------------------------------------------------------------------*/
+static void xio_hedge_copy_init(struct xio_hedge *hedge, int i)
+{
+	struct xio_msg	*req = hedge->req;
+	struct xio_msg	*copy = &hedge->copy[i];
+	size_t		j;
+
+	/* out buffers are shared, so req is handed back only once no copy
+	 * is left on the wire. the answers land in library buffers
+	 */
+	copy->out		= req->out;
+	copy->in.header.iov_base = NULL;
+	copy->in.header.iov_len	= 0;
+	copy->in.data_iovlen	= req->in.data_iovlen;
+	for (j = 0; j < req->in.data_iovlen; j++) {
+		copy->in.data_iov[j].iov_base	= NULL;
+		copy->in.data_iov[j].iov_len	= req->in.data_iov[j].iov_len;
+		copy->in.data_iov[j].mr		= NULL;
+	}
+	copy->flags		= req->flags;
+	copy->timeout_ms	= 0;
+	copy->user_context	= req->user_context;
+	copy->next		= NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_copy_in_header						     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_copy_in_header(struct xio_msg *req,
+				       struct xio_msg *sub)
+{
+	size_t hdr_len;
+
+	if (req->in.header.iov_base) {
+		if (sub->in.header.iov_len > req->in.header.iov_len) {
+			hdr_len = req->in.header.iov_len;
+			req->status = XIO_E_MSG_SIZE;
+		} else {
+			hdr_len = sub->in.header.iov_len;
+		}
+		if (hdr_len)
+			memcpy(req->in.header.iov_base,
+			       sub->in.header.iov_base, hdr_len);
+		req->in.header.iov_len = hdr_len;
+	} else {
+		/* pointer into the answer, valid until release */
+		req->in.header = sub->in.header;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_hedge_deliver							     */
+/*---------------------------------------------------------------------------*/
+static void xio_hedge_deliver(struct xio_msg *req, struct xio_msg *copy)
+{
+	req->status = copy->status;
+	xio_session_copy_in_header(req, copy);
+
+	if (copy->in.data_iovlen == 0) {
+		req->in.data_iovlen = 0;
+	} else if (req->in.data_iovlen && req->in.data_iov[0].iov_base) {
+		/* user provided buffer so do copy */
+		if (xio_iovex_length(copy->in.data_iov,
+				     copy->in.data_iovlen) >
+		    xio_iovex_length(req->in.data_iov,
+				     req->in.data_iovlen)) {
+			req->status = XIO_E_MSG_SIZE;
+			return;
+		}
+		req->in.data_iovlen = memcpyv(
+				(struct xio_iovec *)req->in.data_iov,
+				req->in.data_iovlen,
+				(struct xio_iovec *)copy->in.data_iov,
+				copy->in.data_iovlen);
+	} else {
+		/* pointers into the winner's buffers, valid until release */
+		req->in.data_iovlen = memclonev(
+				(struct xio_iovec *)req->in.data_iov,
+				XIO_MAX_IOV,
+				(struct xio_iovec *)copy->in.data_iov,
+				copy->in.data_iovlen);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_hedge_launch						     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_hedge_launch(struct xio_session *session,
+				     struct xio_hedge *hedge)
+{
+	struct xio_connection	*connection, *backup = NULL;
+	uint64_t		cost, best_cost = 0;
+
+	hedge->state = XIO_HEDGE_STATE_RACING;
+
+	spin_lock(&session->connections_list_lock);
+	list_for_each_entry(connection, &session->connections_list,
+			    connections_list_entry) {
+		if (connection == hedge->conn[0] ||
+		    connection->ctx != hedge->conn[0]->ctx ||
+		    connection->state != XIO_CONNECTION_STATE_ONLINE ||
+		    connection->in_close)
+			continue;
+		cost = xio_session_lb_cost(session, connection);
+		if (backup == NULL || cost < best_cost) {
+			backup = connection;
+			best_cost = cost;
+		}
+	}
+	spin_unlock(&session->connections_list_lock);
+
+	/* nowhere to go, the original copy runs alone */
+	if (backup == NULL)
+		return;
+
+	xio_hedge_copy_init(hedge, 1);
+	if (xio_send_request(backup, &hedge->copy[1]))
+		return;
+
+	hedge->copy[1].timer.parent	= hedge;
+	hedge->conn[1]			= backup;
+	hedge->outstanding++;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_hedge_arm						     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_hedge_arm(struct xio_connection *connection,
+				  uint64_t wait)
+{
+	struct xio_context	*ctx = connection->ctx;
+	uint64_t		msec_cycles = ctx->stats.hertz / 1000;
+	uint64_t		due;
+	int			retval;
+
+	/* timers count whole milliseconds, what is left of the delay is
+	 * checked on every pass of the event loop
+	 */
+	if (wait < msec_cycles) {
+		xio_ctx_add_event(ctx, &connection->hedge_event);
+		return;
+	}
+
+	due = get_cycles() + wait - wait % msec_cycles;
+	if (xio_is_delayed_work_pending(&connection->hedge_work)) {
+		if (connection->hedge_due <= due)
+			return;
+		xio_ctx_del_delayed_work(ctx, &connection->hedge_work);
+	}
+
+	connection->hedge_due = due;
+	retval = xio_ctx_add_delayed_work(ctx, wait / msec_cycles,
+					  connection,
+					  xio_session_hedge_handler,
+					  &connection->hedge_work);
+	if (retval != 0)
+		ERROR_LOG("xio_ctx_add_delayed_work failed.\n");
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_hedge_handler						     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_hedge_handler(void *data)
 {
+	struct xio_connection	*connection = data;
+	struct xio_session	*session = connection->session;
+	struct xio_hedge	*hedge, *tmp_hedge;
+	uint64_t		now = get_cycles();
+	uint64_t		elapsed, wait = 0;
+
+	list_for_each_entry_safe(hedge, tmp_hedge, &connection->hedge_list,
+				 entry) {
+		if (hedge->state != XIO_HEDGE_STATE_PENDING)
+			continue;
+		elapsed = now - hedge->copy[0].timestamp;
+		if (elapsed < session->hedge_delay) {
+			if (!wait || session->hedge_delay - elapsed < wait)
+				wait = session->hedge_delay - elapsed;
+			continue;
+		}
+		list_del_init(&hedge->entry);
+		xio_session_hedge_launch(session, hedge);
+	}
+
+	/* the earliest of the hedges still waiting */
+	if (wait)
+		xio_session_hedge_arm(connection, wait);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_hedge_event						     */
+/*---------------------------------------------------------------------------*/
+void xio_session_hedge_event(xio_ctx_event_t *tev, void *data)
+{
+	xio_session_hedge_handler(data);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_send_hedged						     */
+/*---------------------------------------------------------------------------*/
+static int xio_session_send_hedged(struct xio_connection *connection,
+				   struct xio_msg *req)
+{
+	struct xio_session	*session = connection->session;
+	struct xio_hedge	*hedge;
+
+	hedge = kcalloc(1, sizeof(*hedge), GFP_KERNEL);
+	if (hedge == NULL) {
+		xio_set_error(ENOMEM);
+		ERROR_LOG("failed to allocate hedge\n");
+		return -1;
+	}
+	INIT_LIST_HEAD(&hedge->entry);
+	hedge->req		= req;
+	hedge->conn[0]		= connection;
+	hedge->state		= XIO_HEDGE_STATE_PENDING;
+	hedge->outstanding	= 1;
+	xio_hedge_copy_init(hedge, 0);
+
+	/* the application request itself never reaches the wire */
+	if (xio_send_request(connection, &hedge->copy[0])) {
+		kfree(hedge);
+		return -1;
+	}
+	hedge->copy[0].timer.parent = hedge;
+
+	req->sn			= hedge->copy[0].sn;
+	req->type		= XIO_MSG_TYPE_REQ;
+	req->timestamp		= hedge->copy[0].timestamp;
+	req->timer.parent	= NULL;
+
+	list_add_tail(&hedge->entry, &connection->hedge_list);
+	xio_session_hedge_arm(connection, session->hedge_delay);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_hedge_put						     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_hedge_put(struct xio_hedge *hedge)
+{
+	list_del_init(&hedge->entry);
+
+	/* kept so that the answer to the cancel is not taken for the
+	 * application's
+	 */
+	if (hedge->cancel_conn)
+		list_add_tail(&hedge->entry, &hedge->cancel_conn->hedge_list);
+	else
+		kfree(hedge);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_hedge_done						     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_hedge_done(struct xio_hedge *hedge)
+{
+	struct xio_task		*task = hedge->rsp_task;
+	struct xio_msg		*req = hedge->req;
+	struct xio_session_hdr	hdr = hedge->rsp_hdr;
+
+	xio_hedge_deliver(req, task->sender_task->omsg);
+	hedge->rsp_task = NULL;
+	xio_session_hedge_put(hedge);
+
+	/* the batch it arrived in is long gone */
+	task->imsg.more_in_batch = 0;
+	xio_on_rsp_deliver(task->connection, task, req, &hdr);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_hedge_rsp						     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_hedge_rsp(struct xio_connection *connection,
+				  struct xio_task *task,
+				  const struct xio_session_hdr *hdr)
+{
+	struct xio_msg		*copy = task->sender_task->omsg;
+	struct xio_hedge	*hedge = copy->timer.parent;
+	struct xio_msg		*req = hedge->req;
+	int			loser = (copy == &hedge->copy[0]);
+
+	hedge->outstanding--;
+	if (hedge->rsp_task) {
+		/* late answer of the loser, the held one goes up */
+		xio_release_response_task(task);
+		xio_session_hedge_done(hedge);
+		return;
+	}
+
+	if (hedge->state != XIO_HEDGE_STATE_DONE && hedge->outstanding) {
+		/* hold the answer like one the application did not release
+		 * yet, until the loser can no longer touch req's buffers
+		 */
+		hedge->state	= XIO_HEDGE_STATE_DONE;
+		hedge->rsp_task	= task;
+		hedge->rsp_hdr	= *hdr;
+		task->connection = connection;
+		list_move_tail(&task->tasks_list_entry,
+			       &connection->io_tasks_list);
+		list_add_tail(&hedge->entry, &connection->hedge_list);
+
+		/* a copy that is still queued is cancelled on the spot and
+		 * the held answer is delivered from within
+		 */
+		if (hedge->copy[loser].timer.in_flight)
+			hedge->cancel_conn = hedge->conn[loser];
+		xio_cancel_request(hedge->conn[loser], &hedge->copy[loser]);
+		return;
+	}
+
+	/* the only answer, or the loser's once the winner's was flushed */
+	xio_hedge_deliver(req, copy);
+	hedge->state = XIO_HEDGE_STATE_DONE;
+	xio_session_hedge_put(hedge);
+
+	xio_on_rsp_deliver(connection, task, req, hdr);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_hedge_error						     */
+/*---------------------------------------------------------------------------*/
+static int xio_session_hedge_error(struct xio_connection *connection,
+				   struct xio_msg *copy,
+				   enum xio_status result)
+{
+	struct xio_hedge	*hedge = copy->timer.parent;
+	struct xio_msg		*req = hedge->req;
+	enum xio_hedge_state	state = hedge->state;
+
+	/* a failed copy has no cancel answer to wait for */
+	if (hedge->cancel_conn == connection)
+		hedge->cancel_conn = NULL;
+
+	/* the other copy may still answer */
+	if (--hedge->outstanding)
+		return 0;
+
+	if (hedge->rsp_task) {
+		xio_session_hedge_done(hedge);
+		return 0;
+	}
+
+	hedge->state = XIO_HEDGE_STATE_DONE;
+	xio_session_hedge_put(hedge);
+
+	/* the winner's answer went down with its connection */
+	if (state == XIO_HEDGE_STATE_DONE && result == XIO_E_MSG_CANCELED)
+		result = XIO_E_MSG_FLUSHED;
+
+	return xio_session_notify_msg_error(connection, req, result);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_hedge_cancel_rsp						     */
+/*---------------------------------------------------------------------------*/
+static int xio_session_hedge_cancel_rsp(struct xio_connection *connection,
+					uint64_t sn, enum xio_status result)
+{
+	struct xio_hedge	*hedge;
+	struct xio_msg		*pmsg;
+
+	/* the loser is still out */
+	xio_msg_list_foreach(pmsg, &connection->in_flight_reqs_msgq, pdata) {
+		if (pmsg->sn != sn)
+			continue;
+		if (!(pmsg->flags & XIO_MSG_FLAG_HEDGE) ||
+		    pmsg->timer.parent == NULL)
+			return 0;
+		hedge = pmsg->timer.parent;
+		if (hedge->cancel_conn != connection)
+			return 0;
+		hedge->cancel_conn = NULL;
+
+		/* not cancelled, the answer is on its way */
+		if (result != XIO_E_MSG_CANCELED)
+			return 1;
+
+		xio_connection_remove_in_flight(connection, pmsg);
+		xio_session_hedge_error(connection, pmsg, result);
+		return 1;
+	}
+
+	/* the loser answered first */
+	list_for_each_entry(hedge, &connection->hedge_list, entry) {
+		if (hedge->cancel_conn != connection || hedge->outstanding)
+			continue;
+		if (hedge->copy[hedge->conn[1] == connection].sn != sn)
+			continue;
+		list_del(&hedge->entry);
+		kfree(hedge);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_hedge_flush						     */
+/*---------------------------------------------------------------------------*/
+void xio_session_hedge_flush(struct xio_connection *connection)
+{
+	struct xio_hedge	*hedge, *tmp_hedge;
+
+	list_for_each_entry_safe(hedge, tmp_hedge, &connection->hedge_list,
+				 entry) {
+		if (hedge->state != XIO_HEDGE_STATE_DONE)
+			continue;
+		list_del_init(&hedge->entry);
+		if (hedge->rsp_task) {
+			/* the answer held here goes down with the connection,
+			 * the loser's answer or failure completes req instead
+			 */
+			xio_release_response_task(hedge->rsp_task);
+			hedge->rsp_task = NULL;
+			continue;
+		}
+		/* only the answer to the cancel was awaited */
+		kfree(hedge);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_stripe_slice							     */
+/*---------------------------------------------------------------------------*/
+static int xio_stripe_slice(const struct xio_vmsg *src, uint64_t off,
+			    uint64_t len, struct xio_vmsg *dst)
+{
+	uint64_t	iov_start = 0, iov_end, from, to;
+	uint64_t	end = off + len;
+	size_t		i, n = 0;
+
+	for (i = 0; i < src->data_iovlen && iov_start < end; i++) {
+		iov_end = iov_start + src->data_iov[i].iov_len;
+		if (iov_end > off) {
+			if (n == XIO_MAX_IOV - 1)
+				return -1;
+			from = (iov_start > off) ? iov_start : off;
+			to = (iov_end < end) ? iov_end : end;
+
+			/* same buffer and memory region, narrower window */
+			dst->data_iov[n] = src->data_iov[i];
+			dst->data_iov[n].iov_base =
+				(uint8_t *)src->data_iov[i].iov_base +
+				(from - iov_start);
+			dst->data_iov[n].iov_len = to - from;
+			n++;
+		}
+		iov_start = iov_end;
+	}
+	dst->data_iovlen = n;
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_stripe_targets						     */
+/*---------------------------------------------------------------------------*/
+static int xio_session_stripe_targets(struct xio_session *session,
+				      struct xio_context *ctx,
+				      struct xio_connection **online,
+				      int max)
+{
+	struct xio_connection	*connection;
+	int			n = 0, local;
+
+	/* the caller's own connections come first */
+	spin_lock(&session->connections_list_lock);
+	for (local = 1; local >= 0; local--) {
+		list_for_each_entry(connection, &session->connections_list,
+				    connections_list_entry) {
+			if ((connection->ctx == ctx) != local ||
+			    connection->state != XIO_CONNECTION_STATE_ONLINE ||
+			    connection->in_close)
+				continue;
+			if (n == max)
+				break;
+			online[n++] = connection;
+		}
+		if (local && n == 0)
+			break;
+	}
+	spin_unlock(&session->connections_list_lock);
+
+	return n;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_send_striped						     */
+/*---------------------------------------------------------------------------*/
+int xio_session_send_striped(struct xio_session *session,
+			     struct xio_context *ctx,
+			     struct xio_msg *req,
+			     size_t stripe_size)
+{
+	struct xio_connection	*online[XIO_LB_MAX_CONNECTIONS];
+	struct xio_connection	*connection;
+	struct xio_stripe_set	*set;
+	struct xio_stripe_part	*part;
+	struct xio_stripe_hdr	shdr, *tmp_shdr;
+	struct xio_vmsg		*data;
+	struct xio_msg		*sub;
+	uint64_t		in_len, out_len, total;
+	size_t			hdr_len, hdr_stride;
+	uint8_t			*hdr;
+	int			i, n, nr;
+
+	if (session == NULL || ctx == NULL || req == NULL ||
+	    stripe_size == 0) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid parameters\n");
+		return -1;
+	}
+
+	/* one direction only, answers are written in place */
+	in_len = xio_iovex_length(req->in.data_iov, req->in.data_iovlen);
+	out_len = xio_iovex_length(req->out.data_iov, req->out.data_iovlen);
+	if ((in_len == 0) == (out_len == 0) ||
+	    (in_len && req->in.data_iov[0].iov_base == NULL)) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid parameters\n");
+		return -1;
+	}
+	data	= in_len ? &req->in : &req->out;
+	total	= in_len ? in_len : out_len;
+
+	/* req is completed on ctx, so at least one stripe stays here */
+	n = xio_session_stripe_targets(session, ctx, online,
+				       XIO_LB_MAX_CONNECTIONS);
+	if (n == 0) {
+		xio_set_error(EAGAIN);
+		return -1;
+	}
+
+	if (total > (uint64_t)stripe_size * XIO_MAX_STRIPES)
+		stripe_size = (total + XIO_MAX_STRIPES - 1) / XIO_MAX_STRIPES;
+	nr = (total + stripe_size - 1) / stripe_size;
+
+	/* sub requests, their parts and headers in one block */
+	hdr_len		= req->out.header.iov_len;
+	hdr_stride	= (hdr_len + sizeof(shdr) + 7) & ~(size_t)7;
+	set = kcalloc(1, sizeof(*set) +
+		      nr * (sizeof(*sub) + sizeof(*part) + hdr_stride),
+		      GFP_KERNEL);
+	if (set == NULL) {
+		xio_set_error(ENOMEM);
+		ERROR_LOG("failed to allocate stripes\n");
+		return -1;
+	}
+	set->req		= req;
+	set->session		= session;
+	set->ctx		= ctx;
+	set->in			= in_len != 0;
+	set->outstanding	= nr;
+	set->stripe_size	= stripe_size;
+	set->total_len		= total;
+	set->part		= (struct xio_stripe_part *)&set->sub[nr];
+	INIT_LIST_HEAD(&set->entry);
+	hdr = (uint8_t *)&set->part[nr];
+
+	shdr.total_len	= total;
+	shdr.count	= nr;
+	for (i = 0; i < nr; i++, hdr += hdr_stride) {
+		sub = &set->sub[i];
+		shdr.index	= i;
+		shdr.offset	= (uint64_t)i * stripe_size;
+		shdr.stripe_len	= total - shdr.offset;
+		if (shdr.stripe_len > stripe_size)
+			shdr.stripe_len = stripe_size;
+
+		if (xio_stripe_slice(data, shdr.offset, shdr.stripe_len,
+				     set->in ? &sub->in : &sub->out)) {
+			kfree(set);
+			xio_set_error(EINVAL);
+			ERROR_LOG("stripe needs too many iovecs\n");
+			return -1;
+		}
+
+		/* the application header followed by the descriptor */
+		if (hdr_len)
+			memcpy(hdr, req->out.header.iov_base, hdr_len);
+		tmp_shdr = (struct xio_stripe_hdr *)(hdr + hdr_len);
+		PACK_LLVAL(&shdr, tmp_shdr, offset);
+		PACK_LLVAL(&shdr, tmp_shdr, stripe_len);
+		PACK_LLVAL(&shdr, tmp_shdr, total_len);
+		PACK_LVAL(&shdr, tmp_shdr, index);
+		PACK_LVAL(&shdr, tmp_shdr, count);
+		sub->out.header.iov_base = hdr;
+		sub->out.header.iov_len	 = hdr_len + sizeof(shdr);
+
+		sub->flags = (req->flags & ~(XIO_MSG_FLAG_HEDGE |
+				XIO_MSG_FLAG_REQUEST_READ_RECEIPT)) |
+				XIO_MSG_FLAG_STRIPE;
+		sub->user_context = req->user_context;
+		set->part[i].set = set;
+	}
+
+	/* round robin keeps neighbour stripes on different connections,
+	 * and puts the first one on the caller's own
+	 */
+	for (i = 0; i < nr; i++) {
+		connection = online[i % n];
+		if (connection->ctx != ctx) {
+			/* only the owning thread may post on it */
+			part		= &set->part[i];
+			part->conn	= connection;
+			part->ctx	= connection->ctx;
+			xio_ctx_init_event(&part->event,
+					   xio_session_stripe_post, part);
+			if (xio_ctx_add_work(part->ctx, part,
+					     xio_session_stripe_submit,
+					     &part->work)) {
+				part->conn = NULL;
+				break;
+			}
+			set->remote++;
+			continue;
+		}
+		if (xio_send_request(connection, &set->sub[i]))
+			break;
+		set->sub[i].timer.parent = set;
+	}
+	if (i == 0) {
+		kfree(set);
+		return -1;
+	}
+	if (i < nr) {
+		/* the stripes already out complete req with an error */
+		set->outstanding = i;
+		set->error = XIO_E_NO_BUFS;
+	}
+
+	req->sn			= set->sub[0].sn;
+	req->type		= XIO_MSG_TYPE_REQ;
+	req->timestamp		= set->sub[0].timestamp;
+	req->timer.parent	= NULL;
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_stripe_submit						     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_stripe_submit(void *data)
+{
+	struct xio_stripe_part	*part = data;
+	struct xio_stripe_set	*set = part->set;
+	struct xio_session	*session = set->session;
+	struct xio_msg		*sub = &set->sub[part - set->part];
+	struct xio_connection	*connection;
+	int			found = 0;
+
+	/* runs on the thread owning the connection, which may have been
+	 * closed since it was picked
+	 */
+	spin_lock(&session->connections_list_lock);
+	list_for_each_entry(connection, &session->connections_list,
+			    connections_list_entry) {
+		if (connection == part->conn) {
+			found = 1;
+			break;
+		}
+	}
+	spin_unlock(&session->connections_list_lock);
+
+	if (found && connection->state == XIO_CONNECTION_STATE_ONLINE &&
+	    !connection->in_close) {
+		if (xio_send_request(connection, sub) == 0) {
+			sub->timer.parent = set;
+			return;
+		}
+		part->result = XIO_E_NO_BUFS;
+	} else {
+		part->result = XIO_E_MSG_FLUSHED;
+	}
+	part->failed = 1;
+
+	/* straight back to the thread owning req */
+	xio_ctx_add_work(set->ctx, part, xio_session_stripe_done,
+			 &part->work);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_stripe_post						     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_stripe_post(xio_ctx_event_t *tev, void *data)
+{
+	struct xio_stripe_part	*part = data;
+
+	/* the answer or failure of a remote stripe, raised on the next pass
+	 * of the owning loop once nothing refers to the sub request anymore
+	 */
+	xio_ctx_add_work(part->set->ctx, part, xio_session_stripe_done,
+			 &part->work);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_stripe_status							     */
+/*---------------------------------------------------------------------------*/
+static enum xio_status xio_stripe_status(struct xio_stripe_set *set,
+					 struct xio_msg *sub)
+{
+	uint64_t	expected;
+
+	if (sub->status != XIO_E_SUCCESS)
+		return sub->status;
+
+	/* the data already landed in the application buffers */
+	expected = set->total_len -
+		   (uint64_t)(sub - set->sub) * set->stripe_size;
+	if (expected > set->stripe_size)
+		expected = set->stripe_size;
+	if (set->in &&
+	    xio_iovex_length(sub->in.data_iov, sub->in.data_iovlen) != expected)
+		return XIO_E_PARTIAL_MSG;
+
+	return XIO_E_SUCCESS;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_stripe_complete						     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_stripe_complete(struct xio_stripe_set *set)
+{
+	struct xio_task		*task = set->rsp_task;
+	struct xio_session	*session = set->session;
+	struct xio_msg		*req = set->req;
+	struct xio_connection	*connection = NULL, *tmp_connection;
+	struct xio_session_hdr	hdr = set->rsp_hdr;
+	enum xio_status		error = set->error;
+
+	if (task != NULL) {
+		list_del_init(&set->entry);
+		connection = task->connection;
+		if (error == XIO_E_SUCCESS) {
+			req->status = set->status;
+			xio_session_copy_in_header(req,
+						   task->sender_task->omsg);
+			kfree(set);
+
+			/* the batch it arrived in is long gone */
+			task->imsg.more_in_batch = 0;
+			xio_on_rsp_deliver(connection, task, req, &hdr);
+			return;
+		}
+		xio_release_response_task(task);
+	} else {
+		/* the local answer went down with its connection */
+		if (error == XIO_E_SUCCESS)
+			error = XIO_E_MSG_FLUSHED;
+		spin_lock(&session->connections_list_lock);
+		list_for_each_entry(tmp_connection, &session->connections_list,
+				    connections_list_entry) {
+			if (tmp_connection->ctx == set->ctx) {
+				connection = tmp_connection;
+				break;
+			}
+		}
+		spin_unlock(&session->connections_list_lock);
+	}
+	kfree(set);
+
+	if (connection) {
+		xio_session_notify_msg_error(connection, req, error);
+		return;
+	}
+	if (session->ses_ops.on_msg_error)
+		session->ses_ops.on_msg_error(session, error, req,
+					      session->cb_user_context);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_stripe_done						     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_stripe_done(void *data)
+{
+	struct xio_stripe_part	*part = data;
+	struct xio_stripe_set	*set = part->set;
+
+	if (part->failed) {
+		if (set->error == XIO_E_SUCCESS)
+			set->error = part->result;
+	} else if (set->status == XIO_E_SUCCESS) {
+		set->status = part->result;
+	}
+
+	if (--set->outstanding)
+		return;
+
+	xio_session_stripe_complete(set);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_stripe_rsp						     */
+/*---------------------------------------------------------------------------*/
+static struct xio_msg *xio_session_stripe_rsp(
+		struct xio_connection *connection,
+		struct xio_task *task,
+		struct xio_msg *sub,
+		const struct xio_session_hdr *hdr)
+{
+	struct xio_stripe_set	*set = sub->timer.parent;
+	struct xio_stripe_part	*part = &set->part[sub - set->sub];
+	struct xio_msg		*req = set->req;
+	struct xio_task		*held;
+	enum xio_status		error;
+
+	if (part->conn) {
+		/* a remote stripe, reported back once its answer is gone */
+		part->result = xio_stripe_status(set, sub);
+		xio_release_response_task(task);
+		xio_ctx_add_event(connection->ctx, &part->event);
+		return NULL;
+	}
+
+	if (set->status == XIO_E_SUCCESS)
+		set->status = xio_stripe_status(set, sub);
+
+	if (--set->outstanding) {
+		if (set->remote && set->rsp_task == NULL) {
+			/* keep one answer to deliver req with, like one the
+			 * application did not release yet
+			 */
+			set->rsp_task	= task;
+			set->rsp_hdr	= *hdr;
+			task->connection = connection;
+			list_move_tail(&task->tasks_list_entry,
+				       &connection->io_tasks_list);
+			list_add_tail(&set->entry, &connection->stripe_list);
+			return NULL;
+		}
+		xio_release_response_task(task);
+		return NULL;
+	}
+
+	/* the last answer carries req, the others are released */
+	held = set->rsp_task;
+	if (held) {
+		list_del_init(&set->entry);
+		xio_release_response_task(held);
+	}
+
+	error = set->error;
+	if (error != XIO_E_SUCCESS) {
+		kfree(set);
+		xio_release_response_task(task);
+		xio_session_notify_msg_error(connection, req, error);
+		return NULL;
+	}
+
+	req->status = set->status;
+	xio_session_copy_in_header(req, sub);
+	kfree(set);
+
+	return req;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_stripe_error						     */
+/*---------------------------------------------------------------------------*/
+static int xio_session_stripe_error(struct xio_connection *connection,
+				    struct xio_msg *sub,
+				    enum xio_status result)
+{
+	struct xio_stripe_set	*set = sub->timer.parent;
+	struct xio_stripe_part	*part = &set->part[sub - set->sub];
+	struct xio_msg		*req;
+	enum xio_status		error;
+
+	if (part->conn) {
+		/* the caller may still touch sub, report on the next pass */
+		part->result = result;
+		part->failed = 1;
+		xio_ctx_add_event(connection->ctx, &part->event);
+		return 0;
+	}
+
+	if (set->error == XIO_E_SUCCESS)
+		set->error = result;
+	if (--set->outstanding)
+		return 0;
+
+	if (set->rsp_task) {
+		xio_session_stripe_complete(set);
+		return 0;
+	}
+
+	req = set->req;
+	error = set->error;
+	kfree(set);
+
+	return xio_session_notify_msg_error(connection, req, error);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_stripe_flush						     */
+/*---------------------------------------------------------------------------*/
+void xio_session_stripe_flush(struct xio_connection *connection)
+{
+	struct xio_stripe_set	*set, *tmp_set;
+
+	/* the answers held here go down with the connection, the remote
+	 * stripes still complete req with an error
+	 */
+	list_for_each_entry_safe(set, tmp_set, &connection->stripe_list,
+				 entry) {
+		list_del_init(&set->entry);
+		xio_release_response_task(set->rsp_task);
+		set->rsp_task = NULL;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_msg_stripe_info							     */
+/*---------------------------------------------------------------------------*/
+int xio_msg_stripe_info(struct xio_msg *req, struct xio_stripe_info *info)
+{
+	struct xio_stripe_hdr	shdr, *tmp_shdr;
+
+	if (req == NULL || info == NULL ||
+	    !(req->flags & XIO_MSG_FLAG_STRIPE) ||
+	    req->in.header.iov_len < sizeof(shdr)) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid parameters\n");
+		return -1;
+	}
+
+	/* the descriptor trails the application header */
+	req->in.header.iov_len -= sizeof(shdr);
+	tmp_shdr = (struct xio_stripe_hdr *)
+		((uint8_t *)req->in.header.iov_base + req->in.header.iov_len);
+	UNPACK_LLVAL(tmp_shdr, &shdr, offset);
+	UNPACK_LLVAL(tmp_shdr, &shdr, stripe_len);
+	UNPACK_LLVAL(tmp_shdr, &shdr, total_len);
+	UNPACK_LVAL(tmp_shdr, &shdr, index);
+	UNPACK_LVAL(tmp_shdr, &shdr, count);
+	req->flags &= ~XIO_MSG_FLAG_STRIPE;
+
+	info->offset		= shdr.offset;
+	info->stripe_len	= shdr.stripe_len;
+	info->total_len		= shdr.total_len;
+	info->index		= shdr.index;
+	info->count		= shdr.count;
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_fanout_put						     */
+/*---------------------------------------------------------------------------*/
+static struct xio_msg *xio_session_fanout_put(
+		struct xio_connection *connection,
+		struct xio_fanout *fanout,
+		enum xio_status result)
+{
+	struct xio_msg	*msg = fanout->msg;
+	enum xio_status	error;
+
+	if (result != XIO_E_SUCCESS && fanout->error == XIO_E_SUCCESS)
+		fanout->error = result;
+	if (--fanout->outstanding)
+		return NULL;
+
+	/* the last target completes msg */
+	error = fanout->error;
+	kfree(fanout);
+	if (error == XIO_E_SUCCESS)
+		return msg;
+
+	xio_session_notify_msg_error(connection, msg, error);
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_fanout_comp						     */
+/*---------------------------------------------------------------------------*/
+static struct xio_msg *xio_session_fanout_comp(
+		struct xio_connection *connection,
+		struct xio_msg *copy,
+		enum xio_status result)
+{
+	struct xio_fanout *fanout = copy->timer.parent;
+
+	if (fanout->status)
+		fanout->status[copy - fanout->copy] = result;
+
+	return xio_session_fanout_put(connection, fanout, result);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_send_msg_fanout							     */
+/*---------------------------------------------------------------------------*/
+int xio_send_msg_fanout(struct xio_connection **conns, int nr,
+			struct xio_msg *msg, int *status)
+{
+	struct xio_fanout	*fanout;
+	struct xio_msg		*copy;
+	int			i, posted = 0;
+
+	if (conns == NULL || nr <= 0 || msg == NULL || msg->next) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid parameters\n");
+		return -1;
+	}
+	for (i = 0; i < nr; i++) {
+		if (conns[i] == NULL || conns[i]->ctx != conns[0]->ctx) {
+			xio_set_error(EINVAL);
+			ERROR_LOG("invalid parameters\n");
+			return -1;
+		}
+	}
+
+	fanout = kcalloc(1, sizeof(*fanout) + nr * sizeof(*copy), GFP_KERNEL);
+	if (fanout == NULL) {
+		xio_set_error(ENOMEM);
+		ERROR_LOG("failed to allocate fan out\n");
+		return -1;
+	}
+	fanout->msg	= msg;
+	fanout->status	= status;
+	/* one reference per target and one held while posting */
+	fanout->outstanding = nr + 1;
+
+	for (i = 0; i < nr; i++) {
+		copy = &fanout->copy[i];
+		/* every copy points at the same out buffers */
+		copy->out		= msg->out;
+		copy->flags		= (msg->flags &
+					   ~(XIO_MSG_FLAG_HEDGE |
+					     XIO_MSG_FLAG_STRIPE |
+					     XIO_MSG_FLAG_REQUEST_READ_RECEIPT)) |
+					  XIO_MSG_FLAG_FANOUT;
+		copy->user_context	= msg->user_context;
+		copy->timer.parent	= fanout;
+		if (status)
+			status[i] = XIO_E_IN_PORGRESS;
+
+		if (xio_send_msg(conns[i], copy))
+			xio_session_fanout_comp(conns[i], copy,
+						XIO_E_NO_BUFS);
+		else
+			posted++;
+	}
+	if (posted == 0) {
+		kfree(fanout);
+		return -1;
+	}
+
+	msg->sn		= fanout->copy[0].sn;
+	msg->type	= XIO_ONE_WAY_REQ;
+	msg->timestamp	= fanout->copy[0].timestamp;
+
+	/* a send completion is never reported inline, so dropping the
+	 * posting reference can only end in an error notification
+	 */
+	xio_session_fanout_put(conns[0], fanout, XIO_E_SUCCESS);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_forward_done						     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_forward_done(struct xio_msg *fwd)
+{
+	struct xio_task *task = fwd->timer.parent;
+
+	/* the received buffers are no longer referenced */
+	fwd->flags		&= ~XIO_MSG_FLAG_FORWARD;
+	fwd->timer.parent	= NULL;
+	xio_tasks_pool_put(task);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_forward_msg							     */
+/*---------------------------------------------------------------------------*/
+int xio_forward_msg(struct xio_connection *connection,
+		    struct xio_msg *imsg, struct xio_msg *fwd)
+{
+	struct xio_task	*task;
+	int		retval;
+
+	if (connection == NULL || imsg == NULL || fwd == NULL ||
+	    imsg->next || fwd->next) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid parameters\n");
+		return -1;
+	}
+	task = container_of(imsg, struct xio_task, imsg);
+	if ((task->tlv_type != XIO_MSG_REQ &&
+	     task->tlv_type != XIO_ONE_WAY_REQ) ||
+	    task->connection == NULL ||
+	    task->connection->ctx != connection->ctx) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid parameters\n");
+		return -1;
+	}
+
+	/* send straight from the receive task's buffers, the task is held
+	 * until the forward completes
+	 */
+	fwd->out		= imsg->in;
+	fwd->flags		= (fwd->flags &
+				   ~(XIO_MSG_FLAG_HEDGE | XIO_MSG_FLAG_STRIPE |
+				     XIO_MSG_FLAG_FANOUT |
+				     XIO_MSG_FLAG_REQUEST_READ_RECEIPT)) |
+				  XIO_MSG_FLAG_FORWARD;
+	fwd->timer.parent	= task;
+	xio_task_addref(task);
+
+	if (task->tlv_type == XIO_ONE_WAY_REQ)
+		retval = xio_send_msg(connection, fwd);
+	else
+		retval = xio_send_request(connection, fwd);
+
+	/* not queued and not already flushed back */
+	if (retval && fwd->timer.parent)
+		xio_session_forward_done(fwd);
+
+	return retval;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_set_resume						     */
+/*---------------------------------------------------------------------------*/
+int xio_session_set_resume(struct xio_session *session, uint32_t grace_ms)
+{
+	if (session == NULL) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid parameters\n");
+		return -1;
+	}
+	session->resume_grace_ms = grace_ms;
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_resume_flush						     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_resume_flush(struct xio_session *session)
+{
+	struct xio_msg_list	msgq;
+	struct xio_msg		*pmsg, *tmp_pmsg;
+
+	xio_msg_list_init(&msgq);
+	spin_lock(&session->resume_lock);
+	xio_msg_list_concat(&msgq, &session->resume_msgq, pdata);
+	session->resume_ctx = NULL;
+	spin_unlock(&session->resume_lock);
+
+	xio_msg_list_foreach_safe(pmsg, &msgq, tmp_pmsg, pdata) {
+		xio_msg_list_remove(&msgq, pmsg, pdata);
+		if (session->ses_ops.on_msg_error)
+			session->ses_ops.on_msg_error(
+					session,
+					XIO_E_MSG_FLUSHED, pmsg,
+					session->resume_user_context);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_resume_expired						     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_resume_expired(void *data)
+{
+	struct xio_session	*session = data;
+
+	xio_session_resume_flush(session);
+
+	/* nobody came back, finish the teardown held back on the last close */
+	if (session->connections_nr == 0 &&
+	    session->state == XIO_SESSION_STATE_ONLINE) {
+		session->state = XIO_SESSION_STATE_CLOSING;
+		xio_session_notify_teardown(session,
+					    XIO_E_SESSION_DISCONECTED);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_resume_replay_work					     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_resume_replay_work(void *data)
+{
+	xio_session_resume_replay(data);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_resume_kick						     */
+/*---------------------------------------------------------------------------*/
+static void xio_session_resume_kick(struct xio_connection *dropped)
+{
+	struct xio_session	*session = dropped->session;
+	struct xio_connection	*connection, *target = NULL;
+
+	/* an online connection of the same context first, else any */
+	spin_lock(&session->connections_list_lock);
+	list_for_each_entry(connection, &session->connections_list,
+			    connections_list_entry) {
+		if (connection == dropped ||
+		    connection->state != XIO_CONNECTION_STATE_ONLINE ||
+		    connection->in_close)
+			continue;
+		if (connection->ctx == dropped->ctx) {
+			target = connection;
+			break;
+		}
+		if (target == NULL)
+			target = connection;
+	}
+	/* listed connections are alive, the release on their own thread
+	 * cancels the work
+	 */
+	if (target && target->ctx != dropped->ctx)
+		xio_ctx_add_work(target->ctx, target,
+				 xio_session_resume_replay_work,
+				 &target->resume_work);
+	spin_unlock(&session->connections_list_lock);
+
+	if (target && target->ctx == dropped->ctx)
+		xio_session_resume_replay(target);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_resume_park						     */
+/*---------------------------------------------------------------------------*/
+void xio_session_resume_park(struct xio_connection *connection)
+{
+	struct xio_session	*session = connection->session;
+	int			retval = 0;
+
+	if (!session->resume_grace_ms ||
+	    session->state != XIO_SESSION_STATE_ONLINE)
+		return;
+
+	/* the next conn of the context takes over the task pool and its
+	 * registered buffers
+	 */
+	if (connection->conn)
+		connection->conn->keep_pool_ms = session->resume_grace_ms;
+
+	spin_lock(&session->resume_lock);
+	xio_connection_detach_msgs(connection, &session->resume_msgq);
+	session->resume_user_context = connection->cb_user_context;
+
+	/* the grace period runs on the context of the first drop and
+	 * restarts with the drops that follow there
+	 */
+	if (session->resume_ctx == NULL ||
+	    session->resume_ctx == connection->ctx) {
+		session->resume_ctx = connection->ctx;
+		if (xio_is_delayed_work_pending(&session->resume_work))
+			xio_ctx_del_delayed_work(connection->ctx,
+						 &session->resume_work);
+		retval = xio_ctx_add_delayed_work(connection->ctx,
+						  session->resume_grace_ms,
+						  session,
+						  xio_session_resume_expired,
+						  &session->resume_work);
+	}
+	spin_unlock(&session->resume_lock);
+	if (retval != 0)
+		ERROR_LOG("xio_ctx_add_delayed_work failed.\n");
+
+	xio_session_resume_kick(connection);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_resume_replay						     */
+/*---------------------------------------------------------------------------*/
+void xio_session_resume_replay(struct xio_connection *connection)
+{
+	struct xio_session	*session = connection->session;
+	struct xio_msg_list	msgq;
+
+	if (!session->resume_grace_ms)
+		return;
+
+	xio_msg_list_init(&msgq);
+	spin_lock(&session->resume_lock);
+	xio_msg_list_concat(&msgq, &session->resume_msgq, pdata);
+	/* only the context running the timer may stop it, elsewhere it
+	 * expires with nothing left to flush
+	 */
+	if (session->resume_ctx == connection->ctx) {
+		if (xio_is_delayed_work_pending(&session->resume_work))
+			xio_ctx_del_delayed_work(connection->ctx,
+						 &session->resume_work);
+		session->resume_ctx = NULL;
+	}
+	spin_unlock(&session->resume_lock);
+
+	if (xio_msg_list_empty(&msgq))
+		return;
+
+	/* in their original order, in flight ones first */
+	xio_connection_attach_msgs(connection, &msgq);
+
+	xio_connection_xmit_msgs(connection);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_send_request						     */
+/*---------------------------------------------------------------------------*/
+struct xio_connection *xio_session_send_request(struct xio_session *session,
+						struct xio_context *ctx,
+						struct xio_msg *req,
+						uint64_t key)
+{
+	struct xio_connection	*connection, *best = NULL;
+	struct xio_connection	*online[XIO_LB_MAX_CONNECTIONS];
+	uint64_t		cost, best_cost = 0;
+	int			i, n;
+
+	if (session == NULL || ctx == NULL || req == NULL) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid parameters\n");
+		return NULL;
+	}
+
+	n = xio_session_online_connections(session, ctx, online);
+	if (n == 0) {
+		xio_set_error(EAGAIN);
+		return NULL;
+	}
+
+	switch (session->lb_policy) {
+	case XIO_LB_ROUND_ROBIN:
+		best = online[session->lb_next++ % n];
+		break;
+	case XIO_LB_HASH:
+		/* fibonacci hashing spreads sequential keys */
+		best = online[((key * 0x9E3779B97F4A7C15ULL) >> 32) % n];
+		break;
+	case XIO_LB_LEAST_OUTSTANDING:
+	case XIO_LB_LATENCY_EWMA:
+		/* start the scan in turn so that ties are spread */
+		for (i = 0; i < n; i++) {
+			connection = online[(session->lb_next + i) % n];
+			cost = xio_session_lb_cost(session, connection);
+			if (best == NULL || cost < best_cost) {
+				best = connection;
+				best_cost = cost;
+			}
+		}
+		session->lb_next++;
+		break;
+	}
+
+	if (unlikely(req->flags & XIO_MSG_FLAG_HEDGE) && n > 1 &&
+	    session->hedge_permille && session->hedge_delay &&
+	    !(req->flags & XIO_MSG_FLAG_REQUEST_READ_RECEIPT)) {
+		if (xio_session_send_hedged(best, req))
+			return NULL;
+		return best;
+	}
+
+	if (xio_send_request(best, req))
+		return NULL;
+
+	return best;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_notify_cancel						     */
+/*---------------------------------------------------------------------------*/
+int xio_session_notify_cancel(struct xio_connection *connection,
+			      struct xio_msg *req, enum xio_status result)
+{
+	if (unlikely(req->flags & XIO_MSG_FLAG_FORWARD) && req->timer.parent)
+		xio_session_forward_done(req);
+	if (unlikely(req->flags & XIO_MSG_FLAG_HEDGE) && req->timer.parent)
+		return xio_session_hedge_error(connection, req, result);
+	if (unlikely(req->flags & XIO_MSG_FLAG_STRIPE) && req->timer.parent)
+		return xio_session_stripe_error(connection, req, result);
+	if (unlikely(req->flags & XIO_MSG_FLAG_FANOUT) && req->timer.parent) {
+		xio_session_fanout_comp(connection, req, result);
+		return 0;
+	}
+
+	/* notify the upper layer */
+	if (connection->ses_ops.on_cancel)
+		connection->ses_ops.on_cancel(
+				connection->session, req,
+				result,
+				connection->cb_user_context);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_session_notify_msg_error						     */
+/*---------------------------------------------------------------------------*/
+int xio_session_notify_msg_error(struct xio_connection *connection,
+				 struct xio_msg *msg, enum xio_status result)
+{
+	if (unlikely(msg->flags & XIO_MSG_FLAG_FORWARD) && msg->timer.parent)
+		xio_session_forward_done(msg);
+	if (unlikely(msg->flags & XIO_MSG_FLAG_HEDGE) && msg->timer.parent)
+		return xio_session_hedge_error(connection, msg, result);
+	if (unlikely(msg->flags & XIO_MSG_FLAG_STRIPE) && msg->timer.parent)
+		return xio_session_stripe_error(connection, msg, result);
+	if (unlikely(msg->flags & XIO_MSG_FLAG_FANOUT) && msg->timer.parent) {
+		xio_session_fanout_comp(connection, msg, result);
+		return 0;
+	}
+
 	/* notify the upper layer */
 	if (connection->ses_ops.on_msg_error)
 		connection->ses_ops.on_msg_error(
@@ -39,8 +39,19 @@
 #define XIO_SESSION_H
 
 #include "xio_hash.h"
+#include "xio_msg_list.h"
 #include "sys/hashtable.h"
 
+/* connections of one context xio_session_send_request chooses from */
+#define XIO_LB_MAX_CONNECTIONS		64
+
+/* hedge delay: response time histogram of quarter octave buckets that is
+ * halved every window samples, the percentile is refreshed every update
+ */
+#define XIO_HEDGE_BUCKETS		256
+#define XIO_HEDGE_WINDOW		8192
+#define XIO_HEDGE_UPDATE		64
+
 /*---------------------------------------------------------------------------*/
 /* forward declarations			                                     */
 /*---------------------------------------------------------------------------*/
@@ -66,6 +77,7 @@ enum xio_session_state {
 /*---------------------------------------------------------------------------*/
 struct xio_session {
 	uint64_t			trans_sn; /* transaction sn */
+	uint64_t			token;	  /* server's, in every hello */
 	uint32_t			session_id;
 	uint32_t			peer_session_id;
 	uint32_t			session_flags;
@@ -106,6 +118,26 @@ struct xio_session {
 	int				disable_teardown;
 	struct xio_connection		*lead_connection;
 	struct xio_connection		*redir_connection;
+
+	/* xio_session_send_request */
+	enum xio_lb_policy		lb_policy;
+	uint32_t			lb_next;
+
+	/* request hedging */
+	uint32_t			hedge_permille;
+	uint32_t			hedge_samples;
+	uint64_t			hedge_delay;	/* cycles, 0 - learning */
+	uint32_t			hedge_hist[XIO_HEDGE_BUCKETS];
+
+	/* resumption: requests of a dropped connection wait for a
+	 * replacement on any context until the grace period ends
+	 */
+	uint32_t			resume_grace_ms;
+	spinlock_t			resume_lock;	/* resume_msgq */
+	struct xio_context		*resume_ctx;	/* runs resume_work */
+	void				*resume_user_context;
+	struct xio_msg_list		resume_msgq;
+	xio_delayed_work_handle_t	resume_work;
 };
 
 /*---------------------------------------------------------------------------*/
@@ -224,5 +256,15 @@ void xio_session_notify_rejected(struct xio_session *session);
 
 void xio_session_post_teardown(struct xio_session *session);
 
+void xio_session_resume_park(struct xio_connection *connection);
+
+void xio_session_hedge_flush(struct xio_connection *connection);
+
+void xio_session_hedge_event(xio_ctx_event_t *tev, void *data);
+
+void xio_session_stripe_flush(struct xio_connection *connection);
+
+void xio_session_resume_replay(struct xio_connection *connection);
+
 #endif /*XIO_SESSION_H */
 
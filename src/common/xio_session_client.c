@@ -148,7 +148,14 @@ int xio_on_connection_hello_rsp_recv(struct xio_connection *connection,
 				 XIO_CONNECTION_STATE_ESTABLISHED);
 	xio_session_notify_connection_established(session, connection);
 
-	if (session->state == XIO_SESSION_STATE_ACCEPTED) {
+	if (session->state == XIO_SESSION_STATE_ONLINE) {
+		/* joined an online session, now try to send */
+		xio_connection_set_state(connection,
+					 XIO_CONNECTION_STATE_ONLINE);
+		/* requests of a dropped connection are sent again */
+		xio_session_resume_replay(connection);
+		xio_connection_xmit_msgs(connection);
+	} else if (session->state == XIO_SESSION_STATE_ACCEPTED) {
 		/* is this the last to accept */
 		spin_lock(&session->connections_list_lock);
 		list_for_each_entry(tmp_connection,
@@ -367,6 +374,9 @@ int xio_read_setup_rsp(struct xio_connection *connection,
 		len = xio_read_uint16(&rsp->user_context_len, 0, ptr);
 		ptr = ptr + len;
 
+		len = xio_read_uint64(&session->token, 0, ptr);
+		ptr = ptr + len;
+
 		if (session->portals_array_len) {
 			session->portals_array = kcalloc(
 					session->portals_array_len,
@@ -789,10 +799,10 @@ int xio_on_client_conn_established(struct xio_session *session,
 			  "connection:%p, session:%p, conn:%p\n",
 			   connection, connection->session,
 			   connection->conn);
-		/* now try to send */
-		xio_connection_set_state(connection,
-					 XIO_CONNECTION_STATE_ONLINE);
-		xio_connection_xmit_msgs(connection);
+		/* a new conn has its pool only now, introduce it to the
+		 * session, the hello response sets it online
+		 */
+		xio_connection_send_hello_req(connection);
 		break;
 	default:
 		break;
@@ -832,6 +842,12 @@ int xio_on_conn_event_client(void *observer, void *sender, int event,
 */
 		xio_on_assign_in_buf(session, conn, event_data);
 		break;
+	case XIO_CONN_EVENT_DATA_CHUNK:
+/*		TRACE_LOG("session: [notification] - data chunk. " \
+			 "session:%p, conn:%p\n", observer, sender);
+*/
+		xio_on_data_chunk(session, conn, event_data);
+		break;
 	case XIO_CONN_EVENT_CANCEL_REQUEST:
 		DEBUG_LOG("session: [notification] - cancel request. " \
 			 "session:%p, conn:%p\n", observer, sender);
@@ -893,7 +909,8 @@ struct xio_connection *xio_connect(struct xio_session  *session,
 				       void *conn_user_context)
 {
 	struct xio_session	*psession = NULL;
-	struct xio_connection	*connection = NULL, *tmp_connection;
+	struct xio_connection	*connection = NULL;
+	struct xio_conn		*conn = NULL;
 	int			retval;
 
 	if ((ctx == NULL) || (session == NULL)) {
@@ -912,16 +929,8 @@ struct xio_connection *xio_connect(struct xio_session  *session,
 
 	mutex_lock(&session->lock);
 
-	/* only one connection per context allowed */
-	connection = xio_session_find_connection_by_ctx(session, ctx);
-	if (connection != NULL) {
-		ERROR_LOG("context:%p, already assigned connection:%p\n",
-			  ctx, connection);
-		goto cleanup;
-	}
 	if (session->state == XIO_SESSION_STATE_INIT) {
 		char portal[64];
-		struct xio_conn	*conn;
 		/* extract portal from uri */
 		if (xio_uri_get_portal(session->uri, portal,
 				       sizeof(portal)) != 0) {
@@ -964,7 +973,6 @@ struct xio_connection *xio_connect(struct xio_session  *session,
 						     conn_user_context);
 	} else if (session->state == XIO_SESSION_STATE_ONLINE ||
 		   session->state == XIO_SESSION_STATE_ACCEPTED) {
-		struct xio_conn *conn;
 		char *portal;
 		if (conn_idx == 0) {
 			portal = session->portals_array[
@@ -983,32 +991,81 @@ struct xio_connection *xio_connect(struct xio_session  *session,
 				     session->session_id);
 		if (conn == NULL) {
 			ERROR_LOG("failed to open connection\n");
-			goto cleanup;
-		}
-		tmp_connection = xio_session_assign_conn(session, conn);
-		if (tmp_connection != connection) {
-			ERROR_LOG("failed to open connection conn:%p, %p %p\n",
-				  conn, tmp_connection, connection);
-			goto cleanup;
+			goto cleanup1;
 		}
+		/* the conn is the connection's own, see xio_conn_open */
+		xio_connection_set_conn(connection, conn);
 		DEBUG_LOG("reconnecting to %s, ctx:%p\n", portal, ctx);
 		retval = xio_conn_connect(conn, portal,
 					  &session->observer, out_if);
 		if (retval != 0) {
 			ERROR_LOG("connection connect failed\n");
-			goto cleanup;
+			goto cleanup2;
 		}
-		connection = tmp_connection;
-		if (session->state == XIO_SESSION_STATE_ONLINE)
-			xio_connection_send_hello_req(connection);
 	}
 	mutex_unlock(&session->lock);
 
 	return connection;
 
+cleanup2:
+	connection->conn = NULL;
+	xio_conn_close(conn, &session->observer);
+cleanup1:
+	xio_session_free_connection(connection);
 cleanup:
 	mutex_unlock(&session->lock);
 
 	return NULL;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_connect_prewarm							     */
+/*---------------------------------------------------------------------------*/
+int xio_connect_prewarm(struct xio_context *ctx, const char *uri,
+			const char *out_if)
+{
+	char		portal[64];
+
+	if ((ctx == NULL) || (uri == NULL)) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid parameters\n");
+		return -1;
+	}
+	if (xio_uri_get_portal(uri, portal, sizeof(portal)) != 0) {
+		xio_set_error(EADDRNOTAVAIL);
+		ERROR_LOG("parsing uri failed. uri: %s\n", uri);
+		return -1;
+	}
+
+	/* the context's pool keeps the conn until a session takes it or
+	 * xio_connect_prewarm_release closes it
+	 */
+	return xio_conn_prewarm(ctx, portal, out_if);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_connect_prewarm_release						     */
+/*---------------------------------------------------------------------------*/
+int xio_connect_prewarm_release(struct xio_context *ctx, const char *uri)
+{
+	char		portal[64];
+
+	if (ctx == NULL) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid parameters\n");
+		return -1;
+	}
+	if (uri == NULL) {
+		xio_conn_prewarm_release(ctx, NULL);
+		return 0;
+	}
+	if (xio_uri_get_portal(uri, portal, sizeof(portal)) != 0) {
+		xio_set_error(EADDRNOTAVAIL);
+		ERROR_LOG("parsing uri failed. uri: %s\n", uri);
+		return -1;
+	}
+	xio_conn_prewarm_release(ctx, portal);
+
+	return 0;
+}
+
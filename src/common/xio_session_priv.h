@@ -91,6 +91,13 @@ int xio_on_assign_in_buf(struct xio_session *session,
 			 struct xio_conn *conn,
 			 union xio_conn_event_data *event_data);
 
+/*---------------------------------------------------------------------------*/
+/* xio_on_data_chunk							     */
+/*---------------------------------------------------------------------------*/
+int xio_on_data_chunk(struct xio_session *session,
+		      struct xio_conn *conn,
+		      union xio_conn_event_data *event_data);
+
 /*---------------------------------------------------------------------------*/
 /* xio_on_cancel_request						     */
 /*---------------------------------------------------------------------------*/
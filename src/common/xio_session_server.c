@@ -209,6 +209,8 @@ struct xio_msg *xio_session_write_accept_rsp(
 
 	/* calculate length */
 	tot_len = 3*sizeof(uint16_t) + sizeof(uint32_t);
+	if (action == XIO_ACTION_ACCEPT)
+		tot_len += sizeof(uint64_t);
 	for (i = 0; i < portals_array_len; i++)
 		tot_len += strlen(portals_array[i]) + sizeof(uint16_t);
 	tot_len += user_context_len;
@@ -255,6 +257,11 @@ struct xio_msg *xio_session_write_accept_rsp(
 	len = xio_write_uint16(user_context_len, 0, ptr);
 	ptr  = ptr + len;
 
+	/* token, the client's hellos carry it back */
+	if (action == XIO_ACTION_ACCEPT) {
+		len = xio_write_uint64(session->token, 0, ptr);
+		ptr  = ptr + len;
+	}
 
 	for (i = 0; i < portals_array_len; i++) {
 		str_len = strlen(portals_array[i]);
@@ -599,6 +606,12 @@ int xio_on_conn_event_server(void *observer, void *sender, int event,
 */
 		xio_on_assign_in_buf(session, conn, event_data);
 		break;
+	case XIO_CONN_EVENT_DATA_CHUNK:
+/*		TRACE_LOG("session: [notification] - data chunk. " \
+			 "session:%p, conn:%p\n", observer, sender);
+*/
+		xio_on_data_chunk(session, conn, event_data);
+		break;
 	case XIO_CONN_EVENT_CANCEL_REQUEST:
 		DEBUG_LOG("session: [notification] - cancel request. " \
 			 "session:%p, conn:%p\n", observer, sender);
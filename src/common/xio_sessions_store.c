@@ -42,6 +42,7 @@
 #include "xio_observer.h"
 #include "xio_transport.h"
 #include "xio_task.h"
+#include "xio_context.h"
 #include "xio_session.h"
 #include "xio_sessions_store.h"
 
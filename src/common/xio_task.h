@@ -65,6 +65,7 @@ struct xio_task {
 	struct xio_connection	*connection;
 
 	void			*pool;
+	struct xio_tasks_slab	*slab;
 	release_task_fn		release;
 
 	enum xio_task_state	state;		/* task state enum	*/
@@ -81,6 +82,18 @@ struct xio_task {
 
 };
 
+struct xio_tasks_slab {
+	struct list_head	slabs_list_entry;
+	/* pool private data of the slab's tasks, the first slab uses the
+	 * pool's own dd_data
+	 */
+	void			*dd_data;
+	int			start_idx;
+	int			nr;
+	int			nr_free;	/* of nr, in the pool */
+	int			pad;
+};
+
 struct xio_tasks_pool {
 	/* pool of tasks */
 	struct xio_task		**array;
@@ -92,6 +105,13 @@ struct xio_tasks_pool {
 	int			nr;
 	void			*dd_data;
 	void			*pool_ops;
+
+	/* tasks are allocated in slabs, up to max */
+	struct list_head	slabs_list;
+	int			alloc_nr;
+	int			pool_dd_data_sz;
+	int			task_dd_data_sz;
+	int			pad;
 };
 
 /*---------------------------------------------------------------------------*/
@@ -116,6 +136,37 @@ struct xio_tasks_pool *xio_tasks_pool_init(int max,
 			int task_dd_data_sz,
 			void *pool_ops);
 
+/*---------------------------------------------------------------------------*/
+/* xio_tasks_pool_create						     */
+/*---------------------------------------------------------------------------*/
+struct xio_tasks_pool *xio_tasks_pool_create(int max,
+			int pool_dd_data_sz,
+			int task_dd_data_sz,
+			void *pool_ops);
+
+/*---------------------------------------------------------------------------*/
+/* xio_tasks_pool_alloc_slab						     */
+/*---------------------------------------------------------------------------*/
+struct xio_tasks_slab *xio_tasks_pool_alloc_slab(struct xio_tasks_pool *q,
+						 int nr);
+
+/*---------------------------------------------------------------------------*/
+/* xio_tasks_pool_add_slab						     */
+/*---------------------------------------------------------------------------*/
+void xio_tasks_pool_add_slab(struct xio_tasks_pool *q,
+			     struct xio_tasks_slab *slab);
+
+/*---------------------------------------------------------------------------*/
+/* xio_tasks_pool_idle_slab						     */
+/*---------------------------------------------------------------------------*/
+struct xio_tasks_slab *xio_tasks_pool_idle_slab(struct xio_tasks_pool *q);
+
+/*---------------------------------------------------------------------------*/
+/* xio_tasks_pool_free_slab						     */
+/*---------------------------------------------------------------------------*/
+void xio_tasks_pool_free_slab(struct xio_tasks_pool *q,
+			      struct xio_tasks_slab *slab);
+
 /*---------------------------------------------------------------------------*/
 /* xio_tasks_pool_get							     */
 /*---------------------------------------------------------------------------*/
@@ -131,11 +182,35 @@ static inline struct xio_task *xio_tasks_pool_get(
 	t = list_first_entry(&q->stack, struct xio_task,  tasks_list_entry);
 	list_del_init(&t->tasks_list_entry);
 	q->nr--;
+	t->slab->nr_free--;
 	kref_init(&t->kref);
 	t->tlv_type = 0xbeef;  /* poison the type */
 	return t;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_tasks_pool_get_bulk						     */
+/*---------------------------------------------------------------------------*/
+static inline int xio_tasks_pool_get_bulk(
+			struct xio_tasks_pool *q,
+			struct list_head *list, int nr)
+{
+	struct xio_task *t;
+	int		i;
+
+	for (i = 0; i < nr && !list_empty(&q->stack); i++) {
+		t = list_first_entry(&q->stack, struct xio_task,
+				     tasks_list_entry);
+		list_move_tail(&t->tasks_list_entry, list);
+		t->slab->nr_free--;
+		kref_init(&t->kref);
+		t->tlv_type = 0xbeef;  /* poison the type */
+	}
+	q->nr -= i;
+
+	return i;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_tasks_pool_put							     */
 /*---------------------------------------------------------------------------*/
@@ -144,6 +219,17 @@ static inline void xio_tasks_pool_put(struct xio_task *task)
 	kref_put(&task->kref, task->release);
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_tasks_pool_push - return an unreferenced task to the stack	     */
+/*---------------------------------------------------------------------------*/
+static inline void xio_tasks_pool_push(struct xio_tasks_pool *q,
+				       struct xio_task *t)
+{
+	list_move(&t->tasks_list_entry, &q->stack);
+	q->nr++;
+	t->slab->nr_free++;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_tasks_pool_free_tasks						     */
 /*---------------------------------------------------------------------------*/
@@ -153,9 +239,9 @@ static inline int xio_tasks_pool_free_tasks(
 	if (!q)
 		return 0;
 
-	if (q->nr != q->max)
+	if (q->nr != q->alloc_nr)
 		ERROR_LOG("tasks inventory: %d/%d = missing:%d\n",
-			  q->nr, q->max, q->max-q->nr);
+			  q->nr, q->alloc_nr, q->alloc_nr-q->nr);
 	return q->nr;
 }
 
@@ -166,7 +252,7 @@ static inline struct xio_task *xio_tasks_pool_lookup(
 			struct xio_tasks_pool *q,
 			int id)
 {
-	return  ((id < q->max) ? q->array[id] : NULL);
+	return  ((id < q->alloc_nr) ? q->array[id] : NULL);
 }
 
 #endif
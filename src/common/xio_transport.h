@@ -63,6 +63,7 @@ enum xio_transport_event {
 	XIO_TRANSPORT_CANCEL_RESPONSE,
 	XIO_TRANSPORT_MESSAGE_ERROR,
 	XIO_TRANSPORT_ERROR,
+	XIO_TRANSPORT_DATA_CHUNK,
 };
 
 enum xio_transport_opt {
@@ -104,6 +105,11 @@ union xio_transport_event_data {
 	struct {
 		enum xio_status	reason;
 	} error;
+	struct {
+		struct xio_task	*task;
+		size_t		offset;
+		size_t		len;
+	} chunk;
 };
 
 struct xio_transport_base {
@@ -126,6 +132,11 @@ struct xio_tasks_pool_ops {
 	void	(*pool_get_params)(struct xio_transport_base *transport_hndl,
 				int *pool_len, int *pool_dd_sz,
 				int *task_dd_size);
+	/* optional: the pool is allocated in slabs of slab_len tasks as
+	 * the traffic needs them, instead of pool_len tasks at once
+	 */
+	void	(*pool_get_slab_params)(struct xio_transport_base *trans_hndl,
+				int *slab_len);
 	int	(*pool_alloc)(struct xio_transport_base *trans_hndl,
 				int max, void *pool_dd_data);
 	int	(*pool_free)(struct xio_transport_base *trans_hndl,
@@ -134,6 +145,12 @@ struct xio_tasks_pool_ops {
 				void *pool_dd_data, struct xio_task *task);
 	int	(*pool_uninit_item)(void *pool_dd_data, struct xio_task *task);
 	int	(*pool_run)(struct xio_transport_base *trans_hndl);
+	/* optional: the slab of a closed handle suits trans_hndl, its items
+	 * are initialized again instead of allocating new resources. a
+	 * transport implementing it frees such slabs without a handle
+	 */
+	int	(*pool_reuse)(struct xio_transport_base *trans_hndl,
+				void *pool_dd_data);
 
 	int	(*pre_put)(struct xio_transport_base *trans_hndl,
 			struct xio_task *task);
@@ -147,6 +164,9 @@ struct xio_tasks_pool_cls {
 	void		  (*task_free)(struct xio_task *task);
 
 	struct xio_task	* (*task_lookup)(void *pool, int task_id);
+
+	/* return an idle slab of tasks to the system */
+	int		  (*pool_shrink)(void *pool);
 };
 
 struct xio_transport {
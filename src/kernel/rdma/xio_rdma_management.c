@@ -182,7 +182,10 @@ static struct xio_cq *xio_cq_init(struct xio_device *dev,
 	} else
 		cpu = ctx->cpuid;
 
-	cpu = cpu % dev->cqs_used;
+	if (ctx->comp_vector != -1)
+		cpu = ctx->comp_vector % dev->ib_dev->num_comp_vectors;
+	else
+		cpu = cpu % dev->cqs_used;
 
 	tcq = kzalloc(sizeof(struct xio_cq), GFP_KERNEL);
 	if (!tcq) {
@@ -252,6 +255,7 @@ static struct xio_cq *xio_cq_init(struct xio_device *dev,
 	}
 
 	INIT_LIST_HEAD(&tcq->trans_list);
+	ctx->cq_comp_vector = cpu;
 
 	write_lock_bh(&dev->cq_lock);
 	list_add(&tcq->cq_list_entry, &dev->cq_list);
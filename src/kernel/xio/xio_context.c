@@ -122,6 +122,9 @@ struct xio_context *xio_context_create(unsigned int flags,
 	ctx->cpuid  = cpu_hint;
 	ctx->nodeid = cpu_to_node(cpu_hint);
 	ctx->polling_timeout = polling_timeout;
+	ctx->comp_vector = -1;
+	ctx->cq_comp_vector = -1;
+	ctx->prewarm_max = XIO_CTX_PREWARM_MAX;
 	ctx->workqueue = xio_workqueue_create(ctx);
 	if (!ctx->workqueue) {
 		xio_set_error(ENOMEM);
@@ -131,6 +134,10 @@ struct xio_context *xio_context_create(unsigned int flags,
 
 	XIO_OBSERVABLE_INIT(&ctx->observable, ctx);
 	INIT_LIST_HEAD(&ctx->ctx_list);
+	INIT_LIST_HEAD(&ctx->tx_sched_list);
+	INIT_LIST_HEAD(&ctx->prewarm_list);
+	xio_ctx_init_event(&ctx->tx_sched_event,
+			   xio_connection_tx_sched_handler, ctx);
 
 	switch (flags) {
 	case XIO_LOOP_USER_LOOP:
@@ -203,9 +210,30 @@ int xio_modify_context(struct xio_context *ctx,
 		return -1;
 	}
 
+	if ((attr_mask & XIO_CONTEXT_ATTR_COMP_VECTOR) &&
+	    attr->comp_vector < -1) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid comp_vector(%d)\n", attr->comp_vector);
+		return -1;
+	}
+	if ((attr_mask & XIO_CONTEXT_ATTR_PREWARM_MAX) &&
+	    attr->prewarm_max < 0) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid prewarm_max(%d)\n", attr->prewarm_max);
+		return -1;
+	}
+
 	if (attr_mask & XIO_CONTEXT_ATTR_USER_CTX)
 		ctx->user_context = attr->user_context;
 
+	/* taken by the completion queues created from now on */
+	if (attr_mask & XIO_CONTEXT_ATTR_COMP_VECTOR)
+		ctx->comp_vector = attr->comp_vector;
+
+	/* a lower bound closes the surplus on the next prewarm or take */
+	if (attr_mask & XIO_CONTEXT_ATTR_PREWARM_MAX)
+		ctx->prewarm_max = attr->prewarm_max;
+
 	return 0;
 }
 
@@ -225,6 +253,13 @@ int xio_query_context(struct xio_context *ctx,
 	if (attr_mask & XIO_CONTEXT_ATTR_USER_CTX)
 		attr->user_context = ctx->user_context;
 
+	if (attr_mask & XIO_CONTEXT_ATTR_COMP_VECTOR)
+		attr->comp_vector = (ctx->cq_comp_vector != -1) ?
+			ctx->cq_comp_vector : ctx->comp_vector;
+
+	if (attr_mask & XIO_CONTEXT_ATTR_PREWARM_MAX)
+		attr->prewarm_max = ctx->prewarm_max;
+
 	return 0;
 }
 
@@ -259,6 +294,15 @@ void xio_context_destroy(struct xio_context *ctx)
 	kfree(ctx);
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_context_busy_cycles						     */
+/*---------------------------------------------------------------------------*/
+uint64_t xio_context_busy_cycles(struct xio_context *ctx)
+{
+	/* not measured, the balancer goes by connections and queues */
+	return 0;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_ctx_add_delayed_work						     */
 /*---------------------------------------------------------------------------*/
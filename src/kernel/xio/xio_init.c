@@ -132,7 +132,14 @@ EXPORT_SYMBOL(xio_session_event_str);
 EXPORT_SYMBOL(xio_bind);
 EXPORT_SYMBOL(xio_accept);
 EXPORT_SYMBOL(xio_unbind);
+EXPORT_SYMBOL(xio_portals_balancer_create);
+EXPORT_SYMBOL(xio_portals_balancer_destroy);
+EXPORT_SYMBOL(xio_portals_balancer_add);
+EXPORT_SYMBOL(xio_portals_balancer_select);
+EXPORT_SYMBOL(xio_portals_balancer_accept);
 EXPORT_SYMBOL(xio_connect);
+EXPORT_SYMBOL(xio_connect_prewarm);
+EXPORT_SYMBOL(xio_connect_prewarm_release);
 EXPORT_SYMBOL(xio_disconnect);
 
 EXPORT_SYMBOL(xio_get_connection);
@@ -141,8 +148,18 @@ EXPORT_SYMBOL(xio_modify_connection);
 EXPORT_SYMBOL(xio_query_connection);
 
 EXPORT_SYMBOL(xio_send_request);
+EXPORT_SYMBOL(xio_send_request_batch);
+EXPORT_SYMBOL(xio_session_send_request);
+EXPORT_SYMBOL(xio_session_set_lb_policy);
+EXPORT_SYMBOL(xio_session_set_hedge);
+EXPORT_SYMBOL(xio_session_send_striped);
+EXPORT_SYMBOL(xio_msg_stripe_info);
+EXPORT_SYMBOL(xio_send_msg_fanout);
+EXPORT_SYMBOL(xio_forward_msg);
+EXPORT_SYMBOL(xio_session_set_resume);
 EXPORT_SYMBOL(xio_send_response);
 EXPORT_SYMBOL(xio_release_response);
+EXPORT_SYMBOL(xio_release_response_batch);
 
 EXPORT_SYMBOL(xio_write_tlv);
 EXPORT_SYMBOL(xio_read_tlv);
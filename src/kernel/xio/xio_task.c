@@ -49,26 +49,20 @@
 #define XIO_TASK_MAGIC   0x58494f5f5441534b
 
 /*---------------------------------------------------------------------------*/
-/* xio_tasks_pool_init							     */
+/* xio_tasks_pool_create						     */
 /*---------------------------------------------------------------------------*/
-struct xio_tasks_pool *xio_tasks_pool_init(int max, int pool_dd_data_sz,
-					   int task_dd_data_sz,
-					   void *pool_ops)
+struct xio_tasks_pool *xio_tasks_pool_create(int max, int pool_dd_data_sz,
+					     int task_dd_data_sz,
+					     void *pool_ops)
 {
-	int			i;
 	void			*buf;
-	void			*data;
 	struct xio_tasks_pool	*q;
-	size_t			elems_alloc_sz;
 
-	/* pool + private data */
+	/* pool + private data + array, the tasks come in slabs */
 	size_t pool_alloc_sz = sizeof(struct xio_tasks_pool) +
 				pool_dd_data_sz +
 				max*sizeof(struct xio_task *);
 
-	/* pool data */
-	elems_alloc_sz = max*(sizeof(struct xio_task) + task_dd_data_sz);
-
 	pool_alloc_sz = PAGE_ALIGN(pool_alloc_sz);
 
 	buf = vmalloc(pool_alloc_sz);
@@ -82,36 +76,154 @@ struct xio_tasks_pool *xio_tasks_pool_init(int max, int pool_dd_data_sz,
 	q = buf;
 	q->dd_data = buf + sizeof(struct xio_tasks_pool);
 
-	buf = buf + sizeof(struct xio_tasks_pool) + pool_dd_data_sz;
-
 	/* array */
-	q->array = buf;
+	q->array = buf + sizeof(struct xio_tasks_pool) + pool_dd_data_sz;
+
+	INIT_LIST_HEAD(&q->stack);
+	INIT_LIST_HEAD(&q->slabs_list);
+
+	q->max = max;
+	q->pool_ops = pool_ops;
+	q->pool_dd_data_sz = pool_dd_data_sz;
+	q->task_dd_data_sz = task_dd_data_sz;
+
+	return q;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_tasks_pool_alloc_slab						     */
+/*---------------------------------------------------------------------------*/
+struct xio_tasks_slab *xio_tasks_pool_alloc_slab(struct xio_tasks_pool *q,
+						 int nr)
+{
+	struct xio_tasks_slab	*slab;
+	struct xio_task		*task;
+	void			*data;
+	size_t			task_sz, dd_sz, slab_alloc_sz;
+	int			i;
+
+	nr = min(nr, q->max - q->alloc_nr);
+	if (nr <= 0) {
+		xio_set_error(ENOMEM);
+		return NULL;
+	}
 
-	elems_alloc_sz = PAGE_ALIGN(elems_alloc_sz);
+	/* the first slab shares the pool's private data */
+	dd_sz = (q->alloc_nr == 0) ? 0 :
+			ALIGN(q->pool_dd_data_sz, sizeof(uint64_t));
+	task_sz = sizeof(struct xio_task) + q->task_dd_data_sz;
 
-	data = vmalloc(elems_alloc_sz);
-	if (data == NULL) {
+	slab_alloc_sz = PAGE_ALIGN(sizeof(*slab) + dd_sz + nr*task_sz);
+
+	slab = vmalloc(slab_alloc_sz);
+	if (slab == NULL) {
 		xio_set_error(ENOMEM);
 		return NULL;
 	}
-	memset(data, 0, elems_alloc_sz);
+	memset(slab, 0, slab_alloc_sz);
+
+	slab->dd_data	= dd_sz ? (void *)(slab + 1) : q->dd_data;
+	slab->start_idx	= q->alloc_nr;
+	slab->nr	= nr;
+
+	data = (char *)(slab + 1) + dd_sz;
+	for (i = 0; i < nr; i++) {
+		task		= data;
+		task->ltid	= slab->start_idx + i;
+		task->magic	= XIO_TASK_MAGIC;
+		task->pool	= (void *)q;
+		task->slab	= slab;
+		task->dd_data	= ((char *)data) + sizeof(struct xio_task);
+		INIT_LIST_HEAD(&task->tasks_list_entry);
+		q->array[task->ltid] = task;
+		data = ((char *)data) + task_sz;
+	}
+	q->alloc_nr += nr;
+	list_add_tail(&slab->slabs_list_entry, &q->slabs_list);
 
-	INIT_LIST_HEAD(&q->stack);
+	return slab;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_tasks_pool_add_slab						     */
+/*---------------------------------------------------------------------------*/
+void xio_tasks_pool_add_slab(struct xio_tasks_pool *q,
+			     struct xio_tasks_slab *slab)
+{
+	int i;
 
-	for (i = 0; i < max; i++) {
-		q->array[i]		= data;
-		q->array[i]->ltid	= i;
-		q->array[i]->magic	= XIO_TASK_MAGIC;
-		q->array[i]->pool	= (void *)q;
-		q->array[i]->dd_data	= ((char *)data) +
-						sizeof(struct xio_task);
+	for (i = slab->start_idx; i < slab->start_idx + slab->nr; i++)
 		list_add_tail(&q->array[i]->tasks_list_entry, &q->stack);
-		data = ((char *)data) + sizeof(struct xio_task) +
-					task_dd_data_sz;
+	q->nr += slab->nr;
+	slab->nr_free += slab->nr;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_tasks_pool_idle_slab						     */
+/*---------------------------------------------------------------------------*/
+struct xio_tasks_slab *xio_tasks_pool_idle_slab(struct xio_tasks_pool *q)
+{
+	struct xio_tasks_slab	*slab;
+
+	/* only the last slab may go, and never the first one */
+	if (list_empty(&q->slabs_list) ||
+	    q->slabs_list.next == q->slabs_list.prev)
+		return NULL;
+
+	slab = list_entry(q->slabs_list.prev, struct xio_tasks_slab,
+			  slabs_list_entry);
+
+	return (slab->nr_free == slab->nr) ? slab : NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_tasks_pool_free_slab						     */
+/*---------------------------------------------------------------------------*/
+void xio_tasks_pool_free_slab(struct xio_tasks_pool *q,
+			      struct xio_tasks_slab *slab)
+{
+	struct xio_task *task;
+	int		i;
+
+	/* the slab is idle (or was never added): its tasks are in the pool
+	 * or on no list at all
+	 */
+	for (i = slab->start_idx; i < slab->start_idx + slab->nr; i++) {
+		task = q->array[i];
+		if (!list_empty(&task->tasks_list_entry)) {
+			list_del(&task->tasks_list_entry);
+			q->nr--;
+		}
+		q->array[i] = NULL;
 	}
-	q->max = max;
-	q->nr = max;
-	q->pool_ops = pool_ops;
+	q->alloc_nr -= slab->nr;
+	list_del(&slab->slabs_list_entry);
+
+	vfree(slab);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_tasks_pool_init							     */
+/*---------------------------------------------------------------------------*/
+struct xio_tasks_pool *xio_tasks_pool_init(int max, int pool_dd_data_sz,
+					   int task_dd_data_sz,
+					   void *pool_ops)
+{
+	struct xio_tasks_pool	*q;
+	struct xio_tasks_slab	*slab;
+
+	q = xio_tasks_pool_create(max, pool_dd_data_sz, task_dd_data_sz,
+				  pool_ops);
+	if (q == NULL)
+		return NULL;
+
+	/* all the tasks at once */
+	slab = xio_tasks_pool_alloc_slab(q, max);
+	if (slab == NULL) {
+		vfree(q);
+		return NULL;
+	}
+	xio_tasks_pool_add_slab(q, slab);
 
 	return q;
 }
@@ -121,6 +233,11 @@ struct xio_tasks_pool *xio_tasks_pool_init(int max, int pool_dd_data_sz,
 /*---------------------------------------------------------------------------*/
 void xio_tasks_pool_free(struct xio_tasks_pool *q)
 {
-	vfree(q->array[0]);
+	struct xio_tasks_slab *slab, *tmp_slab;
+
+	list_for_each_entry_safe(slab, tmp_slab, &q->slabs_list,
+				 slabs_list_entry)
+		vfree(slab);
+
 	vfree(q);
 }
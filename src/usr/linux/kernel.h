@@ -140,4 +140,24 @@ static inline char *kstrndup(const char *s, size_t len, gfp_t gfp)
 	return strndup(s, len);
 }
 
+static inline void get_random_bytes(void *buf, int nbytes)
+{
+	struct timespec	ts;
+	int		fd, i, len = 0;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd >= 0) {
+		len = read(fd, buf, nbytes);
+		close(fd);
+	}
+	if (len == nbytes)
+		return;
+
+	/* no entropy source, the clock is better than nothing */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	for (i = 0; i < nbytes; i++)
+		((uint8_t *)buf)[i] ^= (uint8_t)((ts.tv_nsec >> (i % 4) * 8) ^
+						 ts.tv_sec ^ getpid());
+}
+
 #endif /* _LINUX_KERNEL_H */
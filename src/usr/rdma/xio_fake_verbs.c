@@ -0,0 +1,2045 @@
+/*
+ * Copyright (c) 2013 Mellanox Technologies®. All rights reserved.
+ *
+ * This software is available to you under a choice of one of two licenses.
+ * You may choose to be licensed under the terms of the GNU General Public
+ * License (GPL) Version 2, available from the file COPYING in the main
+ * directory of this source tree, or the Mellanox Technologies® BSD license
+ * below:
+ *
+ *      - Redistribution and use in source and binary forms, with or without
+ *        modification, are permitted provided that the following conditions
+ *        are met:
+ *
+ *      - Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *      - Neither the name of the Mellanox Technologies® nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * In-process stand-in for libibverbs and librdmacm, linked instead of them
+ * when configured with --enable-fake-verbs. It lets the rdma transport run
+ * without a device, with both ends of every connection in one process:
+ *
+ * - queue pairs are memory queues, sends and rdma operations are executed
+ *   by the posting thread as memcpy between registered regions.
+ * - a send that finds no receive buffer waits on the queue pair until the
+ *   peer posts one, as an rnr retry count of 7 would.
+ * - completions become visible XIO_FAKE_VERBS_LATENCY_USECS microseconds
+ *   (default 0) after they were posted, completion channels are timerfds.
+ * - the connection manager only knows this process; addresses resolve to
+ *   the single fake device and listeners are looked up by port.
+ * - with XIO_FAKE_VERBS_STATS set, the number of post and poll calls and of
+ *   the work requests and completions they carried is printed at exit, to
+ *   compare how well a change batches doorbells and completions.
+ */
+#include "xio_os.h"
+#include <infiniband/verbs.h>
+#include <rdma/rdma_cma.h>
+#include <ib_cm.h>
+
+#include "libxio.h"
+#include "xio_common.h"
+#include "xio_mem.h"
+
+
+/*---------------------------------------------------------------------------*/
+/* defines								     */
+/*---------------------------------------------------------------------------*/
+#define FAKE_DEV_NAME			"fake_verbs0"
+#define FAKE_LATENCY_ENV		"XIO_FAKE_VERBS_LATENCY_USECS"
+#define FAKE_STATS_ENV			"XIO_FAKE_VERBS_STATS"
+#define FAKE_MAX_INLINE			512
+#define FAKE_MAX_SGE			32
+#define FAKE_MAX_RECV_SGE		4
+#define FAKE_MAX_QP_WR			16384
+#define FAKE_MAX_CQE			(1 << 20)
+#define FAKE_MAX_SRQ			1024
+#define FAKE_MAX_RD_ATOM		16
+#define FAKE_MAX_PRIVATE_DATA		256
+#define FAKE_FIRST_PORT			49152
+#define FAKE_MR_TBL_SIZE		256
+
+#define FAKE_DONE			0
+#define FAKE_STALL			1
+
+/*---------------------------------------------------------------------------*/
+/* structures								     */
+/*---------------------------------------------------------------------------*/
+struct fake_cqe {
+	struct ibv_wc			wc;
+	uint64_t			ready_ns;
+};
+
+struct fake_comp_channel {
+	struct ibv_comp_channel		channel;
+	pthread_mutex_t			lock;
+	struct list_head		fired_list;
+};
+
+struct fake_cq {
+	struct ibv_cq			cq;
+	pthread_mutex_t			lock;
+	struct fake_cqe			*ring;
+	uint32_t			ring_sz;
+	uint32_t			head;
+	uint32_t			count;
+	int				armed;
+	/* protected by the channel lock */
+	int				fired;
+	int				pad;
+	uint64_t			fire_ns;
+	struct list_head		fired_entry;
+};
+
+struct fake_recv {
+	uint64_t			wr_id;
+	int				num_sge;
+	int				pad;
+	struct ibv_sge			sg_list[FAKE_MAX_RECV_SGE];
+};
+
+/* a receive queue, owned by a qp or shared by an srq */
+struct fake_rwq {
+	pthread_mutex_t			lock;
+	struct fake_recv		*ring;
+	uint32_t			ring_sz;
+	uint32_t			head;
+	uint32_t			count;
+	int				pad;
+	struct list_head		waiters;
+};
+
+struct fake_srq {
+	struct ibv_srq			srq;
+	struct fake_rwq			rwq;
+};
+
+/* a send work request waiting for a receive buffer at the peer */
+struct fake_send {
+	struct list_head		entry;
+	struct ibv_send_wr		wr;
+	struct ibv_sge			sg_list[FAKE_MAX_SGE];
+	char				inline_buf[FAKE_MAX_INLINE];
+};
+
+struct fake_cm_id;
+
+struct fake_qp {
+	struct ibv_qp			qp;
+	struct ibv_qp_cap		cap;
+	int				sq_sig_all;
+	pthread_mutex_t			sq_lock;
+	struct list_head		stalled_list;
+	struct list_head		waiter_entry;
+	struct fake_rwq			*waiting_on;
+	struct fake_rwq			rq;
+	struct fake_qp			*peer;
+};
+
+struct fake_event_channel {
+	struct rdma_event_channel	channel;
+	int				wfd;
+	pthread_mutex_t			lock;
+	struct list_head		event_list;
+};
+
+struct fake_cm_event {
+	struct rdma_cm_event		event;
+	struct list_head		entry;
+	uint8_t				private_data[FAKE_MAX_PRIVATE_DATA];
+};
+
+struct fake_cm_id {
+	struct rdma_cm_id		id;
+	struct list_head		listen_entry;
+	struct fake_cm_id		*peer;
+	uint16_t			port;
+	uint16_t			listening;
+	uint16_t			connected;
+	uint16_t			disconnected;
+};
+
+struct fake_stats {
+	uint64_t			send_calls;
+	uint64_t			send_wrs;
+	uint64_t			rdma_wrs;
+	uint64_t			recv_calls;
+	uint64_t			recv_wrs;
+	uint64_t			polls;
+	uint64_t			empty_polls;
+	uint64_t			completions;
+};
+
+struct fake_device {
+	struct ibv_device		device;
+	struct ibv_context		context;
+	int				async_pipe[2];
+};
+
+/*---------------------------------------------------------------------------*/
+/* globals								     */
+/*---------------------------------------------------------------------------*/
+static struct fake_device	fake_dev;
+static pthread_once_t		fake_dev_once = PTHREAD_ONCE_INIT;
+static uint64_t			fake_latency_ns;
+static int			fake_stats_on;
+static struct fake_stats	fake_stats;
+
+/* connections, listeners and memory keys */
+static pthread_rwlock_t		fake_lock = PTHREAD_RWLOCK_INITIALIZER;
+static LIST_HEAD(fake_listen_list);
+static struct ibv_mr		**fake_mr_tbl;
+static uint32_t			fake_mr_tbl_len;
+static uint32_t			fake_next_qpn = 1;
+static uint16_t			fake_next_port = FAKE_FIRST_PORT;
+
+static int fake_post_send(struct ibv_qp *ibqp, struct ibv_send_wr *wr,
+			  struct ibv_send_wr **bad_wr);
+static int fake_post_recv(struct ibv_qp *ibqp, struct ibv_recv_wr *wr,
+			  struct ibv_recv_wr **bad_wr);
+static int fake_post_srq_recv(struct ibv_srq *ibsrq, struct ibv_recv_wr *wr,
+			      struct ibv_recv_wr **bad_wr);
+static int fake_poll_cq(struct ibv_cq *ibcq, int num_entries,
+			struct ibv_wc *wc);
+static int fake_req_notify_cq(struct ibv_cq *ibcq, int solicited_only);
+
+/*---------------------------------------------------------------------------*/
+/* fake_now_ns								     */
+/*---------------------------------------------------------------------------*/
+static inline uint64_t fake_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_ready_ns							     */
+/*---------------------------------------------------------------------------*/
+static inline uint64_t fake_ready_ns(void)
+{
+	/* without latency skip the clock, everything is ready at once */
+	return fake_latency_ns ? fake_now_ns() + fake_latency_ns : 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_stats_add							     */
+/*---------------------------------------------------------------------------*/
+static inline void fake_stats_add(uint64_t *counter, uint64_t val)
+{
+	if (fake_stats_on)
+		__sync_fetch_and_add(counter, val);
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_stats_print							     */
+/*---------------------------------------------------------------------------*/
+static void fake_stats_print(void)
+{
+	struct fake_stats *st = &fake_stats;
+
+	fprintf(stderr,
+		"%s: send calls %llu wrs %llu (rdma %llu), " \
+		"recv calls %llu wrs %llu, " \
+		"polls %llu (empty %llu) completions %llu\n",
+		FAKE_DEV_NAME,
+		(unsigned long long)st->send_calls,
+		(unsigned long long)st->send_wrs,
+		(unsigned long long)st->rdma_wrs,
+		(unsigned long long)st->recv_calls,
+		(unsigned long long)st->recv_wrs,
+		(unsigned long long)st->polls,
+		(unsigned long long)st->empty_polls,
+		(unsigned long long)st->completions);
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_dev_init							     */
+/*---------------------------------------------------------------------------*/
+static void fake_dev_init(void)
+{
+	char *env = getenv(FAKE_LATENCY_ENV);
+
+	if (env)
+		fake_latency_ns = strtoull(env, NULL, 0) * 1000ULL;
+
+	env = getenv(FAKE_STATS_ENV);
+	if (env && atoi(env) && atexit(fake_stats_print) == 0)
+		fake_stats_on = 1;
+
+	strcpy(fake_dev.device.name, FAKE_DEV_NAME);
+	strcpy(fake_dev.device.dev_name, FAKE_DEV_NAME);
+	fake_dev.device.node_type	= IBV_NODE_CA;
+	fake_dev.device.transport_type	= IBV_TRANSPORT_IB;
+
+	fake_dev.context.device			= &fake_dev.device;
+	fake_dev.context.ops.post_send		= fake_post_send;
+	fake_dev.context.ops.post_recv		= fake_post_recv;
+	fake_dev.context.ops.post_srq_recv	= fake_post_srq_recv;
+	fake_dev.context.ops.poll_cq		= fake_poll_cq;
+	fake_dev.context.ops.req_notify_cq	= fake_req_notify_cq;
+	fake_dev.context.cmd_fd			= -1;
+	fake_dev.context.num_comp_vectors	= 1;
+	pthread_mutex_init(&fake_dev.context.mutex, NULL);
+
+	/* nothing is ever written, the fd only has to be pollable */
+	if (pipe(fake_dev.async_pipe) == 0) {
+		fake_dev.context.async_fd = fake_dev.async_pipe[0];
+	} else {
+		ERROR_LOG("pipe failed. (errno=%d %m)\n", errno);
+		fake_dev.context.async_fd = -1;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_mr_find - caller holds fake_lock				     */
+/*---------------------------------------------------------------------------*/
+static struct ibv_mr *fake_mr_find(uint32_t key, uint64_t addr,
+				   uint32_t length)
+{
+	struct ibv_mr *mr;
+
+	if (key >= fake_mr_tbl_len)
+		return NULL;
+	mr = fake_mr_tbl[key];
+	if (!mr || addr < uint64_from_ptr(mr->addr) ||
+	    addr + length > uint64_from_ptr(mr->addr) + mr->length)
+		return NULL;
+
+	return mr;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_fork_init							     */
+/*---------------------------------------------------------------------------*/
+int ibv_fork_init(void)
+{
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_get_device_name							     */
+/*---------------------------------------------------------------------------*/
+const char *ibv_get_device_name(struct ibv_device *device)
+{
+	return device->name;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_query_device							     */
+/*---------------------------------------------------------------------------*/
+int ibv_query_device(struct ibv_context *context,
+		     struct ibv_device_attr *device_attr)
+{
+	memset(device_attr, 0, sizeof(*device_attr));
+	strcpy(device_attr->fw_ver, "0.0.0");
+	device_attr->max_mr_size		= ~0ULL;
+	device_attr->page_size_cap		= 4096;
+	device_attr->max_qp			= 65536;
+	device_attr->max_qp_wr			= FAKE_MAX_QP_WR;
+	device_attr->max_sge			= FAKE_MAX_SGE;
+	device_attr->max_cq			= 65536;
+	device_attr->max_cqe			= FAKE_MAX_CQE;
+	device_attr->max_mr			= 1 << 20;
+	device_attr->max_pd			= 65536;
+	device_attr->max_qp_rd_atom		= FAKE_MAX_RD_ATOM;
+	device_attr->max_qp_init_rd_atom	= FAKE_MAX_RD_ATOM;
+	device_attr->max_srq			= FAKE_MAX_SRQ;
+	device_attr->max_srq_wr			= FAKE_MAX_QP_WR;
+	device_attr->max_srq_sge		= FAKE_MAX_RECV_SGE;
+	device_attr->phys_port_cnt		= 1;
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_get_async_event							     */
+/*---------------------------------------------------------------------------*/
+int ibv_get_async_event(struct ibv_context *context,
+			struct ibv_async_event *event)
+{
+	errno = EAGAIN;
+	return -1;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_ack_async_event							     */
+/*---------------------------------------------------------------------------*/
+void ibv_ack_async_event(struct ibv_async_event *event)
+{
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_event_type_str							     */
+/*---------------------------------------------------------------------------*/
+const char *ibv_event_type_str(enum ibv_event_type event)
+{
+	return "fake async event";
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_wc_status_str							     */
+/*---------------------------------------------------------------------------*/
+const char *ibv_wc_status_str(enum ibv_wc_status status)
+{
+	switch (status) {
+	case IBV_WC_SUCCESS:
+		return "success";
+	case IBV_WC_LOC_LEN_ERR:
+		return "local length error";
+	case IBV_WC_LOC_QP_OP_ERR:
+		return "local QP operation error";
+	case IBV_WC_LOC_PROT_ERR:
+		return "local protection error";
+	case IBV_WC_WR_FLUSH_ERR:
+		return "Work Request Flushed Error";
+	case IBV_WC_REM_INV_REQ_ERR:
+		return "remote invalid request error";
+	case IBV_WC_REM_ACCESS_ERR:
+		return "remote access error";
+	default:
+		return "general error";
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_alloc_pd								     */
+/*---------------------------------------------------------------------------*/
+struct ibv_pd *ibv_alloc_pd(struct ibv_context *context)
+{
+	struct ibv_pd *pd = ucalloc(1, sizeof(*pd));
+
+	if (!pd) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	pd->context = context;
+
+	return pd;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_dealloc_pd							     */
+/*---------------------------------------------------------------------------*/
+int ibv_dealloc_pd(struct ibv_pd *pd)
+{
+	ufree(pd);
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_reg_mr								     */
+/*---------------------------------------------------------------------------*/
+#undef ibv_reg_mr
+struct ibv_mr *ibv_reg_mr(struct ibv_pd *pd, void *addr, size_t length,
+			  int access)
+{
+	struct ibv_mr	*mr;
+	struct ibv_mr	**tbl;
+	uint32_t	key, len;
+
+	/* there is no memory to hand out with IBV_ACCESS_ALLOCATE_MR */
+	if (!addr) {
+		errno = EINVAL;
+		return NULL;
+	}
+	mr = ucalloc(1, sizeof(*mr));
+	if (!mr) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	pthread_rwlock_wrlock(&fake_lock);
+	/* key 0 stays unused so a zeroed sge never matches */
+	for (key = 1; key < fake_mr_tbl_len; key++)
+		if (!fake_mr_tbl[key])
+			break;
+	if (key >= fake_mr_tbl_len) {
+		len = fake_mr_tbl_len ? 2*fake_mr_tbl_len : FAKE_MR_TBL_SIZE;
+		tbl = realloc(fake_mr_tbl, len*sizeof(*tbl));
+		if (!tbl) {
+			pthread_rwlock_unlock(&fake_lock);
+			ufree(mr);
+			errno = ENOMEM;
+			return NULL;
+		}
+		memset(tbl + fake_mr_tbl_len, 0,
+		       (len - fake_mr_tbl_len)*sizeof(*tbl));
+		if (key == 0)
+			key = 1;
+		fake_mr_tbl	= tbl;
+		fake_mr_tbl_len	= len;
+	}
+	mr->context	= pd->context;
+	mr->pd		= pd;
+	mr->addr	= addr;
+	mr->length	= length;
+	mr->handle	= key;
+	mr->lkey	= key;
+	mr->rkey	= key;
+	fake_mr_tbl[key] = mr;
+	pthread_rwlock_unlock(&fake_lock);
+
+	return mr;
+}
+
+#ifdef IBV_ACCESS_OPTIONAL_RANGE
+/*---------------------------------------------------------------------------*/
+/* ibv_reg_mr_iova2							     */
+/*---------------------------------------------------------------------------*/
+struct ibv_mr *ibv_reg_mr_iova2(struct ibv_pd *pd, void *addr, size_t length,
+				uint64_t iova, unsigned int access)
+{
+	return ibv_reg_mr(pd, addr, length, access);
+}
+#endif
+
+/*---------------------------------------------------------------------------*/
+/* ibv_dereg_mr								     */
+/*---------------------------------------------------------------------------*/
+int ibv_dereg_mr(struct ibv_mr *mr)
+{
+	pthread_rwlock_wrlock(&fake_lock);
+	fake_mr_tbl[mr->lkey] = NULL;
+	pthread_rwlock_unlock(&fake_lock);
+	ufree(mr);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_channel_settime - caller holds the channel lock			     */
+/*---------------------------------------------------------------------------*/
+static void fake_channel_settime(struct fake_comp_channel *fch)
+{
+	struct fake_cq		*fcq;
+	struct itimerspec	its;
+	uint64_t		next = 0;
+
+	list_for_each_entry(fcq, &fch->fired_list, fired_entry) {
+		if (!next || fcq->fire_ns < next)
+			next = fcq->fire_ns;
+	}
+	/* an absolute time in the past expires at once, zero disarms */
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec	= next / 1000000000ULL;
+	its.it_value.tv_nsec	= next % 1000000000ULL;
+	timerfd_settime(fch->channel.fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_cq_fire - caller holds the cq lock				     */
+/*---------------------------------------------------------------------------*/
+static void fake_cq_fire(struct fake_cq *fcq, uint64_t ready_ns)
+{
+	struct fake_comp_channel *fch;
+
+	fcq->armed = 0;
+	if (!fcq->cq.channel)
+		return;
+
+	fch = container_of(fcq->cq.channel, struct fake_comp_channel, channel);
+	pthread_mutex_lock(&fch->lock);
+	if (!fcq->fired) {
+		fcq->fired	= 1;
+		fcq->fire_ns	= ready_ns ? ready_ns : 1;
+		list_add_tail(&fcq->fired_entry, &fch->fired_list);
+		fake_channel_settime(fch);
+	}
+	pthread_mutex_unlock(&fch->lock);
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_cq_grow - caller holds the cq lock				     */
+/*---------------------------------------------------------------------------*/
+static int fake_cq_grow(struct fake_cq *fcq, uint32_t ring_sz)
+{
+	struct fake_cqe *ring;
+	uint32_t	i;
+
+	ring = umalloc(ring_sz*sizeof(*ring));
+	if (!ring)
+		return -1;
+	for (i = 0; i < fcq->count; i++)
+		ring[i] = fcq->ring[(fcq->head + i) % fcq->ring_sz];
+	ufree(fcq->ring);
+	fcq->ring	= ring;
+	fcq->ring_sz	= ring_sz;
+	fcq->head	= 0;
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_cq_push								     */
+/*---------------------------------------------------------------------------*/
+static void fake_cq_push(struct ibv_cq *ibcq, struct ibv_wc *wc,
+			 uint64_t ready_ns)
+{
+	struct fake_cq	*fcq = container_of(ibcq, struct fake_cq, cq);
+	struct fake_cqe	*cqe;
+
+	pthread_mutex_lock(&fcq->lock);
+	if (fcq->count == fcq->ring_sz) {
+		/* a real device would overrun, keep the completion */
+		ERROR_LOG("fake cq %p overrun, %d entries\n", fcq, fcq->count);
+		if (fake_cq_grow(fcq, 2*fcq->ring_sz)) {
+			pthread_mutex_unlock(&fcq->lock);
+			return;
+		}
+	}
+	cqe = &fcq->ring[(fcq->head + fcq->count) % fcq->ring_sz];
+	cqe->wc		= *wc;
+	cqe->ready_ns	= ready_ns;
+	fcq->count++;
+	if (fcq->armed)
+		fake_cq_fire(fcq, ready_ns);
+	pthread_mutex_unlock(&fcq->lock);
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_cq_clean - drop the completions of a destroyed qp		     */
+/*---------------------------------------------------------------------------*/
+static void fake_cq_clean(struct ibv_cq *ibcq, uint32_t qp_num)
+{
+	struct fake_cq	*fcq = container_of(ibcq, struct fake_cq, cq);
+	struct fake_cqe	*src;
+	uint32_t	i, n = 0;
+
+	pthread_mutex_lock(&fcq->lock);
+	for (i = 0; i < fcq->count; i++) {
+		src = &fcq->ring[(fcq->head + i) % fcq->ring_sz];
+		if (src->wc.qp_num == qp_num)
+			continue;
+		fcq->ring[(fcq->head + n) % fcq->ring_sz] = *src;
+		n++;
+	}
+	fcq->count = n;
+	pthread_mutex_unlock(&fcq->lock);
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_create_comp_channel						     */
+/*---------------------------------------------------------------------------*/
+struct ibv_comp_channel *ibv_create_comp_channel(struct ibv_context *context)
+{
+	struct fake_comp_channel *fch = ucalloc(1, sizeof(*fch));
+
+	if (!fch) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	fch->channel.context	= context;
+	fch->channel.fd		= timerfd_create(CLOCK_MONOTONIC,
+						 TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fch->channel.fd < 0) {
+		ufree(fch);
+		return NULL;
+	}
+	pthread_mutex_init(&fch->lock, NULL);
+	INIT_LIST_HEAD(&fch->fired_list);
+
+	return &fch->channel;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_destroy_comp_channel						     */
+/*---------------------------------------------------------------------------*/
+int ibv_destroy_comp_channel(struct ibv_comp_channel *channel)
+{
+	struct fake_comp_channel *fch =
+		container_of(channel, struct fake_comp_channel, channel);
+
+	if (!list_empty(&fch->fired_list))
+		return EBUSY;
+
+	close(channel->fd);
+	pthread_mutex_destroy(&fch->lock);
+	ufree(fch);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_get_cq_event							     */
+/*---------------------------------------------------------------------------*/
+int ibv_get_cq_event(struct ibv_comp_channel *channel,
+		     struct ibv_cq **cq, void **cq_context)
+{
+	struct fake_comp_channel *fch =
+		container_of(channel, struct fake_comp_channel, channel);
+	struct fake_cq		*fcq, *found = NULL;
+	uint64_t		expirations, now;
+
+	pthread_mutex_lock(&fch->lock);
+	if (read(channel->fd, &expirations, sizeof(expirations)) < 0 &&
+	    errno != EAGAIN) {
+		pthread_mutex_unlock(&fch->lock);
+		return -1;
+	}
+	now = fake_now_ns();
+	list_for_each_entry(fcq, &fch->fired_list, fired_entry) {
+		if (fcq->fire_ns <= now) {
+			found = fcq;
+			break;
+		}
+	}
+	if (found) {
+		list_del_init(&found->fired_entry);
+		found->fired = 0;
+	}
+	fake_channel_settime(fch);
+	pthread_mutex_unlock(&fch->lock);
+
+	if (!found) {
+		errno = EAGAIN;
+		return -1;
+	}
+	*cq		= &found->cq;
+	*cq_context	= found->cq.cq_context;
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_ack_cq_events							     */
+/*---------------------------------------------------------------------------*/
+void ibv_ack_cq_events(struct ibv_cq *cq, unsigned int nevents)
+{
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_create_cq							     */
+/*---------------------------------------------------------------------------*/
+struct ibv_cq *ibv_create_cq(struct ibv_context *context, int cqe,
+			     void *cq_context,
+			     struct ibv_comp_channel *channel,
+			     int comp_vector)
+{
+	struct fake_cq *fcq;
+
+	if (cqe <= 0 || cqe > FAKE_MAX_CQE) {
+		errno = EINVAL;
+		return NULL;
+	}
+	fcq = ucalloc(1, sizeof(*fcq));
+	if (!fcq) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	fcq->ring = umalloc(cqe*sizeof(*fcq->ring));
+	if (!fcq->ring) {
+		ufree(fcq);
+		errno = ENOMEM;
+		return NULL;
+	}
+	fcq->ring_sz		= cqe;
+	fcq->cq.context		= context;
+	fcq->cq.channel		= channel;
+	fcq->cq.cq_context	= cq_context;
+	fcq->cq.cqe		= cqe;
+	pthread_mutex_init(&fcq->lock, NULL);
+	INIT_LIST_HEAD(&fcq->fired_entry);
+
+	return &fcq->cq;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_resize_cq							     */
+/*---------------------------------------------------------------------------*/
+int ibv_resize_cq(struct ibv_cq *cq, int cqe)
+{
+	struct fake_cq	*fcq = container_of(cq, struct fake_cq, cq);
+	int		retval = 0;
+
+	if (cqe <= 0 || cqe > FAKE_MAX_CQE)
+		return EINVAL;
+
+	pthread_mutex_lock(&fcq->lock);
+	if (cqe > fcq->ring_sz && fake_cq_grow(fcq, cqe))
+		retval = ENOMEM;
+	else
+		cq->cqe = cqe;
+	pthread_mutex_unlock(&fcq->lock);
+
+	return retval;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_destroy_cq							     */
+/*---------------------------------------------------------------------------*/
+int ibv_destroy_cq(struct ibv_cq *cq)
+{
+	struct fake_cq			*fcq = container_of(cq, struct fake_cq,
+							    cq);
+	struct fake_comp_channel	*fch;
+
+	if (cq->channel) {
+		fch = container_of(cq->channel, struct fake_comp_channel,
+				   channel);
+		pthread_mutex_lock(&fch->lock);
+		if (fcq->fired)
+			list_del_init(&fcq->fired_entry);
+		fake_channel_settime(fch);
+		pthread_mutex_unlock(&fch->lock);
+	}
+	pthread_mutex_destroy(&fcq->lock);
+	ufree(fcq->ring);
+	ufree(fcq);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_poll_cq								     */
+/*---------------------------------------------------------------------------*/
+static int fake_poll_cq(struct ibv_cq *ibcq, int num_entries,
+			struct ibv_wc *wc)
+{
+	struct fake_cq	*fcq = container_of(ibcq, struct fake_cq, cq);
+	struct fake_cqe	*cqe;
+	uint64_t	now = fake_latency_ns ? fake_now_ns() : 0;
+	int		n = 0;
+
+	pthread_mutex_lock(&fcq->lock);
+	while (n < num_entries && fcq->count) {
+		cqe = &fcq->ring[fcq->head];
+		if (cqe->ready_ns > now)
+			break;
+		wc[n++] = cqe->wc;
+		fcq->head = (fcq->head + 1) % fcq->ring_sz;
+		fcq->count--;
+	}
+	pthread_mutex_unlock(&fcq->lock);
+
+	fake_stats_add(&fake_stats.polls, 1);
+	fake_stats_add(n ? &fake_stats.completions : &fake_stats.empty_polls,
+		       n ? n : 1);
+
+	/* the peer thread plays the device, a busy poll that keeps the cpu
+	 * would hold back the completion it waits for
+	 */
+	if (!n)
+		sched_yield();
+
+	return n;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_req_notify_cq							     */
+/*---------------------------------------------------------------------------*/
+static int fake_req_notify_cq(struct ibv_cq *ibcq, int solicited_only)
+{
+	struct fake_cq *fcq = container_of(ibcq, struct fake_cq, cq);
+
+	pthread_mutex_lock(&fcq->lock);
+	/* completions still in flight would otherwise never signal */
+	if (fcq->count)
+		fake_cq_fire(fcq, fcq->ring[fcq->head].ready_ns);
+	else
+		fcq->armed = 1;
+	pthread_mutex_unlock(&fcq->lock);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_rwq_init							     */
+/*---------------------------------------------------------------------------*/
+static int fake_rwq_init(struct fake_rwq *rwq, uint32_t max_wr)
+{
+	pthread_mutex_init(&rwq->lock, NULL);
+	INIT_LIST_HEAD(&rwq->waiters);
+	rwq->ring_sz = max_wr ? max_wr : 1;
+	rwq->ring = ucalloc(rwq->ring_sz, sizeof(*rwq->ring));
+
+	return rwq->ring ? 0 : -1;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_rwq_destroy							     */
+/*---------------------------------------------------------------------------*/
+static void fake_rwq_destroy(struct fake_rwq *rwq)
+{
+	pthread_mutex_destroy(&rwq->lock);
+	ufree(rwq->ring);
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_rwq_post							     */
+/*---------------------------------------------------------------------------*/
+static int fake_rwq_post(struct fake_rwq *rwq, struct ibv_recv_wr *wr,
+			 struct ibv_recv_wr **bad_wr)
+{
+	struct fake_recv	*recv;
+	int			retval = 0;
+
+	fake_stats_add(&fake_stats.recv_calls, 1);
+
+	pthread_mutex_lock(&rwq->lock);
+	for (; wr; wr = wr->next) {
+		fake_stats_add(&fake_stats.recv_wrs, 1);
+		if (wr->num_sge > FAKE_MAX_RECV_SGE) {
+			retval = EINVAL;
+			break;
+		}
+		if (rwq->count == rwq->ring_sz) {
+			retval = ENOMEM;
+			break;
+		}
+		recv = &rwq->ring[(rwq->head + rwq->count) % rwq->ring_sz];
+		recv->wr_id	= wr->wr_id;
+		recv->num_sge	= wr->num_sge;
+		memcpy(recv->sg_list, wr->sg_list,
+		       wr->num_sge*sizeof(struct ibv_sge));
+		rwq->count++;
+	}
+	pthread_mutex_unlock(&rwq->lock);
+	if (retval)
+		*bad_wr = wr;
+
+	return retval;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_rwq_pop - or queue the sender until a buffer is posted		     */
+/*---------------------------------------------------------------------------*/
+static int fake_rwq_pop(struct fake_rwq *rwq, struct fake_recv *recv,
+			struct fake_qp *sender)
+{
+	int found = 0;
+
+	pthread_mutex_lock(&rwq->lock);
+	if (rwq->count) {
+		*recv = rwq->ring[rwq->head];
+		rwq->head = (rwq->head + 1) % rwq->ring_sz;
+		rwq->count--;
+		found = 1;
+	} else if (!sender->waiting_on) {
+		sender->waiting_on = rwq;
+		list_add_tail(&sender->waiter_entry, &rwq->waiters);
+	}
+	pthread_mutex_unlock(&rwq->lock);
+
+	return found;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_sge_len								     */
+/*---------------------------------------------------------------------------*/
+static inline uint32_t fake_sge_len(struct ibv_sge *sg_list, int num_sge)
+{
+	uint32_t	len = 0;
+	int		i;
+
+	for (i = 0; i < num_sge; i++)
+		len += sg_list[i].length;
+
+	return len;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_check_local - caller holds fake_lock				     */
+/*---------------------------------------------------------------------------*/
+static int fake_check_local(struct ibv_sge *sg_list, int num_sge)
+{
+	int i;
+
+	for (i = 0; i < num_sge; i++) {
+		if (sg_list[i].length &&
+		    !fake_mr_find(sg_list[i].lkey, sg_list[i].addr,
+				  sg_list[i].length))
+			return -1;
+	}
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_copy_sges - scatter the gather list into another sge list	     */
+/*---------------------------------------------------------------------------*/
+static void fake_copy_sges(struct ibv_sge *dst, int dst_num,
+			   struct ibv_sge *src, int src_num)
+{
+	uint32_t	doff = 0, soff = 0, n;
+	int		d = 0, s = 0;
+
+	while (d < dst_num && s < src_num) {
+		n = min(dst[d].length - doff, src[s].length - soff);
+		memcpy(ptr_from_int64(dst[d].addr + doff),
+		       ptr_from_int64(src[s].addr + soff), n);
+		doff += n;
+		soff += n;
+		if (doff == dst[d].length) {
+			d++;
+			doff = 0;
+		}
+		if (soff == src[s].length) {
+			s++;
+			soff = 0;
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_flush_rq - complete the posted receives of a qp in error	     */
+/*---------------------------------------------------------------------------*/
+static void fake_flush_rq(struct fake_qp *fqp)
+{
+	struct ibv_wc	wc;
+	struct fake_rwq	*rwq = &fqp->rq;
+
+	memset(&wc, 0, sizeof(wc));
+	wc.status	= IBV_WC_WR_FLUSH_ERR;
+	wc.opcode	= IBV_WC_RECV;
+	wc.qp_num	= fqp->qp.qp_num;
+
+	pthread_mutex_lock(&rwq->lock);
+	while (rwq->count) {
+		wc.wr_id = rwq->ring[rwq->head].wr_id;
+		rwq->head = (rwq->head + 1) % rwq->ring_sz;
+		rwq->count--;
+		fake_cq_push(fqp->qp.recv_cq, &wc, 0);
+	}
+	pthread_mutex_unlock(&rwq->lock);
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_qp_error							     */
+/*---------------------------------------------------------------------------*/
+static void fake_qp_error(struct fake_qp *fqp)
+{
+	if (fqp->qp.state == IBV_QPS_ERR)
+		return;
+	fqp->qp.state = IBV_QPS_ERR;
+	if (!fqp->qp.srq)
+		fake_flush_rq(fqp);
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_wc_opcode							     */
+/*---------------------------------------------------------------------------*/
+static inline enum ibv_wc_opcode fake_wc_opcode(enum ibv_wr_opcode opcode)
+{
+	switch (opcode) {
+	case IBV_WR_RDMA_WRITE:
+	case IBV_WR_RDMA_WRITE_WITH_IMM:
+		return IBV_WC_RDMA_WRITE;
+	case IBV_WR_RDMA_READ:
+		return IBV_WC_RDMA_READ;
+	default:
+		return IBV_WC_SEND;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_exec - run one send work request, caller holds the sq lock	     */
+/*---------------------------------------------------------------------------*/
+static int fake_exec(struct fake_qp *fqp, struct ibv_send_wr *wr)
+{
+	struct fake_qp		*peer = fqp->peer;
+	struct fake_rwq		*rwq = NULL;
+	struct fake_recv	recv;
+	struct ibv_wc		wc, rwc;
+	struct ibv_sge		rsge;
+	int			is_inline = wr->send_flags & IBV_SEND_INLINE;
+	int			need_recv = 0;
+	uint64_t		ready_ns;
+
+	memset(&wc, 0, sizeof(wc));
+	wc.wr_id	= wr->wr_id;
+	wc.status	= IBV_WC_SUCCESS;
+	wc.opcode	= fake_wc_opcode(wr->opcode);
+	wc.qp_num	= fqp->qp.qp_num;
+	wc.byte_len	= fake_sge_len(wr->sg_list, wr->num_sge);
+
+	if (fqp->qp.state == IBV_QPS_ERR || !peer ||
+	    peer->qp.state == IBV_QPS_ERR) {
+		wc.status = IBV_WC_WR_FLUSH_ERR;
+		fake_cq_push(fqp->qp.send_cq, &wc, 0);
+		return FAKE_DONE;
+	}
+
+	switch (wr->opcode) {
+	case IBV_WR_SEND:
+	case IBV_WR_SEND_WITH_IMM:
+	case IBV_WR_RDMA_WRITE_WITH_IMM:
+		need_recv = 1;
+		break;
+	case IBV_WR_RDMA_WRITE:
+	case IBV_WR_RDMA_READ:
+		break;
+	default:
+		wc.status = IBV_WC_LOC_QP_OP_ERR;
+		goto complete;
+	}
+	if (!is_inline && fake_check_local(wr->sg_list, wr->num_sge)) {
+		wc.status = IBV_WC_LOC_PROT_ERR;
+		goto complete;
+	}
+	if (need_recv) {
+		rwq = peer->qp.srq ?
+			&container_of(peer->qp.srq, struct fake_srq, srq)->rwq :
+			&peer->rq;
+		if (!fake_rwq_pop(rwq, &recv, fqp))
+			return FAKE_STALL;
+	}
+
+	memset(&rwc, 0, sizeof(rwc));
+	rsge.addr	= wr->wr.rdma.remote_addr;
+	rsge.length	= wc.byte_len;
+	rsge.lkey	= wr->wr.rdma.rkey;
+
+	switch (wr->opcode) {
+	case IBV_WR_SEND:
+	case IBV_WR_SEND_WITH_IMM:
+		if (fake_sge_len(recv.sg_list, recv.num_sge) < wc.byte_len) {
+			rwc.status = IBV_WC_LOC_LEN_ERR;
+			wc.status  = IBV_WC_REM_INV_REQ_ERR;
+		} else if (fake_check_local(recv.sg_list, recv.num_sge)) {
+			rwc.status = IBV_WC_LOC_PROT_ERR;
+			wc.status  = IBV_WC_REM_OP_ERR;
+		} else {
+			fake_copy_sges(recv.sg_list, recv.num_sge,
+				       wr->sg_list, wr->num_sge);
+		}
+		rwc.opcode = IBV_WC_RECV;
+		break;
+	case IBV_WR_RDMA_WRITE:
+	case IBV_WR_RDMA_WRITE_WITH_IMM:
+		if (wc.byte_len &&
+		    !fake_mr_find(rsge.lkey, rsge.addr, rsge.length)) {
+			rwc.status = IBV_WC_REM_ACCESS_ERR;
+			wc.status  = IBV_WC_REM_ACCESS_ERR;
+		} else {
+			fake_copy_sges(&rsge, 1, wr->sg_list, wr->num_sge);
+		}
+		rwc.opcode = IBV_WC_RECV_RDMA_WITH_IMM;
+		break;
+	case IBV_WR_RDMA_READ:
+		if (wc.byte_len &&
+		    !fake_mr_find(rsge.lkey, rsge.addr, rsge.length))
+			wc.status = IBV_WC_REM_ACCESS_ERR;
+		else
+			fake_copy_sges(wr->sg_list, wr->num_sge, &rsge, 1);
+		break;
+	default:
+		break;
+	}
+
+	ready_ns = fake_ready_ns();
+	if (need_recv) {
+		rwc.wr_id	= recv.wr_id;
+		rwc.byte_len	= wc.byte_len;
+		rwc.qp_num	= peer->qp.qp_num;
+		rwc.src_qp	= fqp->qp.qp_num;
+		if (wr->opcode != IBV_WR_SEND) {
+			rwc.wc_flags	= IBV_WC_WITH_IMM;
+			rwc.imm_data	= wr->imm_data;
+		}
+		fake_cq_push(peer->qp.recv_cq, &rwc, ready_ns);
+	}
+	if (wc.status != IBV_WC_SUCCESS)
+		fake_qp_error(peer);
+
+complete:
+	if (wc.status != IBV_WC_SUCCESS || fqp->sq_sig_all ||
+	    (wr->send_flags & IBV_SEND_SIGNALED))
+		fake_cq_push(fqp->qp.send_cq, &wc, fake_ready_ns());
+	if (wc.status != IBV_WC_SUCCESS)
+		fake_qp_error(fqp);
+
+	return FAKE_DONE;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_stall - keep a copy of a send that waits for a receive buffer	     */
+/*---------------------------------------------------------------------------*/
+static int fake_stall(struct fake_qp *fqp, struct ibv_send_wr *wr)
+{
+	struct fake_send *send = umalloc(sizeof(*send));
+
+	if (!send)
+		return ENOMEM;
+
+	send->wr	= *wr;
+	send->wr.next	= NULL;
+	send->wr.sg_list = send->sg_list;
+	if (wr->send_flags & IBV_SEND_INLINE) {
+		/* the caller may reuse inline buffers once posted */
+		send->sg_list[0].addr	= uint64_from_ptr(send->inline_buf);
+		send->sg_list[0].length	= 0;
+		send->sg_list[0].lkey	= 0;
+		fake_copy_sges(send->sg_list, 1, wr->sg_list, wr->num_sge);
+		send->sg_list[0].length = fake_sge_len(wr->sg_list,
+						       wr->num_sge);
+		send->wr.num_sge	= 1;
+	} else {
+		memcpy(send->sg_list, wr->sg_list,
+		       wr->num_sge*sizeof(struct ibv_sge));
+	}
+	list_add_tail(&send->entry, &fqp->stalled_list);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_resume - run stalled sends in order, caller holds the sq lock	     */
+/*---------------------------------------------------------------------------*/
+static void fake_resume(struct fake_qp *fqp)
+{
+	struct fake_send *send, *next;
+
+	list_for_each_entry_safe(send, next, &fqp->stalled_list, entry) {
+		if (fake_exec(fqp, &send->wr) == FAKE_STALL)
+			return;
+		list_del(&send->entry);
+		ufree(send);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_rwq_wake - resume the senders waiting for this queue		     */
+/*---------------------------------------------------------------------------*/
+static void fake_rwq_wake(struct fake_rwq *rwq)
+{
+	struct fake_qp	*fqp, *next;
+	LIST_HEAD(waiters);
+
+	pthread_mutex_lock(&rwq->lock);
+	if (list_empty(&rwq->waiters)) {
+		pthread_mutex_unlock(&rwq->lock);
+		return;
+	}
+	list_splice_init(&rwq->waiters, &waiters);
+	list_for_each_entry(fqp, &waiters, waiter_entry)
+		fqp->waiting_on = NULL;
+	pthread_mutex_unlock(&rwq->lock);
+
+	list_for_each_entry_safe(fqp, next, &waiters, waiter_entry) {
+		list_del_init(&fqp->waiter_entry);
+		pthread_mutex_lock(&fqp->sq_lock);
+		fake_resume(fqp);
+		pthread_mutex_unlock(&fqp->sq_lock);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_unwait - caller holds fake_lock for writing			     */
+/*---------------------------------------------------------------------------*/
+static void fake_unwait(struct fake_qp *fqp)
+{
+	struct fake_rwq *rwq = fqp->waiting_on;
+
+	if (!rwq)
+		return;
+	pthread_mutex_lock(&rwq->lock);
+	list_del_init(&fqp->waiter_entry);
+	fqp->waiting_on = NULL;
+	pthread_mutex_unlock(&rwq->lock);
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_post_send							     */
+/*---------------------------------------------------------------------------*/
+static int fake_post_send(struct ibv_qp *ibqp, struct ibv_send_wr *wr,
+			  struct ibv_send_wr **bad_wr)
+{
+	struct fake_qp	*fqp = container_of(ibqp, struct fake_qp, qp);
+	int		retval = 0;
+
+	fake_stats_add(&fake_stats.send_calls, 1);
+
+	pthread_rwlock_rdlock(&fake_lock);
+	pthread_mutex_lock(&fqp->sq_lock);
+	for (; wr; wr = wr->next) {
+		fake_stats_add(&fake_stats.send_wrs, 1);
+		if (wr->opcode != IBV_WR_SEND &&
+		    wr->opcode != IBV_WR_SEND_WITH_IMM)
+			fake_stats_add(&fake_stats.rdma_wrs, 1);
+		if (wr->num_sge > fqp->cap.max_send_sge ||
+		    ((wr->send_flags & IBV_SEND_INLINE) &&
+		     fake_sge_len(wr->sg_list, wr->num_sge) >
+		     fqp->cap.max_inline_data)) {
+			retval = EINVAL;
+			break;
+		}
+		/* keep the order behind sends that wait for the peer */
+		if (list_empty(&fqp->stalled_list) &&
+		    fake_exec(fqp, wr) == FAKE_DONE)
+			continue;
+		retval = fake_stall(fqp, wr);
+		if (retval)
+			break;
+	}
+	pthread_mutex_unlock(&fqp->sq_lock);
+	pthread_rwlock_unlock(&fake_lock);
+	if (retval)
+		*bad_wr = wr;
+
+	return retval;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_post_recv							     */
+/*---------------------------------------------------------------------------*/
+static int fake_post_recv(struct ibv_qp *ibqp, struct ibv_recv_wr *wr,
+			  struct ibv_recv_wr **bad_wr)
+{
+	struct fake_qp	*fqp = container_of(ibqp, struct fake_qp, qp);
+	int		retval;
+
+	pthread_rwlock_rdlock(&fake_lock);
+	retval = fake_rwq_post(&fqp->rq, wr, bad_wr);
+	if (fqp->qp.state == IBV_QPS_ERR)
+		fake_flush_rq(fqp);
+	else
+		fake_rwq_wake(&fqp->rq);
+	pthread_rwlock_unlock(&fake_lock);
+
+	return retval;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_post_srq_recv							     */
+/*---------------------------------------------------------------------------*/
+static int fake_post_srq_recv(struct ibv_srq *ibsrq, struct ibv_recv_wr *wr,
+			      struct ibv_recv_wr **bad_wr)
+{
+	struct fake_srq	*fsrq = container_of(ibsrq, struct fake_srq, srq);
+	int		retval;
+
+	pthread_rwlock_rdlock(&fake_lock);
+	retval = fake_rwq_post(&fsrq->rwq, wr, bad_wr);
+	fake_rwq_wake(&fsrq->rwq);
+	pthread_rwlock_unlock(&fake_lock);
+
+	return retval;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_create_srq							     */
+/*---------------------------------------------------------------------------*/
+struct ibv_srq *ibv_create_srq(struct ibv_pd *pd,
+			       struct ibv_srq_init_attr *srq_init_attr)
+{
+	struct fake_srq *fsrq;
+
+	if (srq_init_attr->attr.max_wr > FAKE_MAX_QP_WR ||
+	    srq_init_attr->attr.max_sge > FAKE_MAX_RECV_SGE) {
+		errno = EINVAL;
+		return NULL;
+	}
+	fsrq = ucalloc(1, sizeof(*fsrq));
+	if (!fsrq || fake_rwq_init(&fsrq->rwq, srq_init_attr->attr.max_wr)) {
+		ufree(fsrq);
+		errno = ENOMEM;
+		return NULL;
+	}
+	fsrq->srq.context	= pd->context;
+	fsrq->srq.srq_context	= srq_init_attr->srq_context;
+	fsrq->srq.pd		= pd;
+
+	return &fsrq->srq;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_destroy_srq							     */
+/*---------------------------------------------------------------------------*/
+int ibv_destroy_srq(struct ibv_srq *srq)
+{
+	struct fake_srq	*fsrq = container_of(srq, struct fake_srq, srq);
+
+	fake_rwq_destroy(&fsrq->rwq);
+	ufree(fsrq);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* ibv_query_qp								     */
+/*---------------------------------------------------------------------------*/
+int ibv_query_qp(struct ibv_qp *qp, struct ibv_qp_attr *attr,
+		 int attr_mask, struct ibv_qp_init_attr *init_attr)
+{
+	struct fake_qp *fqp = container_of(qp, struct fake_qp, qp);
+
+	memset(attr, 0, sizeof(*attr));
+	attr->qp_state		= qp->state;
+	attr->cap		= fqp->cap;
+	attr->max_rd_atomic	= FAKE_MAX_RD_ATOM;
+	attr->max_dest_rd_atomic = FAKE_MAX_RD_ATOM;
+
+	memset(init_attr, 0, sizeof(*init_attr));
+	init_attr->qp_context	= qp->qp_context;
+	init_attr->send_cq	= qp->send_cq;
+	init_attr->recv_cq	= qp->recv_cq;
+	init_attr->srq		= qp->srq;
+	init_attr->cap		= fqp->cap;
+	init_attr->qp_type	= qp->qp_type;
+	init_attr->sq_sig_all	= fqp->sq_sig_all;
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_sa_port								     */
+/*---------------------------------------------------------------------------*/
+static inline uint16_t fake_sa_port(struct sockaddr *sa)
+{
+	if (sa->sa_family == AF_INET6)
+		return ntohs(((struct sockaddr_in6 *)sa)->sin6_port);
+	return ntohs(((struct sockaddr_in *)sa)->sin_port);
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_sa_set_port							     */
+/*---------------------------------------------------------------------------*/
+static inline void fake_sa_set_port(struct sockaddr *sa, uint16_t port)
+{
+	if (sa->sa_family == AF_INET6)
+		((struct sockaddr_in6 *)sa)->sin6_port = htons(port);
+	else
+		((struct sockaddr_in *)sa)->sin_port = htons(port);
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_sa_len								     */
+/*---------------------------------------------------------------------------*/
+static inline size_t fake_sa_len(struct sockaddr *sa)
+{
+	return (sa->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) :
+					     sizeof(struct sockaddr_in);
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_find_listener - caller holds fake_lock				     */
+/*---------------------------------------------------------------------------*/
+static struct fake_cm_id *fake_find_listener(uint16_t port)
+{
+	struct fake_cm_id *fid;
+
+	list_for_each_entry(fid, &fake_listen_list, listen_entry) {
+		if (fid->port == port)
+			return fid;
+	}
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_alloc_port - caller holds fake_lock for writing			     */
+/*---------------------------------------------------------------------------*/
+static uint16_t fake_alloc_port(void)
+{
+	uint16_t port;
+
+	do {
+		port = fake_next_port++;
+		if (fake_next_port == 0)
+			fake_next_port = FAKE_FIRST_PORT;
+	} while (fake_find_listener(port));
+
+	return port;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_cm_post - queue a cm event on the channel of an id		     */
+/*---------------------------------------------------------------------------*/
+static void fake_cm_post(struct fake_cm_id *fid,
+			 enum rdma_cm_event_type type, int status,
+			 struct fake_cm_id *listen_id,
+			 struct rdma_conn_param *conn_param)
+{
+	struct fake_event_channel	*fch;
+	struct fake_cm_event		*fev;
+	char				c = 0;
+
+	fev = ucalloc(1, sizeof(*fev));
+	if (!fev) {
+		ERROR_LOG("fake cm event %s lost\n", rdma_event_str(type));
+		return;
+	}
+	fev->event.id		= &fid->id;
+	fev->event.listen_id	= listen_id ? &listen_id->id : NULL;
+	fev->event.event	= type;
+	fev->event.status	= status;
+	if (conn_param) {
+		fev->event.param.conn = *conn_param;
+		if (conn_param->private_data_len) {
+			memcpy(fev->private_data, conn_param->private_data,
+			       conn_param->private_data_len);
+			fev->event.param.conn.private_data = fev->private_data;
+		}
+	}
+
+	fch = container_of(fid->id.channel, struct fake_event_channel,
+			   channel);
+	pthread_mutex_lock(&fch->lock);
+	list_add_tail(&fev->entry, &fch->event_list);
+	pthread_mutex_unlock(&fch->lock);
+	if (write(fch->wfd, &c, sizeof(c)) != sizeof(c))
+		ERROR_LOG("write failed. (errno=%d %m)\n", errno);
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_get_devices							     */
+/*---------------------------------------------------------------------------*/
+struct ibv_context **rdma_get_devices(int *num_devices)
+{
+	struct ibv_context **list;
+
+	pthread_once(&fake_dev_once, fake_dev_init);
+
+	list = ucalloc(2, sizeof(*list));
+	if (!list) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	list[0] = &fake_dev.context;
+	if (num_devices)
+		*num_devices = 1;
+
+	return list;
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_free_devices							     */
+/*---------------------------------------------------------------------------*/
+void rdma_free_devices(struct ibv_context **list)
+{
+	ufree(list);
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_event_str							     */
+/*---------------------------------------------------------------------------*/
+const char *rdma_event_str(enum rdma_cm_event_type event)
+{
+	static const char *const str[] = {
+		[RDMA_CM_EVENT_ADDR_RESOLVED]	= "RDMA_CM_EVENT_ADDR_RESOLVED",
+		[RDMA_CM_EVENT_ADDR_ERROR]	= "RDMA_CM_EVENT_ADDR_ERROR",
+		[RDMA_CM_EVENT_ROUTE_RESOLVED]	= "RDMA_CM_EVENT_ROUTE_RESOLVED",
+		[RDMA_CM_EVENT_ROUTE_ERROR]	= "RDMA_CM_EVENT_ROUTE_ERROR",
+		[RDMA_CM_EVENT_CONNECT_REQUEST]	= "RDMA_CM_EVENT_CONNECT_REQUEST",
+		[RDMA_CM_EVENT_CONNECT_RESPONSE] =
+					"RDMA_CM_EVENT_CONNECT_RESPONSE",
+		[RDMA_CM_EVENT_CONNECT_ERROR]	= "RDMA_CM_EVENT_CONNECT_ERROR",
+		[RDMA_CM_EVENT_UNREACHABLE]	= "RDMA_CM_EVENT_UNREACHABLE",
+		[RDMA_CM_EVENT_REJECTED]	= "RDMA_CM_EVENT_REJECTED",
+		[RDMA_CM_EVENT_ESTABLISHED]	= "RDMA_CM_EVENT_ESTABLISHED",
+		[RDMA_CM_EVENT_DISCONNECTED]	= "RDMA_CM_EVENT_DISCONNECTED",
+		[RDMA_CM_EVENT_DEVICE_REMOVAL]	= "RDMA_CM_EVENT_DEVICE_REMOVAL",
+		[RDMA_CM_EVENT_MULTICAST_JOIN]	= "RDMA_CM_EVENT_MULTICAST_JOIN",
+		[RDMA_CM_EVENT_MULTICAST_ERROR]	=
+					"RDMA_CM_EVENT_MULTICAST_ERROR",
+		[RDMA_CM_EVENT_ADDR_CHANGE]	= "RDMA_CM_EVENT_ADDR_CHANGE",
+		[RDMA_CM_EVENT_TIMEWAIT_EXIT]	= "RDMA_CM_EVENT_TIMEWAIT_EXIT",
+	};
+
+	if ((unsigned)event < sizeof(str)/sizeof(str[0]) && str[event])
+		return str[event];
+	return "UNKNOWN EVENT";
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_create_event_channel						     */
+/*---------------------------------------------------------------------------*/
+struct rdma_event_channel *rdma_create_event_channel(void)
+{
+	struct fake_event_channel	*fch;
+	int				fds[2];
+
+	pthread_once(&fake_dev_once, fake_dev_init);
+
+	fch = ucalloc(1, sizeof(*fch));
+	if (!fch) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	/* one byte per queued event keeps the read end level triggered */
+	if (pipe(fds)) {
+		ufree(fch);
+		return NULL;
+	}
+	fch->channel.fd = fds[0];
+	fch->wfd	= fds[1];
+	pthread_mutex_init(&fch->lock, NULL);
+	INIT_LIST_HEAD(&fch->event_list);
+
+	return &fch->channel;
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_destroy_event_channel						     */
+/*---------------------------------------------------------------------------*/
+void rdma_destroy_event_channel(struct rdma_event_channel *channel)
+{
+	struct fake_event_channel	*fch =
+		container_of(channel, struct fake_event_channel, channel);
+	struct fake_cm_event		*fev, *next;
+
+	list_for_each_entry_safe(fev, next, &fch->event_list, entry) {
+		list_del(&fev->entry);
+		ufree(fev);
+	}
+	close(fch->channel.fd);
+	close(fch->wfd);
+	pthread_mutex_destroy(&fch->lock);
+	ufree(fch);
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_get_cm_event							     */
+/*---------------------------------------------------------------------------*/
+int rdma_get_cm_event(struct rdma_event_channel *channel,
+		      struct rdma_cm_event **event)
+{
+	struct fake_event_channel	*fch =
+		container_of(channel, struct fake_event_channel, channel);
+	struct fake_cm_event		*fev = NULL;
+	char				c;
+
+	if (read(channel->fd, &c, sizeof(c)) != sizeof(c))
+		return -1;
+
+	/* events of destroyed ids leave extra bytes behind */
+	pthread_mutex_lock(&fch->lock);
+	if (!list_empty(&fch->event_list)) {
+		fev = list_first_entry(&fch->event_list,
+				       struct fake_cm_event, entry);
+		list_del_init(&fev->entry);
+	}
+	pthread_mutex_unlock(&fch->lock);
+	if (!fev) {
+		errno = EAGAIN;
+		return -1;
+	}
+	*event = &fev->event;
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_ack_cm_event							     */
+/*---------------------------------------------------------------------------*/
+int rdma_ack_cm_event(struct rdma_cm_event *event)
+{
+	ufree(container_of(event, struct fake_cm_event, event));
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_create_id							     */
+/*---------------------------------------------------------------------------*/
+int rdma_create_id(struct rdma_event_channel *channel,
+		   struct rdma_cm_id **id, void *context,
+		   enum rdma_port_space ps)
+{
+	struct fake_cm_id *fid = ucalloc(1, sizeof(*fid));
+
+	if (!fid) {
+		errno = ENOMEM;
+		return -1;
+	}
+	fid->id.channel	= channel;
+	fid->id.context	= context;
+	fid->id.ps	= ps;
+	INIT_LIST_HEAD(&fid->listen_entry);
+	*id = &fid->id;
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* fake_disconnect_one - caller holds fake_lock for writing		     */
+/*---------------------------------------------------------------------------*/
+static void fake_disconnect_one(struct fake_cm_id *fid)
+{
+	struct fake_qp *fqp;
+
+	fid->disconnected = 1;
+	if (fid->id.qp) {
+		fqp = container_of(fid->id.qp, struct fake_qp, qp);
+		fake_qp_error(fqp);
+		/* stalled sends are flushed now that the qp is in error */
+		fake_unwait(fqp);
+		pthread_mutex_lock(&fqp->sq_lock);
+		fake_resume(fqp);
+		pthread_mutex_unlock(&fqp->sq_lock);
+	}
+	fake_cm_post(fid, RDMA_CM_EVENT_DISCONNECTED, 0, NULL, NULL);
+	fake_cm_post(fid, RDMA_CM_EVENT_TIMEWAIT_EXIT, 0, NULL, NULL);
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_destroy_id							     */
+/*---------------------------------------------------------------------------*/
+int rdma_destroy_id(struct rdma_cm_id *id)
+{
+	struct fake_cm_id		*fid = container_of(id,
+							    struct fake_cm_id,
+							    id);
+	struct fake_event_channel	*fch;
+	struct fake_cm_event		*fev, *next;
+
+	if (id->qp)
+		rdma_destroy_qp(id);
+
+	pthread_rwlock_wrlock(&fake_lock);
+	list_del_init(&fid->listen_entry);
+	if (fid->peer && fid->peer->peer == fid) {
+		/* like the DREQ sent when a connected id goes away */
+		if (fid->connected && !fid->peer->disconnected)
+			fake_disconnect_one(fid->peer);
+		fid->peer->peer = NULL;
+	}
+
+	fch = container_of(id->channel, struct fake_event_channel, channel);
+	pthread_mutex_lock(&fch->lock);
+	list_for_each_entry_safe(fev, next, &fch->event_list, entry) {
+		if (fev->event.id == id || fev->event.listen_id == id) {
+			list_del(&fev->entry);
+			ufree(fev);
+		}
+	}
+	pthread_mutex_unlock(&fch->lock);
+	pthread_rwlock_unlock(&fake_lock);
+	ufree(fid);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_bind_addr							     */
+/*---------------------------------------------------------------------------*/
+int rdma_bind_addr(struct rdma_cm_id *id, struct sockaddr *addr)
+{
+	struct fake_cm_id	*fid = container_of(id, struct fake_cm_id, id);
+	struct sockaddr		*src = &id->route.addr.src_addr;
+
+	memcpy(src, addr, fake_sa_len(addr));
+	pthread_rwlock_wrlock(&fake_lock);
+	fid->port = fake_sa_port(src);
+	if (fid->port == 0) {
+		fid->port = fake_alloc_port();
+		fake_sa_set_port(src, fid->port);
+	}
+	pthread_rwlock_unlock(&fake_lock);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_listen								     */
+/*---------------------------------------------------------------------------*/
+int rdma_listen(struct rdma_cm_id *id, int backlog)
+{
+	struct fake_cm_id *fid = container_of(id, struct fake_cm_id, id);
+
+	pthread_rwlock_wrlock(&fake_lock);
+	if (fake_find_listener(fid->port)) {
+		pthread_rwlock_unlock(&fake_lock);
+		errno = EADDRINUSE;
+		return -1;
+	}
+	fid->listening = 1;
+	list_add_tail(&fid->listen_entry, &fake_listen_list);
+	pthread_rwlock_unlock(&fake_lock);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_get_src_port							     */
+/*---------------------------------------------------------------------------*/
+uint16_t rdma_get_src_port(struct rdma_cm_id *id)
+{
+	return htons(fake_sa_port(&id->route.addr.src_addr));
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_resolve_addr							     */
+/*---------------------------------------------------------------------------*/
+int rdma_resolve_addr(struct rdma_cm_id *id, struct sockaddr *src_addr,
+		      struct sockaddr *dst_addr, int timeout_ms)
+{
+	struct fake_cm_id	*fid = container_of(id, struct fake_cm_id, id);
+	struct sockaddr		*src = &id->route.addr.src_addr;
+
+	memcpy(&id->route.addr.dst_addr, dst_addr, fake_sa_len(dst_addr));
+	if (src_addr) {
+		rdma_bind_addr(id, src_addr);
+	} else if (!fid->port) {
+		/* every address is local, answer from the loopback */
+		memset(src, 0, sizeof(id->route.addr.src_storage));
+		if (dst_addr->sa_family == AF_INET6) {
+			src->sa_family = AF_INET6;
+			((struct sockaddr_in6 *)src)->sin6_addr =
+				in6addr_loopback;
+		} else {
+			src->sa_family = AF_INET;
+			((struct sockaddr_in *)src)->sin_addr.s_addr =
+				htonl(INADDR_LOOPBACK);
+		}
+		pthread_rwlock_wrlock(&fake_lock);
+		fid->port = fake_alloc_port();
+		pthread_rwlock_unlock(&fake_lock);
+		fake_sa_set_port(src, fid->port);
+	}
+	id->verbs	= &fake_dev.context;
+	id->port_num	= 1;
+	fake_cm_post(fid, RDMA_CM_EVENT_ADDR_RESOLVED, 0, NULL, NULL);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_resolve_route							     */
+/*---------------------------------------------------------------------------*/
+int rdma_resolve_route(struct rdma_cm_id *id, int timeout_ms)
+{
+	fake_cm_post(container_of(id, struct fake_cm_id, id),
+		     RDMA_CM_EVENT_ROUTE_RESOLVED, 0, NULL, NULL);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_create_qp							     */
+/*---------------------------------------------------------------------------*/
+int rdma_create_qp(struct rdma_cm_id *id, struct ibv_pd *pd,
+		   struct ibv_qp_init_attr *qp_init_attr)
+{
+	struct ibv_qp_cap	*cap = &qp_init_attr->cap;
+	struct fake_qp		*fqp;
+
+	if (qp_init_attr->qp_type != IBV_QPT_RC ||
+	    cap->max_send_wr > FAKE_MAX_QP_WR ||
+	    cap->max_recv_wr > FAKE_MAX_QP_WR ||
+	    cap->max_send_sge > FAKE_MAX_SGE ||
+	    cap->max_recv_sge > FAKE_MAX_RECV_SGE ||
+	    cap->max_inline_data > FAKE_MAX_INLINE) {
+		errno = EINVAL;
+		return -1;
+	}
+	fqp = ucalloc(1, sizeof(*fqp));
+	if (!fqp || fake_rwq_init(&fqp->rq, cap->max_recv_wr)) {
+		ufree(fqp);
+		errno = ENOMEM;
+		return -1;
+	}
+	fqp->cap		= *cap;
+	fqp->sq_sig_all		= qp_init_attr->sq_sig_all;
+	pthread_mutex_init(&fqp->sq_lock, NULL);
+	INIT_LIST_HEAD(&fqp->stalled_list);
+	INIT_LIST_HEAD(&fqp->waiter_entry);
+
+	fqp->qp.context		= pd->context;
+	fqp->qp.qp_context	= qp_init_attr->qp_context;
+	fqp->qp.pd		= pd;
+	fqp->qp.send_cq		= qp_init_attr->send_cq;
+	fqp->qp.recv_cq		= qp_init_attr->recv_cq;
+	fqp->qp.srq		= qp_init_attr->srq;
+	fqp->qp.qp_type		= IBV_QPT_RC;
+	fqp->qp.state		= IBV_QPS_INIT;
+
+	pthread_rwlock_wrlock(&fake_lock);
+	fqp->qp.qp_num		= fake_next_qpn++;
+	fqp->qp.handle		= fqp->qp.qp_num;
+	pthread_rwlock_unlock(&fake_lock);
+
+	id->qp = &fqp->qp;
+	id->pd = pd;
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_destroy_qp							     */
+/*---------------------------------------------------------------------------*/
+void rdma_destroy_qp(struct rdma_cm_id *id)
+{
+	struct fake_qp		*fqp;
+	struct fake_send	*send, *next;
+
+	if (!id->qp)
+		return;
+	fqp = container_of(id->qp, struct fake_qp, qp);
+
+	pthread_rwlock_wrlock(&fake_lock);
+	if (fqp->peer) {
+		if (fqp->peer->waiting_on == &fqp->rq)
+			fake_unwait(fqp->peer);
+		fqp->peer->peer = NULL;
+	}
+	fake_unwait(fqp);
+	pthread_rwlock_unlock(&fake_lock);
+
+	list_for_each_entry_safe(send, next, &fqp->stalled_list, entry) {
+		list_del(&send->entry);
+		ufree(send);
+	}
+	/* as a driver does, so no completion refers to a freed qp */
+	fake_cq_clean(fqp->qp.send_cq, fqp->qp.qp_num);
+	if (fqp->qp.recv_cq != fqp->qp.send_cq)
+		fake_cq_clean(fqp->qp.recv_cq, fqp->qp.qp_num);
+
+	fake_rwq_destroy(&fqp->rq);
+	pthread_mutex_destroy(&fqp->sq_lock);
+	ufree(fqp);
+	id->qp = NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_connect								     */
+/*---------------------------------------------------------------------------*/
+int rdma_connect(struct rdma_cm_id *id, struct rdma_conn_param *conn_param)
+{
+	struct fake_cm_id	*fid = container_of(id, struct fake_cm_id, id);
+	struct fake_cm_id	*listener, *child;
+	struct rdma_conn_param	param;
+	struct sockaddr		*dst = &id->route.addr.dst_addr;
+
+	pthread_rwlock_wrlock(&fake_lock);
+	listener = fake_find_listener(fake_sa_port(dst));
+	if (!listener) {
+		pthread_rwlock_unlock(&fake_lock);
+		fake_cm_post(fid, RDMA_CM_EVENT_REJECTED,
+			     IB_CM_REJ_INVALID_SERVICE_ID, NULL, NULL);
+		return 0;
+	}
+	child = ucalloc(1, sizeof(*child));
+	if (!child) {
+		pthread_rwlock_unlock(&fake_lock);
+		errno = ENOMEM;
+		return -1;
+	}
+	child->id.channel	= listener->id.channel;
+	child->id.context	= listener->id.context;
+	child->id.ps		= listener->id.ps;
+	child->id.verbs		= &fake_dev.context;
+	child->id.port_num	= 1;
+	child->port		= listener->port;
+	child->peer		= fid;
+	INIT_LIST_HEAD(&child->listen_entry);
+	memcpy(&child->id.route.addr.src_storage, dst, fake_sa_len(dst));
+	memcpy(&child->id.route.addr.dst_storage,
+	       &id->route.addr.src_storage,
+	       fake_sa_len(&id->route.addr.src_addr));
+	fid->peer = child;
+
+	/* the passive side sees the resources from its own point of view */
+	param = *conn_param;
+	param.responder_resources	= conn_param->initiator_depth;
+	param.initiator_depth		= conn_param->responder_resources;
+	if (id->qp)
+		param.qp_num		= id->qp->qp_num;
+	fake_cm_post(child, RDMA_CM_EVENT_CONNECT_REQUEST, 0, listener,
+		     &param);
+	pthread_rwlock_unlock(&fake_lock);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_accept								     */
+/*---------------------------------------------------------------------------*/
+int rdma_accept(struct rdma_cm_id *id, struct rdma_conn_param *conn_param)
+{
+	struct fake_cm_id	*fid = container_of(id, struct fake_cm_id, id);
+	struct fake_cm_id	*peer;
+	struct fake_qp		*fqp, *pqp;
+
+	pthread_rwlock_wrlock(&fake_lock);
+	peer = fid->peer;
+	if (!peer || !id->qp || !peer->id.qp) {
+		pthread_rwlock_unlock(&fake_lock);
+		errno = peer ? EINVAL : ECONNREFUSED;
+		return -1;
+	}
+	fqp = container_of(id->qp, struct fake_qp, qp);
+	pqp = container_of(peer->id.qp, struct fake_qp, qp);
+	fqp->peer	= pqp;
+	pqp->peer	= fqp;
+	fqp->qp.state	= IBV_QPS_RTS;
+	pqp->qp.state	= IBV_QPS_RTS;
+	fid->connected	= 1;
+	peer->connected	= 1;
+
+	fake_cm_post(peer, RDMA_CM_EVENT_ESTABLISHED, 0, NULL, conn_param);
+	fake_cm_post(fid, RDMA_CM_EVENT_ESTABLISHED, 0, NULL, NULL);
+	pthread_rwlock_unlock(&fake_lock);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_reject								     */
+/*---------------------------------------------------------------------------*/
+int rdma_reject(struct rdma_cm_id *id, const void *private_data,
+		uint8_t private_data_len)
+{
+	struct fake_cm_id	*fid = container_of(id, struct fake_cm_id, id);
+	struct rdma_conn_param	param;
+
+	memset(&param, 0, sizeof(param));
+	param.private_data	= private_data;
+	param.private_data_len	= private_data_len;
+
+	pthread_rwlock_wrlock(&fake_lock);
+	if (fid->peer) {
+		fake_cm_post(fid->peer, RDMA_CM_EVENT_REJECTED,
+			     IB_CM_REJ_CONSUMER_DEFINED, NULL, &param);
+		fid->peer->peer = NULL;
+		fid->peer = NULL;
+	}
+	pthread_rwlock_unlock(&fake_lock);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* rdma_disconnect							     */
+/*---------------------------------------------------------------------------*/
+int rdma_disconnect(struct rdma_cm_id *id)
+{
+	struct fake_cm_id *fid = container_of(id, struct fake_cm_id, id);
+
+	pthread_rwlock_wrlock(&fake_lock);
+	if (!fid->connected) {
+		pthread_rwlock_unlock(&fake_lock);
+		errno = EINVAL;
+		return -1;
+	}
+	/* the peer disconnecting already took both ends down */
+	if (!fid->disconnected) {
+		fake_disconnect_one(fid);
+		if (fid->peer && !fid->peer->disconnected)
+			fake_disconnect_one(fid->peer);
+	}
+	pthread_rwlock_unlock(&fake_lock);
+
+	return 0;
+}
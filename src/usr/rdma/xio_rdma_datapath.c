@@ -43,6 +43,7 @@
 #include "xio_common.h"
 #include "xio_observer.h"
 #include "xio_context.h"
+#include "xio_ev_loop.h"
 #include "xio_task.h"
 #include "xio_transport.h"
 #include "xio_protocol.h"
@@ -74,6 +75,9 @@ static int xio_rdma_on_recv_cancel_rsp(struct xio_rdma_transport *rdma_hndl,
 static int xio_rdma_send_nop(struct xio_rdma_transport *rdma_hndl);
 static int xio_sched_rdma_wr_req(struct xio_rdma_transport *rdma_hndl,
 				 struct xio_task *task);
+static int xio_rdma_write_rsp_header(struct xio_rdma_transport *rdma_hndl,
+				     struct xio_task *task,
+				     struct xio_rsp_hdr *rsp_hdr);
 static void xio_sched_consume_cq(xio_ctx_event_t *tev, void *data);
 static void xio_sched_poll_cq(xio_ctx_event_t *tev, void *data);
 
@@ -93,6 +97,22 @@ static inline struct ibv_mr *xio_rdma_mr_lookup(struct xio_mr *tmr,
 	return NULL;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_rdma_mark_dirty							     */
+/*---------------------------------------------------------------------------*/
+static inline void xio_rdma_mark_dirty(struct xio_rdma_transport *rdma_hndl)
+{
+	/* only listed transports are visited once a poll cycle is over */
+	if (rdma_hndl->state != XIO_STATE_CONNECTED ||
+	    !list_empty(&rdma_hndl->idle_entry))
+		return;
+
+	if (rdma_hndl->tx_ready_tasks_num || rdma_hndl->kick_rdma_rd ||
+	    (rdma_hndl->credits && rdma_hndl->sim_peer_credits < MAX_RECV_WR))
+		list_add_tail(&rdma_hndl->idle_entry,
+			      &rdma_hndl->tcq->idle_list);
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_post_recv							     */
 /*---------------------------------------------------------------------------*/
@@ -121,6 +141,7 @@ int xio_post_recv(struct xio_rdma_transport *rdma_hndl,
 
 	/* credit updates */
 	rdma_hndl->credits += nr_posted;
+	xio_rdma_mark_dirty(rdma_hndl);
 
 	return retval;
 }
@@ -162,6 +183,14 @@ static int xio_post_send(struct xio_rdma_transport *rdma_hndl,
 	}
 	rdma_hndl->sqe_avail -= nr_posted;
 
+	/* work requests per doorbell = TX_WRS / TX_DOORBELLS */
+	if (rdma_hndl->tcq->stat_tx_doorbells >= 0)
+		xio_stat_inc(&rdma_hndl->base.ctx->stats,
+			     rdma_hndl->tcq->stat_tx_doorbells);
+	if (rdma_hndl->tcq->stat_tx_wrs >= 0)
+		xio_stat_add(&rdma_hndl->base.ctx->stats,
+			     rdma_hndl->tcq->stat_tx_wrs, nr_posted);
+
 	return retval;
 }
 
@@ -210,6 +239,51 @@ static inline uint16_t tx_window_sz(struct xio_rdma_transport *rdma_hndl)
 	return rdma_hndl->max_sn - rdma_hndl->sn;
 }
 
+/*---------------------------------------------------------------------------*/
+/* tx_credits_window							     */
+/*---------------------------------------------------------------------------*/
+static inline uint16_t tx_credits_window(struct xio_rdma_transport *rdma_hndl)
+{
+	/* the last peer credit is kept for a credit update unless the post
+	 * carries credits, otherwise with small receive windows both sides
+	 * may run dry while holding each other's credits
+	 */
+	if (rdma_options.enable_adaptive_rq &&
+	    !rdma_hndl->credits && rdma_hndl->peer_credits)
+		return rdma_hndl->peer_credits - 1;
+
+	return rdma_hndl->peer_credits;
+}
+
+/*---------------------------------------------------------------------------*/
+/* tx_batch_full							     */
+/*---------------------------------------------------------------------------*/
+static inline int tx_batch_full(struct xio_rdma_transport *rdma_hndl)
+{
+	uint16_t window;
+
+	/* holding more tasks back cannot enlarge the next post */
+	window = min(tx_credits_window(rdma_hndl), tx_window_sz(rdma_hndl));
+	window = min(window, (uint16_t)rdma_hndl->sqe_avail);
+
+	return rdma_hndl->tx_ready_tasks_num >= window;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_rdma_sig_policy							     */
+/*---------------------------------------------------------------------------*/
+static inline void xio_rdma_sig_policy(struct xio_rdma_transport *rdma_hndl,
+				       struct xio_work_req *wr, int force)
+{
+	/* unsignaled sends are reclaimed by the next signaled one */
+	if (force || ++rdma_hndl->unsig_cnt >= rdma_hndl->sig_interval) {
+		wr->send_wr.send_flags |= IBV_SEND_SIGNALED;
+		rdma_hndl->unsig_cnt = 0;
+	} else {
+		wr->send_wr.send_flags &= ~IBV_SEND_SIGNALED;
+	}
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_rdma_xmit							     */
 /*---------------------------------------------------------------------------*/
@@ -217,7 +291,6 @@ static int xio_rdma_xmit(struct xio_rdma_transport *rdma_hndl)
 {
 	struct xio_task		*task = NULL, *task1, *task2;
 	struct xio_rdma_task	*rdma_task = NULL;
-	struct xio_rdma_task	*prev_rdma_task = NULL;
 	struct xio_work_req	dummy_wr;
 	struct xio_work_req	*first_wr = NULL;
 	struct xio_work_req	*curr_wr = NULL;
@@ -226,9 +299,10 @@ static int xio_rdma_xmit(struct xio_rdma_transport *rdma_hndl)
 	uint16_t		window;
 	uint16_t		retval;
 	uint16_t		req_nr = 0;
+	uint16_t		credits;
 
 	tx_window = tx_window_sz(rdma_hndl);
-	window = min(rdma_hndl->peer_credits, tx_window);
+	window = min(tx_credits_window(rdma_hndl), tx_window);
 	window = min(window, rdma_hndl->sqe_avail);
 	/*
 	TRACE_LOG("XMIT: tx_window:%d, peer_credits:%d, sqe_avail:%d\n",
@@ -274,7 +348,6 @@ static int xio_rdma_xmit(struct xio_rdma_transport *rdma_hndl)
 
 			prev_wr->send_wr.next = &curr_wr->send_wr;
 
-			prev_rdma_task	= rdma_task;
 			prev_wr		= curr_wr;
 			req_nr++;
 			rdma_hndl->tx_ready_tasks_num--;
@@ -285,7 +358,12 @@ static int xio_rdma_xmit(struct xio_rdma_transport *rdma_hndl)
 				       &rdma_hndl->in_flight_list);
 			continue;
 		}
-		if (rdma_task->ib_op == XIO_IB_RDMA_WRITE) {
+		if (rdma_task->ib_op == XIO_IB_RDMA_WRITE_IMM) {
+			if (req_nr >= window)
+				break;
+			/* the data write carries the response itself */
+			curr_wr = &rdma_task->rdmad;
+		} else if (rdma_task->ib_op == XIO_IB_RDMA_WRITE) {
 			if (req_nr >= (window - 1))
 				break;
 
@@ -293,7 +371,6 @@ static int xio_rdma_xmit(struct xio_rdma_transport *rdma_hndl)
 			/* prepare it for rdma wr and concatenate the send
 			 * wr to it */
 			rdma_task->rdmad.send_wr.next = &rdma_task->txd.send_wr;
-			rdma_task->txd.send_wr.send_flags |= IBV_SEND_SIGNALED;
 
 			curr_wr = &rdma_task->rdmad;
 			req_nr++;
@@ -302,20 +379,32 @@ static int xio_rdma_xmit(struct xio_rdma_transport *rdma_hndl)
 				break;
 			curr_wr = &rdma_task->txd;
 		}
-		xio_rdma_write_sn(task, rdma_hndl->sn, rdma_hndl->ack_sn,
-				  rdma_hndl->credits);
+		if (rdma_task->ib_op == XIO_IB_RDMA_WRITE_IMM) {
+			/* the rest of the credits go with a later message */
+			credits = min(rdma_hndl->credits,
+				      XIO_IMM_RSP_MAX_CREDITS);
+			rdma_task->rdmad.send_wr.imm_data =
+				htonl(XIO_IMM_RSP(task->rtid, credits,
+						  task->omsg->flags));
+			prev_wr->send_wr.next = &curr_wr->send_wr;
+			prev_wr = curr_wr;
+		} else {
+			credits = rdma_hndl->credits;
+			xio_rdma_write_sn(task, rdma_hndl->sn,
+					  rdma_hndl->ack_sn, credits);
+			prev_wr->send_wr.next = &curr_wr->send_wr;
+			prev_wr = &rdma_task->txd;
+		}
+		/* the write and send pair is always completed together */
+		xio_rdma_sig_policy(rdma_hndl, prev_wr,
+				    task->is_control ||
+				    rdma_task->ib_op == XIO_IB_RDMA_WRITE);
 		rdma_task->sn = rdma_hndl->sn;
 		rdma_hndl->sn++;
-		rdma_hndl->sim_peer_credits += rdma_hndl->credits;
-		rdma_hndl->credits = 0;
+		rdma_hndl->sim_peer_credits += credits;
+		rdma_hndl->credits -= credits;
 		rdma_hndl->peer_credits--;
-		rdma_hndl->last_send_was_signaled =
-			rdma_task->txd.send_wr.send_flags & IBV_SEND_SIGNALED;
-
-		prev_wr->send_wr.next = &curr_wr->send_wr;
-		prev_wr = &rdma_task->txd;
 
-		prev_rdma_task = rdma_task;
 		req_nr++;
 		rdma_hndl->tx_ready_tasks_num--;
 		if (IS_REQUEST(task->tlv_type))
@@ -328,11 +417,15 @@ static int xio_rdma_xmit(struct xio_rdma_transport *rdma_hndl)
 	if (req_nr) {
 		first_wr = container_of(dummy_wr.send_wr.next,
 					struct xio_work_req, send_wr);
-		prev_rdma_task->txd.send_wr.next = NULL;
-		if (tx_window_sz(rdma_hndl) < 1 ||
-		    rdma_hndl->sqe_avail < req_nr + 1)
-			prev_rdma_task->txd.send_wr.send_flags |=
-				IBV_SEND_SIGNALED;
+		prev_wr->send_wr.next = NULL;
+		/* the window and the send queue only reopen on completions */
+		if (tx_window_sz(rdma_hndl) < SEND_SIG_HEADROOM ||
+		    rdma_hndl->sqe_avail < req_nr + SEND_SIG_HEADROOM) {
+			prev_wr->send_wr.send_flags |= IBV_SEND_SIGNALED;
+			rdma_hndl->unsig_cnt = 0;
+		}
+		rdma_hndl->last_send_was_signaled =
+			!!(prev_wr->send_wr.send_flags & IBV_SEND_SIGNALED);
 		retval = xio_post_send(rdma_hndl, first_wr, req_nr);
 		if (retval != 0) {
 			ERROR_LOG("xio_post_send failed\n");
@@ -360,6 +453,13 @@ static int xio_xmit_rdma_rd(struct xio_rdma_transport *rdma_hndl)
 
 	while (!list_empty(&rdma_hndl->rdma_rd_list) &&
 	       rdma_hndl->sqe_avail > num_reqs) {
+		/* outstanding rdma reads are bounded by the negotiated
+		 * initiator depth
+		 */
+		if (rdma_hndl->client_initiator_depth &&
+		    (rdma_hndl->rdma_rd_req_in_flight + num_reqs >=
+		     rdma_hndl->client_initiator_depth))
+			break;
 
 		task = list_first_entry(
 				&rdma_hndl->rdma_rd_list,
@@ -391,6 +491,7 @@ static int xio_xmit_rdma_rd(struct xio_rdma_transport *rdma_hndl)
 					struct xio_work_req, send_wr);
 		prev_wr->send_wr.next = NULL;
 		rdma_hndl->rdma_in_flight += num_reqs;
+		rdma_hndl->rdma_rd_req_in_flight += num_reqs;
 		/* submit the chain of rdma-rd requests, start from the first */
 		err = xio_post_send(rdma_hndl, first_wr, num_reqs);
 		if (err)
@@ -399,6 +500,7 @@ static int xio_xmit_rdma_rd(struct xio_rdma_transport *rdma_hndl)
 		/* ToDo: error handling */
 	} else if (!list_empty(&rdma_hndl->rdma_rd_list)) {
 		rdma_hndl->kick_rdma_rd = 1;
+		xio_rdma_mark_dirty(rdma_hndl);
 	}
 
 	return 0;
@@ -416,6 +518,18 @@ int xio_rdma_rearm_rq(struct xio_rdma_transport *rdma_hndl)
 	struct xio_rdma_task	*prev_rdma_task = NULL;
 	int			num_to_post;
 	int			i;
+	int			cqe_needed;
+
+	/* the cq slots of a shrunk window are returned once the buffers
+	 * that were posted for it are consumed
+	 */
+	cqe_needed = MAX_SEND_WR + rdma_hndl->actual_rq_depth;
+	if (rdma_hndl->rqe_avail <= rdma_hndl->actual_rq_depth &&
+	    rdma_hndl->cqe_reserved > cqe_needed) {
+		xio_cq_free_slots(rdma_hndl->tcq,
+				  rdma_hndl->cqe_reserved - cqe_needed);
+		rdma_hndl->cqe_reserved = cqe_needed;
+	}
 
 	num_to_post = rdma_hndl->actual_rq_depth - rdma_hndl->rqe_avail;
 	for (i = 0; i < num_to_post; i++) {
@@ -445,6 +559,152 @@ int xio_rdma_rearm_rq(struct xio_rdma_transport *rdma_hndl)
 	return 0;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_srq_pay_owed							     */
+/*---------------------------------------------------------------------------*/
+static void xio_srq_pay_owed(struct xio_srq *srq)
+{
+	struct xio_rdma_transport	*rdma_hndl, *next;
+	int				n;
+
+	list_for_each_entry_safe(rdma_hndl, next, &srq->owed_list,
+				 srq_owed_entry) {
+		if (!srq->credits_avail)
+			break;
+		if (rdma_hndl->state != XIO_STATE_CONNECTED)
+			continue;
+		n = min(rdma_hndl->srq_owed, srq->credits_avail);
+		srq->credits_avail	-= n;
+		rdma_hndl->srq_owed	-= n;
+		rdma_hndl->credits	+= n;
+		if (!rdma_hndl->srq_owed)
+			list_del_init(&rdma_hndl->srq_owed_entry);
+		xio_rdma_mark_dirty(rdma_hndl);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_srq_grant_credits						     */
+/*---------------------------------------------------------------------------*/
+void xio_srq_grant_credits(struct xio_rdma_transport *rdma_hndl, int nr)
+{
+	struct xio_srq	*srq = rdma_hndl->srq;
+	int		n = min(nr, srq->credits_avail);
+
+	/* what the posted buffers cannot cover is paid on refill */
+	srq->credits_avail	-= n;
+	rdma_hndl->credits	+= n;
+	rdma_hndl->srq_owed	+= nr - n;
+	if (rdma_hndl->srq_owed && list_empty(&rdma_hndl->srq_owed_entry))
+		list_add_tail(&rdma_hndl->srq_owed_entry, &srq->owed_list);
+	xio_rdma_mark_dirty(rdma_hndl);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_srq_rearm							     */
+/*---------------------------------------------------------------------------*/
+int xio_srq_rearm(struct xio_srq *srq)
+{
+	struct xio_tasks_pool	*pool = srq->tasks_pool;
+	struct xio_task		*task;
+	struct xio_rdma_task	*rdma_task;
+	struct xio_rdma_task	*first_rdma_task = NULL;
+	struct xio_rdma_task	*prev_rdma_task = NULL;
+	struct ibv_recv_wr	*bad_wr = NULL;
+	struct ibv_recv_wr	*wr;
+	int			num_to_post, nr_posted = 0;
+	int			i, retval;
+
+	num_to_post = srq->srq_depth - srq->srqe_avail;
+	for (i = 0; i < num_to_post; i++) {
+		/* the rest of the buffers are held by the upper layer */
+		task = xio_tasks_pool_get(pool);
+		if (task == NULL)
+			break;
+		rdma_task = task->dd_data;
+		if (first_rdma_task == NULL)
+			first_rdma_task = rdma_task;
+		else
+			prev_rdma_task->rxd.recv_wr.next =
+						&rdma_task->rxd.recv_wr;
+		prev_rdma_task = rdma_task;
+		rdma_task->ib_op = XIO_IB_RECV;
+		list_add_tail(&task->tasks_list_entry, &srq->rx_list);
+	}
+	if (first_rdma_task == NULL)
+		return 0;
+
+	prev_rdma_task->rxd.recv_wr.next = NULL;
+	retval = ibv_post_srq_recv(srq->srq, &first_rdma_task->rxd.recv_wr,
+				   &bad_wr);
+	if (likely(!retval)) {
+		nr_posted = i;
+	} else {
+		for (wr = &first_rdma_task->rxd.recv_wr; wr != bad_wr;
+		     wr = wr->next)
+			nr_posted++;
+		/* return what was not posted. not through the release,
+		 * that would rearm again
+		 */
+		for (wr = bad_wr; wr; wr = wr->next) {
+			task = ptr_from_int64(wr->wr_id);
+			rdma_task = task->dd_data;
+			rdma_task->ib_op = XIO_IB_NULL;
+			xio_tasks_pool_push(pool, task);
+		}
+		xio_set_error(retval);
+		ERROR_LOG("ibv_post_srq_recv failed. (errno=%d %s)\n",
+			  retval, strerror(retval));
+	}
+	srq->srqe_avail		+= nr_posted;
+	srq->credits_avail	+= nr_posted;
+
+	xio_srq_pay_owed(srq);
+
+	return retval;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_srq_on_recv							     */
+/*---------------------------------------------------------------------------*/
+static inline void xio_srq_on_recv(struct xio_rdma_transport *rdma_hndl)
+{
+	struct xio_srq	*srq = rdma_hndl->srq;
+	int		nr = 1;
+
+	srq->srqe_avail--;
+
+	/* the consumed credit goes back to the peer, and while the queue
+	 * is well stocked the peer's window may grow up to rq_depth
+	 */
+	if (rdma_hndl->state == XIO_STATE_CONNECTED) {
+		if (srq->credits_avail > srq->srq_depth/2 &&
+		    (rdma_hndl->sim_peer_credits + rdma_hndl->credits <
+		     rdma_hndl->rq_depth))
+			nr++;
+		xio_srq_grant_credits(rdma_hndl, nr);
+	}
+
+	if (srq->srqe_avail <= srq->low_wm)
+		xio_srq_rearm(srq);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_srq_lookup							     */
+/*---------------------------------------------------------------------------*/
+static inline struct xio_rdma_transport *xio_srq_lookup(struct xio_srq *srq,
+							uint32_t qp_num)
+{
+	struct xio_rdma_transport	*rdma_hndl;
+	struct xio_key_int32		key = {
+		qp_num
+	};
+
+	HT_LOOKUP(&srq->qp_htbl, &key, rdma_hndl, srq_htbl);
+
+	return rdma_hndl;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_rdma_rx_error_handler						     */
 /*---------------------------------------------------------------------------*/
@@ -518,6 +778,10 @@ static void xio_handle_task_error(struct xio_task *task)
 	case XIO_IB_RDMA_WRITE:
 		xio_rdma_wr_error_handler(rdma_hndl, task);
 		break;
+	case XIO_IB_RDMA_WRITE_IMM:
+		/* no send follows, the write is the response */
+		xio_rdma_tx_error_handler(rdma_hndl, task);
+		break;
 	default:
 		ERROR_LOG("unknown opcode: task:%p, type:0x%x, " \
 			  "magic:0x%lx, ib_op:0x%x\n",
@@ -540,6 +804,15 @@ static void xio_handle_wc_error(struct ibv_wc *wc)
 
 	if (task) {
 		rdma_task = task->dd_data;
+		if (rdma_task->srq && rdma_task->ib_op == XIO_IB_RECV) {
+			rdma_task->srq->srqe_avail--;
+			rdma_task->rdma_hndl = xio_srq_lookup(rdma_task->srq,
+							      wc->qp_num);
+			if (rdma_task->rdma_hndl == NULL) {
+				xio_tasks_pool_put(task);
+				return;
+			}
+		}
 		rdma_hndl = rdma_task->rdma_hndl;
 	}
 
@@ -659,37 +932,114 @@ send_final_nop:
 	return 0;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_rdma_rq_resize							     */
+/*---------------------------------------------------------------------------*/
+static int xio_rdma_rq_resize(struct xio_rdma_transport *rdma_hndl,
+			      int rq_window)
+{
+	int cqe_needed = MAX_SEND_WR + rq_window + EXTRA_RQE;
+
+	if (cqe_needed > rdma_hndl->cqe_reserved) {
+		if (xio_cq_alloc_slots(rdma_hndl->tcq,
+				       cqe_needed -
+				       rdma_hndl->cqe_reserved) != 0)
+			return -1;
+		rdma_hndl->cqe_reserved = cqe_needed;
+	}
+
+	TRACE_LOG("rdma_hndl:%p receive window %d => %d\n",
+		  rdma_hndl, rdma_hndl->rq_window, rq_window);
+
+	/* a shrunk window leaves the credits already granted with the
+	 * peer, the extra buffers are simply not reposted
+	 */
+	rdma_hndl->rq_window		= rq_window;
+	rdma_hndl->actual_rq_depth	= rq_window + EXTRA_RQE;
+
+	if (rdma_hndl->rqe_avail < rdma_hndl->actual_rq_depth) {
+		xio_rdma_rearm_rq(rdma_hndl);
+		/* hand the new credits to the peer */
+		xio_rdma_idle_handler(rdma_hndl);
+	}
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_rdma_resize_handler						     */
+/*---------------------------------------------------------------------------*/
+void xio_rdma_resize_handler(void *data)
+{
+	struct xio_rdma_transport *rdma_hndl = data;
+	int rx_nr	= rdma_hndl->rx_tick_nr;
+	int pressure	= rdma_hndl->rq_pressure;
+	int min_window	= min(RQ_MIN_WINDOW, rdma_hndl->rq_depth);
+
+	rdma_hndl->rx_tick_nr	= 0;
+	rdma_hndl->rq_pressure	= 0;
+
+	if (rdma_hndl->state != XIO_STATE_CONNECTED)
+		return;
+
+	if (rx_nr) {
+		rdma_hndl->idle_ticks = 0;
+		/* the peer ran dry in at least every other window */
+		if (!rdma_hndl->srq &&
+		    rdma_hndl->rq_window < rdma_hndl->rq_depth &&
+		    rx_nr >= rdma_hndl->rq_window &&
+		    2*pressure*rdma_hndl->rq_window >= rx_nr)
+			xio_rdma_rq_resize(rdma_hndl,
+					   min(2*rdma_hndl->rq_window,
+					       rdma_hndl->rq_depth));
+	} else if (++rdma_hndl->idle_ticks >= RESIZE_IDLE_TICKS) {
+		/* quiet for a while: step down, a tick at a time */
+		if (!rdma_hndl->srq && rdma_hndl->rq_window > min_window)
+			xio_rdma_rq_resize(rdma_hndl,
+					   max(rdma_hndl->rq_window/2,
+					       min_window));
+		xio_rdma_primary_pool_shrink(rdma_hndl);
+	}
+
+	/* without the tick the window keeps its current size */
+	if (xio_ctx_add_delayed_work(rdma_hndl->base.ctx, RESIZE_TICK_MSEC,
+				     rdma_hndl, xio_rdma_resize_handler,
+				     &rdma_hndl->resize_work) != 0)
+		ERROR_LOG("xio_ctx_add_delayed_work failed.\n");
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_rdma_rx_handler							     */
 /*---------------------------------------------------------------------------*/
 static int xio_rdma_rx_handler(struct xio_rdma_transport *rdma_hndl,
 			       struct xio_task *task)
 {
-	struct xio_task		*task1, *task2;
 	struct xio_rdma_task	*rdma_task;
 	int			must_send = 0;
-	int			retval;
-
-	/* prefetch next buffer */
-	task1 = list_first_entry(&task->tasks_list_entry,
-			 struct xio_task,  tasks_list_entry);
-	xio_prefetch(task1->mbuf.buf.head);
-	task2 = list_first_entry(&task1->tasks_list_entry,
-			 struct xio_task,  tasks_list_entry);
-	xio_prefetch(task2->mbuf.buf.head);
-
 
-	rdma_hndl->rqe_avail--;
 	rdma_hndl->sim_peer_credits--;
+	rdma_hndl->rx_tick_nr++;
 
-	/* rearm the receive queue  */
-	if ((rdma_hndl->state == XIO_STATE_CONNECTED) &&
-	    (rdma_hndl->rqe_avail <= rdma_hndl->rq_depth + 1))
-		xio_rdma_rearm_rq(rdma_hndl);
+	if (rdma_hndl->srq) {
+		xio_srq_on_recv(rdma_hndl);
+	} else {
+		rdma_hndl->rqe_avail--;
 
-	retval = xio_mbuf_read_first_tlv(&task->mbuf);
+		/* the peer is down to the credit it keeps for updates */
+		if (rdma_hndl->sim_peer_credits <= 1)
+			rdma_hndl->rq_pressure++;
 
-	task->tlv_type = xio_mbuf_tlv_type(&task->mbuf);
+		/* the receive queue is refilled once the whole polled
+		 * batch was handled, in a single post
+		 */
+		if ((rdma_hndl->state == XIO_STATE_CONNECTED) &&
+		    (rdma_hndl->rqe_avail <= rdma_hndl->rq_window + 1) &&
+		    list_empty(&rdma_hndl->rx_rearm_entry))
+			list_add_tail(&rdma_hndl->rx_rearm_entry,
+				      &rdma_hndl->tcq->rx_rearm_list);
+	}
+
+	/* the header was parsed with the rest of the batch */
 	list_move_tail(&task->tasks_list_entry, &rdma_hndl->io_list);
 
 
@@ -719,8 +1069,11 @@ static int xio_rdma_rx_handler(struct xio_rdma_transport *rdma_hndl,
 		break;
 	}
 
+	/* piggybacked peer credits may unblock queued work */
+	xio_rdma_mark_dirty(rdma_hndl);
+
 	if (rdma_hndl->state != XIO_STATE_CONNECTED)
-		return retval;
+		return 0;
 
 	/* transmit ready packets */
 	if (rdma_hndl->tx_ready_tasks_num) {
@@ -738,7 +1091,7 @@ static int xio_rdma_rx_handler(struct xio_rdma_transport *rdma_hndl,
 	if (must_send)
 		xio_rdma_xmit(rdma_hndl);
 
-	return retval;
+	return 0;
 }
 
 
@@ -808,6 +1161,8 @@ static int xio_rdma_tx_comp_handler(struct xio_rdma_transport *rdma_hndl,
 	if (rdma_hndl->tx_ready_tasks_num)
 		xio_rdma_xmit(rdma_hndl);
 
+	/* freed send queue entries may unblock a pending nop */
+	xio_rdma_mark_dirty(rdma_hndl);
 
 	if (!found && removed)
 		ERROR_LOG("not found but removed %d type:0x%x\n",
@@ -816,6 +1171,40 @@ static int xio_rdma_tx_comp_handler(struct xio_rdma_transport *rdma_hndl,
 	return 0;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_rdma_notify_data_chunk						     */
+/*---------------------------------------------------------------------------*/
+static void xio_rdma_notify_data_chunk(struct xio_rdma_transport *rdma_hndl,
+				       struct xio_rdma_task *rdma_task)
+{
+	union xio_transport_event_data	event_data;
+	struct xio_task			*owner = rdma_task->chunk_owner;
+	struct xio_rdma_task		*owner_rdma_task;
+	size_t				len = 0;
+	int				i;
+
+	if (owner == NULL || owner->state == XIO_TASK_STATE_CANCEL_PENDING)
+		return;
+
+	for (i = 0; i < rdma_task->rdmad.send_wr.num_sge; i++)
+		len += rdma_task->rdmad.sge[i].length;
+
+	/* rdma reads on the qp complete in order, so the chunks are
+	 * delivered contiguously
+	 */
+	owner_rdma_task = owner->dd_data;
+
+	event_data.chunk.task	= owner;
+	event_data.chunk.offset	= owner_rdma_task->chunk_off;
+	event_data.chunk.len	= len;
+
+	owner_rdma_task->chunk_off += len;
+
+	xio_transport_notify_observer(&rdma_hndl->base,
+				      XIO_TRANSPORT_DATA_CHUNK,
+				      &event_data);
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_rdma_rd_comp_handler						     */
 /*---------------------------------------------------------------------------*/
@@ -829,6 +1218,7 @@ static void xio_rdma_rd_comp_handler(
 					(struct xio_transport_base *)rdma_hndl;
 
 	rdma_hndl->rdma_in_flight--;
+	rdma_hndl->rdma_rd_req_in_flight--;
 	rdma_hndl->sqe_avail++;
 
 	if (rdma_task->phantom_idx == 0) {
@@ -842,6 +1232,8 @@ static void xio_rdma_rd_comp_handler(
 			return;
 		}
 
+		xio_rdma_notify_data_chunk(rdma_hndl, rdma_task);
+
 		list_move_tail(&task->tasks_list_entry, &rdma_hndl->io_list);
 
 		xio_xmit_rdma_rd(rdma_hndl);
@@ -878,6 +1270,7 @@ static void xio_rdma_rd_comp_handler(
 						 &event_data);
 		}
 	} else {
+		xio_rdma_notify_data_chunk(rdma_hndl, rdma_task);
 		xio_tasks_pool_put(task);
 		xio_xmit_rdma_rd(rdma_hndl);
 	}
@@ -892,6 +1285,78 @@ static inline void xio_rdma_wr_comp_handler(
 {
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_rdma_imm_rsp_build						     */
+/*---------------------------------------------------------------------------*/
+static int xio_rdma_imm_rsp_build(struct xio_rdma_transport *rdma_hndl,
+				  struct xio_task *task,
+				  uint32_t imm, uint32_t len)
+{
+	struct xio_task		*sender_task;
+	struct xio_session_hdr	hdr, *tmp_hdr;
+	struct xio_rsp_hdr	rsp_hdr;
+	uint16_t		payload;
+
+	sender_task = xio_rdma_primary_task_lookup(rdma_hndl,
+						   XIO_IMM_RSP_TID(imm));
+	if (unlikely(sender_task == NULL || sender_task->omsg == NULL)) {
+		ERROR_LOG("no request for immediate response. tid:%d\n",
+			  XIO_IMM_RSP_TID(imm));
+		goto cleanup;
+	}
+
+	/* write in the receive buffer the headers the peer left out */
+	xio_mbuf_reset(&task->mbuf);
+	if (xio_mbuf_tlv_start(&task->mbuf) != 0)
+		goto cleanup;
+
+	/* responses are routed by their sender task, not by session id */
+	hdr.dest_session_id	= 0;
+	hdr.serial_num		= sender_task->omsg->sn;
+	hdr.flags		= XIO_IMM_RSP_FLAGS(imm);
+	hdr.receipt_result	= XIO_READ_RECEIPT_ACCEPT;
+
+	tmp_hdr = xio_mbuf_set_session_hdr(&task->mbuf);
+	PACK_LVAL(&hdr, tmp_hdr, dest_session_id);
+	PACK_LLVAL(&hdr, tmp_hdr, serial_num);
+	PACK_LVAL(&hdr, tmp_hdr, flags);
+	PACK_LVAL(&hdr, tmp_hdr, receipt_result);
+
+	rsp_hdr.version		= XIO_RSP_HEADER_VERSION;
+	rsp_hdr.rsp_hdr_len	= sizeof(rsp_hdr);
+	rsp_hdr.tid		= XIO_IMM_RSP_TID(imm);
+	rsp_hdr.opcode		= XIO_IB_RDMA_WRITE;
+	rsp_hdr.flags		= 0;
+	rsp_hdr.ulp_hdr_len	= 0;
+	rsp_hdr.ulp_pad_len	= 0;
+	rsp_hdr.ulp_imm_len	= len;
+	rsp_hdr.status		= XIO_E_SUCCESS;
+	xio_rdma_write_rsp_header(rdma_hndl, task, &rsp_hdr);
+
+	payload = xio_mbuf_tlv_payload_len(&task->mbuf);
+	if (xio_mbuf_write_tlv(&task->mbuf, XIO_MSG_TYPE_RSP, payload) != 0)
+		goto cleanup;
+
+	/* the qp delivers in order, so this is the expected sn */
+	xio_rdma_write_sn(task, rdma_hndl->exp_sn, 0,
+			  XIO_IMM_RSP_CREDITS(imm));
+
+	xio_mbuf_read_first_tlv(&task->mbuf);
+	task->tlv_type = xio_mbuf_tlv_type(&task->mbuf);
+
+	return 0;
+
+cleanup:
+	xio_set_error(XIO_E_MSG_INVALID);
+	ERROR_LOG("xio_rdma_imm_rsp_build failed\n");
+	/* the rx handler drops messages of unknown type */
+	task->tlv_type = 0;
+	xio_transport_notify_observer_error(&rdma_hndl->base,
+					    XIO_E_MSG_INVALID);
+
+	return -1;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_handle_wc							     */
 /*---------------------------------------------------------------------------*/
@@ -899,7 +1364,20 @@ static inline void xio_handle_wc(struct ibv_wc *wc, int has_more)
 {
 	struct xio_task			*task = ptr_from_int64(wc->wr_id);
 	XIO_TO_RDMA_TASK(task, rdma_task);
-	struct xio_rdma_transport	*rdma_hndl = rdma_task->rdma_hndl;
+	struct xio_rdma_transport	*rdma_hndl;
+
+	/* a shared receive buffer belongs to whichever qp consumed it */
+	if (rdma_task->srq && rdma_task->ib_op == XIO_IB_RECV) {
+		rdma_task->rdma_hndl = xio_srq_lookup(rdma_task->srq,
+						      wc->qp_num);
+		if (unlikely(rdma_task->rdma_hndl == NULL)) {
+			/* the qp is already gone */
+			rdma_task->srq->srqe_avail--;
+			xio_tasks_pool_put(task);
+			return;
+		}
+	}
+	rdma_hndl = rdma_task->rdma_hndl;
 
 	/*
 	TRACE_LOG("received opcode :%s [%x]\n",
@@ -907,6 +1385,10 @@ static inline void xio_handle_wc(struct ibv_wc *wc, int has_more)
 	*/
 
 	switch (wc->opcode) {
+	case IBV_WC_RECV_RDMA_WITH_IMM:
+		xio_rdma_imm_rsp_build(rdma_hndl, task, ntohl(wc->imm_data),
+				       wc->byte_len);
+		/* fall through */
 	case IBV_WC_RECV:
 		rdma_task->more_in_batch = has_more;
 		xio_rdma_rx_handler(rdma_hndl, task);
@@ -918,7 +1400,10 @@ static inline void xio_handle_wc(struct ibv_wc *wc, int has_more)
 		xio_rdma_rd_comp_handler(rdma_hndl, task);
 		break;
 	case IBV_WC_RDMA_WRITE:
-		xio_rdma_wr_comp_handler(rdma_hndl, task);
+		if (rdma_task->ib_op == XIO_IB_RDMA_WRITE_IMM)
+			xio_rdma_tx_comp_handler(rdma_hndl, task);
+		else
+			xio_rdma_wr_comp_handler(rdma_hndl, task);
 		break;
 	default:
 		ERROR_LOG("unknown opcode :%s [%x]\n",
@@ -927,6 +1412,160 @@ static inline void xio_handle_wc(struct ibv_wc *wc, int has_more)
 	}
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_rx_rearm_batch							     */
+/*---------------------------------------------------------------------------*/
+static void xio_rx_rearm_batch(struct xio_cq *tcq)
+{
+	struct xio_rdma_transport *rdma_hndl;
+
+	while (!list_empty(&tcq->rx_rearm_list)) {
+		rdma_hndl = list_first_entry(&tcq->rx_rearm_list,
+					     struct xio_rdma_transport,
+					     rx_rearm_entry);
+		list_del_init(&rdma_hndl->rx_rearm_entry);
+		if (rdma_hndl->state == XIO_STATE_CONNECTED)
+			xio_rdma_rearm_rq(rdma_hndl);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_handle_wc_array							     */
+/*---------------------------------------------------------------------------*/
+static void xio_handle_wc_array(struct xio_cq *tcq, int nr)
+{
+	struct ibv_wc	*wc = tcq->wc_array;
+	struct xio_task	*task;
+	int		i, last_recv = -1;
+
+	/* the tasks are scattered, start loading all of them at once */
+	for (i = 0; i < nr; i++) {
+		xio_prefetch(ptr_from_int64(wc[i].wr_id));
+		if (wc[i].opcode & IBV_WC_RECV)
+			last_recv = i;
+	}
+
+	/* then the receive headers the tasks point at */
+	for (i = 0; i < nr; i++) {
+		if (!(wc[i].opcode & IBV_WC_RECV))
+			continue;
+		task = ptr_from_int64(wc[i].wr_id);
+		xio_prefetch(task->dd_data);
+		xio_prefetch(task->mbuf.buf.head);
+	}
+
+	/* parse the headers before any callback runs, responses that came
+	 * with an immediate have none and are rebuilt on dispatch
+	 */
+	for (i = 0; i < nr; i++) {
+		if (wc[i].opcode != IBV_WC_RECV ||
+		    wc[i].status != IBV_WC_SUCCESS)
+			continue;
+		task = ptr_from_int64(wc[i].wr_id);
+		xio_mbuf_read_first_tlv(&task->mbuf);
+		task->tlv_type = xio_mbuf_tlv_type(&task->mbuf);
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (likely(wc[i].status == IBV_WC_SUCCESS))
+			xio_handle_wc(&wc[i], (i != last_recv));
+		else
+			xio_handle_wc_error(&wc[i]);
+	}
+
+	xio_rx_rearm_batch(tcq);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_cq_moderate							     */
+/*---------------------------------------------------------------------------*/
+static void xio_cq_moderate(struct xio_cq *tcq)
+{
+	/* completions per second above which the next level is taken */
+	static const struct {
+		uint32_t	rate;
+		int32_t		cq_count;
+		int32_t		cq_period;
+		int32_t		delayed_arm;
+	} profile[CQ_MOD_LEVELS] = {
+		{ 20000,	1,	0,	MAX_NUM_DELAYED_ARM },
+		{ 80000,	4,	4,	MAX_NUM_DELAYED_ARM },
+		{ 250000,	16,	8,	2*MAX_NUM_DELAYED_ARM },
+		{ 600000,	32,	16,	4*MAX_NUM_DELAYED_ARM },
+		{ 0,		64,	32,	8*MAX_NUM_DELAYED_ARM },
+	};
+	struct xio_cq_moderation	*mod = &tcq->mod;
+	struct xio_statistics		*stats = &tcq->ctx->stats;
+	cycles_t			now = get_cycles();
+	cycles_t			elapsed = now - mod->sample_start;
+	uint64_t			rate;
+	int				level = mod->level;
+	int				cq_count;
+	int				cq_period;
+	int				rtt_budget;
+
+	if (elapsed < CQ_MOD_SAMPLE_USECS*g_mhz)
+		return;
+
+	rate = mod->comps*USECS_IN_SEC*g_mhz/elapsed;
+
+	/* one step at a time, going down only well below the threshold */
+	if (level < CQ_MOD_LEVELS - 1 && rate > profile[level].rate)
+		level++;
+	else if (level > 0 && rate < profile[level - 1].rate/2)
+		level--;
+
+	/* never hold a completion longer than the traffic needs to
+	 * gather cq_count of them
+	 */
+	cq_count  = profile[level].cq_count;
+	cq_period = profile[level].cq_period;
+	if (cq_period && mod->comps)
+		cq_period = min(cq_period,
+				max(1, (int)(cq_count*elapsed /
+					     (mod->comps*g_mhz))));
+
+	/* while responses arrive, holding a completion may cost only a
+	 * share of their round trip. below a usec the cq is left alone
+	 */
+	if (mod->rtt_samples) {
+		rtt_budget = mod->rtt/(g_mhz*CQ_MOD_RTT_SHARE);
+		if (rtt_budget < 1) {
+			cq_count  = 1;
+			cq_period = 0;
+		} else if (cq_period > rtt_budget) {
+			cq_period = rtt_budget;
+		}
+	}
+
+#ifdef HAVE_IBV_MODIFY_CQ
+	if (!mod->modify_failed &&
+	    (cq_count != mod->cq_count || cq_period != mod->cq_period)) {
+		if (xio_cq_modify(tcq, cq_count, cq_period) == 0) {
+			mod->cq_count	= cq_count;
+			mod->cq_period	= cq_period;
+		} else {
+			/* not supported by the device, don't retry */
+			mod->modify_failed = 1;
+		}
+	}
+#endif
+	mod->level		= level;
+	mod->max_delayed_arm	= profile[level].delayed_arm;
+	mod->comps		= 0;
+	mod->rtt_samples	= 0;
+	mod->sample_start	= now;
+
+	if (mod->stat_cq_count >= 0)
+		stats->counter[mod->stat_cq_count] = mod->cq_count;
+	if (mod->stat_cq_period >= 0)
+		stats->counter[mod->stat_cq_period] = mod->cq_period;
+	if (mod->stat_delayed_arm >= 0)
+		stats->counter[mod->stat_delayed_arm] = mod->max_delayed_arm;
+	if (mod->stat_rtt >= 0)
+		stats->counter[mod->stat_rtt] = mod->rtt/g_mhz;
+}
+
 /*
  * Could read as many entries as possible without blocking, but
  * that just fills up a list of tasks.  Instead pop out of here
@@ -936,8 +1575,7 @@ static inline void xio_handle_wc(struct ibv_wc *wc, int has_more)
 static int xio_poll_cq(struct xio_cq *tcq, int max_wc, int timeout_us)
 {
 	int		err = 0;
-	int		wclen = max_wc, i, numwc  = 0;
-	int		last_recv = -1;
+	int		wclen = max_wc, numwc  = 0;
 	int		timeouts_num = 0;
 	int		polled = 0;
 	cycles_t	timeout;
@@ -980,20 +1618,7 @@ static int xio_poll_cq(struct xio_cq *tcq, int max_wc, int timeout_us)
 			break;
 		}
 		timeouts_num = 0;
-		for (i = err; i > 0; i--) {
-			if (tcq->wc_array[i-1].opcode == IBV_WC_RECV) {
-				last_recv = i-1;
-				break;
-			}
-		}
-		for (i = 0; i < err; i++) {
-			if (likely(tcq->wc_array[i].status == IBV_WC_SUCCESS))
-				xio_handle_wc(&tcq->wc_array[i],
-					      (i != last_recv));
-			else
-				xio_handle_wc_error(
-						&tcq->wc_array[i]);
-		}
+		xio_handle_wc_array(tcq, err);
 		numwc += err;
 		if (numwc == max_wc) {
 			err = 1;
@@ -1002,6 +1627,11 @@ static int xio_poll_cq(struct xio_cq *tcq, int max_wc, int timeout_us)
 		wclen = max_wc - numwc;
 	}
 
+	tcq->mod.comps += numwc;
+	if (tcq->mod.stat_comps >= 0)
+		xio_stat_add(&tcq->ctx->stats, tcq->mod.stat_comps, numwc);
+	xio_cq_moderate(tcq);
+
 	return err;
 }
 
@@ -1038,7 +1668,7 @@ static void xio_poll_cq_armable(struct xio_cq *tcq)
 		return;
 	}
 
-	if (err == 0 && (++tcq->num_delayed_arm == MAX_NUM_DELAYED_ARM))
+	if (err == 0 && (++tcq->num_delayed_arm >= tcq->mod.max_delayed_arm))
 		/* no more completions on cq, give up and arm the interrupts */
 		xio_rearm_completions(tcq);
 	else {
@@ -1081,12 +1711,19 @@ static void xio_sched_consume_cq(xio_ctx_event_t *tev, void *data)
    the interrupts are re-armed */
 static void xio_sched_poll_cq(xio_ctx_event_t *tev, void *data)
 {
-	struct xio_rdma_transport	*rdma_hndl;
+	struct xio_rdma_transport	*rdma_hndl, *tmp_rdma_hndl;
 	struct xio_cq			*tcq = data;
+	LIST_HEAD(dirty_list);
 
 	xio_poll_cq_armable(tcq);
 
-	list_for_each_entry(rdma_hndl, &tcq->trans_list, trans_list_entry) {
+	/* visit only transports with pending work, the ones that are still
+	 * blocked are marked again by the completion that unblocks them
+	 */
+	list_splice_init(&tcq->idle_list, &dirty_list);
+	list_for_each_entry_safe(rdma_hndl, tmp_rdma_hndl, &dirty_list,
+				 idle_entry) {
+		list_del_init(&rdma_hndl->idle_entry);
 		xio_rdma_idle_handler(rdma_hndl);
 	}
 }
@@ -1113,6 +1750,9 @@ void xio_cq_event_handler(int fd  __attribute__ ((unused)),
 	/* accumulate number of cq events that need to
 	 * be acked, and periodically ack them
 	 */
+	if (tcq->mod.stat_events >= 0)
+		xio_stat_inc(&tcq->ctx->stats, tcq->mod.stat_events);
+
 	if (++tcq->cq_events_that_need_ack == 128/*UINT_MAX*/) {
 		ibv_ack_cq_events(tcq->cq, 128/*UINT_MAX*/);
 		tcq->cq_events_that_need_ack = 0;
@@ -1136,7 +1776,6 @@ int xio_rdma_poll(struct xio_transport_base *transport,
 	int				i;
 	struct xio_rdma_transport	*rdma_hndl;
 	struct xio_cq			*tcq;
-	int				last_recv = -1;
 	int				nr_comp = 0, recv_counter;
 	int				nr;
 	cycles_t			timeout = -1;
@@ -1156,23 +1795,11 @@ int xio_rdma_poll(struct xio_transport_base *transport,
 		nr = min(max_nr, tcq->wc_array_len);
 		retval = ibv_poll_cq(tcq->cq, nr, tcq->wc_array);
 		if (likely(retval > 0)) {
-			for (i = retval; i > 0; i--) {
-				if (tcq->wc_array[i-1].opcode == IBV_WC_RECV) {
-					last_recv = i-1;
-					break;
-				}
-			}
 			recv_counter = 0;
-			for (i = 0; i < retval; i++) {
-				if (tcq->wc_array[i].opcode == IBV_WC_RECV)
+			for (i = 0; i < retval; i++)
+				if (tcq->wc_array[i].opcode & IBV_WC_RECV)
 					recv_counter++;
-					if (rdma_hndl->tcq->wc_array[i].status ==
-				    IBV_WC_SUCCESS)
-					xio_handle_wc(&tcq->wc_array[i],
-						      (i != last_recv));
-				else
-					xio_handle_wc_error(&tcq->wc_array[i]);
-			}
+			xio_handle_wc_array(tcq, retval);
 			nr_comp += recv_counter;
 			max_nr -= recv_counter;
 			if (nr_comp >= min_nr || max_nr == 0)
@@ -1580,6 +2207,24 @@ cleanup:
 }
 
 
+/*---------------------------------------------------------------------------*/
+/* xio_rdma_set_inline							     */
+/*---------------------------------------------------------------------------*/
+static inline void xio_rdma_set_inline(struct xio_rdma_transport *rdma_hndl,
+				       struct xio_rdma_task *rdma_task,
+				       size_t sge_len)
+{
+	struct xio_cq *tcq = rdma_hndl->tcq;
+
+	if (sge_len < rdma_hndl->max_inline_data) {
+		rdma_task->txd.send_wr.send_flags |= IBV_SEND_INLINE;
+		if (tcq->stat_tx_inline >= 0)
+			xio_stat_inc(&tcq->ctx->stats, tcq->stat_tx_inline);
+	} else if (tcq->stat_tx_dma >= 0) {
+		xio_stat_inc(&tcq->ctx->stats, tcq->stat_tx_dma);
+	}
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_rdma_write_send_data						     */
 /*---------------------------------------------------------------------------*/
@@ -1590,9 +2235,31 @@ static int xio_rdma_write_send_data(
 	XIO_TO_RDMA_TASK(task, rdma_task);
 	size_t			i;
 	struct ibv_mr		*mr;
+	size_t			len;
 
-	/* user provided mr */
-	if (task->omsg->out.data_iov[0].mr) {
+	/* the adapter copies inline data when the wr is posted, so a
+	 * message that fits is sent straight from the user's buffers:
+	 * no copy to the task buffer and no key lookup
+	 */
+	len = xio_mbuf_get_curr_offset(&task->mbuf) +
+	      xio_iovex_length(task->omsg->out.data_iov,
+			       task->omsg->out.data_iovlen);
+	if (len < rdma_hndl->max_inline_data &&
+	    task->omsg->out.data_iovlen < MAX_SGE) {
+		struct ibv_sge	*sge = &rdma_task->txd.sge[1];
+		struct xio_iovec_ex *iov =
+			&task->omsg->out.data_iov[0];
+		for (i = 0; i < task->omsg->out.data_iovlen; i++)  {
+			sge->addr    = uint64_from_ptr(iov->iov_base);
+			sge->length  = (uint32_t)iov->iov_len;
+			sge->lkey    = 0;
+			iov++;
+			sge++;
+		}
+		rdma_task->txd.send_wr.num_sge =
+			task->omsg->out.data_iovlen + 1;
+	} else if (task->omsg->out.data_iov[0].mr) {
+		/* user provided mr */
 		struct ibv_sge	*sge = &rdma_task->txd.sge[1];
 		struct xio_iovec_ex *iov =
 			&task->omsg->out.data_iov[0];
@@ -1936,8 +2603,7 @@ static int xio_rdma_send_req(struct xio_rdma_transport *rdma_hndl,
 	for (i = 1; i < rdma_task->txd.send_wr.num_sge; i++)
 		sge_len += rdma_task->txd.sge[i].length;
 
-	if (sge_len < rdma_hndl->max_inline_data)
-		rdma_task->txd.send_wr.send_flags |= IBV_SEND_INLINE;
+	xio_rdma_set_inline(rdma_hndl, rdma_task, sge_len);
 
 
 	if (IS_FIN(task->tlv_type)) {
@@ -1945,26 +2611,18 @@ static int xio_rdma_send_req(struct xio_rdma_transport *rdma_hndl,
 		must_send = 1;
 	}
 
-	if (unlikely(++rdma_hndl->req_sig_cnt >= HARD_CQ_MOD ||
-		     task->is_control)) {
-		/* avoid race between send completion and response arrival */
-		rdma_task->txd.send_wr.send_flags |= IBV_SEND_SIGNALED;
-		rdma_hndl->req_sig_cnt = 0;
-	}
-
 	rdma_task->ib_op = XIO_IB_SEND;
 
 	list_move_tail(&task->tasks_list_entry, &rdma_hndl->tx_ready_list);
 
 	rdma_hndl->tx_ready_tasks_num++;
+	xio_rdma_mark_dirty(rdma_hndl);
 
-	/* transmit only if  available */
-	if (task->omsg->more_in_batch == 0) {
+	/* ring the doorbell once for the whole batch, or before holding
+	 * back could no longer enlarge the next post
+	 */
+	if (task->omsg->more_in_batch == 0 || tx_batch_full(rdma_hndl))
 		must_send = 1;
-	} else {
-		if (tx_window_sz(rdma_hndl) >= SEND_TRESHOLD)
-			must_send = 1;
-	}
 	/* resource are now available and rdma rd  requests are pending kick
 	 * them
 	 */
@@ -1993,6 +2651,29 @@ static int xio_rdma_send_req(struct xio_rdma_transport *rdma_hndl,
 	return retval;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_rdma_rsp_fits_imm						     */
+/*---------------------------------------------------------------------------*/
+static inline int xio_rdma_rsp_fits_imm(struct xio_rdma_transport *rdma_hndl,
+					struct xio_task *task,
+					uint64_t ulp_hdr_len)
+{
+	XIO_TO_RDMA_TASK(task, rdma_task);
+
+	/* whatever the peer can not rebuild from the request goes in a
+	 * header SEND: a single write, no ulp header, a plain successful
+	 * response
+	 */
+	return rdma_hndl->write_imm &&
+	       rdma_task->ib_op == XIO_IB_RDMA_WRITE &&
+	       rdma_task->req_read_num_sge == 1 &&
+	       ulp_hdr_len == 0 &&
+	       task->tlv_type == XIO_MSG_TYPE_RSP &&
+	       !task->is_control &&
+	       task->omsg->receipt_res == XIO_READ_RECEIPT_ACCEPT &&
+	       task->omsg->flags == (task->omsg->flags & 0xff);
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_rdma_send_rsp							     */
 /*---------------------------------------------------------------------------*/
@@ -2091,6 +2772,14 @@ static int xio_rdma_send_rsp(struct xio_rdma_transport *rdma_hndl,
 					rdma_hndl, task,
 					ulp_hdr_len, 0, ulp_imm_len,
 					XIO_E_SUCCESS);
+
+			/* unless the peer can do without it */
+			if (xio_rdma_rsp_fits_imm(rdma_hndl, task,
+						  ulp_hdr_len)) {
+				rdma_task->ib_op = XIO_IB_RDMA_WRITE_IMM;
+				rdma_task->rdmad.send_wr.opcode =
+						IBV_WR_RDMA_WRITE_WITH_IMM;
+			}
 		} else {
 			ERROR_LOG("partial completion of request due " \
 				  "to missing, response buffer\n");
@@ -2119,23 +2808,22 @@ static int xio_rdma_send_rsp(struct xio_rdma_transport *rdma_hndl,
 		goto cleanup;
 	}
 
+	/* signaling is decided when the task is posted */
 	rdma_task->txd.send_wr.send_flags = 0;
-	if (++rdma_hndl->rsp_sig_cnt >= SOFT_CQ_MOD || task->is_control) {
-		rdma_task->txd.send_wr.send_flags |= IBV_SEND_SIGNALED;
-		rdma_hndl->rsp_sig_cnt = 0;
-	}
+	if (rdma_task->ib_op == XIO_IB_RDMA_WRITE_IMM)
+		rdma_task->rdmad.send_wr.send_flags = 0;
 
 	/* check for inline */
 	if (rdma_task->ib_op == XIO_IB_SEND) {
 		for (i = 1; i < rdma_task->txd.send_wr.num_sge; i++)
 			sge_len += rdma_task->txd.sge[i].length;
 
-		if (sge_len < rdma_hndl->max_inline_data)
-			rdma_task->txd.send_wr.send_flags |= IBV_SEND_INLINE;
+		xio_rdma_set_inline(rdma_hndl, rdma_task, sge_len);
 
 		list_move_tail(&task->tasks_list_entry,
 			       &rdma_hndl->tx_ready_list);
 		rdma_hndl->tx_ready_tasks_num++;
+		xio_rdma_mark_dirty(rdma_hndl);
 	}
 
 	if (IS_FIN(task->tlv_type)) {
@@ -2143,13 +2831,11 @@ static int xio_rdma_send_rsp(struct xio_rdma_transport *rdma_hndl,
 		must_send = 1;
 	}
 
-	/* transmit only if  available */
-	if (task->omsg->more_in_batch == 0) {
+	/* ring the doorbell once for the whole batch, or before holding
+	 * back could no longer enlarge the next post
+	 */
+	if (task->omsg->more_in_batch == 0 || tx_batch_full(rdma_hndl))
 		must_send = 1;
-	} else {
-		if (tx_window_sz(rdma_hndl) >= SEND_TRESHOLD)
-			must_send = 1;
-	}
 	/* resource are now available and rdma rd  requests are pending kick
 	 * them
 	 */
@@ -2195,8 +2881,11 @@ static int xio_rdma_on_rsp_send_comp(struct xio_rdma_transport *rdma_hndl,
 {
 	union xio_transport_event_data event_data;
 
-	if (IS_CANCEL(task->tlv_type))
+	/* the cancel answer task is owned by the transport */
+	if (IS_CANCEL(task->tlv_type)) {
+		xio_tasks_pool_put(task);
 		return 0;
+	}
 
 	event_data.msg.op	= XIO_WC_OP_SEND;
 	event_data.msg.task	= task;
@@ -2243,6 +2932,8 @@ static int xio_rdma_on_recv_rsp(struct xio_rdma_transport *rdma_hndl,
 	void			*ulp_hdr;
 	XIO_TO_RDMA_TASK(task, rdma_task);
 	XIO_TO_RDMA_TASK(task, rdma_sender_task);
+	struct xio_cq_moderation *mod;
+	cycles_t		rtt;
 	int			i;
 
 	/* read the response header */
@@ -2278,6 +2969,19 @@ static int xio_rdma_on_recv_rsp(struct xio_rdma_transport *rdma_hndl,
 	omsg = task->sender_task->omsg;
 	imsg = &task->imsg;
 
+	/* round trip sample for the cq moderation, 1/8 weighted average.
+	 * internal messages carry no submission time
+	 */
+	rtt = get_cycles() - omsg->timestamp;
+	if (omsg->timestamp && rtt < USECS_IN_SEC*g_mhz) {
+		mod = &rdma_hndl->tcq->mod;
+		if (mod->rtt)
+			mod->rtt = mod->rtt - (mod->rtt >> 3) + (rtt >> 3);
+		else
+			mod->rtt = rtt;
+		mod->rtt_samples++;
+	}
+
 	ulp_hdr = xio_mbuf_get_curr_ptr(&task->mbuf);
 	/* msg from received message */
 	if (rsp_hdr.ulp_hdr_len) {
@@ -2489,6 +3193,8 @@ static int xio_prep_rdma_op(
 	uint32_t	tot_len = 0;
 	uint32_t	int_len = 0;
 
+	struct list_head	*task_prev = task->tasks_list_entry.prev;
+
 	LIST_HEAD(tmp_list);
 
 	*tasks_used = 0;
@@ -2678,11 +3384,15 @@ static int xio_prep_rdma_op(
 	return 0;
 cleanup:
 
-	/* list does not contain the original task */
 	list_for_each_entry_safe(ptask, next_ptask, &tmp_list,
 				 tasks_list_entry) {
+		/* the original task goes back where it was */
+		if (ptask == task) {
+			list_move(&task->tasks_list_entry, task_prev);
+			continue;
+		}
 		/* the tmp tasks are returned back to pool */
-		xio_tasks_pool_put(task);
+		xio_tasks_pool_put(ptask);
 	}
 	(*tasks_used) = 0;
 
@@ -2704,6 +3414,39 @@ static inline void xio_set_msg_in_data_iovec(struct xio_task *task,
 	task->imsg.in.data_iovlen = lsize;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_rdma_chunk_sge							     */
+/*---------------------------------------------------------------------------*/
+static size_t xio_rdma_chunk_sge(struct xio_sge *sg_list, size_t size,
+				 size_t tot_len, uint32_t chunk_sz,
+				 struct xio_sge *out_list)
+{
+	size_t		i, nr = 0;
+	uint64_t	addr;
+	uint32_t	len, clen;
+
+	/* keep the number of chunks (and of phantom tasks) bounded */
+	if (tot_len > (size_t)chunk_sz * (MAX_RDMA_RD_CHUNKS - size))
+		chunk_sz = (tot_len + MAX_RDMA_RD_CHUNKS - size - 1) /
+			   (MAX_RDMA_RD_CHUNKS - size);
+
+	for (i = 0; i < size; i++) {
+		addr	= sg_list[i].addr;
+		len	= sg_list[i].length;
+		while (len) {
+			clen = min(len, chunk_sz);
+			out_list[nr].addr	= addr;
+			out_list[nr].length	= clen;
+			out_list[nr].stag	= sg_list[i].stag;
+			addr	+= clen;
+			len	-= clen;
+			nr++;
+		}
+	}
+
+	return nr;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_sched_rdma_rd_req						     */
 /*---------------------------------------------------------------------------*/
@@ -2718,6 +3461,10 @@ static int xio_sched_rdma_rd_req(struct xio_rdma_transport *rdma_hndl,
 	struct xio_sge		lsg_list[XIO_MAX_IOV];
 	size_t			lsg_list_len;
 	size_t			lsg_out_list_len;
+	struct xio_sge		chunk_list[MAX_RDMA_RD_CHUNKS];
+	struct xio_sge		*rsg_list;
+	size_t			rsg_list_len;
+	struct xio_task		*ptask;
 	struct ibv_mr		*mr;
 
 	/* responder side got request for rdma read */
@@ -2840,16 +3587,53 @@ static int xio_sched_rdma_rd_req(struct xio_rdma_transport *rdma_hndl,
 		return -1;
 	}
 
-	xio_prep_rdma_op(task, rdma_hndl,
-			 XIO_IB_RDMA_READ,
-			 IBV_WR_RDMA_READ,
-			 lsg_list,
-			 lsg_list_len, &lsg_out_list_len,
-			 rdma_task->req_write_sge,
-			 rdma_task->req_write_num_sge,
-			 min(rlen, llen),
-			 1,
-			 &rdma_hndl->rdma_rd_list, &tasks_used);
+	/* large messages are read in chunks, so the upper layer may
+	 * consume the data before the whole message lands
+	 */
+	rsg_list	= rdma_task->req_write_sge;
+	rsg_list_len	= rdma_task->req_write_num_sge;
+	if (rdma_options.rdma_chunk_sz &&
+	    min(rlen, llen) > rdma_options.rdma_chunk_sz) {
+		rsg_list_len = xio_rdma_chunk_sge(
+				rdma_task->req_write_sge,
+				rdma_task->req_write_num_sge,
+				min(rlen, llen),
+				rdma_options.rdma_chunk_sz,
+				chunk_list);
+		rsg_list = chunk_list;
+	}
+
+	/* a chunked read may need more phantom tasks than the pool holds */
+	retval = xio_prep_rdma_op(task, rdma_hndl,
+				  XIO_IB_RDMA_READ,
+				  IBV_WR_RDMA_READ,
+				  lsg_list,
+				  lsg_list_len, &lsg_out_list_len,
+				  rsg_list,
+				  rsg_list_len,
+				  min(rlen, llen),
+				  1,
+				  &rdma_hndl->rdma_rd_list, &tasks_used);
+	if (retval) {
+		ERROR_LOG("failed to prepare rdma read\n");
+		xio_set_error(ENOMEM);
+		task->imsg.status = ENOMEM;
+		goto cleanup;
+	}
+
+	/* the chunk tasks are the last ones queued, the message's task
+	 * closes the list
+	 */
+	if (rsg_list == chunk_list) {
+		i = 0;
+		list_for_each_entry_reverse(ptask, &rdma_hndl->rdma_rd_list,
+					    tasks_list_entry) {
+			if (i++ == tasks_used)
+				break;
+			((struct xio_rdma_task *)ptask->dd_data)->chunk_owner =
+									task;
+		}
+	}
 
 	/* prepare the in side of the message */
 	xio_set_msg_in_data_iovec(task, lsg_list, lsg_out_list_len);
@@ -2967,6 +3751,7 @@ static int xio_sched_rdma_wr_req(struct xio_rdma_transport *rdma_hndl,
 	 * tx_ready_list
 	 */
 	rdma_hndl->tx_ready_tasks_num += tasks_used;
+	xio_rdma_mark_dirty(rdma_hndl);
 	return 0;
 cleanup:
 	for (i = 0; i < rdma_task->write_num_sge; i++)
@@ -3131,6 +3916,7 @@ static void xio_rdma_write_setup_msg(struct xio_rdma_transport *rdma_hndl,
 	PACK_SVAL(msg, tmp_msg, sq_depth);
 	PACK_SVAL(msg, tmp_msg, rq_depth);
 	PACK_SVAL(msg, tmp_msg, credits);
+	PACK_SVAL(msg, tmp_msg, flags);
 
 #ifdef EYAL_TODO
 	print_hex_dump_bytes("post_send: ", DUMP_PREFIX_ADDRESS,
@@ -3166,6 +3952,7 @@ static void xio_rdma_read_setup_msg(struct xio_rdma_transport *rdma_hndl,
 	UNPACK_SVAL(tmp_msg, msg, sq_depth);
 	UNPACK_SVAL(tmp_msg, msg, rq_depth);
 	UNPACK_SVAL(tmp_msg, msg, credits);
+	UNPACK_SVAL(tmp_msg, msg, flags);
 
 #ifdef EYAL_TODO
 	print_hex_dump_bytes("post_send: ", DUMP_PREFIX_ADDRESS,
@@ -3190,6 +3977,8 @@ static int xio_rdma_send_setup_req(struct xio_rdma_transport *rdma_hndl,
 	req.sq_depth		= rdma_hndl->sq_depth;
 	req.rq_depth		= rdma_hndl->rq_depth;
 	req.credits		= 0;
+	req.flags		= rdma_options.enable_write_imm ?
+					XIO_RDMA_SETUP_WRITE_IMM : 0;
 
 	xio_rdma_write_setup_msg(rdma_hndl, task, &req);
 
@@ -3296,14 +4085,24 @@ static int xio_rdma_on_setup_msg(struct xio_rdma_transport *rdma_hndl,
 				      rdma_hndl->max_send_buf_sz);
 		rsp->sq_depth	= min(req.sq_depth, rdma_hndl->rq_depth);
 		rsp->rq_depth	= min(req.rq_depth, rdma_hndl->sq_depth);
+		rsp->flags	= rdma_options.enable_write_imm ?
+					req.flags & XIO_RDMA_SETUP_WRITE_IMM :
+					0;
 	}
 
 	/* save the values */
 	rdma_hndl->rq_depth		= rsp->rq_depth;
-	rdma_hndl->actual_rq_depth	= rdma_hndl->rq_depth + EXTRA_RQE;
+	/* an adaptive receive window starts small and grows under load */
+	rdma_hndl->rq_window		= rdma_options.enable_adaptive_rq ?
+					  min(RQ_MIN_WINDOW,
+					      rdma_hndl->rq_depth) :
+					  rdma_hndl->rq_depth;
+	rdma_hndl->actual_rq_depth	= rdma_hndl->rq_window + EXTRA_RQE;
 	rdma_hndl->sq_depth		= rsp->sq_depth;
 	rdma_hndl->membuf_sz		= rsp->buffer_sz;
 	rdma_hndl->max_send_buf_sz	= rsp->buffer_sz;
+	rdma_hndl->write_imm		=
+				!!(rsp->flags & XIO_RDMA_SETUP_WRITE_IMM);
 
 	/* initialize send window */
 	rdma_hndl->sn = 0;
@@ -3528,19 +4327,27 @@ static int xio_rdma_send_cancel(struct xio_rdma_transport *rdma_hndl,
 
 	task->omsg = &omsg;
 
-	/* write xio header to the buffer */
-	retval = xio_rdma_prep_req_header(
-			rdma_hndl, task,
-			ulp_hdr_len, 0, 0,
-			XIO_E_SUCCESS);
+	/* write xio header to the buffer. the peer reads a cancel answer
+	 * with the response header
+	 */
+	if (IS_REQUEST(tlv_type))
+		retval = xio_rdma_prep_req_header(
+				rdma_hndl, task,
+				ulp_hdr_len, 0, 0,
+				XIO_E_SUCCESS);
+	else
+		retval = xio_rdma_prep_rsp_header(
+				rdma_hndl, task,
+				ulp_hdr_len, 0, 0,
+				XIO_E_SUCCESS);
 	if (retval)
-		return -1;
+		goto cleanup;
 
 	payload = xio_mbuf_tlv_payload_len(&task->mbuf);
 
 	/* add tlv */
 	if (xio_mbuf_write_tlv(&task->mbuf, task->tlv_type, payload) != 0)
-		return  -1;
+		goto cleanup;
 
 	/* set the length */
 	rdma_task->txd.sge[0].length	= xio_mbuf_data_length(&task->mbuf);
@@ -3557,6 +4364,13 @@ static int xio_rdma_send_cancel(struct xio_rdma_transport *rdma_hndl,
 	xio_rdma_xmit(rdma_hndl);
 
 	return 0;
+
+cleanup:
+	task->omsg = NULL;
+	free(omsg.out.header.iov_base);
+	xio_tasks_pool_put(task);
+
+	return -1;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -3567,7 +4381,7 @@ int xio_rdma_send(struct xio_transport_base *transport,
 {
 	struct xio_rdma_transport *rdma_hndl =
 		(struct xio_rdma_transport *)transport;
-	int	retval = -1;
+	int	retval = -1, err;
 
 	switch (task->tlv_type) {
 	case XIO_CONN_SETUP_REQ:
@@ -3587,6 +4401,15 @@ int xio_rdma_send(struct xio_transport_base *transport,
 		break;
 	}
 
+	/* a refused message ends the batch. post what was queued ahead
+	 * of it with more_in_batch set
+	 */
+	if (retval && rdma_hndl->tx_ready_tasks_num) {
+		err = xio_errno();
+		xio_rdma_xmit(rdma_hndl);
+		xio_set_error(err);
+	}
+
 	return retval;
 }
 
@@ -3888,10 +4711,13 @@ int xio_rdma_cancel_req(struct xio_transport_base *transport,
 	/* look in the in_flight */
 	list_for_each_entry_safe(ptask, next_ptask, &rdma_hndl->in_flight_list,
 				 tasks_list_entry) {
-		if (ptask->omsg &&
+		/* answered tasks wait here for their send completion, the
+		 * message they carried may already be gone
+		 */
+		if (ptask->state != XIO_TASK_STATE_RESPONSE_RECV &&
+		    ptask->omsg &&
 		    (ptask->omsg->sn == req->sn) &&
-		    (ptask->stag == stag) &&
-		    (ptask->state != XIO_TASK_STATE_RESPONSE_RECV)) {
+		    (ptask->stag == stag)) {
 			TRACE_LOG("[%lu] - message found on in_flight_list\n",
 				  req->sn);
 
@@ -3907,10 +4733,10 @@ int xio_rdma_cancel_req(struct xio_transport_base *transport,
 	/* look in the tx_comp */
 	list_for_each_entry_safe(ptask, next_ptask, &rdma_hndl->tx_comp_list,
 				 tasks_list_entry) {
-		if (ptask->omsg &&
+		if (ptask->state != XIO_TASK_STATE_RESPONSE_RECV &&
+		    ptask->omsg &&
 		    (ptask->omsg->sn == req->sn) &&
-		    (ptask->stag == stag) &&
-		    (ptask->state != XIO_TASK_STATE_RESPONSE_RECV)) {
+		    (ptask->stag == stag)) {
 			TRACE_LOG("[%lu] - message found on tx_comp_list\n",
 				  req->sn);
 			rdma_task	= ptask->dd_data;
@@ -60,6 +60,8 @@
 #define XIO_OPTVAL_DEF_RDMA_BUF_THRESHOLD		SEND_BUF_SZ
 #define XIO_OPTVAL_MIN_RDMA_BUF_THRESHOLD		256
 #define XIO_OPTVAL_MAX_RDMA_BUF_THRESHOLD		65536
+#define XIO_OPTVAL_DEF_RDMA_CHUNK_SIZE		0
+#define XIO_OPTVAL_MIN_RDMA_CHUNK_SIZE		4096
 
 /*---------------------------------------------------------------------------*/
 /* globals								     */
@@ -78,6 +80,7 @@ LIST_HEAD(dev_list);
 static LIST_HEAD(cm_list);
 
 static struct xio_dev_tdata		dev_tdata;
+static struct xio_observer		cq_ctx_observer;
 
 /* rdma options */
 struct xio_rdma_options			rdma_options = {
@@ -85,6 +88,10 @@ struct xio_rdma_options			rdma_options = {
 	.enable_dma_latency		= XIO_OPTVAL_DEF_ENABLE_DMA_LATENCY,
 	.rdma_buf_threshold		= XIO_OPTVAL_DEF_RDMA_BUF_THRESHOLD,
 	.rdma_buf_attr_rdonly		= 0,
+	.rdma_chunk_sz			= XIO_OPTVAL_DEF_RDMA_CHUNK_SIZE,
+	.enable_srq			= 0,
+	.enable_write_imm		= 0,
+	.enable_adaptive_rq		= 0,
 };
 
 /*---------------------------------------------------------------------------*/
@@ -98,6 +105,8 @@ static void xio_rdma_close(struct xio_transport_base *transport);
 static struct rdma_event_channel *xio_cm_channel_get(struct xio_context *ctx);
 static void xio_rdma_post_close(struct xio_transport_base *transport);
 static int xio_rdma_flush_all_tasks(struct xio_rdma_transport *rdma_hndl);
+static struct xio_srq *xio_srq_init(struct xio_cq *tcq);
+static void xio_srq_release(struct xio_srq *srq);
 
 
 /*---------------------------------------------------------------------------*/
@@ -245,13 +254,30 @@ int xio_device_thread_remove_device(struct xio_device *dev)
 /*---------------------------------------------------------------------------*/
 /* xio_cq_modify - use to throttle rates				     */
 /*---------------------------------------------------------------------------*/
-static int xio_cq_modify(struct xio_cq *tcq, int cq_count, int cq_pariod)
+int xio_cq_modify(struct xio_cq *tcq, int cq_count, int cq_pariod)
 {
-	struct ibv_cq_attr  cq_attr;
-	int		    retval;
+#ifdef HAVE_IBV_MODIFY_CQ_ATTR
+	struct ibv_modify_cq_attr  cq_attr;
+#else
+	struct ibv_cq_attr	   cq_attr;
+#endif
+	int			   retval;
 
 	memset(&cq_attr, 0, sizeof(cq_attr));
 
+#ifdef HAVE_IBV_MODIFY_CQ_ATTR
+	cq_attr.attr_mask = IBV_CQ_ATTR_MODERATE;
+	cq_attr.moderate.cq_count = cq_count;
+	cq_attr.moderate.cq_period = cq_pariod;
+
+	/* returns the error rather than setting errno */
+	retval = ibv_modify_cq(tcq->cq, &cq_attr);
+	if (retval == EOPNOTSUPP)
+		DEBUG_LOG("cq moderation is not supported by the device\n");
+	else if (retval)
+		ERROR_LOG("ibv_modify_cq failed. (err=%d %s)\n",
+			  retval, strerror(retval));
+#else
 	cq_attr.comp_mask = IBV_CQ_ATTR_MODERATION;
 	cq_attr.moderation.cq_count = cq_count;
 	cq_attr.moderation.cq_period = cq_pariod;
@@ -260,11 +286,151 @@ static int xio_cq_modify(struct xio_cq *tcq, int cq_count, int cq_pariod)
 			       IBV_CQ_MODERATION);
 	if (retval)
 		ERROR_LOG("ibv_modify_cq failed. (errno=%d %m)\n", errno);
+#endif
 
 	return retval;
 }
 #endif
 
+/*---------------------------------------------------------------------------*/
+/* xio_irq_affinity - 2 if the irq is affine to cpu, 1 if to its node	     */
+/*---------------------------------------------------------------------------*/
+static int xio_irq_affinity(int irq, int cpu, int node)
+{
+	char		path[64];
+	char		buf[1024];
+	char		*ptr, *end;
+	FILE		*f;
+	long		first, last, i;
+	int		match = 0;
+
+	sprintf(path, "/proc/irq/%d/smp_affinity_list", irq);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	ptr = fgets(buf, sizeof(buf), f);
+	fclose(f);
+	if (!ptr)
+		return 0;
+
+	/* ranges list, e.g. "0-3,8,10-11" */
+	while (*ptr) {
+		first = strtol(ptr, &end, 10);
+		if (end == ptr)
+			break;
+		last = first;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+		for (i = first; i <= last; i++) {
+			if (i == cpu)
+				return 2;
+			if (numa_node_of_cpu(i) == node)
+				match = 1;
+		}
+		if (*end != ',')
+			break;
+		ptr = end + 1;
+	}
+
+	return match;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_comp_vector_by_affinity						     */
+/*---------------------------------------------------------------------------*/
+static int xio_comp_vector_by_affinity(struct xio_device *dev,
+				       struct xio_context *ctx)
+{
+	char		path[PATH_MAX];
+	char		link[PATH_MAX];
+	char		*line = NULL;
+	size_t		line_len = 0;
+	const char	*pci, *comp;
+	FILE		*f;
+	ssize_t		len;
+	int		irq, vec, affinity;
+	int		best = 0, best_vec = -1;
+
+	/* the interrupts are named after the device's pci address */
+	snprintf(path, sizeof(path), "%s/device",
+		 dev->verbs->device->ibdev_path);
+	len = readlink(path, link, sizeof(link) - 1);
+	if (len <= 0)
+		return -1;
+	link[len] = 0;
+	pci = strrchr(link, '/');
+	pci = pci ? pci + 1 : link;
+
+	f = fopen("/proc/interrupts", "r");
+	if (!f)
+		return -1;
+
+	/* e.g. "mlx4-comp-3@pci:0000:04:00.0" or "mlx5_comp3@pci:..." */
+	while (getline(&line, &line_len, f) > 0) {
+		if (!strstr(line, pci))
+			continue;
+		comp = strstr(line, "comp");
+		if (!comp)
+			continue;
+		comp += 4;
+		while (*comp == '-' || *comp == '_')
+			comp++;
+		if (!isdigit((unsigned char)*comp))
+			continue;
+		vec = atoi(comp);
+		if (vec >= dev->verbs->num_comp_vectors)
+			continue;
+		if (sscanf(line, " %d:", &irq) != 1)
+			continue;
+
+		affinity = xio_irq_affinity(irq, ctx->cpuid, ctx->nodeid);
+		if (affinity > best) {
+			best	 = affinity;
+			best_vec = vec;
+			if (best == 2)
+				break;
+		}
+	}
+	free(line);
+	fclose(f);
+
+	return best_vec;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_cq_comp_vector							     */
+/*---------------------------------------------------------------------------*/
+static int xio_cq_comp_vector(struct xio_device *dev,
+			      struct xio_context *ctx)
+{
+	int comp_vec;
+
+	if (ctx->comp_vector != -1)
+		return ctx->comp_vector % dev->verbs->num_comp_vectors;
+
+	/* have the cq's interrupt delivered on the context's cpu, or at
+	 * least on its node
+	 */
+	comp_vec = xio_comp_vector_by_affinity(dev, ctx);
+	if (comp_vec == -1)
+		comp_vec = ctx->cpuid % dev->verbs->num_comp_vectors;
+
+	return comp_vec;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_cq_add_counter - per device name, a context has a cq on each one     */
+/*---------------------------------------------------------------------------*/
+static int xio_cq_add_counter(struct xio_cq *tcq, const char *name)
+{
+	char	buf[64];
+
+	snprintf(buf, sizeof(buf), "%s:%s",
+		 tcq->dev->verbs->device->name, name);
+
+	return xio_add_counter(tcq->ctx, buf);
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_cq_create							     */
 /*---------------------------------------------------------------------------*/
@@ -302,8 +468,7 @@ static struct xio_cq *xio_cq_init(struct xio_device *dev,
 	tcq->alloc_sz = min(dev->device_attr.max_cqe, CQE_ALLOC_SIZE);
 	tcq->max_cqe  = dev->device_attr.max_cqe;
 
-	/* set com_vector to cpu */
-	comp_vec = ctx->cpuid % dev->verbs->num_comp_vectors;
+	comp_vec = xio_cq_comp_vector(dev, ctx);
 
 	tcq->channel = ibv_create_comp_channel(dev->verbs);
 	if (tcq->channel == NULL) {
@@ -340,7 +505,7 @@ static struct xio_cq *xio_cq_init(struct xio_device *dev,
 
 	tcq->cq = ibv_create_cq(dev->verbs, tcq->alloc_sz, tcq,
 				tcq->channel, comp_vec);
-	TRACE_LOG("comp_vec:%d\n", comp_vec);
+	DEBUG_LOG("cpu:%d comp_vec:%d\n", ctx->cpuid, comp_vec);
 	if (tcq->cq == NULL) {
 		xio_set_error(errno);
 		ERROR_LOG("ibv_create_cq failed. (errno=%d %m)\n", errno);
@@ -360,16 +525,40 @@ static struct xio_cq *xio_cq_init(struct xio_device *dev,
 		goto cleanup5;
 	}
 
+	ctx->cq_comp_vector = comp_vec;
+
 	/* set cq depth params */
 	tcq->dev	= dev;
 	tcq->cq_depth	= tcq->alloc_sz;
 	tcq->cqe_avail	= tcq->alloc_sz;
 	atomic_set(&tcq->refcnt, 0);
 
+	/* start unmoderated, the datapath adapts to the traffic */
+	tcq->mod.sample_start		= get_cycles();
+	tcq->mod.cq_count		= 1;
+	tcq->mod.cq_period		= 0;
+	tcq->mod.max_delayed_arm	= MAX_NUM_DELAYED_ARM;
+	tcq->mod.stat_events		= xio_cq_add_counter(tcq, "CQ_EVENTS");
+	tcq->mod.stat_comps		= xio_cq_add_counter(tcq, "CQ_COMPS");
+	tcq->mod.stat_cq_count		= xio_cq_add_counter(tcq, "CQ_MOD_COUNT");
+	tcq->mod.stat_cq_period		= xio_cq_add_counter(tcq, "CQ_MOD_USECS");
+	tcq->mod.stat_delayed_arm	= xio_cq_add_counter(tcq, "CQ_ARM_DELAY");
+	tcq->mod.stat_rtt		= xio_cq_add_counter(tcq, "CQ_RTT_USECS");
+	tcq->stat_tx_inline		= xio_cq_add_counter(tcq, "TX_INLINE");
+	tcq->stat_tx_dma		= xio_cq_add_counter(tcq, "TX_DMA");
+	tcq->stat_tx_doorbells		= xio_cq_add_counter(tcq, "TX_DOORBELLS");
+	tcq->stat_tx_wrs		= xio_cq_add_counter(tcq, "TX_WRS");
+
 	INIT_LIST_HEAD(&tcq->trans_list);
+	INIT_LIST_HEAD(&tcq->rx_rearm_list);
+	INIT_LIST_HEAD(&tcq->idle_list);
 
 	list_add(&tcq->cq_list_entry, &dev->cq_list);
 
+	/* one observer node per context, whatever the number of its cqs */
+	xio_context_unreg_observer(ctx, &cq_ctx_observer);
+	xio_context_reg_observer(ctx, &cq_ctx_observer);
+
 	return tcq;
 
 cleanup5:
@@ -393,6 +582,35 @@ cleanup:
 	return NULL;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_cq_del_counters							     */
+/*---------------------------------------------------------------------------*/
+static void xio_cq_del_counters(struct xio_cq *tcq)
+{
+	struct xio_cq_moderation *mod = &tcq->mod;
+
+	if (mod->stat_events >= 0)
+		xio_del_counter(tcq->ctx, mod->stat_events);
+	if (mod->stat_comps >= 0)
+		xio_del_counter(tcq->ctx, mod->stat_comps);
+	if (mod->stat_cq_count >= 0)
+		xio_del_counter(tcq->ctx, mod->stat_cq_count);
+	if (mod->stat_cq_period >= 0)
+		xio_del_counter(tcq->ctx, mod->stat_cq_period);
+	if (mod->stat_delayed_arm >= 0)
+		xio_del_counter(tcq->ctx, mod->stat_delayed_arm);
+	if (mod->stat_rtt >= 0)
+		xio_del_counter(tcq->ctx, mod->stat_rtt);
+	if (tcq->stat_tx_inline >= 0)
+		xio_del_counter(tcq->ctx, tcq->stat_tx_inline);
+	if (tcq->stat_tx_dma >= 0)
+		xio_del_counter(tcq->ctx, tcq->stat_tx_dma);
+	if (tcq->stat_tx_doorbells >= 0)
+		xio_del_counter(tcq->ctx, tcq->stat_tx_doorbells);
+	if (tcq->stat_tx_wrs >= 0)
+		xio_del_counter(tcq->ctx, tcq->stat_tx_wrs);
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_cq_release							     */
 /*---------------------------------------------------------------------------*/
@@ -428,6 +646,11 @@ static void xio_cq_release(struct xio_cq *tcq, int delete_fd)
 	/* if  event is scheduled, then remove it */
 	xio_ctx_remove_event(tcq->ctx, &tcq->event_data);
 
+	if (tcq->srq)
+		xio_srq_release(tcq->srq);
+
+	xio_cq_del_counters(tcq);
+
 	/* the event loop may be release by the time this function is called */
 	retval = ibv_destroy_cq(tcq->cq);
 	if (retval)
@@ -457,6 +680,7 @@ static struct xio_device *xio_device_init(struct ibv_context *ib_ctx)
 		return NULL;
 	}
 	dev->verbs	= ib_ctx;
+	dev->max_inline_data = -1;
 
 	dev->pd = ibv_alloc_pd(dev->verbs);
 	if (dev->pd == NULL) {
@@ -683,14 +907,12 @@ static void xio_cm_list_release()
 }
 
 /*---------------------------------------------------------------------------*/
-/* xio_rdma_context_shutdown						     */
+/* xio_cq_release_ctx							     */
 /*---------------------------------------------------------------------------*/
-static int xio_rdma_context_shutdown(struct xio_transport_base *trans_hndl,
-				     struct xio_context *ctx)
+static void xio_cq_release_ctx(struct xio_context *ctx)
 {
 	struct xio_device	*dev;
 	struct xio_cq		*tcq, *next;
-	struct xio_cm_channel	*channel = NULL;
 
 	pthread_rwlock_wrlock(&dev_lock);
 	list_for_each_entry(dev, &dev_list, dev_list_entry) {
@@ -703,6 +925,32 @@ static int xio_rdma_context_shutdown(struct xio_transport_base *trans_hndl,
 		pthread_rwlock_unlock(&dev->cq_lock);
 	}
 	pthread_rwlock_unlock(&dev_lock);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_cq_on_context_event						     */
+/*---------------------------------------------------------------------------*/
+static int xio_cq_on_context_event(void *observer, void *sender, int event,
+				   void *event_data)
+{
+	/* the cqs live as long as their context, with or without a
+	 * connection left to shut the context down
+	 */
+	if (event == XIO_CONTEXT_EVENT_CLOSE)
+		xio_cq_release_ctx(sender);
+
+	return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_rdma_context_shutdown						     */
+/*---------------------------------------------------------------------------*/
+static int xio_rdma_context_shutdown(struct xio_transport_base *trans_hndl,
+				     struct xio_context *ctx)
+{
+	struct xio_cm_channel	*channel = NULL;
+
+	xio_cq_release_ctx(ctx);
 
 
 	/* find the channel and release it */
@@ -721,7 +969,7 @@ static int xio_rdma_context_shutdown(struct xio_transport_base *trans_hndl,
 /*---------------------------------------------------------------------------*/
 /* xio_cq_alloc_slots							     */
 /*---------------------------------------------------------------------------*/
-static int xio_cq_alloc_slots(struct xio_cq *tcq, int cqe_num)
+int xio_cq_alloc_slots(struct xio_cq *tcq, int cqe_num)
 {
 	if (cqe_num < tcq->cqe_avail) {
 		tcq->cqe_avail -= cqe_num;
@@ -747,10 +995,18 @@ static int xio_cq_alloc_slots(struct xio_cq *tcq, int cqe_num)
 /*---------------------------------------------------------------------------*/
 /* xio_cq_free_slots							     */
 /*---------------------------------------------------------------------------*/
-static int xio_cq_free_slots(struct xio_cq *tcq, int cqe_num)
+int xio_cq_free_slots(struct xio_cq *tcq, int cqe_num)
 {
 	if (tcq->cqe_avail + cqe_num <= tcq->cq_depth) {
 		tcq->cqe_avail += cqe_num;
+		/* give back a step once two are unused */
+		if (tcq->cqe_avail > 2*tcq->alloc_sz &&
+		    tcq->cq_depth > tcq->alloc_sz &&
+		    ibv_resize_cq(tcq->cq,
+				  tcq->cq_depth - tcq->alloc_sz) == 0) {
+			tcq->cq_depth  -= tcq->alloc_sz;
+			tcq->cqe_avail -= tcq->alloc_sz;
+		}
 		return 0;
 	}
 	ERROR_LOG("cq allocation error");
@@ -768,6 +1024,7 @@ static int xio_setup_qp(struct xio_rdma_transport *rdma_hndl)
 	struct ibv_qp_attr		qp_attr;
 	int				dev_found = 0;
 	int				retval = 0;
+	int				inline_sz;
 	struct	xio_cq			*tcq;
 
 	/* find device */
@@ -790,7 +1047,12 @@ static int xio_setup_qp(struct xio_rdma_transport *rdma_hndl)
 		ERROR_LOG("cq initialization failed\n");
 		return -1;
 	}
-	retval = xio_cq_alloc_slots(tcq, MAX_CQE_PER_QP);
+	if (rdma_options.enable_srq && tcq->srq == NULL)
+		tcq->srq = xio_srq_init(tcq);
+	if (rdma_options.enable_srq)
+		rdma_hndl->srq = tcq->srq;
+
+	retval = xio_cq_alloc_slots(tcq, CQE_PER_QP(rdma_hndl));
 	if (retval != 0) {
 		ERROR_LOG("cq full capacity reached\n");
 		return -1;
@@ -806,30 +1068,59 @@ static int xio_setup_qp(struct xio_rdma_transport *rdma_hndl)
 	qp_init_attr.cap.max_recv_wr		= MAX_RECV_WR + EXTRA_RQE;
 	qp_init_attr.cap.max_send_sge		= MAX_SGE;
 	qp_init_attr.cap.max_recv_sge		= 1;
-	qp_init_attr.cap.max_inline_data	= MAX_INLINE_DATA;
+	if (rdma_hndl->srq) {
+		qp_init_attr.srq		= rdma_hndl->srq->srq;
+		qp_init_attr.cap.max_recv_wr	= 0;
+	}
 
 	/* only generate completion queue entries if requested */
 	qp_init_attr.sq_sig_all		= 0;
 
-	retval = rdma_create_qp(rdma_hndl->cm_id, dev->pd, &qp_init_attr);
+	/* take the largest inline size the device accepts. it is probed
+	 * once per device, halving the request until the qp is created
+	 */
+	inline_sz = (dev->max_inline_data < 0) ? MAX_INLINE_DATA :
+						  dev->max_inline_data;
+	for (;;) {
+		qp_init_attr.cap.max_inline_data = inline_sz;
+		retval = rdma_create_qp(rdma_hndl->cm_id, dev->pd,
+					&qp_init_attr);
+		if (retval == 0 || inline_sz == 0 ||
+		    (errno != EINVAL && errno != ENOMEM))
+			break;
+		inline_sz /= 2;
+	}
 	if (retval) {
 		xio_set_error(errno);
-		xio_cq_free_slots(tcq, MAX_CQE_PER_QP);
+		xio_cq_free_slots(tcq, CQE_PER_QP(rdma_hndl));
+		rdma_hndl->srq = NULL;
 		ERROR_LOG("rdma_create_qp failed. (errno=%d %m)\n", errno);
 		return -1;
 	}
 	rdma_hndl->tcq		= tcq;
 	rdma_hndl->qp		= rdma_hndl->cm_id->qp;
 	rdma_hndl->sqe_avail	= MAX_SEND_WR;
+	rdma_hndl->cqe_reserved	= CQE_PER_QP(rdma_hndl);
 
 	memset(&qp_attr, 0, sizeof(qp_attr));
 	if (ibv_query_qp(rdma_hndl->qp, &qp_attr, 0, &qp_init_attr) != 0)
 		ERROR_LOG("ibv_query_qp failed. (errno=%d %m)\n", errno);
 	rdma_hndl->max_inline_data = qp_attr.cap.max_inline_data;
+	dev->max_inline_data = inline_sz;
 
 
 	list_add(&rdma_hndl->trans_list_entry, &tcq->trans_list);
 
+	if (rdma_hndl->srq) {
+		struct xio_key_int32 key = {
+			rdma_hndl->qp->qp_num
+		};
+		HT_INSERT(&rdma_hndl->srq->qp_htbl, &key, rdma_hndl, srq_htbl);
+		/* the buffer that takes the connection setup message */
+		if (rdma_hndl->srq->credits_avail)
+			rdma_hndl->srq->credits_avail--;
+	}
+
 	TRACE_LOG("rdma qp: [new] handle:%p, qp:0x%x, max inline:%d\n",
 		  rdma_hndl,
 		  rdma_hndl->qp->qp_num,
@@ -846,8 +1137,27 @@ static void xio_release_qp(struct xio_rdma_transport *rdma_hndl)
 	if (rdma_hndl->qp) {
 		TRACE_LOG("rdma qp: [close] handle:%p, qp:0x%x\n", rdma_hndl,
 			  rdma_hndl->qp->qp_num);
-		xio_cq_free_slots(rdma_hndl->tcq, MAX_CQE_PER_QP);
+		xio_cq_free_slots(rdma_hndl->tcq, rdma_hndl->cqe_reserved);
+		rdma_hndl->cqe_reserved = 0;
+		if (xio_is_delayed_work_pending(&rdma_hndl->resize_work))
+			xio_ctx_del_delayed_work(rdma_hndl->base.ctx,
+						 &rdma_hndl->resize_work);
 		list_del(&rdma_hndl->trans_list_entry);
+		list_del_init(&rdma_hndl->rx_rearm_entry);
+		list_del_init(&rdma_hndl->idle_entry);
+		if (rdma_hndl->srq) {
+			struct xio_srq *srq = rdma_hndl->srq;
+
+			HT_REMOVE(&srq->qp_htbl, rdma_hndl,
+				  xio_rdma_transport, srq_htbl);
+			/* buffers promised to the peer are free again */
+			srq->credits_avail = min(srq->srqe_avail,
+						 srq->credits_avail +
+						 rdma_hndl->sim_peer_credits +
+						 rdma_hndl->credits);
+			rdma_hndl->srq_owed = 0;
+			list_del_init(&rdma_hndl->srq_owed_entry);
+		}
 		rdma_destroy_qp(rdma_hndl->cm_id);
 		rdma_hndl->qp	= NULL;
 	}
@@ -922,6 +1232,7 @@ static void xio_rdma_task_init(struct xio_task *task,
 	XIO_TO_RDMA_TASK(task, rdma_task);
 
 	rdma_task->rdma_hndl = rdma_hndl;
+	rdma_task->srq = NULL;
 
 	xio_rxd_init(&rdma_task->rxd, task, buf, size, srmr);
 	xio_txd_init(&rdma_task->txd, task, buf, size, srmr);
@@ -1011,8 +1322,13 @@ void xio_rdma_calc_pool_size(struct xio_rdma_transport *rdma_hndl)
 	 * simultaneously */
 
 	rdma_hndl->num_tasks = 6*(rdma_hndl->sq_depth +
-				  rdma_hndl->actual_rq_depth);
+				  rdma_hndl->rq_depth + EXTRA_RQE);
+
+	/* receive buffers come from the shared receive queue */
+	if (rdma_hndl->srq)
+		rdma_hndl->num_tasks = 6*rdma_hndl->sq_depth;
 
+	/* upper bound, the pool is allocated in slabs as needed */
 	rdma_hndl->alloc_sz  = rdma_hndl->num_tasks*rdma_hndl->membuf_sz;
 
 	rdma_hndl->max_tx_ready_tasks_num = rdma_hndl->sq_depth;
@@ -1093,6 +1409,17 @@ struct xio_task *xio_rdma_primary_task_lookup(
 	return NULL;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_rdma_primary_pool_shrink						     */
+/*---------------------------------------------------------------------------*/
+int xio_rdma_primary_pool_shrink(struct xio_rdma_transport *rdma_hndl)
+{
+	if (rdma_hndl->primary_pool_cls.pool_shrink)
+		return rdma_hndl->primary_pool_cls.pool_shrink(
+					rdma_hndl->primary_pool_cls.pool);
+	return -1;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_rdma_task_free							     */
 /*---------------------------------------------------------------------------*/
@@ -1115,6 +1442,12 @@ static int xio_rdma_initial_pool_run(
 	struct xio_rdma_task *rdma_task;
 	int	retval;
 
+	/* the setup message lands on the shared receive queue */
+	if (rdma_hndl->srq) {
+		rdma_hndl->peer_credits	= 1;
+		rdma_hndl->sim_peer_credits = 1;
+		return 0;
+	}
 
 	task = xio_rdma_initial_task_alloc(rdma_hndl);
 	if (task == NULL) {
@@ -1210,15 +1543,17 @@ static int xio_rdma_primary_pool_alloc(
 		(struct xio_rdma_transport *)transport_hndl;
 	struct xio_rdma_tasks_pool *rdma_pool =
 		(struct xio_rdma_tasks_pool *)pool_dd_data;
+	size_t alloc_sz = max*rdma_hndl->membuf_sz;
 
 	rdma_pool->buf_size = rdma_hndl->membuf_sz;
+	rdma_pool->buf_idx = 0;
 
 	if (disable_huge_pages) {
-		rdma_pool->io_buf = xio_alloc(rdma_hndl->alloc_sz);
+		rdma_pool->io_buf = xio_alloc(alloc_sz);
 		if (!rdma_pool->io_buf) {
 			xio_set_error(ENOMEM);
 			ERROR_LOG("xio_alloc rdma pool sz:%zu failed\n",
-					rdma_hndl->alloc_sz);
+					alloc_sz);
 			return -1;
 		}
 		rdma_pool->data_pool = rdma_pool->io_buf->addr;
@@ -1240,18 +1575,18 @@ static int xio_rdma_primary_pool_alloc(
 		/* maybe allocation of with unuma_alloc can provide better
 		 * performance?
 		 */
-		rdma_pool->data_pool = umalloc_huge_pages(rdma_hndl->alloc_sz);
+		rdma_pool->data_pool = umalloc_huge_pages(alloc_sz);
 		if (!rdma_pool->data_pool) {
 			xio_set_error(ENOMEM);
 			ERROR_LOG("malloc rdma pool sz:%zu failed\n",
-					rdma_hndl->alloc_sz);
+					alloc_sz);
 			return -1;
 		}
 
-		/* One pool of registered memory per PD */
+		/* One region of registered memory per slab */
 		rdma_pool->data_mr = ibv_reg_mr(rdma_hndl->tcq->dev->pd,
 				rdma_pool->data_pool,
-				rdma_hndl->alloc_sz,
+				alloc_sz,
 				IBV_ACCESS_LOCAL_WRITE);
 		if (!rdma_pool->data_mr) {
 			xio_set_error(errno);
@@ -1277,7 +1612,26 @@ static int xio_rdma_primary_pool_run(
 	struct xio_rdma_transport *rdma_hndl =
 		(struct xio_rdma_transport *)transport_hndl;
 
-	xio_rdma_rearm_rq(rdma_hndl);
+	int retval;
+
+	/* watch the traffic to size the receive window and the pool */
+	if (rdma_options.enable_adaptive_rq) {
+		retval = xio_ctx_add_delayed_work(rdma_hndl->base.ctx,
+						  RESIZE_TICK_MSEC, rdma_hndl,
+						  xio_rdma_resize_handler,
+						  &rdma_hndl->resize_work);
+		if (retval != 0) {
+			ERROR_LOG("xio_ctx_add_delayed_work failed.\n");
+			return -1;
+		}
+	}
+
+	if (rdma_hndl->srq)
+		xio_srq_grant_credits(rdma_hndl,
+				      min(rdma_hndl->rq_depth,
+					  SRQ_CONN_CREDITS));
+	else
+		xio_rdma_rearm_rq(rdma_hndl);
 
 	return 0;
 }
@@ -1312,7 +1666,8 @@ static int xio_rdma_primary_pool_init_task(
 		(struct xio_rdma_transport *)transport_hndl;
 	struct xio_rdma_tasks_pool *rdma_pool =
 		(struct xio_rdma_tasks_pool *)pool_dd_data;
-	void *buf = rdma_pool->data_pool + (task->ltid*rdma_pool->buf_size);
+	void *buf = rdma_pool->data_pool +
+			(rdma_pool->buf_idx++)*rdma_pool->buf_size;
 
 	XIO_TO_RDMA_TASK(task, rdma_task);
 	rdma_task->ib_op = 0x200;
@@ -1328,6 +1683,28 @@ static int xio_rdma_primary_pool_init_task(
 	return 0;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_rdma_primary_pool_reuse						     */
+/*---------------------------------------------------------------------------*/
+static int xio_rdma_primary_pool_reuse(
+		struct xio_transport_base *transport_hndl, void *pool_dd_data)
+{
+	struct xio_rdma_transport *rdma_hndl =
+		(struct xio_rdma_transport *)transport_hndl;
+	struct xio_rdma_tasks_pool *rdma_pool =
+		(struct xio_rdma_tasks_pool *)pool_dd_data;
+
+	/* the region is registered with the device of the closed handle */
+	if (rdma_pool->data_mr->pd != rdma_hndl->tcq->dev->pd ||
+	    (size_t)rdma_pool->buf_size != rdma_hndl->membuf_sz)
+		return -1;
+
+	/* the tasks get their buffers again in the same order */
+	rdma_pool->buf_idx = 0;
+
+	return 0;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_rdma_task_pre_put						     */
 /*---------------------------------------------------------------------------*/
@@ -1360,6 +1737,8 @@ static int xio_rdma_task_pre_put(
 	rdma_task->txd.send_wr.num_sge = 1;
 	rdma_task->ib_op = XIO_IB_NULL;
 	rdma_task->phantom_idx = 0;
+	rdma_task->chunk_owner = NULL;
+	rdma_task->chunk_off = 0;
 	rdma_task->sn = 0;
 
 	return 0;
@@ -1381,15 +1760,203 @@ static void xio_rdma_primary_pool_get_params(
 	*task_dd_sz = sizeof(struct xio_rdma_task);
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_rdma_primary_pool_get_slab_params				     */
+/*---------------------------------------------------------------------------*/
+static void xio_rdma_primary_pool_get_slab_params(
+		struct xio_transport_base *transport_hndl, int *slab_len)
+{
+	struct xio_rdma_transport *rdma_hndl =
+		(struct xio_rdma_transport *)transport_hndl;
+
+	/* a fixed pool is allocated at once */
+	if (!rdma_options.enable_adaptive_rq)
+		*slab_len = rdma_hndl->num_tasks;
+	else
+		*slab_len = (rdma_hndl->num_tasks + TASKS_POOL_SLABS - 1) /
+			    TASKS_POOL_SLABS;
+}
+
 static struct xio_tasks_pool_ops   primary_tasks_pool_ops = {
 	.pool_get_params	= xio_rdma_primary_pool_get_params,
+	.pool_get_slab_params	= xio_rdma_primary_pool_get_slab_params,
 	.pool_alloc		= xio_rdma_primary_pool_alloc,
 	.pool_free		= xio_rdma_primary_pool_free,
 	.pool_init_item		= xio_rdma_primary_pool_init_task,
 	.pool_run		= xio_rdma_primary_pool_run,
+	.pool_reuse		= xio_rdma_primary_pool_reuse,
 	.pre_put		= xio_rdma_task_pre_put,
 };
 
+/*---------------------------------------------------------------------------*/
+/* xio_srq_put_task							     */
+/*---------------------------------------------------------------------------*/
+static void xio_srq_put_task(struct kref *kref)
+{
+	struct xio_task *task = container_of(kref, struct xio_task, kref);
+	struct xio_tasks_pool *pool = (struct xio_tasks_pool *)task->pool;
+	XIO_TO_RDMA_TASK(task, rdma_task);
+	struct xio_srq *srq = rdma_task->srq;
+
+	xio_rdma_task_pre_put(NULL, task);
+
+	task->imsg.user_context		= 0;
+	task->imsg.flags		= 0;
+	task->tlv_type			= 0xdead;
+	task->omsg_flags		= 0;
+	task->state			= XIO_TASK_STATE_INIT;
+	task->conn			= NULL;
+
+	xio_tasks_pool_push(pool, task);
+
+	/* buffers held by the upper layer could not be posted so far */
+	if (!srq->closing && srq->srqe_avail <= srq->low_wm)
+		xio_srq_rearm(srq);
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_srq_init								     */
+/*---------------------------------------------------------------------------*/
+static struct xio_srq *xio_srq_init(struct xio_cq *tcq)
+{
+	struct xio_device		*dev = tcq->dev;
+	struct ibv_srq_init_attr	srq_init_attr;
+	struct xio_rdma_tasks_pool	*rdma_pool;
+	struct xio_srq			*srq;
+	struct xio_task			*task;
+	int				i;
+
+	if (dev->device_attr.max_srq == 0 ||
+	    dev->device_attr.max_srq_wr == 0) {
+		DEBUG_LOG("device does not support shared receive queue\n");
+		return NULL;
+	}
+
+	srq = ucalloc(1, sizeof(*srq));
+	if (srq == NULL) {
+		xio_set_error(ENOMEM);
+		ERROR_LOG("ucalloc failed. %m\n");
+		return NULL;
+	}
+	srq->tcq	= tcq;
+	srq->srq_depth	= min(SRQ_DEPTH, dev->device_attr.max_srq_wr);
+	srq->low_wm	= srq->srq_depth/4;
+	srq->buf_sz	= rdma_options.rdma_buf_threshold;
+	INIT_LIST_HEAD(&srq->rx_list);
+	INIT_LIST_HEAD(&srq->owed_list);
+	HT_INIT(&srq->qp_htbl, xio_int32_hash, xio_int32_cmp, xio_int32_cp);
+
+	memset(&srq_init_attr, 0, sizeof(srq_init_attr));
+	srq_init_attr.srq_context	= srq;
+	srq_init_attr.attr.max_wr	= srq->srq_depth;
+	srq_init_attr.attr.max_sge	= 1;
+
+	srq->srq = ibv_create_srq(dev->pd, &srq_init_attr);
+	if (srq->srq == NULL) {
+		xio_set_error(errno);
+		ERROR_LOG("ibv_create_srq failed. (errno=%d %m)\n", errno);
+		goto cleanup;
+	}
+
+	/* twice the depth, so the queue is refilled while the upper layer
+	 * still holds received messages
+	 */
+	srq->tasks_pool = xio_tasks_pool_init(2*srq->srq_depth,
+					      sizeof(struct xio_rdma_tasks_pool),
+					      sizeof(struct xio_rdma_task),
+					      NULL);
+	if (srq->tasks_pool == NULL) {
+		ERROR_LOG("xio_tasks_pool_init failed\n");
+		goto cleanup1;
+	}
+	rdma_pool = srq->tasks_pool->dd_data;
+	rdma_pool->buf_size	= srq->buf_sz;
+	rdma_pool->io_buf	= NULL;
+	srq->alloc_sz		= srq->tasks_pool->max*srq->buf_sz;
+
+	rdma_pool->data_pool = umalloc_huge_pages(srq->alloc_sz);
+	if (rdma_pool->data_pool == NULL) {
+		xio_set_error(ENOMEM);
+		ERROR_LOG("malloc srq pool sz:%zu failed\n", srq->alloc_sz);
+		goto cleanup2;
+	}
+	rdma_pool->data_mr = ibv_reg_mr(dev->pd, rdma_pool->data_pool,
+					srq->alloc_sz, IBV_ACCESS_LOCAL_WRITE);
+	if (rdma_pool->data_mr == NULL) {
+		xio_set_error(errno);
+		ERROR_LOG("ibv_reg_mr failed, %m\n");
+		goto cleanup3;
+	}
+
+	for (i = 0; i < srq->tasks_pool->max; i++) {
+		task = srq->tasks_pool->array[i];
+		xio_rdma_task_init(
+			task,
+			NULL,
+			rdma_pool->data_pool + (task->ltid*srq->buf_sz),
+			srq->buf_sz,
+			rdma_pool->data_mr);
+		((struct xio_rdma_task *)task->dd_data)->srq = srq;
+		task->release	= xio_srq_put_task;
+		task->conn	= NULL;
+	}
+
+	if (xio_cq_alloc_slots(tcq, srq->srq_depth) != 0) {
+		ERROR_LOG("cq full capacity reached\n");
+		goto cleanup4;
+	}
+
+	xio_srq_rearm(srq);
+
+	DEBUG_LOG("srq: depth:%d, buf_sz:%zd, memory:%zd bytes\n",
+		  srq->srq_depth, srq->buf_sz, srq->alloc_sz);
+
+	return srq;
+
+cleanup4:
+	ibv_dereg_mr(rdma_pool->data_mr);
+cleanup3:
+	ufree_huge_pages(rdma_pool->data_pool);
+cleanup2:
+	xio_tasks_pool_free(srq->tasks_pool);
+cleanup1:
+	ibv_destroy_srq(srq->srq);
+cleanup:
+	ufree(srq);
+
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+/* xio_srq_release							     */
+/*---------------------------------------------------------------------------*/
+static void xio_srq_release(struct xio_srq *srq)
+{
+	struct xio_rdma_tasks_pool *rdma_pool = srq->tasks_pool->dd_data;
+	struct xio_task		   *task, *next_task;
+	int retval;
+
+	srq->closing = 1;
+	srq->tcq->srq = NULL;
+
+	retval = ibv_destroy_srq(srq->srq);
+	if (retval)
+		ERROR_LOG("ibv_destroy_srq failed. (err=%d)\n", retval);
+
+	/* buffers still posted are never completed, take them back */
+	list_for_each_entry_safe(task, next_task, &srq->rx_list,
+				 tasks_list_entry)
+		xio_tasks_pool_put(task);
+
+	xio_cq_free_slots(srq->tcq, srq->srq_depth);
+	xio_tasks_pool_free_tasks(srq->tasks_pool);
+
+	ibv_dereg_mr(rdma_pool->data_mr);
+	ufree_huge_pages(rdma_pool->data_pool);
+	xio_tasks_pool_free(srq->tasks_pool);
+	ufree(srq);
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_rdma_post_close							     */
 /*---------------------------------------------------------------------------*/
@@ -1461,6 +2028,10 @@ static void on_cm_route_resolved(struct rdma_cm_event *ev,
 	cm_params.initiator_depth =
 		rdma_hndl->tcq->dev->device_attr.max_qp_init_rd_atom;
 
+	/* a peer on a shared receive queue may run dry for a moment */
+	if (rdma_hndl->srq)
+		cm_params.rnr_retry_count = 7;
+
 	/* connect to peer */
 	retval = rdma_connect(rdma_hndl->cm_id, &cm_params);
 	if (retval != 0) {
@@ -1836,9 +2407,12 @@ static struct xio_transport_base *xio_rdma_open(
 	rdma_hndl->cm_id		= NULL;
 	rdma_hndl->qp			= NULL;
 	rdma_hndl->tcq			= NULL;
+	rdma_hndl->srq			= NULL;
 	rdma_hndl->base.ctx		= ctx;
 	rdma_hndl->rq_depth		= MAX_RECV_WR;
 	rdma_hndl->sq_depth		= MAX_SEND_WR;
+	rdma_hndl->sig_interval		= min(SEND_SIG_INTERVAL,
+					      MAX_SEND_WR / 4);
 	rdma_hndl->peer_credits		= 0;
 	rdma_hndl->cm_channel		= xio_cm_channel_get(ctx);
 	rdma_hndl->max_send_buf_sz	= rdma_options.rdma_buf_threshold;
@@ -1860,6 +2434,9 @@ static struct xio_transport_base *xio_rdma_open(
 	INIT_LIST_HEAD(&rdma_hndl->rx_list);
 	INIT_LIST_HEAD(&rdma_hndl->io_list);
 	INIT_LIST_HEAD(&rdma_hndl->rdma_rd_list);
+	INIT_LIST_HEAD(&rdma_hndl->rx_rearm_entry);
+	INIT_LIST_HEAD(&rdma_hndl->idle_entry);
+	INIT_LIST_HEAD(&rdma_hndl->srq_owed_entry);
 
 	TRACE_LOG("xio_rdma_open: [new] handle:%p\n", rdma_hndl);
 
@@ -1964,6 +2541,9 @@ static int xio_rdma_accept(struct xio_transport_base *transport)
 	else
 		cm_params.initiator_depth = rdma_hndl->client_initiator_depth;
 
+	if (rdma_hndl->srq)
+		cm_params.rnr_retry_count = 7;
+
 	/* "accept" the connection */
 	retval = rdma_accept(rdma_hndl->cm_id, &cm_params);
 	if (retval) {
@@ -2168,6 +2748,31 @@ static int xio_rdma_set_opt(void *xio_obj,
 			ALIGN(rdma_options.rdma_buf_threshold, 64);
 		return 0;
 		break;
+	case XIO_OPTNAME_RDMA_CHUNK_SIZE:
+		VALIDATE_SZ(sizeof(int));
+		if (*(int *)optval != 0 &&
+		    *(int *)optval < XIO_OPTVAL_MIN_RDMA_CHUNK_SIZE) {
+			xio_set_error(EINVAL);
+			return -1;
+		}
+		rdma_options.rdma_chunk_sz = *((int *)optval);
+		return 0;
+		break;
+	case XIO_OPTNAME_ENABLE_SRQ:
+		VALIDATE_SZ(sizeof(int));
+		rdma_options.enable_srq = *((int *)optval);
+		return 0;
+		break;
+	case XIO_OPTNAME_ENABLE_WRITE_IMM:
+		VALIDATE_SZ(sizeof(int));
+		rdma_options.enable_write_imm = *((int *)optval);
+		return 0;
+		break;
+	case XIO_OPTNAME_ENABLE_ADAPTIVE_RQ:
+		VALIDATE_SZ(sizeof(int));
+		rdma_options.enable_adaptive_rq = *((int *)optval);
+		return 0;
+		break;
 	default:
 		break;
 	}
@@ -2198,6 +2803,22 @@ static int xio_rdma_get_opt(void  *xio_obj,
 				XIO_OPTVAL_MIN_RDMA_BUF_THRESHOLD;
 		*optlen = sizeof(int);
 		return 0;
+	case XIO_OPTNAME_RDMA_CHUNK_SIZE:
+		*((int *)optval) = rdma_options.rdma_chunk_sz;
+		*optlen = sizeof(int);
+		return 0;
+	case XIO_OPTNAME_ENABLE_SRQ:
+		*((int *)optval) = rdma_options.enable_srq;
+		*optlen = sizeof(int);
+		return 0;
+	case XIO_OPTNAME_ENABLE_WRITE_IMM:
+		*((int *)optval) = rdma_options.enable_write_imm;
+		*optlen = sizeof(int);
+		return 0;
+	case XIO_OPTNAME_ENABLE_ADAPTIVE_RQ:
+		*((int *)optval) = rdma_options.enable_adaptive_rq;
+		*optlen = sizeof(int);
+		return 0;
 	default:
 		break;
 	}
@@ -2252,6 +2873,7 @@ static void xio_rdma_init()
 	int			retval = 0;
 
 	INIT_LIST_HEAD(&cm_list);
+	XIO_OBSERVER_INIT(&cq_ctx_observer, NULL, xio_cq_on_context_event);
 
 	spin_lock_init(&mngmt_lock);
 	pthread_rwlock_init(&dev_lock, NULL);
@@ -40,6 +40,8 @@
 
 #include "xio_transport.h"
 #include "xio_context.h"
+#include "xio_hash.h"
+#include "sys/hashtable.h"
 
 /*---------------------------------------------------------------------------*/
 /* externals								     */
@@ -63,23 +65,58 @@ extern struct list_head		dev_list;
 #define MAX_RECV_WR			256
 #define EXTRA_RQE			32
 
+/* with enable_adaptive_rq the posted receive window starts small and
+ * follows the traffic
+ */
+#define RQ_MIN_WINDOW			32
+#define RESIZE_TICK_MSEC		100
+#define RESIZE_IDLE_TICKS		10
+/* the primary pool grows in slabs of num_tasks/TASKS_POOL_SLABS */
+#define TASKS_POOL_SLABS		8
+
 #define MAX_CQE_PER_QP			(MAX_SEND_WR+MAX_RECV_WR)
 #define CQE_ALLOC_SIZE			(10*(MAX_SEND_WR+MAX_RECV_WR))
+/* receive completions of a shared queue are accounted once per cq,
+ * an adaptive window reserves more slots as it grows
+ */
+#define CQE_PER_QP(rdma_hndl)		((rdma_hndl)->srq ? MAX_SEND_WR : \
+					 !rdma_options.enable_adaptive_rq ? \
+					 MAX_CQE_PER_QP : \
+					 (MAX_SEND_WR + RQ_MIN_WINDOW + \
+					  EXTRA_RQE))
 
 #define DEF_DATA_ALIGNMENT		0
 #define SEND_BUF_SZ			8192
 #define MAX_HDR_SZ			512
-#define MAX_INLINE_DATA			200
+#define MAX_INLINE_DATA			1024 /* probed down per device */
 #define BUDGET_SIZE			1024
 #define MAX_NUM_DELAYED_ARM		16
 
+#define SRQ_DEPTH			4096 /* per context and device */
+#define SRQ_CONN_CREDITS		4    /* initial window of each peer
+					      * on a shared receive queue
+					      */
+
 #define NUM_CONN_SETUP_TASKS		2 /* one posted for req rx,
 					   * one for reply tx
 					   */
 #define CONN_SETUP_BUF_SIZE		4096
 
-#define SOFT_CQ_MOD			8
-#define HARD_CQ_MOD			64
+#define MAX_RDMA_RD_CHUNKS		(4*XIO_MAX_IOV)
+
+/* selective signaling: one signaled send per interval, and always when
+ * the send queue or the peer window are about to run out
+ */
+#define SEND_SIG_INTERVAL		16
+#define SEND_SIG_HEADROOM		4
+
+/* adaptive interrupt moderation */
+#define CQ_MOD_LEVELS			5
+#define CQ_MOD_SAMPLE_USECS		1000
+/* moderation never delays a completion by more than this fraction of the
+ * observed response round trip
+ */
+#define CQ_MOD_RTT_SHARE		8
 #define SEND_TRESHOLD			8
 
 #define PAGE_SIZE			page_size
@@ -120,7 +157,8 @@ enum xio_ib_op_code {
 	XIO_IB_RECV		= 1,
 	XIO_IB_SEND,
 	XIO_IB_RDMA_WRITE,
-	XIO_IB_RDMA_READ
+	XIO_IB_RDMA_READ,
+	XIO_IB_RDMA_WRITE_IMM
 };
 
 #ifndef IBV_DEVICE_MR_ALLOCATE
@@ -133,6 +171,7 @@ enum xio_ib_op_code {
 
 struct xio_transport_base;
 struct xio_rdma_transport;
+struct xio_srq;
 
 /*---------------------------------------------------------------------------*/
 struct xio_rdma_options {
@@ -140,6 +179,11 @@ struct xio_rdma_options {
 	int			enable_dma_latency;
 	int			rdma_buf_threshold;
 	int			rdma_buf_attr_rdonly;
+	int			rdma_chunk_sz;
+	int			enable_srq;
+	int			enable_write_imm;
+	int			enable_adaptive_rq;
+	int			pad;
 };
 
 struct xio_sge {
@@ -193,14 +237,26 @@ struct __attribute__((__packed__)) xio_rsp_hdr {
 	uint64_t		ulp_imm_len;	/* ulp data length	*/
 };
 
+#define XIO_RDMA_SETUP_WRITE_IMM	0x1	/* rsp data by write w/ imm */
+
 struct __attribute__((__packed__)) xio_rdma_setup_msg {
 	uint16_t		credits;	/* peer send credits	*/
 	uint16_t		sq_depth;
 	uint16_t		rq_depth;
-	uint16_t		pad;
+	uint16_t		flags;		/* XIO_RDMA_SETUP_*	*/
 	uint64_t		buffer_sz;
 };
 
+/* a response whose metadata fits in the immediate of the data's rdma write
+ * is sent without header: tid, credits and session flags
+ */
+#define XIO_IMM_RSP(tid, credits, flags)	\
+		(((uint32_t)(tid) << 16) | ((credits) << 8) | (flags))
+#define XIO_IMM_RSP_TID(imm)		((uint16_t)((imm) >> 16))
+#define XIO_IMM_RSP_CREDITS(imm)	(((imm) >> 8) & 0xff)
+#define XIO_IMM_RSP_FLAGS(imm)		((imm) & 0xff)
+#define XIO_IMM_RSP_MAX_CREDITS		0xff
+
 struct __attribute__((__packed__)) xio_nop_hdr {
 	uint16_t		hdr_len;	 /* req header length	*/
 	uint16_t		sn;		/* serial number	*/
@@ -228,6 +284,9 @@ struct xio_work_req {
 
 struct xio_rdma_task {
 	struct xio_rdma_transport	*rdma_hndl;
+	struct xio_srq			*srq;	/* owner of receive buffers
+						 * taken from a shared queue
+						 */
 	enum xio_ib_op_code		ib_op;
 	uint32_t			phantom_idx;
 	uint32_t			recv_num_sge;
@@ -240,6 +299,11 @@ struct xio_rdma_task {
 	uint16_t			more_in_batch;
 	uint32_t			pad;
 
+	/* chunked rdma read: the task that owns the message and the
+	 * number of bytes already delivered to the upper layer
+	 */
+	struct xio_task			*chunk_owner;
+	size_t				chunk_off;
 
 	/* The buffer mapped with the 3 xio_work_req
 	 * used to transfer the headers
@@ -262,6 +326,27 @@ struct xio_rdma_task {
 	struct xio_sge			req_recv_sge[XIO_MAX_IOV];
 };
 
+struct xio_cq_moderation {
+	cycles_t			sample_start;
+	uint64_t			comps;	      /* in current sample */
+	uint64_t			rtt;	      /* response round trip
+						       * average, cycles
+						       */
+	int32_t				rtt_samples;  /* in current sample */
+	int32_t				level;
+	int32_t				cq_count;     /* applied to the cq */
+	int32_t				cq_period;    /* usecs */
+	int32_t				max_delayed_arm;
+	int32_t				modify_failed; /* device can't moderate */
+	/* context statistics counters, -1 if not registered */
+	int32_t				stat_events;
+	int32_t				stat_comps;
+	int32_t				stat_cq_count;
+	int32_t				stat_cq_period;
+	int32_t				stat_delayed_arm;
+	int32_t				stat_rtt;
+};
+
 struct xio_cq  {
 	struct ibv_cq			*cq;
 	struct ibv_comp_channel		*channel;
@@ -277,13 +362,48 @@ struct xio_cq  {
 	int32_t				cqe_avail;    /* free elements  */
 	atomic_t			refcnt;       /* utilization counter */
 	int32_t				num_delayed_arm;
+	struct xio_cq_moderation	mod;
+	int32_t				stat_tx_inline;
+	int32_t				stat_tx_dma;
+	int32_t				stat_tx_doorbells;
+	int32_t				stat_tx_wrs;
+	struct xio_srq			*srq;	      /* shared receive queue */
 	struct list_head		trans_list;   /* list of all transports
 						       * attached to this cq
 						       */
+	struct list_head		rx_rearm_list; /* receive queues to
+						       * refill after the
+						       * polled batch
+						       */
+	struct list_head		idle_list;    /* transports with tx
+						       * work or credits
+						       * pending
+						       */
 	struct list_head		cq_list_entry; /* list of all
 						       cq per device */
 };
 
+/* one receive queue shared by all the qps of a cq. credits handed to the
+ * peers never exceed the posted buffers: credits_avail counts the posted
+ * buffers that no peer was promised yet
+ */
+struct xio_srq {
+	struct ibv_srq			*srq;
+	struct xio_cq			*tcq;
+	struct xio_tasks_pool		*tasks_pool;
+	struct list_head		rx_list;      /* posted buffers */
+	struct list_head		owed_list;    /* qps owed credits */
+	int32_t				srq_depth;
+	int32_t				srqe_avail;   /* posted buffers */
+	int32_t				credits_avail;
+	int32_t				low_wm;	      /* refill watermark */
+	int32_t				closing;
+	int32_t				pad;
+	size_t				buf_sz;
+	size_t				alloc_sz;
+	HT_HEAD(, xio_rdma_transport, HASHTABLE_PRIME_SMALL) qp_htbl;
+};
+
 struct xio_device {
 	struct list_head		cq_list;
 	struct list_head		dev_list_entry;    /* list of all
@@ -292,6 +412,10 @@ struct xio_device {
 	struct ibv_context		*verbs;
 	struct ibv_pd			*pd;
 	struct ibv_device_attr		device_attr;
+	int				max_inline_data; /* probed on first
+							  * qp, -1 before
+							  */
+	int				pad;
 };
 
 struct xio_mr_elem {
@@ -316,16 +440,21 @@ struct xio_rdma_tasks_pool {
 	struct ibv_mr			*data_mr;
 	struct xio_buf			*io_buf;
 	int				buf_size;
-	int				pad;
+	int				buf_idx;	/* next task's buffer */
 };
 
 struct xio_rdma_transport {
 	struct xio_transport_base	base;
 	struct xio_cq			*tcq;
 	struct ibv_qp			*qp;
+	struct xio_srq			*srq;
 	struct xio_mempool		*rdma_mempool;
 
 	struct list_head		trans_list_entry;
+	struct list_head		rx_rearm_entry;
+	struct list_head		idle_entry;
+	struct list_head		srq_owed_entry;
+	HT_ENTRY(xio_rdma_transport, xio_key_int32) srq_htbl;
 
 	/*  tasks queues */
 	struct list_head		tx_ready_list;
@@ -351,11 +480,31 @@ struct xio_rdma_transport {
 	uint16_t			peer_credits;
 
 	uint16_t			last_send_was_signaled;
+	int				srq_owed;	  /* credits not yet
+							   * covered by the
+							   * shared queue
+							   */
+	int				rq_window;	  /* receives kept
+							   * posted, up to
+							   * rq_depth
+							   */
+	int				cqe_reserved;	  /* cq slots held */
+	int				rx_tick_nr;	  /* receives in the
+							   * resize tick
+							   */
+	int				rq_pressure;	  /* of them, found
+							   * the peer short
+							   * of credits
+							   */
+	int				idle_ticks;
+	int				pad0;
+	xio_ctx_delayed_work_t		resize_work;
 
 	/* fast path params */
 	int				rdma_in_flight;
 	int				sqe_avail;
 	enum xio_transport_state	state;
+	int				rdma_rd_req_in_flight;
 
 	/* tx parameters */
 	size_t				max_send_buf_sz;
@@ -365,8 +514,15 @@ struct xio_rdma_transport {
 	int				tx_ready_tasks_num;
 	int				max_tx_ready_tasks_num;
 	int				max_inline_data;
-	uint16_t			req_sig_cnt;
-	uint16_t			rsp_sig_cnt;
+	int				write_imm;	/* negotiated write
+							 * with immediate
+							 */
+	uint16_t			sig_interval;	/* sends per signaled
+							 * completion
+							 */
+	uint16_t			unsig_cnt;	/* sends since the last
+							 * signaled one
+							 */
 	/* sender window parameters */
 	uint16_t			sn;	   /* serial number */
 	uint16_t			ack_sn;	   /* serial number */
@@ -389,7 +545,7 @@ struct xio_rdma_transport {
 	uint16_t			client_initiator_depth;
 	uint16_t			client_responder_resources;
 
-	uint16_t			pad2[2];
+	uint16_t			pad2[4];
 
 	/* connection's flow control */
 	size_t				alloc_sz;
@@ -466,6 +622,8 @@ void xio_cq_event_handler(int fd, int events, void *data);
 int xio_post_recv(struct xio_rdma_transport *rdma_hndl,
 		  struct xio_task *task, int num_recv_bufs);
 int xio_rdma_rearm_rq(struct xio_rdma_transport *rdma_hndl);
+int xio_srq_rearm(struct xio_srq *srq);
+void xio_srq_grant_credits(struct xio_rdma_transport *rdma_hndl, int nr);
 
 int xio_rdma_send(struct xio_transport_base *transport,
 		  struct xio_task *task);
@@ -481,8 +639,16 @@ int xio_rdma_cancel_rsp(struct xio_transport_base *transport,
 			struct xio_task *task, enum xio_status result,
 			void *ulp_msg, size_t ulp_msg_sz);
 
+void xio_rdma_resize_handler(void *data);
+
 /* xio_rdma_management.c */
 void xio_rdma_calc_pool_size(struct xio_rdma_transport *rdma_hndl);
+int xio_cq_alloc_slots(struct xio_cq *tcq, int cqe_num);
+int xio_cq_free_slots(struct xio_cq *tcq, int cqe_num);
+
+#ifdef HAVE_IBV_MODIFY_CQ
+int xio_cq_modify(struct xio_cq *tcq, int cq_count, int cq_period);
+#endif
 
 struct xio_task *xio_rdma_primary_task_alloc(
 				struct xio_rdma_transport *rdma_hndl);
@@ -494,4 +660,6 @@ struct xio_task *xio_rdma_primary_task_lookup(
 void xio_rdma_task_free(struct xio_rdma_transport *rdma_hndl,
 			struct xio_task *task);
 
+int xio_rdma_primary_pool_shrink(struct xio_rdma_transport *rdma_hndl);
+
 #endif  /* XIO_RDMA_TRANSPORT_H */
@@ -45,6 +45,7 @@
 #include "xio_observer.h"
 #include "xio_rdma_mempool.h"
 #include "xio_task.h"
+#include "get_clock.h"
 #include "xio_rdma_transport.h"
 #include "xio_rdma_utils.h"
 
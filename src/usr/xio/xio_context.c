@@ -234,12 +234,19 @@ struct xio_context *xio_context_create(struct xio_context_attr *ctx_attr,
 	ctx->nodeid		= numa_node_of_cpu(cpu);
 	ctx->polling_timeout	= polling_timeout_us;
 	ctx->worker		= (uint64_t) pthread_self();
+	ctx->comp_vector	= -1;
+	ctx->cq_comp_vector	= -1;
+	ctx->prewarm_max	= XIO_CTX_PREWARM_MAX;
 
 	if (ctx_attr)
 		ctx->user_context = ctx_attr->user_context;
 
 	XIO_OBSERVABLE_INIT(&ctx->observable, ctx);
 	INIT_LIST_HEAD(&ctx->ctx_list);
+	INIT_LIST_HEAD(&ctx->tx_sched_list);
+	INIT_LIST_HEAD(&ctx->prewarm_list);
+	xio_ctx_init_event(&ctx->tx_sched_event,
+			   xio_connection_tx_sched_handler, ctx);
 
 	ctx->workqueue = xio_workqueue_create(ctx);
 	if (!ctx->workqueue) {
@@ -355,6 +362,14 @@ void xio_context_destroy(struct xio_context *ctx)
 	ufree(ctx);
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_context_busy_cycles						     */
+/*---------------------------------------------------------------------------*/
+uint64_t xio_context_busy_cycles(struct xio_context *ctx)
+{
+	return xio_ev_loop_busy_cycles(ctx->ev_loop);
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_ctx_add_delayed_work						     */
 /*---------------------------------------------------------------------------*/
@@ -445,9 +460,30 @@ int xio_modify_context(struct xio_context *ctx,
 		return -1;
 	}
 
+	if ((attr_mask & XIO_CONTEXT_ATTR_COMP_VECTOR) &&
+	    attr->comp_vector < -1) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid comp_vector(%d)\n", attr->comp_vector);
+		return -1;
+	}
+	if ((attr_mask & XIO_CONTEXT_ATTR_PREWARM_MAX) &&
+	    attr->prewarm_max < 0) {
+		xio_set_error(EINVAL);
+		ERROR_LOG("invalid prewarm_max(%d)\n", attr->prewarm_max);
+		return -1;
+	}
+
 	if (attr_mask & XIO_CONTEXT_ATTR_USER_CTX)
 		ctx->user_context = attr->user_context;
 
+	/* taken by the completion queues created from now on */
+	if (attr_mask & XIO_CONTEXT_ATTR_COMP_VECTOR)
+		ctx->comp_vector = attr->comp_vector;
+
+	/* a lower bound closes the surplus on the next prewarm or take */
+	if (attr_mask & XIO_CONTEXT_ATTR_PREWARM_MAX)
+		ctx->prewarm_max = attr->prewarm_max;
+
 	return 0;
 }
 
@@ -467,6 +503,13 @@ int xio_query_context(struct xio_context *ctx,
 	if (attr_mask & XIO_CONTEXT_ATTR_USER_CTX)
 		attr->user_context = ctx->user_context;
 
+	if (attr_mask & XIO_CONTEXT_ATTR_COMP_VECTOR)
+		attr->comp_vector = (ctx->cq_comp_vector != -1) ?
+			ctx->cq_comp_vector : ctx->comp_vector;
+
+	if (attr_mask & XIO_CONTEXT_ATTR_PREWARM_MAX)
+		attr->prewarm_max = ctx->prewarm_max;
+
 	return 0;
 }
 
@@ -46,6 +46,7 @@
 #include <libxio.h>
 #include "xio_ev_loop.h"
 #include "xio_common.h"
+#include "get_clock.h"
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
@@ -61,6 +62,7 @@ struct xio_ev_loop {
 	int				wakeup_armed;
 	struct list_head		poll_events_list;
 	struct list_head		events_list;
+	uint64_t			busy_cycles; /* outside epoll_wait */
 };
 
 /*---------------------------------------------------------------------------*/
@@ -326,12 +328,15 @@ static inline int xio_ev_loop_run_helper(void *loop_hndl, int timeout)
 	struct xio_ev_data	*tev;
 	int			work_remains;
 	int			tmout;
+	cycles_t		mark = get_cycles();
 
 retry:
 	work_remains = xio_ev_loop_exec_scheduled(loop);
 	tmout = work_remains ? 0 : timeout;
 
+	loop->busy_cycles += get_cycles() - mark;
 	nevent = epoll_wait(loop->efd, events, ARRAY_SIZE(events), tmout);
+	mark = get_cycles();
 	if (unlikely(nevent < 0)) {
 		if (errno != EINTR) {
 			xio_set_error(errno);
@@ -381,10 +386,21 @@ retry:
 
 	loop->stop_loop = 0;
 	loop->wakeup_armed = 0;
+	loop->busy_cycles += get_cycles() - mark;
 
 	return 0;
 }
 
+/*---------------------------------------------------------------------------*/
+/* xio_ev_loop_busy_cycles						     */
+/*---------------------------------------------------------------------------*/
+uint64_t xio_ev_loop_busy_cycles(void *loop_hndl)
+{
+	struct xio_ev_loop	*loop = loop_hndl;
+
+	return loop->busy_cycles;
+}
+
 /*---------------------------------------------------------------------------*/
 /* xio_ev_loop_run_timeout						     */
 /*---------------------------------------------------------------------------*/
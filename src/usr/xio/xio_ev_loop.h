@@ -99,6 +99,15 @@ int xio_ev_loop_is_stopping(void *loop_hndl);
  */
 void xio_ev_loop_destroy(void **loop);
 
+/**
+ * cycles spent by the loop outside of waiting for events
+ *
+ * @param[in] loop		Pointer to event loop
+ *
+ * @returns busy cycles accumulated since the loop was created
+ */
+uint64_t xio_ev_loop_busy_cycles(void *loop);
+
 /**
  * add event handlers on dispatcher
  *
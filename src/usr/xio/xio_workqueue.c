@@ -51,9 +51,15 @@ enum xio_workqueue_flags {
 struct xio_workqueue {
 	struct xio_context		*ctx;
 	struct xio_timers_list		timers_list;
+	/* pending works. the pipe only wakes the loop, so that a work
+	 * deleted before it ran leaves nothing behind that points to it
+	 */
+	struct list_head		work_list;
+	pthread_spinlock_t		work_lock;
 	int				timer_fd;
 	int				pipe_fd[2];
 	volatile uint32_t		flags;
+	int				pad;
 };
 
 #define NSEC_PER_SEC    1000000000L
@@ -191,21 +197,32 @@ static void xio_work_action_handler(int fd, int events, void *user_context)
 	while (1) {
 		s = read(work_queue->pipe_fd[0], &exp, sizeof(exp));
 		if (s < 0) {
-			if (errno != EAGAIN)
+			if (errno != EAGAIN) {
 				ERROR_LOG("failed to read from pipe, %m\n");
-			return;
+				return;
+			}
+			break;
 		}
 		if (s != sizeof(uint64_t)) {
 			ERROR_LOG("failed to read from pipe, %m\n");
 			return;
 		}
-		work = ptr_from_int64(exp);
-
-		if (work->flags & XIO_WORK_PENDING) {
-			work->flags	&= ~XIO_WORK_PENDING;
+	}
 
-			work->function(work->data);
+	/* a work may add or delete works, so pick one at a time */
+	while (1) {
+		pthread_spin_lock(&work_queue->work_lock);
+		if (list_empty(&work_queue->work_list)) {
+			pthread_spin_unlock(&work_queue->work_lock);
+			break;
 		}
+		work = list_first_entry(&work_queue->work_list,
+					xio_work_handle_t, entry);
+		list_del_init(&work->entry);
+		work->flags &= ~XIO_WORK_PENDING;
+		pthread_spin_unlock(&work_queue->work_lock);
+
+		work->function(work->data);
 	}
 }
 
@@ -224,6 +241,8 @@ struct xio_workqueue *xio_workqueue_create(struct xio_context *ctx)
 	}
 
 	xio_timers_list_init(&work_queue->timers_list);
+	INIT_LIST_HEAD(&work_queue->work_list);
+	pthread_spin_init(&work_queue->work_lock, PTHREAD_PROCESS_PRIVATE);
 	work_queue->ctx = ctx;
 
 	work_queue->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
@@ -270,6 +289,7 @@ exit2:
 exit1:
 	close(work_queue->timer_fd);
 exit:
+	pthread_spin_destroy(&work_queue->work_lock);
 	ufree(work_queue);
 	return NULL;
 }
@@ -300,6 +320,7 @@ int xio_workqueue_destroy(struct xio_workqueue *work_queue)
 	close(work_queue->pipe_fd[0]);
 	close(work_queue->pipe_fd[1]);
 	close(work_queue->timer_fd);
+	pthread_spin_destroy(&work_queue->work_lock);
 	ufree(work_queue);
 
 	return retval;
@@ -386,9 +407,17 @@ int xio_workqueue_add_work(struct xio_workqueue *work_queue,
 	uint64_t	exp = uint64_from_ptr(work);
 	int		s;
 
+	pthread_spin_lock(&work_queue->work_lock);
 	work->function	= function;
 	work->data	= data;
+	if (work->flags & XIO_WORK_PENDING) {
+		/* already queued, runs once */
+		pthread_spin_unlock(&work_queue->work_lock);
+		return 0;
+	}
 	work->flags	|= XIO_WORK_PENDING;
+	list_add_tail(&work->entry, &work_queue->work_list);
+	pthread_spin_unlock(&work_queue->work_lock);
 
 	s = write(work_queue->pipe_fd[1], &exp, sizeof(exp));
 	if (s < 0) {
@@ -408,10 +437,16 @@ int xio_workqueue_add_work(struct xio_workqueue *work_queue,
 int xio_workqueue_del_work(struct xio_workqueue *work_queue,
 			   xio_work_handle_t *work)
 {
+	int retval = -1;
+
+	pthread_spin_lock(&work_queue->work_lock);
 	if (work->flags & XIO_WORK_PENDING) {
 		work->flags &= ~XIO_WORK_PENDING;
-		return 0;
+		list_del_init(&work->entry);
+		retval = 0;
 	}
-	return -1;
+	pthread_spin_unlock(&work_queue->work_lock);
+
+	return retval;
 }
 